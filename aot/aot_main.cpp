@@ -0,0 +1,473 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../hardware/BlockIR.h"
+#include "../hardware/ChipEight.h"
+#include "../hardware/ControlFlow.h"
+#include "../hardware/Disassembler.h"
+#include "../hardware/IrVerifier.h"
+#include "../rom/RomLibrary.h"
+#include "../rom/RomAnalysis.h"
+
+/**
+ * Formats a number as 0x... with a fixed number of hex digits
+ */
+static std::string hex(unsigned int value, int digits)
+{
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+/**
+ * Generates C++ for a ROM, one labelled section per basic block inside a single dispatch function.
+ * Each block is emitted from its optimised IR, one constant per IR value, working on local copies of the
+ * registers which are written back whenever control returns to the interpreter.
+ */
+class AotGenerator
+{
+public:
+    AotGenerator(const uint8_t *_memory, const ControlFlowGraph &_graph, bool _loadStoreQuirk, bool _shiftQuirk)
+            : memory(_memory),
+              graph(_graph),
+              loadStoreQuirk(_loadStoreQuirk),
+              shiftQuirk(_shiftQuirk)
+    {
+    }
+
+    std::string generate(uint64_t romHash, size_t romSize)
+    {
+        out << "// Generated by chip8_aot from a " << romSize << " byte ROM (hash " << hex(romHash >> 32u, 8)
+            << hex(romHash & 0xFFFFFFFFu, 8).substr(2) << "), do not edit\n"
+            << "#include <cstring>\n"
+            << "#include \"hardware/AotModule.h\"\n\n"
+            << "// Every block gets a label whether or not anything jumps to it\n"
+            << "#ifdef __GNUC__\n"
+            << "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+            << "#endif\n\n";
+
+        writeTable("image", [this](unsigned int address)
+        { return memory[address]; });
+        writeTable("codeMap", [this](unsigned int address)
+        { return graph.isCode(address) ? 1 : 0; });
+
+        out << "static inline void store(Chip8AotState *s, int index, uint8_t value)\n"
+               "{\n"
+               "    index &= CHIP8_AOT_MEMORY_SIZE - 1;\n"
+               "    if (index > " << START_ADDRESS << ")\n"
+               "    {\n"
+               "        s->memory[index] = value;\n"
+               "        s->codeModified |= codeMap[index];\n"
+               "    }\n"
+               "    else\n"
+               "    {\n"
+               "        s->writeMemory(s->context, index, value);\n"
+               "    }\n"
+               "}\n\n"
+               "static inline bool intact(const uint8_t *memory, unsigned int start, unsigned int length)\n"
+               "{\n"
+               "    return memcmp(memory + start, image + start, length) == 0;\n"
+               "}\n\n"
+               "static int run(Chip8AotState *s, int budget)\n"
+               "{\n"
+               "    uint8_t V[16];\n"
+               "    memcpy(V, s->registers, sizeof(V));\n"
+               "    uint16_t I = *s->indexRegister;\n"
+               "    uint16_t pc = *s->pc;\n"
+               "    uint8_t sp = *s->sp;\n"
+               "    uint8_t *memory = s->memory;\n"
+               "    uint16_t *stack = s->stack;\n"
+               "    const uint8_t *keypad = s->keypad;\n"
+               "    int executed = 0;\n"
+               "    (void) keypad;\n"
+               "    (void) stack;\n\n"
+               "    for (;;)\n"
+               "    {\n"
+               "        switch (pc)\n"
+               "        {\n";
+
+        for (const BasicBlock &block : graph.getBlocks())
+        {
+            writeBlock(block);
+        }
+
+        out << "            default:\n"
+               "                goto out;\n"
+               "        }\n"
+               "    }\n\n"
+               "out:\n"
+               "    memcpy(s->registers, V, sizeof(V));\n"
+               "    *s->indexRegister = I;\n"
+               "    *s->pc = pc;\n"
+               "    *s->sp = sp;\n"
+               "    return executed;\n"
+               "}\n\n"
+               "static const Chip8AotModule module = {CHIP8_AOT_ABI_VERSION, " << romSize << ", "
+            << hex(romHash >> 32u, 8) << hex(romHash & 0xFFFFFFFFu, 8).substr(2) << "ull, "
+            << (loadStoreQuirk ? 1 : 0) << ", " << (shiftQuirk ? 1 : 0) << ", codeMap, run};\n\n"
+               "extern \"C\" CHIP8_AOT_EXPORT const Chip8AotModule *chip8_aot_module()\n"
+               "{\n"
+               "    return &module;\n"
+               "}\n";
+        return out.str();
+    }
+
+private:
+    const uint8_t *memory;
+    const ControlFlowGraph &graph;
+    bool loadStoreQuirk;
+    bool shiftQuirk;
+    std::ostringstream out;
+
+    template<typename Function>
+    void writeTable(const char *name, Function value)
+    {
+        out << "static const uint8_t " << name << "[4096] =\n{\n";
+        for (unsigned int address = 0; address < 4096; address += 16)
+        {
+            out << "    ";
+            for (unsigned int i = 0; i < 16; i++)
+            {
+                out << (int) value(address + i) << (i < 15 ? "," : ",\n");
+            }
+        }
+        out << "};\n\n";
+    }
+
+    static std::string label(uint16_t address)
+    {
+        return "L_" + hex(address, 3).substr(2);
+    }
+
+    /**
+     * Continues at another address: straight to its block if there is one, otherwise back to the interpreter
+     */
+    std::string jumpTo(uint16_t address) const
+    {
+        if (graph.findBlock(address) != nullptr)
+        {
+            return "goto " + label(address) + ";";
+        }
+        return "{ pc = " + hex(address, 3) + "; goto out; }";
+    }
+
+    static std::string reg(unsigned int index)
+    {
+        return "V[" + hex(index, 1) + "]";
+    }
+
+    static std::string value(uint16_t index)
+    {
+        return "v" + std::to_string(index);
+    }
+
+    void writeBlock(const BasicBlock &block)
+    {
+        IrBlock ir = liftBlock(memory, block, loadStoreQuirk, shiftQuirk);
+        optimizeBlock(ir);
+
+        out << "            case " << hex(block.start, 3) << ":\n"
+            << "            " << label(block.start) << ":\n"
+            << "            {\n"
+            << "                if (budget - executed < " << ir.length << " || (s->codeModified && !intact(memory, "
+            << hex(block.start, 3) << ", " << block.end - block.start << ")))\n"
+            << "                {\n"
+            << "                    pc = " << hex(block.start, 3) << ";\n"
+            << "                    goto out;\n"
+            << "                }\n"
+            << "                executed += " << ir.length << ";\n";
+
+        // A Stop block's end is the instruction the interpreter has to handle
+        uint16_t last = block.exit == BlockExit::Stop ? block.end : block.end - 2;
+        for (uint16_t address = block.start; address < block.end; address += 2)
+        {
+            uint16_t opcode = (memory[address] << 8u) | memory[address + 1];
+            out << "                // " << hex(address, 3) << ": " << disassemble(opcode) << "\n";
+        }
+
+        // Effects whose value nothing reads are emitted as plain statements
+        std::vector<bool> used(ir.instrs.size(), false);
+        for (const IrInstr &instr : ir.instrs)
+        {
+            const uint16_t operands[] = {instr.a, instr.b, instr.c};
+            for (int operand = 0; operand < irOperandCount(instr.op); operand++)
+            {
+                used[operands[operand]] = true;
+            }
+        }
+        for (uint16_t result : {ir.condition, ir.computed})
+        {
+            if (result != IrBlock::NO_VALUE)
+            {
+                used[result] = true;
+            }
+        }
+        for (size_t i = 0; i < ir.instrs.size(); i++)
+        {
+            out << "                " << writeValue(ir.instrs[i], i, used[i]) << "\n";
+        }
+        writeExit(ir, last, (memory[last] << 8u) | memory[last + 1]);
+        out << "            }\n";
+    }
+
+    /**
+     * @return The statement computing one IR value, or performing its effect
+     */
+    static std::string writeValue(const IrInstr &instr, uint16_t index, bool used)
+    {
+        std::string a = value(instr.a);
+        std::string b = value(instr.b);
+        std::string define = "const unsigned " + value(index) + " = ";
+        std::string defineIfUsed = used ? define : "";
+        switch (instr.op)
+        {
+            case IrOp::Const:
+                return define + std::to_string(instr.imm) + ";";
+            case IrOp::GetReg:
+                return define + reg(instr.reg) + ";";
+            case IrOp::GetIndex:
+                return define + "I;";
+            case IrOp::GetDelay:
+                return define + "*s->delayRegister;";
+            case IrOp::GetKey:
+                return define + "keypad[" + a + " & 0x0Fu];";
+            case IrOp::Load:
+                return define + "memory[(" + a + ") & (CHIP8_AOT_MEMORY_SIZE - 1)];";
+            case IrOp::Add:
+                return define + "(" + a + " + " + b + ") & 0xFFu;";
+            case IrOp::Carry:
+                return define + a + " + " + b + " > 255 ? 1 : 0;";
+            case IrOp::Sub:
+                return define + "(" + a + " - " + b + ") & 0xFFu;";
+            case IrOp::Greater:
+                return define + a + " > " + b + " ? 1 : 0;";
+            case IrOp::Or:
+                return define + a + " | " + b + ";";
+            case IrOp::And:
+                return define + a + " & " + b + ";";
+            case IrOp::Xor:
+                return define + a + " ^ " + b + ";";
+            case IrOp::Shr:
+                return define + a + " >> 1u;";
+            case IrOp::Shl:
+                return define + "(" + a + " << 1u) & 0xFFu;";
+            case IrOp::Lsb:
+                return define + a + " & 0x1u;";
+            case IrOp::Msb:
+                return define + "(" + a + " & 0x80u) >> 7u;";
+            case IrOp::AddIndex:
+                return define + "(" + a + " + " + b + ") & 0xFFFFu;";
+            case IrOp::Offset:
+                return define + a + " + " + std::to_string(instr.imm) + ";";
+            case IrOp::Font:
+                return define + std::to_string(FONT_START_ADDRESS) + " + 5 * " + a + ";";
+            case IrOp::Mod10:
+                return define + a + " % 10;";
+            case IrOp::Div10:
+                return define + a + " / 10;";
+            case IrOp::Equal:
+                return define + a + " == " + b + ";";
+            case IrOp::NotEqual:
+                return define + a + " != " + b + ";";
+            case IrOp::SetReg:
+                return reg(instr.reg) + " = " + a + ";";
+            case IrOp::SetIndex:
+                return "I = " + a + ";";
+            case IrOp::SetDelay:
+                return "*s->delayRegister = " + a + ";";
+            case IrOp::SetSound:
+                return "*s->soundRegister = " + a + ";";
+            case IrOp::Store:
+                return "store(s, " + a + ", " + b + ");";
+            case IrOp::Random:
+                return defineIfUsed + "s->random(s->context);";
+            case IrOp::Draw:
+                return defineIfUsed + "chip8_aot_draw(s, memory, " + value(instr.c) + ", " + a + ", " + b + ", " +
+                       std::to_string(instr.imm) + ");\n                *s->drawFlag = true;";
+            case IrOp::Clear:
+                return "chip8_aot_clear(s);";
+            default:
+                return "";
+        }
+    }
+
+    void writeExit(const IrBlock &block, uint16_t address, uint16_t opcode)
+    {
+        std::string Vx = reg((opcode & 0x0F00u) >> 8u);
+        const std::string indent = "                ";
+
+        switch (block.exit)
+        {
+            case BlockExit::Fallthrough:
+                out << indent << jumpTo(block.end) << "\n";
+                return;
+            case BlockExit::Jump:
+                if (block.target == address)
+                {
+                    // Spins on itself for the rest of the frame
+                    out << indent << "executed = budget;\n"
+                        << indent << "pc = " << hex(address, 3) << ";\n"
+                        << indent << "goto out;\n";
+                }
+                else
+                {
+                    out << indent << jumpTo(block.target) << "\n";
+                }
+                return;
+            case BlockExit::Call:
+                out << indent << "stack[sp] = " << hex(block.end, 3) << ";\n"
+                    << indent << "++sp;\n"
+                    << indent << jumpTo(block.target) << "\n";
+                return;
+            case BlockExit::Return:
+                out << indent << "--sp;\n"
+                    << indent << "pc = stack[sp];\n"
+                    << indent << "continue;\n";
+                return;
+            case BlockExit::Computed:
+                out << indent << "pc = " << value(block.computed) << ";\n"
+                    << indent << "continue;\n";
+                return;
+            case BlockExit::WaitKey:
+                // Keys can't change mid-frame, so with none down it waits out the rest of the frame
+                out << indent << "for (int key = 0; key < 16; key++)\n"
+                    << indent << "{\n"
+                    << indent << "    if (keypad[key])\n"
+                    << indent << "    {\n"
+                    << indent << "        " << Vx << " = key;\n"
+                    << indent << "        " << jumpTo(block.end) << "\n"
+                    << indent << "    }\n"
+                    << indent << "}\n"
+                    << indent << "executed = budget;\n"
+                    << indent << "pc = " << hex(address, 3) << ";\n"
+                    << indent << "goto out;\n";
+                return;
+            case BlockExit::Skip:
+                out << indent << "if (" << value(block.condition) << ")\n"
+                    << indent << "{\n"
+                    << indent << "    " << jumpTo(block.end + 2) << "\n"
+                    << indent << "}\n"
+                    << indent << jumpTo(block.end) << "\n";
+                return;
+            case BlockExit::Stop:
+                out << indent << "pc = " << hex(block.end, 3) << ";\n"
+                    << indent << "goto out;\n";
+                return;
+        }
+    }
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: chip8_aot <rom_path> [-o <output.cpp>] [--load-store-quirk] [--shift-quirk] [--verify]\n"
+                 "Translates a ROM into C++ which builds into a module for chip8_emu --compiled, e.g.\n"
+                 "  c++ -O2 -shared -fPIC -I<source dir> game.cpp -o game.so\n"
+                 "--verify first checks the optimised IR of every block against the interpreter" << std::endl;
+}
+
+int main(int argc, char **args)
+{
+    if (argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    const char *romPath = args[1];
+    std::string outputPath;
+    bool loadStoreQuirk = false;
+    bool shiftQuirk = false;
+    bool verify = false;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = args[i];
+        if (arg == "-o" && i + 1 < argc)
+        {
+            outputPath = args[++i];
+        }
+        else if (arg == "--load-store-quirk")
+        {
+            loadStoreQuirk = true;
+        }
+        else if (arg == "--shift-quirk")
+        {
+            shiftQuirk = true;
+        }
+        else if (arg == "--verify")
+        {
+            verify = true;
+        }
+        else
+        {
+            std::cout << "Unknown option: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+
+    std::ifstream file(romPath, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.empty() || rom.size() > 4096 - START_ADDRESS)
+    {
+        std::cout << "Can't use ROM: " << romPath << std::endl;
+        return 1;
+    }
+
+    // Same memory image ChipEight starts with
+    uint8_t memory[4096]{};
+    memcpy(&memory[FONT_START_ADDRESS], fontset, FONT_SET_SIZE);
+    memcpy(&memory[START_ADDRESS], rom.data(), rom.size());
+
+    std::shared_ptr<const RomAnalysis> analysis = RomAnalysis::get(rom, AnalysisCache::defaultDirectory());
+    const ControlFlowGraph &graph = analysis->getGraph();
+
+    if (verify)
+    {
+        IrVerifier verifier(rom, loadStoreQuirk, shiftQuirk);
+        int failed = verifier.verify(IrProgram::build(rom, graph, loadStoreQuirk, shiftQuirk), 256);
+        if (failed > 0)
+        {
+            std::cout << failed << " blocks failed verification" << std::endl;
+            return 1;
+        }
+    }
+
+    AotGenerator generator(memory, graph, loadStoreQuirk, shiftQuirk);
+    std::string source = generator.generate(hashROM(rom.data(), rom.size()), rom.size());
+
+    if (outputPath.empty())
+    {
+        std::cout << source;
+        return 0;
+    }
+
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    output << source;
+    if (!output)
+    {
+        std::cout << "Failed to write " << outputPath << std::endl;
+        return 1;
+    }
+
+    size_t codeBytes = 0;
+    size_t computed = 0;
+    size_t liftedValues = 0;
+    size_t optimizedValues = 0;
+    for (const BasicBlock &block : graph.getBlocks())
+    {
+        codeBytes += block.end - block.start;
+        computed += block.exit == BlockExit::Computed;
+
+        IrBlock ir = liftBlock(memory, block, loadStoreQuirk, shiftQuirk);
+        liftedValues += ir.instrs.size();
+        optimizeBlock(ir);
+        optimizedValues += ir.instrs.size();
+    }
+    std::cout << graph.getBlocks().size() << " blocks, " << codeBytes << " of " << rom.size()
+              << " ROM bytes compiled, " << computed << " computed jumps left to run time" << std::endl;
+    std::cout << optimizedValues << " IR values after optimisation, from " << liftedValues << std::endl;
+    return 0;
+}
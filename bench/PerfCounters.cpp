@@ -0,0 +1,131 @@
+#include "PerfCounters.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int fd : fds)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
+/**
+ * Opens the counters, disabled until start(). Counters the CPU lacks are skipped, but at least cycles and
+ * instructions must be available.
+ * @return False if counters can't be used here, see getError()
+ */
+bool PerfCounters::open()
+{
+#ifdef __linux__
+    const uint32_t types[COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                      PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+    const uint64_t configs[COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8u) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16u),
+            PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    for (int i = 0; i < COUNTERS; i++)
+    {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] == -1 && i < 2)
+        {
+            error = std::string("perf_event_open: ") + strerror(errno);
+            if (errno == EACCES || errno == EPERM)
+            {
+                error += " (check /proc/sys/kernel/perf_event_paranoid)";
+            }
+            return false;
+        }
+    }
+    return true;
+#else
+    error = "hardware counters are only supported on Linux";
+    return false;
+#endif
+}
+
+/**
+ * @return Why open() failed
+ */
+const std::string &PerfCounters::getError() const
+{
+    return error;
+}
+
+/**
+ * Resets and starts every counter
+ */
+void PerfCounters::start()
+{
+#ifdef __linux__
+    for (int fd : fds)
+    {
+        if (fd != -1)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/**
+ * Stops the counters
+ * @return Counts since start()
+ */
+PerfSample PerfCounters::stop()
+{
+    double values[COUNTERS] = {-1, -1, -1, -1, -1};
+#ifdef __linux__
+    for (int fd : fds)
+    {
+        if (fd != -1)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int i = 0; i < COUNTERS; i++)
+    {
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (fds[i] != -1 && read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+        {
+            values[i] = (double) data[0] * ((double) data[1] / (double) data[2]);
+        }
+    }
+#endif
+
+    PerfSample sample;
+    sample.cycles = values[0];
+    sample.instructions = values[1];
+    sample.branchMisses = values[2];
+    sample.l1Misses = values[3];
+    sample.llcMisses = values[4];
+    return sample;
+}
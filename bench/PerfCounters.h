@@ -0,0 +1,51 @@
+#ifndef CHIP8_EMU_PERFCOUNTERS_H
+#define CHIP8_EMU_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Counter values over one measured region, scaled up if the kernel had to multiplex the counters.
+ * A counter the CPU or kernel doesn't offer is reported as -1.
+ */
+struct PerfSample
+{
+    double cycles = -1;
+    double instructions = -1;
+    double branchMisses = -1;
+    double l1Misses = -1;
+    double llcMisses = -1;
+};
+
+/**
+ * Hardware performance counters for the calling thread through Linux perf_event_open, counting user space
+ * only. Elsewhere, or when the kernel refuses (containers, perf_event_paranoid), open() fails and the
+ * benchmark carries on with wall-clock numbers alone.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters() = default;
+
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool open();
+
+    const std::string &getError() const;
+
+    void start();
+
+    PerfSample stop();
+
+private:
+    static const int COUNTERS = 5;
+
+    int fds[COUNTERS] = {-1, -1, -1, -1, -1};
+    std::string error;
+};
+
+#endif //CHIP8_EMU_PERFCOUNTERS_H
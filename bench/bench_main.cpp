@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "PerfCounters.h"
+#include "../hardware/BlockIR.h"
+#include "../hardware/ChipEight.h"
+#include "../hardware/InstancePool.h"
+#include "../frontend/Upscaler.h"
+#include "../rom/RomAnalysis.h"
+
+/**
+ * Runs a function repeatedly for roughly the given time
+ * @param function Work to measure
+ * @param minimumSeconds How long to keep repeating
+ * @return Average nanoseconds per call
+ */
+static double measure(const std::function<void()> &function, double minimumSeconds = 0.25)
+{
+    // Warm up caches and branch predictors
+    function();
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t calls = 0;
+    double elapsed;
+    do
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            function();
+        }
+        calls += 16;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    while (elapsed < minimumSeconds);
+
+    return elapsed * 1e9 / calls;
+}
+
+/**
+ * Ways of running a ROM
+ */
+enum class Engine
+{
+    Interpreter, Analysis, IR
+};
+
+static const char *engineName(Engine engine)
+{
+    switch (engine)
+    {
+        case Engine::Analysis:
+            return "analysis";
+        case Engine::IR:
+            return "ir";
+        default:
+            return "interpreter";
+    }
+}
+
+/**
+ * @param rom ROM contents
+ * @param cyclesPerTick Instructions per frame
+ * @param engine How to run it
+ * @param analysis Analysis of the ROM, for the analysis and IR engines
+ * @param program IR of the ROM, for the IR engine
+ * @return Headless instance with a fixed seed, so every run of it executes the same instructions
+ */
+static std::unique_ptr<ChipEight> createInstance(const std::vector<uint8_t> &rom, int cyclesPerTick, Engine engine,
+                                                 const std::shared_ptr<const RomAnalysis> &analysis,
+                                                 const std::shared_ptr<const IrProgram> &program)
+{
+    auto chipEight = std::make_unique<ChipEight>(false, false, cyclesPerTick, true);
+    chipEight->LoadROM(rom.data(), rom.size());
+    chipEight->seed(1);
+    if (engine != Engine::Interpreter)
+    {
+        chipEight->setAnalysis(analysis);
+    }
+    if (engine == Engine::IR)
+    {
+        chipEight->setIrProgram(program);
+    }
+    return chipEight;
+}
+
+/**
+ * Counts the DXYN instructions a fresh instance executes, one instruction at a time
+ * @param rom ROM contents
+ * @param cyclesPerTick Instructions per frame
+ * @param frames Frames to run
+ * @return Sprite draws over the run
+ */
+static uint64_t countDraws(const std::vector<uint8_t> &rom, int cyclesPerTick, uint64_t frames)
+{
+    auto chipEight = createInstance(rom, cyclesPerTick, Engine::Interpreter, nullptr, nullptr);
+    const uint8_t *memory = chipEight->getMemory();
+    const uint16_t *pc = chipEight->getPC();
+
+    uint64_t draws = 0;
+    for (uint64_t frame = 0; frame < frames; frame++)
+    {
+        for (int i = 0; i < cyclesPerTick; i++)
+        {
+            draws += *pc < 4095 && (memory[*pc] >> 4u) == 0xD;
+            chipEight->stepInstruction();
+        }
+        chipEight->decrementTimers();
+    }
+    return draws;
+}
+
+/**
+ * Prints counters divided by a number of events, "-" for counters that aren't available
+ */
+static void printPerEvent(const char *label, const PerfSample &sample, double events)
+{
+    auto field = [events](double value, int width, int precision)
+    {
+        if (value < 0)
+        {
+            std::cout << std::setw(width) << "-";
+        }
+        else
+        {
+            std::cout << std::setw(width) << std::setprecision(precision) << value / events;
+        }
+    };
+
+    std::cout << "    " << std::left << std::setw(11) << label << std::right << std::fixed;
+    field(sample.cycles, 10, 2);
+    field(sample.instructions, 10, 2);
+    if (sample.cycles > 0 && sample.instructions >= 0)
+    {
+        std::cout << std::setw(8) << std::setprecision(2) << sample.instructions / sample.cycles;
+    }
+    else
+    {
+        std::cout << std::setw(8) << "-";
+    }
+    field(sample.branchMisses, 10, 4);
+    field(sample.l1Misses, 10, 4);
+    field(sample.llcMisses, 10, 4);
+    std::cout << std::endl;
+}
+
+/**
+ * Measures emulated instructions per second for a ROM with each engine, and where hardware counters are
+ * available, what each emulated instruction and each sprite draw costs the host CPU
+ * @param path ROM file
+ * @param cyclesPerTick Instructions per frame
+ * @param counters Open counters, or nullptr
+ */
+static void benchmarkEngines(const char *path, int cyclesPerTick, PerfCounters *counters)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.empty())
+    {
+        std::cout << "ERROR: Couldn't read ROM: " << path << std::endl;
+        return;
+    }
+    std::shared_ptr<const RomAnalysis> analysis = RomAnalysis::get(rom, "");
+    std::shared_ptr<const IrProgram> program = IrProgram::build(rom, analysis->getGraph(), false, false);
+
+    for (Engine engine : {Engine::Interpreter, Engine::Analysis, Engine::IR})
+    {
+        auto chipEight = createInstance(rom, cyclesPerTick, engine, analysis, program);
+        double frameNs = measure([&]
+                                 { chipEight->executeCycle(); }, 1.0);
+        std::cout << std::left << std::setw(40) << path << std::setw(12) << engineName(engine) << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(12) << frameNs << " ns/frame" << std::setw(10)
+                  << frameNs / cyclesPerTick << " ns/instr" << std::setw(10) << 1e3 / (frameNs / cyclesPerTick)
+                  << " MIPS" << std::endl;
+
+        if (counters == nullptr)
+        {
+            continue;
+        }
+
+        // About a quarter of a second from power-on, so the draw count can be replayed exactly
+        auto frames = (uint64_t) std::max(60.0, 0.25e9 / frameNs);
+        auto counted = createInstance(rom, cyclesPerTick, engine, analysis, program);
+        counters->start();
+        for (uint64_t frame = 0; frame < frames; frame++)
+        {
+            counted->executeCycle();
+        }
+        PerfSample sample = counters->stop();
+
+        uint64_t draws = countDraws(rom, cyclesPerTick, frames);
+        printPerEvent("per instr", sample, (double) frames * cyclesPerTick);
+        if (draws > 0)
+        {
+            printPerEvent("per draw", sample, (double) draws);
+        }
+    }
+}
+
+/**
+ * Plays a few frames then times only putting the instance back, since the frames would swamp it
+ * @param chipEight Instance to play
+ * @param restore Puts it back to power-on
+ * @return Average nanoseconds per restore
+ */
+static double measureRestore(ChipEight &chipEight, const std::function<void()> &restore)
+{
+    const int rounds = 2000;
+    std::chrono::steady_clock::duration total{};
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int frame = 0; frame < 3; frame++)
+        {
+            chipEight.executeCycle();
+        }
+        auto start = std::chrono::steady_clock::now();
+        restore();
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(total).count() / rounds;
+}
+
+/**
+ * Measures the ways of getting an instance back to power-on after some play: constructing and loading a new
+ * one, reset(), loadState() of a power-on state, and an InstancePool reset from its template
+ * @param path ROM file
+ * @param cyclesPerTick Instructions per frame
+ */
+static void benchmarkInstanceSetup(const char *path, int cyclesPerTick)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.empty())
+    {
+        return;
+    }
+    auto create = [&]
+    {
+        auto chipEight = std::make_unique<ChipEight>(false, false, cyclesPerTick, true);
+        chipEight->LoadROM(rom.data(), rom.size());
+        return chipEight;
+    };
+
+    double construct = measure([&]
+                               { create(); });
+
+    auto chipEight = create();
+    auto powerOn = std::make_unique<ChipEightState>();
+    chipEight->saveState(*powerOn);
+    double reset = measureRestore(*chipEight, [&]
+    { chipEight->reset(); });
+    double load = measureRestore(*chipEight, [&]
+    { chipEight->loadState(*powerOn); });
+
+    InstancePool pool(create(), 1);
+    ChipEight &pooled = pool.get(0);
+    double pooledReset = measureRestore(pooled, [&]
+    { pool.reset(pooled); });
+
+    std::cout << std::left << std::setw(40) << path << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << construct << std::setw(10) << reset << std::setw(10) << load << std::setw(10)
+              << pooledReset << std::endl;
+}
+
+/**
+ * Measures the software upscaler for each kernel, style and scale, for full and partial redraws
+ */
+static void benchmarkUpscaler()
+{
+    // Checkerboard-ish frame so every row has a mix of on and off pixels
+    uint64_t rows[VIDEO_HEIGHT];
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        rows[y] = 0xF0F0A5A5C3C30FF0ull ^ ((uint64_t) y * 0x9E3779B97F4A7C15ull);
+    }
+
+    const UpscaleKernel kernels[] = {UpscaleKernel::Scalar, UpscaleKernel::SSE2, UpscaleKernel::AVX2};
+    const ScaleStyle styles[] = {ScaleStyle::Plain, ScaleStyle::Scanlines, ScaleStyle::PixelGrid};
+    const char *styleNames[] = {"plain", "scanlines", "grid"};
+    const unsigned int scales[] = {1, 2, 4, 10, 20};
+
+    std::cout << "\nSoftware upscaler (ns/frame, full redraw / 4 dirty rows)" << std::endl;
+    for (UpscaleKernel kernel : kernels)
+    {
+        if (!isKernelSupported(kernel))
+        {
+            continue;
+        }
+        for (int s = 0; s < 3; s++)
+        {
+            std::cout << std::left << std::setw(8) << kernelName(kernel) << std::setw(10) << styleNames[s]
+                      << std::right;
+            for (unsigned int scale : scales)
+            {
+                size_t pitch = VIDEO_WIDTH * scale * sizeof(uint32_t);
+                std::vector<uint32_t> pixels(VIDEO_WIDTH * scale * VIDEO_HEIGHT * scale);
+                double full = measure([&]
+                                      {
+                                          upscaleFrame(kernel, rows, 0xFFFFFFFFu, pixels.data(), pitch, scale,
+                                                       styles[s], 0xFFFFFFFFu, 0xFF000000u);
+                                      });
+                double partial = measure([&]
+                                         {
+                                             upscaleFrame(kernel, rows, 0x000F0000u, pixels.data(), pitch,
+                                                          scale, styles[s], 0xFFFFFFFFu, 0xFF000000u);
+                                         });
+                std::cout << "  x" << std::setw(2) << scale << " " << std::fixed << std::setprecision(0)
+                          << std::setw(8) << full << "/" << std::setw(6) << std::left << partial << std::right;
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **args)
+{
+    if (argc > 1 && (strcmp(args[1], "-h") == 0 || strcmp(args[1], "--help") == 0))
+    {
+        std::cout << "Usage: chip8_bench [--cycles <n>] [--no-counters] [rom_path...]" << std::endl;
+        return 0;
+    }
+
+    int cyclesPerTick = 1000;
+    bool useCounters = true;
+    std::vector<const char *> roms;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(args[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            cyclesPerTick = std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--no-counters") == 0)
+        {
+            useCounters = false;
+        }
+        else
+        {
+            roms.push_back(args[i]);
+        }
+    }
+
+    PerfCounters counters;
+    bool haveCounters = false;
+    if (!roms.empty())
+    {
+        std::cout << "Engines (" << cyclesPerTick << " instructions per frame)" << std::endl;
+        if (useCounters)
+        {
+            haveCounters = counters.open();
+            if (haveCounters)
+            {
+                std::cout << std::setw(25) << "cycles" << std::setw(10) << "instrs" << std::setw(8) << "IPC"
+                          << std::setw(10) << "br-miss" << std::setw(10) << "L1d-miss" << std::setw(10)
+                          << "LLC-miss" << std::endl;
+            }
+            else
+            {
+                std::cout << "Hardware counters unavailable, " << counters.getError() << std::endl;
+            }
+        }
+    }
+    for (const char *rom : roms)
+    {
+        benchmarkEngines(rom, cyclesPerTick, haveCounters ? &counters : nullptr);
+    }
+
+    if (!roms.empty())
+    {
+        std::cout << "\nInstance setup (ns)" << std::setw(31) << "new" << std::setw(10) << "reset" << std::setw(10)
+                  << "loadState" << std::setw(10) << "pool" << std::endl;
+    }
+    for (const char *rom : roms)
+    {
+        benchmarkInstanceSetup(rom, cyclesPerTick);
+    }
+
+    benchmarkUpscaler();
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Timings of one launch, in milliseconds
+ */
+struct Launch
+{
+    double firstFrame;
+    double exit;
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: chip8_startup_bench [--runs <n>] <chip8_emu> <rom> [emulator options...]\n"
+                 "Launches the emulator repeatedly for one frame and reports the time from starting the process\n"
+                 "to its first presented frame, and to its exit. Add --headless to leave out the window." << std::endl;
+}
+
+#ifndef _WIN32
+
+/**
+ * Runs the emulator once
+ * @param args Emulator command line
+ * @param launch Timings
+ * @return False if it couldn't be started or never reported a frame
+ */
+static bool launchOnce(const std::vector<std::string> &args, Launch &launch)
+{
+    int output[2];
+    if (pipe(output) != 0)
+    {
+        return false;
+    }
+
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+    {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(output[1]);
+    if (pid < 0)
+    {
+        close(output[0]);
+        return false;
+    }
+
+    // The emulator prints FIRST FRAME (flushed) as soon as its first frame is on screen
+    std::string text;
+    bool sawFrame = false;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(output[0], buffer, sizeof(buffer))) > 0)
+    {
+        text.append(buffer, length);
+        if (!sawFrame && text.find("FIRST FRAME") != std::string::npos)
+        {
+            launch.firstFrame = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            sawFrame = true;
+        }
+    }
+    close(output[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    launch.exit = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!sawFrame)
+    {
+        std::cout << "ERROR: Emulator didn't report a frame:\n" << text << std::endl;
+    }
+    return sawFrame;
+}
+
+#endif
+
+/**
+ * Prints min / median / 95th percentile / max of a set of timings
+ */
+static void printStats(const char *name, std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    auto at = [&values](double fraction)
+    {
+        return values[std::min(values.size() - 1, (size_t) (fraction * (double) values.size()))];
+    };
+    std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(9) << values.front() << std::setw(9) << at(0.5) << std::setw(9) << at(0.95)
+              << std::setw(9) << values.back() << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int runs = 20;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "--runs") == 0)
+    {
+        runs = std::max(1, std::stoi(argv[2]));
+        first = 3;
+    }
+    if (argc - first < 2)
+    {
+        printUsage();
+        return -1;
+    }
+
+#ifdef _WIN32
+    std::cout << "ERROR: chip8_startup_bench needs fork/exec" << std::endl;
+    return -1;
+#else
+    std::vector<std::string> args(argv + first, argv + argc);
+    args.emplace_back("--frames");
+    args.emplace_back("1");
+    args.emplace_back("--report-first-frame");
+
+    // The first launch warms the page cache and isn't counted
+    std::vector<double> firstFrames, exits;
+    for (unsigned int i = 0; i <= runs; i++)
+    {
+        Launch launch{};
+        if (!launchOnce(args, launch))
+        {
+            return -1;
+        }
+        if (i > 0)
+        {
+            firstFrames.push_back(launch.firstFrame);
+            exits.push_back(launch.exit);
+        }
+    }
+
+    std::cout << runs << " launches, milliseconds from start\n"
+              << std::left << std::setw(14) << "" << std::right << std::setw(9) << "min" << std::setw(9)
+              << "median" << std::setw(9) << "p95" << std::setw(9) << "max" << std::endl;
+    printStats("first frame", firstFrames);
+    printStats("exit", exits);
+    return 0;
+#endif
+}
@@ -0,0 +1,95 @@
+/*
+ * Sample reader for chip8_emu --publish <name>: prints the emulated frame, PC and display about once a
+ * second, reading each frame in place from shared memory.
+ *
+ *   chip8_emu game.ch8 --publish /chip8 &
+ *   chip8_shm_consumer /chip8
+ */
+#include <stdio.h>
+#include <time.h>
+#include "../lib/chip8_shm.h"
+
+static void sleepMs(long ms)
+{
+    struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+/* Renders two display rows per text line */
+static void printDisplay(const chip8_shm_slot *slot)
+{
+    static const char *const blocks[4] = {" ", "▄", "▀", "█"};
+    for (int y = 0; y < CHIP8_SHM_VIDEO_HEIGHT; y += 2)
+    {
+        for (int x = 0; x < CHIP8_SHM_VIDEO_WIDTH; x++)
+        {
+            int top = slot->video[y * CHIP8_SHM_VIDEO_WIDTH + x] != 0;
+            int bottom = slot->video[(y + 1) * CHIP8_SHM_VIDEO_WIDTH + x] != 0;
+            fputs(blocks[top * 2 + bottom], stdout);
+        }
+        putchar('\n');
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : "/chip8";
+    chip8_shm_reader *reader = NULL;
+    while ((reader = chip8_shm_open(name)) == NULL)
+    {
+        fprintf(stderr, "Waiting for %s...\n", name);
+        sleepMs(1000);
+    }
+
+    uint64_t lastPublished = 0;
+    unsigned int idle = 0;
+    for (;;)
+    {
+        sleepMs(1000);
+        uint64_t published = chip8_shm_published(reader);
+        if (published == lastPublished)
+        {
+            /* The emulator has stopped or paused; a new run replaces the object, so look for it again */
+            if (++idle == 3)
+            {
+                chip8_shm_close(reader);
+                while ((reader = chip8_shm_open(name)) == NULL)
+                {
+                    sleepMs(1000);
+                }
+                lastPublished = 0;
+                idle = 0;
+            }
+            continue;
+        }
+        idle = 0;
+
+        /* Read in place: take what is needed, then check the slot wasn't reused meanwhile */
+        uint64_t sequence;
+        const chip8_shm_slot *slot = chip8_shm_latest(reader, &sequence);
+        if (slot == NULL)
+        {
+            continue;
+        }
+        uint64_t frame = slot->frame;
+        unsigned int pc = slot->pc;
+        unsigned int index = slot->index;
+        if (!chip8_shm_validate(slot, sequence))
+        {
+            continue;
+        }
+
+        /* Larger reads copy the slot out instead */
+        chip8_shm_slot copy;
+        if (chip8_shm_copy_latest(reader, &copy) != 0)
+        {
+            continue;
+        }
+
+        printf("frame %llu  pc %03X  I %03X  (%llu frames/s)\n", (unsigned long long) frame, pc, index,
+               (unsigned long long) (published - lastPublished));
+        printDisplay(&copy);
+        fflush(stdout);
+        lastPublished = published;
+    }
+}
@@ -0,0 +1,581 @@
+#include "FrameCapture.h"
+#include "Upscaler.h"
+#include "Trace.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+/**
+ * CRC-32 (as used by PNG chunks)
+ * @param crc Running CRC, start with 0
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Updated CRC
+ */
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const std::array<uint32_t, 256> table = []
+    {
+        std::array<uint32_t, 256> result{};
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1u) ? 0xEDB88320u ^ (c >> 1u) : c >> 1u;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xFFu] ^ (crc >> 8u);
+    }
+    return ~crc;
+}
+
+/**
+ * Appends a 32 bit big endian value
+ */
+static void putBigEndian(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(value >> 24u);
+    out.push_back(value >> 16u);
+    out.push_back(value >> 8u);
+    out.push_back(value);
+}
+
+/**
+ * Writes a PNG chunk (length, type, data, CRC)
+ */
+static void writeChunk(FILE *file, const char *type, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> chunk;
+    putBigEndian(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+FrameCapture::FrameCapture(Format _format, std::string _path, unsigned int _scale, bool _changedOnly, bool _lossless)
+        : format(_format),
+          path(std::move(_path)),
+          scale(_scale == 0 ? 1 : _scale),
+          changedOnly(_changedOnly),
+          lossless(_lossless)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+    close();
+}
+
+/**
+ * Converts a format name from the command line
+ * @param name One of "y4m", "raw", "png" or "ffmpeg"
+ * @param format Parsed format
+ * @return True if the name was recognised
+ */
+bool FrameCapture::parseFormat(const std::string &name, Format &format)
+{
+    if (name == "y4m")
+    {
+        format = Format::Y4M;
+    }
+    else if (name == "raw")
+    {
+        format = Format::Raw;
+    }
+    else if (name == "png")
+    {
+        format = Format::PNG;
+    }
+    else if (name == "ffmpeg")
+    {
+        format = Format::FFmpeg;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Opens the output and starts the encoder thread
+ * @return False if the output couldn't be opened
+ */
+bool FrameCapture::open()
+{
+    unsigned int width = VIDEO_WIDTH * scale;
+    unsigned int height = VIDEO_HEIGHT * scale;
+    pixels.resize(width * height);
+
+#ifndef _WIN32
+    // A reader that goes away (ffmpeg exiting early, or a pipe given as the output) makes writes fail with EPIPE
+    // rather than killing the emulator
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    switch (format)
+    {
+        case Format::Y4M:
+        case Format::Raw:
+            output = fopen(path.c_str(), "wb");
+            break;
+        case Format::FFmpeg:
+            output = startFFmpeg(width, height);
+            break;
+        case Format::PNG:
+            // Pattern must contain a frame number placeholder
+            if (path.find('%') == std::string::npos)
+            {
+                path += "_%06llu.png";
+            }
+            if (!parseNamePattern())
+            {
+                std::cout << "ERROR: PNG capture paths need one frame number placeholder like %06d (%% for a "
+                             "literal %): " << path << std::endl;
+                return false;
+            }
+            break;
+    }
+
+    if (format != Format::PNG && output == nullptr)
+    {
+        std::cout << "Failed to open capture output: " << path << std::endl;
+        return false;
+    }
+
+    if (format == Format::Y4M)
+    {
+        fprintf(output, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 Cmono\n", width, height);
+    }
+
+    worker = std::thread(&FrameCapture::encoderLoop, this);
+    return true;
+}
+
+/**
+ * Queues the current framebuffer for encoding. Called by the emulator thread after each tick.
+ * @param video Chip-8 framebuffer (VIDEO_WIDTH * VIDEO_HEIGHT pixels)
+ * @param frameNumber Emulated frame number, used for PNG file names
+ */
+void FrameCapture::submit(const uint32_t *video, uint64_t frameNumber)
+{
+    if (!worker.joinable() || failed.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    uint64_t rows[VIDEO_HEIGHT];
+    packFrame(video, rows);
+
+    if (changedOnly && hasLastFrame && memcmp(rows, lastRows, sizeof(rows)) == 0)
+    {
+        return;
+    }
+    memcpy(lastRows, rows, sizeof(rows));
+    hasLastFrame = true;
+
+    size_t currentHead = head.load(std::memory_order_relaxed);
+    while (currentHead - tail.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+        if (failed.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        if (!lossless)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    PackedFrame &slot = queue[currentHead & (QUEUE_SIZE - 1)];
+    slot.number = frameNumber;
+    memcpy(slot.rows, rows, sizeof(rows));
+    head.store(currentHead + 1, std::memory_order_release);
+}
+
+/**
+ * Encoder thread: drains the queue until close() is called and the queue is empty
+ */
+void FrameCapture::encoderLoop()
+{
+    Trace::setThreadName("capture encoder");
+    while (true)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail == head.load(std::memory_order_acquire))
+        {
+            if (stopping.load(std::memory_order_acquire))
+            {
+                // Re-check after seeing the stop flag so no frame pushed before close() is lost
+                if (currentTail == head.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        {
+            TRACE_ZONE("encode");
+            encode(queue[currentTail & (QUEUE_SIZE - 1)]);
+        }
+        tail.store(currentTail + 1, std::memory_order_release);
+        if (failed.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Upscales a packed frame to 8 bit grey and writes it to the output
+ * @param frame Frame to encode
+ */
+void FrameCapture::encode(const PackedFrame &frame)
+{
+    unsigned int width = VIDEO_WIDTH * scale;
+
+    // Expand one source row, then repeat it for the remaining scaled lines
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        uint8_t *line = &pixels[y * scale * width];
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+        {
+            uint8_t value = ((frame.rows[y] >> (VIDEO_WIDTH - 1 - x)) & 1u) ? 0xFF : 0x00;
+            memset(line + x * scale, value, scale);
+        }
+        for (unsigned int copy = 1; copy < scale; copy++)
+        {
+            memcpy(line + copy * width, line, width);
+        }
+    }
+
+    switch (format)
+    {
+        case Format::Y4M:
+            if (fputs("FRAME\n", output) == EOF || fwrite(pixels.data(), 1, pixels.size(), output) != pixels.size())
+            {
+                stopOnWriteError();
+                return;
+            }
+            break;
+        case Format::Raw:
+        case Format::FFmpeg:
+            if (fwrite(pixels.data(), 1, pixels.size(), output) != pixels.size())
+            {
+                stopOnWriteError();
+                return;
+            }
+            break;
+        case Format::PNG:
+        {
+            // Only the number goes through printf, the pattern itself is never used as a format
+            char number[32];
+            snprintf(number, sizeof(number), zeroPadded ? "%0*llu" : "%*llu", (int) numberWidth,
+                     (unsigned long long) frame.number);
+            if (!writePNG((namePrefix + number + nameSuffix).c_str()))
+            {
+                return;
+            }
+        }
+            break;
+    }
+    written.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Writes the current pixel buffer as an 8 bit greyscale PNG. Uses stored (uncompressed) deflate
+ * blocks so no compression library is needed - convert with another tool if size matters.
+ * @param fileName File to create
+ * @return False if the file couldn't be written
+ */
+bool FrameCapture::writePNG(const char *fileName)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (file == nullptr)
+    {
+        std::cout << "Failed to write capture frame: " << fileName << std::endl;
+        return false;
+    }
+
+    unsigned int width = VIDEO_WIDTH * scale;
+    unsigned int height = VIDEO_HEIGHT * scale;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.insert(header.end(), {8, 0, 0, 0, 0}); // 8 bit, greyscale, deflate, no filter, no interlace
+    writeChunk(file, "IHDR", header);
+
+    // Scanlines each start with a filter type byte (0 = none)
+    std::vector<uint8_t> raw;
+    raw.reserve((width + 1) * height);
+    for (unsigned int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels.begin() + y * width, pixels.begin() + (y + 1) * width);
+    }
+
+    // zlib stream made of stored blocks, followed by the Adler-32 of the raw data
+    std::vector<uint8_t> data = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (size_t offset = 0; offset < raw.size();)
+    {
+        size_t length = std::min<size_t>(raw.size() - offset, 65535);
+        bool last = offset + length == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(length & 0xFFu);
+        data.push_back(length >> 8u);
+        data.push_back(~length & 0xFFu);
+        data.push_back((~length >> 8u) & 0xFFu);
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+        for (size_t i = offset; i < offset + length; i++)
+        {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+    }
+    putBigEndian(data, (b << 16u) | a);
+    writeChunk(file, "IDAT", data);
+    writeChunk(file, "IEND", {});
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Starts ffmpeg encoding raw grey frames from a pipe into path. The path is passed as its own argument, never
+ * through a shell.
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @return Write end of the pipe, or nullptr if ffmpeg couldn't be started
+ */
+FILE *FrameCapture::startFFmpeg(unsigned int width, unsigned int height)
+{
+    std::string size = std::to_string(width) + "x" + std::to_string(height);
+#ifdef _WIN32
+    // No posix_spawn here, so the command goes through cmd.exe and paths it could interpret are refused
+    if (path.find_first_of("\"%!^&|<>") != std::string::npos)
+    {
+        std::cout << "ERROR: ffmpeg capture paths can't contain \" % ! ^ & | < or >" << std::endl;
+        return nullptr;
+    }
+    std::string command = "ffmpeg -loglevel error -y -f rawvideo -pix_fmt gray -s " + size + " -r 60 -i - \"" +
+                          path + "\"";
+    return _popen(command.c_str(), "wb");
+#else
+    std::vector<std::string> arguments = {"ffmpeg", "-loglevel", "error", "-y", "-f", "rawvideo", "-pix_fmt", "gray",
+                                          "-s", size, "-r", "60", "-i", "-", path};
+    std::vector<char *> argv;
+    for (std::string &argument : arguments)
+    {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    int pipeEnds[2];
+    if (pipe(pipeEnds) != 0)
+    {
+        return nullptr;
+    }
+    fcntl(pipeEnds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipeEnds[1], F_SETFD, FD_CLOEXEC);
+
+    // ffmpeg reads the pipe as its standard input and must not inherit the write end
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeEnds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipeEnds[0]);
+    posix_spawn_file_actions_addclose(&actions, pipeEnds[1]);
+    // open() ignores SIGPIPE, ffmpeg gets the default back
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int error = posix_spawnp(&pid, "ffmpeg", &actions, &attributes, argv.data(), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(pipeEnds[0]);
+    if (error != 0)
+    {
+        std::cout << "ERROR: Couldn't start ffmpeg: " << strerror(error) << std::endl;
+        ::close(pipeEnds[1]);
+        return nullptr;
+    }
+
+    encoderProcess = pid;
+    return fdopen(pipeEnds[1], "wb");
+#endif
+}
+
+/**
+ * Splits the PNG path around its frame number placeholder: a printf integer conversion such as %d, %06llu or
+ * %5u, with only the 0 flag and a width
+ * @return False unless there is exactly one placeholder and no other conversion
+ */
+bool FrameCapture::parseNamePattern()
+{
+    bool found = false;
+    std::string text;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        if (path[i] != '%')
+        {
+            text += path[i];
+            continue;
+        }
+        if (++i < path.size() && path[i] == '%')
+        {
+            text += '%';
+            continue;
+        }
+        if (found)
+        {
+            return false;
+        }
+
+        bool zero = i < path.size() && path[i] == '0';
+        unsigned int width = 0;
+        for (; i < path.size() && isdigit((unsigned char) path[i]); i++)
+        {
+            width = std::min(width * 10 + (path[i] - '0'), 20u);
+        }
+        while (i < path.size() && (path[i] == 'l' || path[i] == 'h' || path[i] == 'j' || path[i] == 'z'))
+        {
+            i++;
+        }
+        if (i >= path.size() || (path[i] != 'd' && path[i] != 'i' && path[i] != 'u'))
+        {
+            return false;
+        }
+
+        found = true;
+        zeroPadded = zero;
+        numberWidth = width;
+        namePrefix = text;
+        text.clear();
+    }
+    nameSuffix = text;
+    return found;
+}
+
+/**
+ * Flushes all queued frames, stops the encoder thread and closes the output
+ */
+void FrameCapture::close()
+{
+    if (worker.joinable())
+    {
+        stopping.store(true, std::memory_order_release);
+        worker.join();
+    }
+    closeOutput();
+}
+
+/**
+ * Stops capturing after a write failed, e.g. on a full disk or because ffmpeg exited early. Called on the encoder
+ * thread, which stops once the current frame returns; submit() ignores frames from then on.
+ */
+void FrameCapture::stopOnWriteError()
+{
+    int error = errno;
+    failed.store(true, std::memory_order_release);
+    std::cout << "ERROR: Capture stopped, couldn't write to " << (format == Format::FFmpeg ? "ffmpeg" : path)
+              << ": " << strerror(error) << std::endl;
+    closeOutput();
+}
+
+/**
+ * Closes the output and waits for ffmpeg to finish, reporting it if it failed
+ */
+void FrameCapture::closeOutput()
+{
+    if (output != nullptr)
+    {
+#ifdef _WIN32
+        if (format == Format::FFmpeg)
+        {
+            int status = _pclose(output);
+            output = nullptr;
+            if (status != 0)
+            {
+                std::cout << "ERROR: ffmpeg exited with status " << status << std::endl;
+            }
+        }
+#endif
+        if (output != nullptr)
+        {
+            fclose(output);
+            output = nullptr;
+        }
+    }
+
+#ifndef _WIN32
+    // ffmpeg finishes the file once it sees the end of its input
+    if (encoderProcess != 0)
+    {
+        int status = 0;
+        waitpid((pid_t) encoderProcess, &status, 0);
+        encoderProcess = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        {
+            std::cout << "ERROR: ffmpeg exited with status " << WEXITSTATUS(status) << std::endl;
+        }
+        else if (WIFSIGNALED(status))
+        {
+            std::cout << "ERROR: ffmpeg was killed by signal " << WTERMSIG(status) << std::endl;
+        }
+    }
+#endif
+}
+
+/**
+ * @return Number of frames encoded so far
+ */
+uint64_t FrameCapture::framesWritten() const
+{
+    return written.load(std::memory_order_relaxed);
+}
+
+/**
+ * @return Number of frames dropped because the encoder fell behind
+ */
+uint64_t FrameCapture::framesDropped() const
+{
+    return dropped.load(std::memory_order_relaxed);
+}
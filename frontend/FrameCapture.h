@@ -0,0 +1,114 @@
+#ifndef CHIP8_EMU_FRAMECAPTURE_H
+#define CHIP8_EMU_FRAMECAPTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../hardware/ChipEight.h"
+
+/**
+ * Streams presented frames to a video file on a background encoder thread.
+ *
+ * The emulator thread only packs the framebuffer to 1 bit per pixel and pushes it into a bounded
+ * single-producer/single-consumer ring; upscaling and encoding happen on the worker thread.
+ */
+class FrameCapture
+{
+public:
+    /**
+     * Output formats: YUV4MPEG2 (monochrome), raw 8-bit grey, numbered PNG files, or piped into ffmpeg
+     */
+    enum class Format
+    {
+        Y4M, Raw, PNG, FFmpeg
+    };
+
+    /**
+     * @param _format Output format
+     * @param _path Output file (Y4M/raw), file name pattern (PNG, e.g. "out/frame_%06llu.png") or
+     *              ffmpeg output file
+     * @param _scale Integer upscaling factor applied by the encoder
+     * @param _changedOnly Only capture frames whose pixels differ from the previous captured frame
+     * @param _lossless Wait for the encoder when the queue is full instead of dropping frames
+     */
+    FrameCapture(Format _format, std::string _path, unsigned int _scale, bool _changedOnly, bool _lossless);
+
+    ~FrameCapture();
+
+    static bool parseFormat(const std::string &name, Format &format);
+
+    bool open();
+
+    void submit(const uint32_t *video, uint64_t frameNumber);
+
+    void close();
+
+    uint64_t framesWritten() const;
+
+    uint64_t framesDropped() const;
+
+private:
+    /**
+     * 1 bit per pixel copy of the 64x32 display (one 64 bit word per row)
+     */
+    struct PackedFrame
+    {
+        uint64_t number;
+        uint64_t rows[VIDEO_HEIGHT];
+    };
+
+    // Must be a power of two
+    static const size_t QUEUE_SIZE = 512;
+
+    Format format;
+    std::string path;
+    unsigned int scale;
+    bool changedOnly;
+    bool lossless;
+
+    PackedFrame queue[QUEUE_SIZE]{};
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<bool> stopping{false};
+
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> dropped{0};
+
+    // Set by the encoder thread when a write fails, capturing stops
+    std::atomic<bool> failed{false};
+
+    bool hasLastFrame = false;
+    uint64_t lastRows[VIDEO_HEIGHT]{};
+
+    std::thread worker;
+    FILE *output = nullptr;
+    std::vector<uint8_t> pixels;
+
+    // ffmpeg process reading the output pipe, 0 if none
+    long encoderProcess = 0;
+
+    FILE *startFFmpeg(unsigned int width, unsigned int height);
+
+    // PNG file names: the pattern's text around its frame number placeholder, and the number's padding
+    std::string namePrefix;
+    std::string nameSuffix;
+    unsigned int numberWidth = 0;
+    bool zeroPadded = false;
+
+    bool parseNamePattern();
+
+    void encoderLoop();
+
+    void encode(const PackedFrame &frame);
+
+    void stopOnWriteError();
+
+    void closeOutput();
+
+    bool writePNG(const char *fileName);
+};
+
+#endif //CHIP8_EMU_FRAMECAPTURE_H
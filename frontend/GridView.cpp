@@ -0,0 +1,186 @@
+#include "GridView.h"
+#include "Upscaler.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+GridView::GridView(std::vector<ChipEight *> _instances, unsigned int _scale)
+        : instances(std::move(_instances)),
+          scale(_scale)
+{
+    columns = std::max(1u, (unsigned int) std::ceil(std::sqrt((double) instances.size())));
+    rows = std::max<unsigned int>(1, (instances.size() + columns - 1) / columns);
+
+    // Default scale keeps the whole grid around 1280 pixels wide
+    if (scale == 0)
+    {
+        scale = std::max(1u, std::min(20u, 1280 / (columns * VIDEO_WIDTH)));
+    }
+    lastTiles.resize(instances.size() * VIDEO_HEIGHT);
+    uploaded.resize(instances.size(), false);
+}
+
+GridView::~GridView()
+{
+    if (window == nullptr)
+    {
+        return;
+    }
+
+    SDL_DestroyTexture(atlas);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+/**
+ * Creates the window and the atlas texture
+ * @param _title Window title, followed by the instance receiving keys
+ * @return False if SDL couldn't create them
+ */
+bool GridView::open(const std::string &_title)
+{
+    title = _title;
+    SDL_Init(SDL_INIT_VIDEO);
+    window = SDL_CreateWindow(title.c_str(), 100, 200, columns * VIDEO_WIDTH * scale, rows * VIDEO_HEIGHT * scale,
+                              SDL_WINDOW_SHOWN);
+    if (window != nullptr)
+    {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    }
+    if (renderer != nullptr)
+    {
+        atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                  columns * VIDEO_WIDTH, rows * VIDEO_HEIGHT);
+    }
+    if (atlas == nullptr)
+    {
+        std::cout << "ERROR: Couldn't create grid window: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    // Cells without an instance stay black
+    std::vector<uint32_t> blank(columns * VIDEO_WIDTH * rows * VIDEO_HEIGHT, 0);
+    SDL_UpdateTexture(atlas, nullptr, blank.data(), columns * VIDEO_WIDTH * sizeof(uint32_t));
+    setFocus(0);
+    return true;
+}
+
+/**
+ * Handles window events and routes keys to the focused instance
+ * @return False once the window is closed or Escape is pressed
+ */
+bool GridView::processInputs()
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
+    {
+        switch (event.type)
+        {
+            case SDL_QUIT:
+                return false;
+
+            case SDL_WINDOWEVENT:
+            {
+                // Window contents may have been lost, upload and draw everything again
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                {
+                    std::fill(uploaded.begin(), uploaded.end(), false);
+                }
+            }
+                break;
+
+            case SDL_MOUSEBUTTONDOWN:
+            {
+                unsigned int column = event.button.x / (VIDEO_WIDTH * scale);
+                unsigned int row = event.button.y / (VIDEO_HEIGHT * scale);
+                if (column < columns && row * columns + column < instances.size())
+                {
+                    setFocus(row * columns + column);
+                }
+            }
+                break;
+
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+            {
+                SDL_Keycode sym = event.key.keysym.sym;
+                if (sym == SDLK_ESCAPE)
+                {
+                    return false;
+                }
+                if (sym == SDLK_TAB && event.type == SDL_KEYDOWN)
+                {
+                    setFocus((focus + 1) % instances.size());
+                    break;
+                }
+
+                ChipEight *chip = instances[focus];
+                int key = chip->findKey(sym);
+                if (key >= 0)
+                {
+                    uint16_t mask = chip->getKeypadMask();
+                    chip->setKeypad(event.type == SDL_KEYDOWN ? mask | (1u << key) : mask & ~(1u << key));
+                }
+            }
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+ * Uploads the tiles that changed since the last call and draws the atlas in one copy
+ */
+void GridView::present()
+{
+    TRACE_ZONE("gridPresent");
+    bool changed = false;
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        uint64_t tile[VIDEO_HEIGHT];
+        packFrame(instances[i]->video, tile);
+        uint64_t *last = &lastTiles[i * VIDEO_HEIGHT];
+        if (uploaded[i] && memcmp(tile, last, sizeof(tile)) == 0)
+        {
+            continue;
+        }
+
+        SDL_Rect rect{(int) ((i % columns) * VIDEO_WIDTH), (int) ((i / columns) * VIDEO_HEIGHT), VIDEO_WIDTH,
+                      VIDEO_HEIGHT};
+        SDL_UpdateTexture(atlas, &rect, instances[i]->video, VIDEO_WIDTH * sizeof(uint32_t));
+        memcpy(last, tile, sizeof(tile));
+        uploaded[i] = true;
+        changed = true;
+        ++uploads;
+    }
+
+    if (changed)
+    {
+        SDL_RenderCopy(renderer, atlas, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+}
+
+/**
+ * @return Tile uploads so far, to compare against frames times instances
+ */
+uint64_t GridView::tilesUploaded() const
+{
+    return uploads;
+}
+
+/**
+ * Sends keys to another instance, releasing any held on the old one
+ * @param index Instance to focus
+ */
+void GridView::setFocus(unsigned int index)
+{
+    instances[focus]->setKeypad(0);
+    focus = index;
+    std::string caption = title + " - keys to #" + std::to_string(focus + 1) + " of " +
+                          std::to_string(instances.size());
+    SDL_SetWindowTitle(window, caption.c_str());
+}
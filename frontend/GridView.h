@@ -0,0 +1,60 @@
+#ifndef CHIP8_EMU_GRIDVIEW_H
+#define CHIP8_EMU_GRIDVIEW_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../hardware/ChipEight.h"
+
+/**
+ * Shows many headless instances in one window. Every display is a 64x32 tile of a single atlas texture:
+ * only tiles whose pixels changed are uploaded, and the whole atlas is drawn with one copy per frame, so
+ * the cost of presenting barely grows with the number of instances.
+ *
+ * Keys go to one instance at a time, picked by clicking its tile or cycling with Tab.
+ */
+class GridView
+{
+public:
+    /**
+     * @param _instances Instances to show, in tile order (left to right, top to bottom)
+     * @param _scale Window pixels per Chip-8 pixel, 0 to fit the grid on screen
+     */
+    GridView(std::vector<ChipEight *> _instances, unsigned int _scale);
+
+    ~GridView();
+
+    GridView(const GridView &) = delete;
+
+    GridView &operator=(const GridView &) = delete;
+
+    bool open(const std::string &_title);
+
+    bool processInputs();
+
+    void present();
+
+    uint64_t tilesUploaded() const;
+
+private:
+    std::vector<ChipEight *> instances;
+    unsigned int scale;
+    unsigned int columns;
+    unsigned int rows;
+    std::string title;
+
+    SDL_Window *window{};
+    SDL_Renderer *renderer{};
+    SDL_Texture *atlas{};
+
+    // 1 bit per pixel copy of each tile as last uploaded
+    std::vector<uint64_t> lastTiles;
+    std::vector<bool> uploaded;
+    unsigned int focus = 0;
+    uint64_t uploads = 0;
+
+    void setFocus(unsigned int index);
+};
+
+#endif //CHIP8_EMU_GRIDVIEW_H
@@ -0,0 +1,104 @@
+#include "KeyQueue.h"
+#include <algorithm>
+
+/**
+ * @param key Chip-8 key 0x0 - 0xF
+ * @param down True for a press, false for a release
+ * @param time When the host saw the event
+ */
+void KeyQueue::push(uint8_t key, bool down, std::chrono::steady_clock::time_point time)
+{
+    events.push_back({time, 0, key, down});
+}
+
+/**
+ * @return True if nothing is waiting, including releases held back for a later frame
+ */
+bool KeyQueue::empty() const
+{
+    return events.empty() && releases.empty();
+}
+
+/**
+ * Places the events that arrived since the previous frame into the frame starting now. Must be called for every
+ * frame, even with nothing queued, to keep track of frame times.
+ * @param now Start of the frame
+ * @param instructions Instructions in the frame
+ * @param changes Filled with the changes to apply, ordered by instruction
+ */
+void KeyQueue::takeFrame(std::chrono::steady_clock::time_point now, int instructions, std::vector<KeyChange> &changes)
+{
+    changes.clear();
+    uint64_t frameEnd = frameStart + instructions;
+    int64_t window = (now - lastFrame).count();
+    bool timed = lastFrame != std::chrono::steady_clock::time_point{} && window > 0;
+
+    int previous = 0;
+    while (!events.empty())
+    {
+        KeyChange change = events.front();
+        events.pop_front();
+
+        // Where the event falls between the previous frame and this one, kept in arrival order
+        int position = 0;
+        if (timed && change.time > lastFrame)
+        {
+            position = (int) std::min<int64_t>((change.time - lastFrame).count() * instructions / window,
+                                               instructions - 1);
+        }
+        position = std::max(position, previous);
+        previous = position;
+        uint64_t at = frameStart + position;
+
+        auto held = std::find_if(releases.begin(), releases.end(), [&change](const Release &release)
+        {
+            return release.change.key == change.key;
+        });
+        if (change.down)
+        {
+            if (held != releases.end())
+            {
+                // Pressed again before the held back release: the key just stays down
+                if (held->notBefore > at)
+                {
+                    releases.erase(held);
+                    continue;
+                }
+                held->change.instruction = (int) (held->notBefore - frameStart);
+                changes.push_back(held->change);
+                releases.erase(held);
+            }
+            pressedAt[change.key] = at;
+        }
+        else if (at < pressedAt[change.key] + instructions)
+        {
+            releases.push_back({change, pressedAt[change.key] + instructions});
+            continue;
+        }
+
+        change.instruction = position;
+        changes.push_back(change);
+    }
+
+    // Releases that have now been held long enough
+    for (auto release = releases.begin(); release != releases.end();)
+    {
+        if (release->notBefore < frameEnd)
+        {
+            release->change.instruction = (int) (std::max(release->notBefore, frameStart) - frameStart);
+            changes.push_back(release->change);
+            release = releases.erase(release);
+        }
+        else
+        {
+            ++release;
+        }
+    }
+    std::stable_sort(changes.begin(), changes.end(), [](const KeyChange &a, const KeyChange &b)
+    {
+        return a.instruction < b.instruction;
+    });
+
+    frameStart = frameEnd;
+    lastFrame = now;
+}
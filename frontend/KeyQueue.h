@@ -0,0 +1,51 @@
+#ifndef CHIP8_EMU_KEYQUEUE_H
+#define CHIP8_EMU_KEYQUEUE_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * A key change placed inside a frame
+ */
+struct KeyChange
+{
+    std::chrono::steady_clock::time_point time; // When the host saw it
+    int instruction;                            // Applied before this instruction of the frame
+    uint8_t key;
+    bool down;
+};
+
+/**
+ * Key events waiting for the frame that applies them. Events are stamped when they arrive between frames, and
+ * each frame places the ones that arrived since the previous frame at the instructions matching their arrival
+ * times, so presses keep their order and spacing instead of all landing on the frame boundary.
+ *
+ * A key is held for at least one frame's worth of instructions: a release that comes sooner is moved later,
+ * into the next frame if need be, so a ROM that checks the keys once a frame never misses a short tap.
+ */
+class KeyQueue
+{
+public:
+    void push(uint8_t key, bool down, std::chrono::steady_clock::time_point time);
+
+    bool empty() const;
+
+    void takeFrame(std::chrono::steady_clock::time_point now, int instructions, std::vector<KeyChange> &changes);
+
+private:
+    struct Release
+    {
+        KeyChange change;
+        uint64_t notBefore;     // Instruction count from the first frame
+    };
+
+    std::deque<KeyChange> events;
+    std::vector<Release> releases;
+    std::chrono::steady_clock::time_point lastFrame{};
+    uint64_t frameStart = 0;
+    uint64_t pressedAt[16]{};
+};
+
+#endif //CHIP8_EMU_KEYQUEUE_H
@@ -0,0 +1,194 @@
+#include "LatencyProbe.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+/**
+ * Starts the next emulated frame, and drops presses the ROM read but never answered
+ */
+void LatencyProbe::beginFrame()
+{
+    ++frame;
+    size_t before = pending.size();
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [this](const LatencySample &sample)
+    {
+        return sample.stage > 0 && frame - sample.pressedFrame > TIMEOUT_FRAMES;
+    }), pending.end());
+    ignored += before - pending.size();
+}
+
+/**
+ * @param key Chip-8 key pressed (repeats and keys already down aren't new presses)
+ * @param time When the host saw the press
+ */
+void LatencyProbe::onKeyDown(uint8_t key, std::chrono::steady_clock::time_point time)
+{
+    if (unreadKeys & (1u << key))
+    {
+        return;
+    }
+    LatencySample sample{};
+    sample.pressed = time;
+    sample.pressedFrame = frame;
+    sample.key = key;
+    pending.push_back(sample);
+    unreadKeys |= 1u << key;
+}
+
+/**
+ * @param key Chip-8 key released. If the ROM never saw it down the press is dropped.
+ */
+void LatencyProbe::onKeyUp(uint8_t key)
+{
+    if (!(unreadKeys & (1u << key)))
+    {
+        return;
+    }
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [key](const LatencySample &sample)
+    {
+        return sample.stage == 0 && sample.key == key;
+    }), pending.end());
+    unreadKeys &= ~(1u << key);
+    ++releasedUnread;
+}
+
+/**
+ * Called when an instruction sees keys down
+ * @param keys Mask of the keys it saw down
+ */
+void LatencyProbe::onKeysRead(uint16_t keys)
+{
+    if (!(keys & unreadKeys))
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (LatencySample &sample : pending)
+    {
+        if (sample.stage == 0 && (keys & (1u << sample.key)))
+        {
+            sample.read = now;
+            sample.stage = 1;
+        }
+    }
+    unreadKeys &= ~keys;
+    awaitingChange = true;
+}
+
+/**
+ * Called when an instruction changes the screen
+ */
+void LatencyProbe::onVideoChanged()
+{
+    if (!awaitingChange)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (LatencySample &sample : pending)
+    {
+        if (sample.stage == 1)
+        {
+            sample.changed = now;
+            sample.stage = 2;
+        }
+    }
+    awaitingChange = false;
+}
+
+/**
+ * Called once a frame has been handed to the display
+ */
+void LatencyProbe::onPresent()
+{
+    auto now = std::chrono::steady_clock::now();
+    for (LatencySample &sample : pending)
+    {
+        if (sample.stage == 2)
+        {
+            sample.presented = now;
+            sample.presentedFrame = frame;
+            samples.push_back(sample);
+        }
+    }
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [](const LatencySample &sample)
+    {
+        return sample.stage == 2;
+    }), pending.end());
+}
+
+/**
+ * @return Presses followed all the way to the screen, in the order they were presented
+ */
+const std::vector<LatencySample> &LatencyProbe::getSamples() const
+{
+    return samples;
+}
+
+/**
+ * @param percentile 0-100
+ * @return Frames from press to present at that percentile (0 for the frame the press arrived in)
+ */
+uint64_t LatencyProbe::percentileFrames(double percentile) const
+{
+    std::vector<double> frames;
+    for (const LatencySample &sample : samples)
+    {
+        frames.push_back((double) (sample.presentedFrame - sample.pressedFrame));
+    }
+    return (uint64_t) LatencyProbe::percentile(frames, percentile);
+}
+
+/**
+ * Prints latency percentiles for each stage of the path from key to screen
+ */
+void LatencyProbe::printReport() const
+{
+    std::cout << "Input latency over " << samples.size() << " presses (" << releasedUnread
+              << " released before the ROM read them, " << ignored << " read but not drawn)" << std::endl;
+    if (samples.empty())
+    {
+        return;
+    }
+
+    auto milliseconds = [](std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    std::vector<double> stages[4];
+    for (const LatencySample &sample : samples)
+    {
+        stages[0].push_back(milliseconds(sample.read - sample.pressed));
+        stages[1].push_back(milliseconds(sample.changed - sample.read));
+        stages[2].push_back(milliseconds(sample.presented - sample.changed));
+        stages[3].push_back(milliseconds(sample.presented - sample.pressed));
+    }
+
+    const char *names[4] = {"key -> read", "read -> draw", "draw -> present", "key -> present"};
+    printf("%-16s %9s %9s %9s %9s\n", "ms", "p50", "p90", "p99", "max");
+    for (int stage = 0; stage < 4; stage++)
+    {
+        printf("%-16s %9.2f %9.2f %9.2f %9.2f\n", names[stage], percentile(stages[stage], 50),
+               percentile(stages[stage], 90), percentile(stages[stage], 99), percentile(stages[stage], 100));
+    }
+    printf("%-16s %9llu %9llu %9llu %9llu\n", "frames", (unsigned long long) percentileFrames(50),
+           (unsigned long long) percentileFrames(90), (unsigned long long) percentileFrames(99),
+           (unsigned long long) percentileFrames(100));
+}
+
+/**
+ * Nearest-rank percentile
+ * @param values Samples
+ * @param percentile 0-100
+ * @return Value at that percentile, or 0 with no samples
+ */
+double LatencyProbe::percentile(std::vector<double> values, double percentile)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t) (percentile / 100 * values.size() + 0.999999);
+    return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
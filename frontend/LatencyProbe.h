@@ -0,0 +1,67 @@
+#ifndef CHIP8_EMU_LATENCYPROBE_H
+#define CHIP8_EMU_LATENCYPROBE_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * One key press followed through to the screen
+ */
+struct LatencySample
+{
+    std::chrono::steady_clock::time_point pressed;      // Key event, as stamped by SDL
+    std::chrono::steady_clock::time_point read;         // First EX9E/EXA1/FX0A to see the key down
+    std::chrono::steady_clock::time_point changed;      // First draw or clear changing the screen after that
+    std::chrono::steady_clock::time_point presented;    // Present of the frame holding the change
+    uint64_t pressedFrame;
+    uint64_t presentedFrame;
+    uint8_t key;
+    uint8_t stage;      // 0 waiting for the read, 1 for the change, 2 for the present
+};
+
+/**
+ * Measures input-to-photon latency: how long a key press takes to reach the ROM, what the ROM draws in
+ * response and the present that shows it. Everything runs on the emulator thread, called from the
+ * keypad, the key instructions, the drawing instructions and updateScreen().
+ *
+ * A press only counts once the ROM reads the key and then changes the screen, so presses the ROM ignores
+ * never complete and are dropped after a while rather than skewing the numbers.
+ */
+class LatencyProbe
+{
+public:
+    // Frames a read press can wait for a screen change before it counts as ignored
+    static const uint64_t TIMEOUT_FRAMES = 60;
+
+    void beginFrame();
+
+    void onKeyDown(uint8_t key, std::chrono::steady_clock::time_point time);
+
+    void onKeyUp(uint8_t key);
+
+    void onKeysRead(uint16_t keys);
+
+    void onVideoChanged();
+
+    void onPresent();
+
+    const std::vector<LatencySample> &getSamples() const;
+
+    uint64_t percentileFrames(double percentile) const;
+
+    void printReport() const;
+
+private:
+    std::vector<LatencySample> pending;
+    std::vector<LatencySample> samples;
+    uint64_t frame = 0;
+    uint64_t releasedUnread = 0;
+    uint64_t ignored = 0;
+    uint16_t unreadKeys = 0;
+    bool awaitingChange = false;
+
+    static double percentile(std::vector<double> values, double percentile);
+};
+
+#endif //CHIP8_EMU_LATENCYPROBE_H
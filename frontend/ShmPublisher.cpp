@@ -0,0 +1,125 @@
+#include "ShmPublisher.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static_assert(CHIP8_SHM_VIDEO_WIDTH == VIDEO_WIDTH && CHIP8_SHM_VIDEO_HEIGHT == VIDEO_HEIGHT, "shared display size");
+
+/**
+ * @param _name Shared-memory object name, e.g. "/chip8"
+ */
+ShmPublisher::ShmPublisher(std::string _name) : name(std::move(_name))
+{
+}
+
+ShmPublisher::~ShmPublisher()
+{
+    close();
+}
+
+/**
+ * Creates (or replaces) the shared-memory object and maps it
+ * @return False if it couldn't be created
+ */
+bool ShmPublisher::open()
+{
+#ifdef _WIN32
+    std::cout << "ERROR: Publishing to shared memory needs POSIX shared memory" << std::endl;
+    return false;
+#else
+    // Readers still mapping an old object keep their mapping, new readers get this one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        std::cout << "ERROR: Couldn't create shared memory " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size = sizeof(chip8_shm_header) + CHIP8_SHM_SLOTS * sizeof(chip8_shm_slot);
+    if (ftruncate(fd, (off_t) size) != 0)
+    {
+        std::cout << "ERROR: Couldn't size shared memory " << name << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "ERROR: Couldn't map shared memory " << name << ": " << strerror(errno) << std::endl;
+        mapping = nullptr;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // New objects are zero filled, so only the header needs setting up. The magic goes last so readers
+    // never see a half-initialised header.
+    header = (chip8_shm_header *) mapping;
+    slots = (uint8_t *) mapping + sizeof(chip8_shm_header);
+    header->version = CHIP8_SHM_VERSION;
+    header->slot_count = CHIP8_SHM_SLOTS;
+    header->slot_size = sizeof(chip8_shm_slot);
+    __atomic_store_n(&header->magic, CHIP8_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+#endif
+}
+
+/**
+ * Writes the current state into the next slot
+ * @param chip Instance that just finished a frame
+ * @param frame Its frame number
+ */
+void ShmPublisher::publish(ChipEight &chip, uint64_t frame)
+{
+    if (header == nullptr)
+    {
+        return;
+    }
+
+    auto *slot = (chip8_shm_slot *) (slots + (published % CHIP8_SHM_SLOTS) * sizeof(chip8_shm_slot));
+    uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+    // Odd while writing; the fence keeps the data stores after it
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame = frame;
+    memcpy(slot->video, chip.video, sizeof(slot->video));
+    memcpy(slot->stack, chip.getStack(), sizeof(slot->stack));
+    slot->pc = *chip.getPC();
+    slot->index = *chip.getIndexRegister();
+    slot->keypad = chip.getKeypadMask();
+    memcpy(slot->registers, chip.getRegisters(), sizeof(slot->registers));
+    slot->sp = *chip.getStackPointer();
+    slot->delay_timer = *chip.getDelayRegister();
+    slot->sound_timer = *chip.getSoundRegister();
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->published, ++published, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unmaps and removes the object. Readers that still have it mapped can finish reading.
+ */
+void ShmPublisher::close()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+    {
+        munmap(mapping, size);
+        shm_unlink(name.c_str());
+    }
+#endif
+    mapping = nullptr;
+    header = nullptr;
+    slots = nullptr;
+}
@@ -0,0 +1,41 @@
+#ifndef CHIP8_EMU_SHMPUBLISHER_H
+#define CHIP8_EMU_SHMPUBLISHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "../hardware/ChipEight.h"
+#include "../lib/chip8_shm.h"
+
+/**
+ * Publishes every finished frame (display, registers, timers and frame number) into a POSIX shared-memory
+ * ring for other processes, laid out as described in lib/chip8_shm.h. Publishing is plain stores into the
+ * mapping, guarded by a per-slot sequence counter, so the emulator never waits on readers or makes a syscall.
+ */
+class ShmPublisher
+{
+public:
+    explicit ShmPublisher(std::string _name);
+
+    ~ShmPublisher();
+
+    ShmPublisher(const ShmPublisher &) = delete;
+
+    ShmPublisher &operator=(const ShmPublisher &) = delete;
+
+    bool open();
+
+    void publish(ChipEight &chip, uint64_t frame);
+
+    void close();
+
+private:
+    std::string name;
+    void *mapping = nullptr;
+    size_t size = 0;
+    chip8_shm_header *header = nullptr;
+    uint8_t *slots = nullptr;
+    uint64_t published = 0;
+};
+
+#endif //CHIP8_EMU_SHMPUBLISHER_H
@@ -0,0 +1,105 @@
+#include "SoftwarePresenter.h"
+#include <cstring>
+
+SoftwarePresenter::SoftwarePresenter(SDL_Window *_window, unsigned int _scale, ScaleStyle _style)
+        : window(_window),
+          scale(_scale),
+          style(_style),
+          kernel(bestUpscaleKernel())
+{
+}
+
+SoftwarePresenter::~SoftwarePresenter()
+{
+    SDL_FreeSurface(conversion);
+}
+
+/**
+ * Forces the next present to redraw everything (e.g. after the window was exposed)
+ */
+void SoftwarePresenter::invalidate()
+{
+    fullRedraw = true;
+}
+
+/**
+ * Draws the rows that changed since the last call and updates only those parts of the window
+ * @param video Chip-8 framebuffer
+ */
+void SoftwarePresenter::present(const uint32_t *video)
+{
+    SDL_Surface *surface = SDL_GetWindowSurface(window);
+    if (surface == nullptr)
+    {
+        return;
+    }
+
+    uint64_t rows[VIDEO_HEIGHT];
+    packFrame(video, rows);
+    uint32_t dirtyRows = fullRedraw ? 0xFFFFFFFFu : changedRows(lastRows, rows);
+    if (dirtyRows == 0)
+    {
+        return;
+    }
+
+    // Draw straight into the window when it's 32 bits per pixel, otherwise draw into a 32 bit copy
+    // and let SDL convert the dirty parts
+    SDL_Surface *target = surface;
+    if (surface->format->BytesPerPixel != 4)
+    {
+        if (conversion == nullptr)
+        {
+            conversion = SDL_CreateRGBSurfaceWithFormat(0, VIDEO_WIDTH * scale, VIDEO_HEIGHT * scale, 32,
+                                                        SDL_PIXELFORMAT_RGB888);
+            if (conversion == nullptr)
+            {
+                return;
+            }
+        }
+        target = conversion;
+    }
+
+    if (SDL_MUSTLOCK(target))
+    {
+        SDL_LockSurface(target);
+    }
+    upscaleFrame(kernel, rows, dirtyRows, (uint32_t *) target->pixels, target->pitch, scale, style,
+                 SDL_MapRGB(target->format, 0xFF, 0xFF, 0xFF), SDL_MapRGB(target->format, 0x00, 0x00, 0x00));
+    if (SDL_MUSTLOCK(target))
+    {
+        SDL_UnlockSurface(target);
+    }
+
+    // Merge consecutive dirty rows into one rectangle each
+    SDL_Rect rects[VIDEO_HEIGHT];
+    int rectCount = 0;
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        if (!((dirtyRows >> y) & 1u))
+        {
+            continue;
+        }
+        unsigned int end = y;
+        while (end + 1 < VIDEO_HEIGHT && ((dirtyRows >> (end + 1)) & 1u))
+        {
+            ++end;
+        }
+        int top = y * scale;
+        int height = (end - y + 1) * scale;
+        rects[rectCount++] = {0, top, (int) (VIDEO_WIDTH * scale), height};
+        y = end;
+    }
+
+    if (target != surface)
+    {
+        for (int i = 0; i < rectCount; i++)
+        {
+            SDL_Rect destination = rects[i];
+            SDL_BlitSurface(conversion, &rects[i], surface, &destination);
+        }
+    }
+
+    SDL_UpdateWindowSurfaceRects(window, rects, rectCount);
+    memcpy(lastRows, rows, sizeof(rows));
+    fullRedraw = false;
+}
@@ -0,0 +1,37 @@
+#ifndef CHIP8_EMU_SOFTWAREPRESENTER_H
+#define CHIP8_EMU_SOFTWAREPRESENTER_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include "Upscaler.h"
+
+/**
+ * Presents the Chip-8 display by upscaling it straight into the window surface on the CPU, for hosts
+ * without a GPU where SDL's generic software scaling is slow. Only rows that changed are redrawn and
+ * pushed to the window.
+ */
+class SoftwarePresenter
+{
+public:
+    SoftwarePresenter(SDL_Window *_window, unsigned int _scale, ScaleStyle _style);
+
+    ~SoftwarePresenter();
+
+    void present(const uint32_t *video);
+
+    void invalidate();
+
+private:
+    SDL_Window *window;
+    unsigned int scale;
+    ScaleStyle style;
+    UpscaleKernel kernel;
+
+    // Intermediate 32 bit surface, only used if the window surface isn't 32 bits per pixel
+    SDL_Surface *conversion = nullptr;
+
+    uint64_t lastRows[VIDEO_HEIGHT]{};
+    bool fullRedraw = true;
+};
+
+#endif //CHIP8_EMU_SOFTWAREPRESENTER_H
@@ -0,0 +1,183 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::enabled{false};
+
+/**
+ * One finished zone
+ */
+struct TraceRecord
+{
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+/**
+ * Events of one thread. Only that thread writes; count says how many events are complete.
+ */
+struct TraceBuffer
+{
+    std::unique_ptr<TraceRecord[]> events{new TraceRecord[Trace::BUFFER_EVENTS]};
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<const char *> name{nullptr};
+    unsigned int id = 0;
+};
+
+/**
+ * Every buffer ever created. Buffers outlive their threads so their events can still be written.
+ */
+struct TraceRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+static TraceRegistry &registry()
+{
+    static TraceRegistry instance;
+    return instance;
+}
+
+static thread_local TraceBuffer *threadBuffer = nullptr;
+static thread_local const char *threadName = nullptr;
+
+/**
+ * @return This thread's buffer, created on first use
+ */
+static TraceBuffer *currentBuffer()
+{
+    if (threadBuffer == nullptr)
+    {
+        auto buffer = std::make_unique<TraceBuffer>();
+        buffer->name.store(threadName, std::memory_order_relaxed);
+
+        TraceRegistry &traces = registry();
+        std::lock_guard<std::mutex> lock(traces.mutex);
+        buffer->id = traces.buffers.size() + 1;
+        threadBuffer = buffer.get();
+        traces.buffers.push_back(std::move(buffer));
+    }
+    return threadBuffer;
+}
+
+/**
+ * Starts recording zones on every thread
+ */
+void Trace::enable()
+{
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @return Current time in nanoseconds, never 0
+ */
+uint64_t Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() | 1u;
+}
+
+/**
+ * Adds a finished zone to the calling thread's buffer
+ * @param name Zone name, must outlive the trace
+ * @param start Trace::now() at the start
+ * @param end Trace::now() at the end
+ */
+void Trace::record(const char *name, uint64_t start, uint64_t end)
+{
+    TraceBuffer *buffer = currentBuffer();
+    size_t index = buffer->count.load(std::memory_order_relaxed);
+    if (index >= BUFFER_EVENTS)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer->events[index] = {name, start, end};
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * Names the calling thread in the trace. Costs nothing while tracing is off.
+ * @param name Thread name, must outlive the trace
+ */
+void Trace::setThreadName(const char *name)
+{
+    threadName = name;
+    if (threadBuffer != nullptr)
+    {
+        threadBuffer->name.store(name, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Writes every event recorded so far as Chrome trace-event JSON. Safe to call while other threads record.
+ * @param path Output file
+ * @return False if the file couldn't be written
+ */
+bool Trace::write(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::cout << "ERROR: Couldn't write trace: " << path << std::endl;
+        return false;
+    }
+
+    TraceRegistry &traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+
+    // Events recorded after this point are left for the next write. Timestamps are made relative to the
+    // earliest event so they stay readable.
+    std::vector<size_t> counts;
+    uint64_t origin = UINT64_MAX;
+    for (const auto &buffer : traces.buffers)
+    {
+        counts.push_back(buffer->count.load(std::memory_order_acquire));
+        for (size_t i = 0; i < counts.back(); i++)
+        {
+            origin = std::min(origin, buffer->events[i].start);
+        }
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    bool first = true;
+    uint64_t events = 0;
+    uint64_t dropped = 0;
+    for (size_t index = 0; index < traces.buffers.size(); index++)
+    {
+        const TraceBuffer *buffer = traces.buffers[index].get();
+        const char *name = buffer->name.load(std::memory_order_relaxed);
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->id, name != nullptr ? name : "thread");
+        first = false;
+
+        size_t count = counts[index];
+        for (size_t i = 0; i < count; i++)
+        {
+            const TraceRecord &record = buffer->events[i];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    record.name, buffer->id, (record.start - origin) / 1000.0, (record.end - record.start) / 1000.0);
+        }
+        events += count;
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    fputs("\n]}\n", file);
+    bool ok = fclose(file) == 0;
+
+    std::cout << "Wrote " << events << " trace events to " << path;
+    if (dropped > 0)
+    {
+        std::cout << " (" << dropped << " dropped, buffers full)";
+    }
+    std::cout << std::endl;
+    return ok;
+}
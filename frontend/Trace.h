@@ -0,0 +1,78 @@
+#ifndef CHIP8_EMU_TRACE_H
+#define CHIP8_EMU_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/**
+ * Timeline tracing of frame phases and worker threads, written out as Chrome trace-event JSON for Perfetto or
+ * about://tracing.
+ *
+ * Each thread records into its own fixed-size buffer with no locks: only the owning thread writes, and it
+ * publishes each event by bumping the buffer's count, so write() can read every buffer while threads keep
+ * recording. A full buffer drops further events. While tracing is off a zone costs one load and branch.
+ * Build with CHIP8_NO_TRACE defined to compile zones out entirely.
+ */
+class Trace
+{
+public:
+    // Events each thread can hold before dropping
+    static const size_t BUFFER_EVENTS = 1u << 18u;
+
+    static void enable();
+
+    static bool isEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now();
+
+    static void record(const char *name, uint64_t start, uint64_t end);
+
+    static void setThreadName(const char *name);
+
+    static bool write(const std::string &path);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+/**
+ * Records the time from construction to destruction. TRACE_ZONE only constructs one while tracing is on.
+ */
+class TraceZone
+{
+public:
+    explicit TraceZone(const char *_name) : name(_name), start(Trace::now())
+    {
+    }
+
+    ~TraceZone()
+    {
+        Trace::record(name, start, Trace::now());
+    }
+
+    TraceZone(const TraceZone &) = delete;
+
+    TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#define CHIP8_TRACE_CONCAT(a, b) a##b
+#define CHIP8_TRACE_NAME(line) CHIP8_TRACE_CONCAT(traceZone, line)
+
+#ifdef CHIP8_NO_TRACE
+#define TRACE_ZONE(name)
+#else
+// Name must be a string literal (or otherwise outlive the trace). Tracing being on is checked once, on entry.
+#define TRACE_ZONE(name) std::optional<TraceZone> CHIP8_TRACE_NAME(__LINE__); \
+    if (Trace::isEnabled()) CHIP8_TRACE_NAME(__LINE__).emplace(name)
+#endif
+
+#endif //CHIP8_EMU_TRACE_H
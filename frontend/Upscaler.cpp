@@ -0,0 +1,317 @@
+#include "Upscaler.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHIP8_X86 1
+#endif
+
+static_assert(VIDEO_HEIGHT <= 32, "Dirty row mask holds one bit per row");
+
+/**
+ * Vector stores may write up to one vector past the end of a line
+ */
+static const unsigned int LINE_PADDING = 8;
+
+typedef void (*ExpandFunction)(uint64_t bits, uint32_t *line, unsigned int scale, uint32_t on, uint32_t off);
+
+/**
+ * Halves the brightness of each 8 bit channel, independent of the pixel format
+ */
+static inline uint32_t dim(uint32_t colour)
+{
+    return (colour >> 1u) & 0x7F7F7F7Fu;
+}
+
+/**
+ * Packs the framebuffer into 1 bit per pixel, one 64 bit word per row (leftmost pixel in the top bit)
+ * @param video Chip-8 framebuffer
+ * @param rows Output rows
+ */
+void packFrame(const uint32_t *video, uint64_t rows[VIDEO_HEIGHT])
+{
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        uint64_t row = 0;
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+        {
+            row = (row << 1u) | (video[y * VIDEO_WIDTH + x] != 0);
+        }
+        rows[y] = row;
+    }
+}
+
+/**
+ * Compares two packed frames
+ * @return Bit mask with bit y set if row y differs
+ */
+uint32_t changedRows(const uint64_t previous[VIDEO_HEIGHT], const uint64_t current[VIDEO_HEIGHT])
+{
+    uint32_t mask = 0;
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        mask |= (uint32_t) (previous[y] != current[y]) << y;
+    }
+    return mask;
+}
+
+/**
+ * Expands one packed row to scale pixels per bit
+ */
+static void expandScalar(uint64_t bits, uint32_t *line, unsigned int scale, uint32_t on, uint32_t off)
+{
+    for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+    {
+        uint32_t colour = ((bits >> (VIDEO_WIDTH - 1 - x)) & 1u) ? on : off;
+        for (unsigned int i = 0; i < scale; i++)
+        {
+            *line++ = colour;
+        }
+    }
+}
+
+#ifdef CHIP8_X86
+
+/**
+ * SSE2 row expansion. Small scales turn groups of bits into lane masks and select between the two
+ * colours; larger scales broadcast each colour across its run (stores spill into the next run, which
+ * then overwrites them).
+ */
+__attribute__((target("sse2")))
+static void expandSSE2(uint64_t bits, uint32_t *line, unsigned int scale, uint32_t on, uint32_t off)
+{
+    const __m128i onVector = _mm_set1_epi32(on);
+    const __m128i offVector = _mm_set1_epi32(off);
+
+    if (scale == 1)
+    {
+        // Lane 0 is the leftmost pixel, which is the highest bit of each nibble
+        const __m128i laneBits = _mm_set_epi32(1, 2, 4, 8);
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x += 4)
+        {
+            __m128i nibble = _mm_set1_epi32((bits >> (VIDEO_WIDTH - 4 - x)) & 0xFu);
+            __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(nibble, laneBits), laneBits);
+            __m128i colours = _mm_or_si128(_mm_and_si128(mask, onVector), _mm_andnot_si128(mask, offVector));
+            _mm_storeu_si128((__m128i *) (line + x), colours);
+        }
+    }
+    else if (scale == 2)
+    {
+        const __m128i laneBits = _mm_set_epi32(1, 1, 2, 2);
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x += 2)
+        {
+            __m128i pair = _mm_set1_epi32((bits >> (VIDEO_WIDTH - 2 - x)) & 0x3u);
+            __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(pair, laneBits), laneBits);
+            __m128i colours = _mm_or_si128(_mm_and_si128(mask, onVector), _mm_andnot_si128(mask, offVector));
+            _mm_storeu_si128((__m128i *) (line + x * 2), colours);
+        }
+    }
+    else
+    {
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x++, line += scale)
+        {
+            __m128i colour = ((bits >> (VIDEO_WIDTH - 1 - x)) & 1u) ? onVector : offVector;
+            for (unsigned int i = 0; i < scale; i += 4)
+            {
+                _mm_storeu_si128((__m128i *) (line + i), colour);
+            }
+        }
+    }
+}
+
+/**
+ * AVX2 row expansion, same approach as the SSE2 kernel with 8 pixels per store
+ */
+__attribute__((target("avx2")))
+static void expandAVX2(uint64_t bits, uint32_t *line, unsigned int scale, uint32_t on, uint32_t off)
+{
+    const __m256i onVector = _mm256_set1_epi32(on);
+    const __m256i offVector = _mm256_set1_epi32(off);
+
+    if (scale == 1 || scale == 2 || scale == 4)
+    {
+        // Each store covers (8 / scale) source pixels
+        unsigned int pixelsPerStore = 8 / scale;
+        __m256i laneBits;
+        if (scale == 1)
+        {
+            laneBits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        }
+        else if (scale == 2)
+        {
+            laneBits = _mm256_set_epi32(1, 1, 2, 2, 4, 4, 8, 8);
+        }
+        else
+        {
+            laneBits = _mm256_set_epi32(1, 1, 1, 1, 2, 2, 2, 2);
+        }
+
+        uint64_t groupMask = (1u << pixelsPerStore) - 1;
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x += pixelsPerStore)
+        {
+            __m256i group = _mm256_set1_epi32((bits >> (VIDEO_WIDTH - pixelsPerStore - x)) & groupMask);
+            __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(group, laneBits), laneBits);
+            _mm256_storeu_si256((__m256i *) (line + x * scale), _mm256_blendv_epi8(offVector, onVector, mask));
+        }
+    }
+    else
+    {
+        for (unsigned int x = 0; x < VIDEO_WIDTH; x++, line += scale)
+        {
+            __m256i colour = ((bits >> (VIDEO_WIDTH - 1 - x)) & 1u) ? onVector : offVector;
+            for (unsigned int i = 0; i < scale; i += 8)
+            {
+                _mm256_storeu_si256((__m256i *) (line + i), colour);
+            }
+        }
+    }
+}
+
+#endif
+
+/**
+ * Whether the host CPU can run a kernel
+ * @param kernel Kernel to check
+ * @return True if supported
+ */
+bool isKernelSupported(UpscaleKernel kernel)
+{
+    switch (kernel)
+    {
+        case UpscaleKernel::Scalar:
+            return true;
+#ifdef CHIP8_X86
+        case UpscaleKernel::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case UpscaleKernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * @return Fastest kernel supported by the host CPU
+ */
+UpscaleKernel bestUpscaleKernel()
+{
+    if (isKernelSupported(UpscaleKernel::AVX2))
+    {
+        return UpscaleKernel::AVX2;
+    }
+    if (isKernelSupported(UpscaleKernel::SSE2))
+    {
+        return UpscaleKernel::SSE2;
+    }
+    return UpscaleKernel::Scalar;
+}
+
+/**
+ * @return Display name of a kernel
+ */
+const char *kernelName(UpscaleKernel kernel)
+{
+    switch (kernel)
+    {
+        case UpscaleKernel::SSE2:
+            return "sse2";
+        case UpscaleKernel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * Converts a style name from the command line
+ * @param name One of "plain", "scanlines" or "grid"
+ * @param style Parsed style
+ * @return True if the name was recognised
+ */
+bool parseScaleStyle(const char *name, ScaleStyle &style)
+{
+    if (strcmp(name, "plain") == 0)
+    {
+        style = ScaleStyle::Plain;
+    }
+    else if (strcmp(name, "scanlines") == 0)
+    {
+        style = ScaleStyle::Scanlines;
+    }
+    else if (strcmp(name, "grid") == 0)
+    {
+        style = ScaleStyle::PixelGrid;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Expands packed rows into a 32 bit pixel buffer at an integer scale. Only rows with their bit set in
+ * dirtyRows are written.
+ *
+ * @param kernel Row expansion implementation (must be supported by the CPU)
+ * @param rows Packed frame from packFrame()
+ * @param dirtyRows Bit mask of rows to draw
+ * @param pixels Destination, at least VIDEO_WIDTH * scale by VIDEO_HEIGHT * scale pixels
+ * @param pitch Bytes between destination lines
+ * @param scale Size of each Chip-8 pixel (1 - 64)
+ * @param style Block style
+ * @param onColour Colour of lit pixels, in the destination's pixel format
+ * @param offColour Colour of unlit pixels, in the destination's pixel format
+ */
+void upscaleFrame(UpscaleKernel kernel, const uint64_t rows[VIDEO_HEIGHT], uint32_t dirtyRows, uint32_t *pixels,
+                  size_t pitch, unsigned int scale, ScaleStyle style, uint32_t onColour, uint32_t offColour)
+{
+    scale = std::min(std::max(scale, 1u), MAX_SCALE);
+
+    ExpandFunction expand = expandScalar;
+#ifdef CHIP8_X86
+    if (kernel == UpscaleKernel::SSE2)
+    {
+        expand = expandSSE2;
+    }
+    else if (kernel == UpscaleKernel::AVX2)
+    {
+        expand = expandAVX2;
+    }
+#endif
+
+    static thread_local uint32_t line[VIDEO_WIDTH * MAX_SCALE + LINE_PADDING];
+    static thread_local uint32_t dimLine[VIDEO_WIDTH * MAX_SCALE + LINE_PADDING];
+    size_t lineBytes = VIDEO_WIDTH * scale * sizeof(uint32_t);
+    bool dimLastLine = style != ScaleStyle::Plain && scale >= 2;
+
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        if (!((dirtyRows >> y) & 1u))
+        {
+            continue;
+        }
+
+        expand(rows[y], line, scale, onColour, offColour);
+        if (style == ScaleStyle::PixelGrid && scale >= 2)
+        {
+            for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+            {
+                uint32_t &edge = line[x * scale + scale - 1];
+                edge = dim(edge);
+            }
+        }
+        if (dimLastLine)
+        {
+            expand(rows[y], dimLine, scale, dim(onColour), dim(offColour));
+        }
+
+        auto *destination = (uint8_t *) pixels + y * scale * pitch;
+        for (unsigned int i = 0; i < scale; i++)
+        {
+            memcpy(destination + i * pitch, (dimLastLine && i == scale - 1) ? dimLine : line, lineBytes);
+        }
+    }
+}
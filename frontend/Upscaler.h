@@ -0,0 +1,46 @@
+#ifndef CHIP8_EMU_UPSCALER_H
+#define CHIP8_EMU_UPSCALER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "../hardware/ChipEight.h"
+
+/**
+ * Largest supported scale, bounds the size of the line buffers
+ */
+const unsigned int MAX_SCALE = 64;
+
+/**
+ * Look applied when expanding each Chip-8 pixel to a scale x scale block
+ */
+enum class ScaleStyle
+{
+    Plain,      // Solid blocks
+    Scanlines,  // Last line of every block is dimmed
+    PixelGrid   // Last line and column of every block are dimmed
+};
+
+/**
+ * Implementations of the row expansion, picked at runtime by bestUpscaleKernel()
+ */
+enum class UpscaleKernel
+{
+    Scalar, SSE2, AVX2
+};
+
+void packFrame(const uint32_t *video, uint64_t rows[VIDEO_HEIGHT]);
+
+uint32_t changedRows(const uint64_t previous[VIDEO_HEIGHT], const uint64_t current[VIDEO_HEIGHT]);
+
+UpscaleKernel bestUpscaleKernel();
+
+bool isKernelSupported(UpscaleKernel kernel);
+
+const char *kernelName(UpscaleKernel kernel);
+
+bool parseScaleStyle(const char *name, ScaleStyle &style);
+
+void upscaleFrame(UpscaleKernel kernel, const uint64_t rows[VIDEO_HEIGHT], uint32_t dirtyRows, uint32_t *pixels,
+                  size_t pitch, unsigned int scale, ScaleStyle style, uint32_t onColour, uint32_t offColour);
+
+#endif //CHIP8_EMU_UPSCALER_H
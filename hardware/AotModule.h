@@ -0,0 +1,126 @@
+#ifndef CHIP8_EMU_AOTMODULE_H
+#define CHIP8_EMU_AOTMODULE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Interface between the core and ROMs compiled ahead of time by chip8_aot. Generated modules only
+ * include this header, so it must stay plain C and only change together with CHIP8_AOT_ABI_VERSION.
+ */
+#define CHIP8_AOT_ABI_VERSION 3
+
+/**
+ * Name of the function every module exports, of type Chip8AotEntry
+ */
+#define CHIP8_AOT_ENTRY "chip8_aot_module"
+
+#ifdef _WIN32
+#define CHIP8_AOT_EXPORT __declspec(dllexport)
+#else
+#define CHIP8_AOT_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Machine state handed to compiled code. Points straight into the ChipEight that owns it.
+ */
+struct Chip8AotState
+{
+    uint8_t *registers;
+    uint8_t *memory;
+    uint16_t *stack;
+    uint64_t *display;      // First bit-plane, CHIP8_AOT_ROW_WORDS words per row, leftmost pixel in the top bit
+    uint64_t *dirtyRows;    // Bit n set once row n has changed
+    uint8_t *keypad;
+    uint16_t *pc;
+    uint16_t *indexRegister;
+    uint8_t *sp;
+    uint8_t *delayRegister;
+    uint8_t *soundRegister;
+    bool *drawFlag;
+
+    // Set once memory holding compiled code has been written, so blocks check their bytes before running
+    uint8_t codeModified;
+
+    // Back into the core for the interpreter's RNG and for stores it refuses (below START_ADDRESS)
+    void *context;
+    uint8_t (*random)(void *context);
+    void (*writeMemory)(void *context, int index, uint8_t value);
+};
+
+struct Chip8AotModule
+{
+    uint32_t abiVersion;
+    uint32_t romSize;
+    uint64_t romHash;           // hashROM() of the ROM it was compiled from
+    uint8_t loadStoreQuirk;     // Quirks are baked into the code
+    uint8_t shiftQuirk;
+    const uint8_t *codeMap;     // CHIP8_AOT_MEMORY_SIZE entries, nonzero for bytes that are part of compiled code
+
+    /**
+     * Runs compiled blocks starting at the current PC until one can't be run: the PC isn't the start of
+     * a known block, the block's bytes were modified, or fewer than its length of instructions remain.
+     * The caller interprets one instruction and calls again.
+     * @return Number of instructions executed, at most budget
+     */
+    int (*run)(struct Chip8AotState *state, int budget);
+};
+
+typedef const struct Chip8AotModule *(*Chip8AotEntry)(void);
+
+/**
+ * Memory compiled code addresses (compiled ROMs are always CHIP-8). Loads wrap around it and stores past it
+ * go through writeMemory, which drops them, as in the interpreter.
+ */
+#define CHIP8_AOT_MEMORY_SIZE 4096
+
+/**
+ * Layout of Chip8AotState::display: rows of the 128x64 bit-plane, of which compiled code only uses the
+ * first word of each of the first 32 rows (the 64x32 CHIP-8 display)
+ */
+#define CHIP8_AOT_ROW_WORDS 2
+#define CHIP8_AOT_DISPLAY_WORDS (64 * CHIP8_AOT_ROW_WORDS)
+
+/**
+ * Draws a sprite on the 64x32 display exactly as the interpreter's DXYN does for CHIP-8: one shift per row,
+ * wrapping around the edges
+ * @return 1 if a lit pixel was turned off
+ */
+static inline uint8_t chip8_aot_draw(struct Chip8AotState *s, const uint8_t *memory, uint16_t I, uint8_t x,
+                                     uint8_t y, unsigned int height)
+{
+    uint8_t collision = 0;
+    unsigned int row;
+    x %= 64;
+    y %= 32;
+    for (row = 0; row < height; ++row)
+    {
+        uint64_t bits = (uint64_t) memory[(I + row) & (CHIP8_AOT_MEMORY_SIZE - 1)] << 56u;
+        unsigned int line = (y + row) % 32;
+        uint64_t *word = &s->display[line * CHIP8_AOT_ROW_WORDS];
+        bits = x != 0 ? (bits >> x) | (bits << (64 - x)) : bits;
+        collision |= (*word & bits) != 0;
+        *word ^= bits;
+        *s->dirtyRows |= (uint64_t) 1 << line;
+    }
+    return collision;
+}
+
+/**
+ * CLS as the interpreter does it
+ */
+static inline void chip8_aot_clear(struct Chip8AotState *s)
+{
+    memset(s->display, 0, CHIP8_AOT_DISPLAY_WORDS * sizeof(uint64_t));
+    *s->dirtyRows = ~(uint64_t) 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CHIP8_EMU_AOTMODULE_H
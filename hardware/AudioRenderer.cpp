@@ -0,0 +1,153 @@
+#include "AudioRenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+AudioRenderer::AudioRenderer(std::string _path) : path(std::move(_path))
+{
+    // Rounded rather than truncated: every sample is well clear of a rounding boundary, so the table (and
+    // with it the hash) doesn't depend on the last bit of the maths library's sin()
+    for (int i = 0; i < WAVE_LENGTH; i++)
+    {
+        wave[i] = (int16_t) std::lround(1000 * sin(2.0 * M_PI * i / WAVE_LENGTH));
+    }
+}
+
+AudioRenderer::~AudioRenderer()
+{
+    close();
+}
+
+/**
+ * Creates the output file, if any
+ * @return False if it couldn't be created
+ */
+bool AudioRenderer::open()
+{
+    if (path.empty())
+    {
+        return true;
+    }
+
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cout << "ERROR: Couldn't create audio output: " << path << std::endl;
+        return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, 1 << 16);
+
+    std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    wav = extension == ".wav";
+    if (wav)
+    {
+        // Sizes are filled in by close()
+        writeWavHeader(0);
+    }
+    return true;
+}
+
+/**
+ * Renders one emulated frame of audio
+ * @param tone Whether the beeper sounds during the frame (sound timer above zero after the frame's tick)
+ */
+void AudioRenderer::renderFrame(bool tone)
+{
+    if (tone)
+    {
+        // Like the live device, the tone only advances while it sounds
+        for (int i = 0; i < SAMPLES_PER_FRAME; i++)
+        {
+            auto sample = (uint16_t) wave[phase];
+            frameBytes[i * 2] = sample & 0xFFu;
+            frameBytes[i * 2 + 1] = sample >> 8u;
+            phase = phase + 1 == WAVE_LENGTH ? 0 : phase + 1;
+        }
+    }
+    else
+    {
+        memset(frameBytes, 0, sizeof(frameBytes));
+    }
+
+    for (uint8_t byte : frameBytes)
+    {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    }
+    samples += SAMPLES_PER_FRAME;
+
+    if (file != nullptr)
+    {
+        fwrite(frameBytes, 1, sizeof(frameBytes), file);
+    }
+}
+
+/**
+ * Finishes the WAV header and closes the file
+ */
+void AudioRenderer::close()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    if (wav)
+    {
+        fseek(file, 0, SEEK_SET);
+        writeWavHeader((uint32_t) std::min<uint64_t>(samples * 2, UINT32_MAX - 36));
+    }
+    fclose(file);
+    file = nullptr;
+}
+
+/**
+ * @return Samples rendered so far
+ */
+uint64_t AudioRenderer::samplesRendered() const
+{
+    return samples;
+}
+
+/**
+ * @return FNV-1a hash of the PCM data rendered so far (not including the WAV header)
+ */
+uint64_t AudioRenderer::getHash() const
+{
+    return hash;
+}
+
+/**
+ * Writes a 44 byte header for 16-bit mono PCM
+ * @param dataBytes Size of the sample data
+ */
+void AudioRenderer::writeWavHeader(uint32_t dataBytes)
+{
+    uint8_t header[44];
+    auto put16 = [&header](int offset, uint32_t value)
+    {
+        header[offset] = value & 0xFFu;
+        header[offset + 1] = (value >> 8u) & 0xFFu;
+    };
+    auto put32 = [&put16](int offset, uint32_t value)
+    {
+        put16(offset, value & 0xFFFFu);
+        put16(offset + 2, value >> 16u);
+    };
+
+    memcpy(header, "RIFF", 4);
+    put32(4, 36 + dataBytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);                // fmt chunk size
+    put16(20, 1);                 // PCM
+    put16(22, 1);                 // mono
+    put32(24, SAMPLE_RATE);
+    put32(28, SAMPLE_RATE * 2);   // bytes per second
+    put16(32, 2);                 // bytes per sample
+    put16(34, 16);                // bits per sample
+    memcpy(header + 36, "data", 4);
+    put32(40, dataBytes);
+    fwrite(header, 1, sizeof(header), file);
+}
@@ -0,0 +1,61 @@
+#ifndef CHIP8_EMU_AUDIORENDERER_H
+#define CHIP8_EMU_AUDIORENDERER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Offline counterpart of Sound: renders the beeper into a WAV or raw PCM file in emulated time instead of
+ * playing it. Every emulated frame adds exactly SAMPLES_PER_FRAME samples, so the output only depends on the
+ * ROM and its input and is produced as fast as the emulator runs, headless or turbo included.
+ *
+ * The rendered samples are also hashed, so audio can be compared against a known-good hash across builds.
+ */
+class AudioRenderer
+{
+public:
+    static const int SAMPLE_RATE = 44100;
+    static const int SAMPLES_PER_FRAME = SAMPLE_RATE / 60;
+
+    /**
+     * @param _path Output file, WAV if it ends in ".wav" and otherwise raw signed 16-bit little-endian mono
+     *              PCM. Empty to only hash the audio.
+     */
+    explicit AudioRenderer(std::string _path);
+
+    ~AudioRenderer();
+
+    AudioRenderer(const AudioRenderer &) = delete;
+
+    AudioRenderer &operator=(const AudioRenderer &) = delete;
+
+    bool open();
+
+    void renderFrame(bool tone);
+
+    void close();
+
+    uint64_t samplesRendered() const;
+
+    uint64_t getHash() const;
+
+private:
+    // The tone repeats every 100 samples (441 Hz at 44.1 kHz, as played live)
+    static const int WAVE_LENGTH = 100;
+
+    std::string path;
+    FILE *file = nullptr;
+    bool wav = false;
+
+    int16_t wave[WAVE_LENGTH]{};
+    unsigned int phase = 0;
+    uint8_t frameBytes[SAMPLES_PER_FRAME * 2]{};
+    uint64_t samples = 0;
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    void writeWavHeader(uint32_t dataBytes);
+};
+
+#endif //CHIP8_EMU_AUDIORENDERER_H
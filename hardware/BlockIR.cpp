@@ -0,0 +1,1088 @@
+#include "BlockIR.h"
+#include "ChipEight.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+static const char *OP_NAMES[] = {
+        "Const", "GetReg", "GetIndex", "GetDelay", "GetKey", "Load", "Add", "Carry", "Sub", "Greater", "Or", "And",
+        "Xor", "Shr", "Shl", "Lsb", "Msb", "AddIndex", "Offset", "Font", "Mod10", "Div10", "Equal", "NotEqual",
+        "SetReg", "SetIndex", "SetDelay", "SetSound", "Store", "Random", "Draw", "Clear", "Nop"
+};
+
+/**
+ * @return Number of value operands (a, b, c) an operation uses
+ */
+int irOperandCount(IrOp op)
+{
+    switch (op)
+    {
+        case IrOp::GetKey:
+        case IrOp::Load:
+        case IrOp::Shr:
+        case IrOp::Shl:
+        case IrOp::Lsb:
+        case IrOp::Msb:
+        case IrOp::Offset:
+        case IrOp::Font:
+        case IrOp::Mod10:
+        case IrOp::Div10:
+        case IrOp::SetReg:
+        case IrOp::SetIndex:
+        case IrOp::SetDelay:
+        case IrOp::SetSound:
+            return 1;
+        case IrOp::Add:
+        case IrOp::Carry:
+        case IrOp::Sub:
+        case IrOp::Greater:
+        case IrOp::Or:
+        case IrOp::And:
+        case IrOp::Xor:
+        case IrOp::AddIndex:
+        case IrOp::Equal:
+        case IrOp::NotEqual:
+        case IrOp::Store:
+            return 2;
+        case IrOp::Draw:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Whether an operation only computes a value, so it can be folded, merged or removed when unused
+ */
+static bool isPure(IrOp op)
+{
+    return op <= IrOp::NotEqual;
+}
+
+/**
+ * Computes a pure arithmetic operation
+ */
+static uint32_t evaluate(IrOp op, uint32_t a, uint32_t b, uint32_t imm)
+{
+    switch (op)
+    {
+        case IrOp::Const:
+            return imm;
+        case IrOp::Add:
+            return (a + b) & 0xFFu;
+        case IrOp::Carry:
+            return a + b > 255 ? 1 : 0;
+        case IrOp::Sub:
+            return (a - b) & 0xFFu;
+        case IrOp::Greater:
+            return a > b ? 1 : 0;
+        case IrOp::Or:
+            return a | b;
+        case IrOp::And:
+            return a & b;
+        case IrOp::Xor:
+            return a ^ b;
+        case IrOp::Shr:
+            return a >> 1u;
+        case IrOp::Shl:
+            return (a << 1u) & 0xFFu;
+        case IrOp::Lsb:
+            return a & 0x1u;
+        case IrOp::Msb:
+            return (a & 0x80u) >> 7u;
+        case IrOp::AddIndex:
+            return (a + b) & 0xFFFFu;
+        case IrOp::Offset:
+            return a + imm;
+        case IrOp::Font:
+            return FONT_START_ADDRESS + 5 * a;
+        case IrOp::Mod10:
+            return a % 10;
+        case IrOp::Div10:
+            return a / 10;
+        case IrOp::Equal:
+            return a == b ? 1 : 0;
+        case IrOp::NotEqual:
+            return a != b ? 1 : 0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Appends instructions to a block while lifting
+ */
+class IrBuilder
+{
+public:
+    explicit IrBuilder(IrBlock &_block)
+            : block(_block)
+    {
+    }
+
+    uint16_t emit(IrOp op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0, uint32_t imm = 0, uint8_t reg = 0)
+    {
+        block.instrs.push_back({op, reg, a, b, c, imm});
+        return block.instrs.size() - 1;
+    }
+
+    uint16_t constant(uint32_t value)
+    {
+        return emit(IrOp::Const, 0, 0, 0, value);
+    }
+
+    uint16_t getReg(unsigned int reg)
+    {
+        return emit(IrOp::GetReg, 0, 0, 0, 0, reg);
+    }
+
+    void setReg(unsigned int reg, uint16_t value)
+    {
+        emit(IrOp::SetReg, value, 0, 0, 0, reg);
+    }
+
+private:
+    IrBlock &block;
+};
+
+/**
+ * Lifts one instruction that isn't a block exit, statement by statement as its OP_* handler does it, reading
+ * registers again wherever the handler does so after a write
+ */
+static void liftInstruction(IrBuilder &ir, uint16_t opcode, bool loadStoreQuirk, bool shiftQuirk)
+{
+    unsigned int x = (opcode & 0x0F00u) >> 8u;
+    unsigned int y = (opcode & 0x00F0u) >> 4u;
+    uint32_t kk = opcode & 0x00FFu;
+    uint32_t nnn = opcode & 0x0FFFu;
+
+    switch (opcode & 0xF000u)
+    {
+        case 0x0000:
+            ir.emit(IrOp::Clear);
+            break;
+        case 0x6000:
+            ir.setReg(x, ir.constant(kk));
+            break;
+        case 0x7000:
+            ir.setReg(x, ir.emit(IrOp::Add, ir.getReg(x), ir.constant(kk)));
+            break;
+        case 0x8000:
+        {
+            unsigned int source = shiftQuirk ? x : y;
+            switch (opcode & 0x000Fu)
+            {
+                case 0x0:
+                    ir.setReg(x, ir.getReg(y));
+                    break;
+                case 0x1:
+                    ir.setReg(x, ir.emit(IrOp::Or, ir.getReg(x), ir.getReg(y)));
+                    break;
+                case 0x2:
+                    ir.setReg(x, ir.emit(IrOp::And, ir.getReg(x), ir.getReg(y)));
+                    break;
+                case 0x3:
+                    ir.setReg(x, ir.emit(IrOp::Xor, ir.getReg(x), ir.getReg(y)));
+                    break;
+                case 0x4:
+                {
+                    uint16_t vx = ir.getReg(x);
+                    uint16_t vy = ir.getReg(y);
+                    ir.setReg(0xF, ir.emit(IrOp::Carry, vx, vy));
+                    ir.setReg(x, ir.emit(IrOp::Add, vx, vy));
+                }
+                    break;
+                case 0x5:
+                    ir.setReg(0xF, ir.emit(IrOp::Greater, ir.getReg(x), ir.getReg(y)));
+                    ir.setReg(x, ir.emit(IrOp::Sub, ir.getReg(x), ir.getReg(y)));
+                    break;
+                case 0x6:
+                    ir.setReg(0xF, ir.emit(IrOp::Lsb, ir.getReg(source)));
+                    ir.setReg(x, ir.emit(IrOp::Shr, ir.getReg(source)));
+                    break;
+                case 0x7:
+                    ir.setReg(0xF, ir.emit(IrOp::Greater, ir.getReg(y), ir.getReg(x)));
+                    ir.setReg(x, ir.emit(IrOp::Sub, ir.getReg(y), ir.getReg(x)));
+                    break;
+                case 0xE:
+                    ir.setReg(0xF, ir.emit(IrOp::Msb, ir.getReg(source)));
+                    ir.setReg(x, ir.emit(IrOp::Shl, ir.getReg(source)));
+                    break;
+            }
+        }
+            break;
+        case 0xA000:
+            ir.emit(IrOp::SetIndex, ir.constant(nnn));
+            break;
+        case 0xC000:
+            ir.setReg(x, ir.emit(IrOp::And, ir.emit(IrOp::Random), ir.constant(kk)));
+            break;
+        case 0xD000:
+        {
+            uint16_t vx = ir.getReg(x);
+            uint16_t vy = ir.getReg(y);
+            ir.setReg(0xF, ir.emit(IrOp::Draw, vx, vy, ir.emit(IrOp::GetIndex), opcode & 0x000Fu));
+        }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FFu)
+            {
+                case 0x07:
+                    ir.setReg(x, ir.emit(IrOp::GetDelay));
+                    break;
+                case 0x15:
+                    ir.emit(IrOp::SetDelay, ir.getReg(x));
+                    break;
+                case 0x18:
+                    ir.emit(IrOp::SetSound, ir.getReg(x));
+                    break;
+                case 0x1E:
+                    ir.emit(IrOp::SetIndex, ir.emit(IrOp::AddIndex, ir.emit(IrOp::GetIndex), ir.getReg(x)));
+                    break;
+                case 0x29:
+                    ir.emit(IrOp::SetIndex, ir.emit(IrOp::Font, ir.getReg(x)));
+                    break;
+                case 0x33:
+                {
+                    uint16_t value = ir.getReg(x);
+                    uint16_t index = ir.emit(IrOp::GetIndex);
+                    uint16_t tens = ir.emit(IrOp::Div10, value);
+                    ir.emit(IrOp::Store, ir.emit(IrOp::Offset, index, 0, 0, 2), ir.emit(IrOp::Mod10, value));
+                    ir.emit(IrOp::Store, ir.emit(IrOp::Offset, index, 0, 0, 1), ir.emit(IrOp::Mod10, tens));
+                    ir.emit(IrOp::Store, index, ir.emit(IrOp::Mod10, ir.emit(IrOp::Div10, tens)));
+                }
+                    break;
+                case 0x55:
+                    for (unsigned int i = 0; i <= x; i++)
+                    {
+                        ir.emit(IrOp::Store, ir.emit(IrOp::Offset, ir.emit(IrOp::GetIndex), 0, 0, i), ir.getReg(i));
+                    }
+                    if (!loadStoreQuirk)
+                    {
+                        ir.emit(IrOp::SetIndex, ir.emit(IrOp::AddIndex, ir.emit(IrOp::GetIndex), ir.constant(x + 1)));
+                    }
+                    break;
+                case 0x65:
+                    for (unsigned int i = 0; i <= x; i++)
+                    {
+                        ir.setReg(i, ir.emit(IrOp::Load, ir.emit(IrOp::Offset, ir.emit(IrOp::GetIndex), 0, 0, i)));
+                    }
+                    if (!loadStoreQuirk)
+                    {
+                        ir.emit(IrOp::SetIndex, ir.emit(IrOp::AddIndex, ir.emit(IrOp::GetIndex), ir.constant(x + 1)));
+                    }
+                    break;
+            }
+            break;
+    }
+}
+
+/**
+ * Lifts a basic block into unoptimised IR
+ * @param memory Memory image the block was found in
+ * @param block Block from the control-flow graph
+ * @param loadStoreQuirk Interpreter quirk, baked into the IR
+ * @param shiftQuirk Interpreter quirk, baked into the IR
+ * @return The block's IR
+ */
+IrBlock liftBlock(const uint8_t *memory, const BasicBlock &block, bool loadStoreQuirk, bool shiftQuirk)
+{
+    IrBlock result;
+    result.start = block.start;
+    result.end = block.end;
+    result.length = (block.end - block.start) / 2;
+    result.exit = block.exit;
+    result.target = block.target;
+
+    IrBuilder ir(result);
+    bool hasTerminator = block.exit != BlockExit::Stop && block.exit != BlockExit::Fallthrough;
+    uint16_t bodyEnd = hasTerminator ? block.end - 2 : block.end;
+    for (uint16_t address = block.start; address < bodyEnd; address += 2)
+    {
+        liftInstruction(ir, (memory[address] << 8u) | memory[address + 1], loadStoreQuirk, shiftQuirk);
+    }
+    if (!hasTerminator)
+    {
+        return result;
+    }
+
+    uint16_t opcode = (memory[bodyEnd] << 8u) | memory[bodyEnd + 1];
+    unsigned int x = (opcode & 0x0F00u) >> 8u;
+    unsigned int y = (opcode & 0x00F0u) >> 4u;
+    switch (block.exit)
+    {
+        case BlockExit::Skip:
+            switch (opcode & 0xF000u)
+            {
+                case 0x3000:
+                    result.condition = ir.emit(IrOp::Equal, ir.getReg(x), ir.constant(opcode & 0x00FFu));
+                    break;
+                case 0x4000:
+                    result.condition = ir.emit(IrOp::NotEqual, ir.getReg(x), ir.constant(opcode & 0x00FFu));
+                    break;
+                case 0x5000:
+                    result.condition = ir.emit(IrOp::Equal, ir.getReg(x), ir.getReg(y));
+                    break;
+                case 0x9000:
+                    result.condition = ir.emit(IrOp::NotEqual, ir.getReg(x), ir.getReg(y));
+                    break;
+                default:
+                    result.condition = ir.emit(IrOp::Equal, ir.emit(IrOp::GetKey, ir.getReg(x)),
+                                               ir.constant((opcode & 0x00FFu) == 0x9E ? 1 : 0));
+                    break;
+            }
+            break;
+        case BlockExit::Computed:
+            result.computed = ir.emit(IrOp::Offset, ir.getReg(0), 0, 0, opcode & 0x0FFFu);
+            break;
+        case BlockExit::WaitKey:
+            result.waitRegister = x;
+            break;
+        default:
+            break;
+    }
+    return result;
+}
+
+/**
+ * Forwards register, I and delay timer values from where they were set to where they're read, folds
+ * operations on constants and merges identical computations
+ * @param block Block to optimise in place
+ */
+void propagateConstants(IrBlock &block)
+{
+    std::vector<IrInstr> &instrs = block.instrs;
+    std::vector<uint16_t> replace(instrs.size());
+    uint16_t currentReg[16];
+    uint16_t currentIndex = IrBlock::NO_VALUE;
+    uint16_t currentDelay = IrBlock::NO_VALUE;
+    std::fill(currentReg, currentReg + 16, IrBlock::NO_VALUE);
+    std::map<std::tuple<IrOp, uint16_t, uint16_t, uint32_t>, uint16_t> seen;
+
+    for (size_t i = 0; i < instrs.size(); i++)
+    {
+        IrInstr &instr = instrs[i];
+        replace[i] = i;
+        int operands = irOperandCount(instr.op);
+        if (operands > 0)
+        {
+            instr.a = replace[instr.a];
+        }
+        if (operands > 1)
+        {
+            instr.b = replace[instr.b];
+        }
+        if (operands > 2)
+        {
+            instr.c = replace[instr.c];
+        }
+
+        auto isConst = [&instrs](uint16_t value)
+        {
+            return instrs[value].op == IrOp::Const;
+        };
+        auto forward = [&](uint16_t &current)
+        {
+            if (current != IrBlock::NO_VALUE)
+            {
+                replace[i] = current;
+                instr.op = IrOp::Nop;
+            }
+            else
+            {
+                current = i;
+            }
+        };
+
+        switch (instr.op)
+        {
+            case IrOp::GetReg:
+                forward(currentReg[instr.reg]);
+                continue;
+            case IrOp::SetReg:
+                currentReg[instr.reg] = instr.a;
+                continue;
+            case IrOp::GetIndex:
+                forward(currentIndex);
+                continue;
+            case IrOp::SetIndex:
+                currentIndex = instr.a;
+                continue;
+            case IrOp::GetDelay:
+                forward(currentDelay);
+                continue;
+            case IrOp::SetDelay:
+                currentDelay = instr.a;
+                continue;
+            default:
+                break;
+        }
+
+        if (!isPure(instr.op) || instr.op == IrOp::Load || instr.op == IrOp::GetKey)
+        {
+            continue;
+        }
+
+        // Fold operations on constants, and a few identities
+        if (instr.op != IrOp::Const && (operands < 1 || isConst(instr.a)) && (operands < 2 || isConst(instr.b)))
+        {
+            instr.imm = evaluate(instr.op, instrs[instr.a].imm, instrs[instr.b].imm, instr.imm);
+            instr.op = IrOp::Const;
+        }
+        else if (operands == 2 && isConst(instr.b) && instrs[instr.b].imm == 0 &&
+                 (instr.op == IrOp::Add || instr.op == IrOp::Or || instr.op == IrOp::Xor ||
+                  instr.op == IrOp::AddIndex))
+        {
+            replace[i] = instr.a;
+            instr.op = IrOp::Nop;
+            continue;
+        }
+        else if (operands == 2 && instr.a == instr.b &&
+                 (instr.op == IrOp::Equal || instr.op == IrOp::NotEqual || instr.op == IrOp::Sub ||
+                  instr.op == IrOp::Xor || instr.op == IrOp::Greater))
+        {
+            instr.imm = instr.op == IrOp::Equal ? 1 : 0;
+            instr.op = IrOp::Const;
+        }
+        else if (instr.op == IrOp::Offset && instrs[instr.a].op == IrOp::Offset)
+        {
+            instr.imm += instrs[instr.a].imm;
+            instr.a = instrs[instr.a].a;
+        }
+
+        // Reuse an identical earlier value
+        bool constant = instr.op == IrOp::Const;
+        uint16_t a = operands > 0 && !constant ? instr.a : 0;
+        uint16_t b = operands > 1 && !constant ? instr.b : 0;
+        auto key = std::make_tuple(instr.op, a, b, constant || instr.op == IrOp::Offset ? instr.imm : 0);
+        auto existing = seen.find(key);
+        if (existing != seen.end())
+        {
+            replace[i] = existing->second;
+            instr.op = IrOp::Nop;
+        }
+        else
+        {
+            seen[key] = i;
+        }
+    }
+
+    if (block.condition != IrBlock::NO_VALUE)
+    {
+        block.condition = replace[block.condition];
+    }
+    if (block.computed != IrBlock::NO_VALUE)
+    {
+        block.computed = replace[block.computed];
+    }
+}
+
+/**
+ * Removes writes to registers, I and the timers that a later write in the block replaces. Run after
+ * propagateConstants(), which leaves no reads after writes.
+ * @param block Block to optimise in place
+ */
+void coalesceRegisterWrites(IrBlock &block)
+{
+    bool writtenReg[16]{};
+    bool writtenIndex = false;
+    bool writtenDelay = false;
+    bool writtenSound = false;
+
+    for (size_t i = block.instrs.size(); i-- > 0;)
+    {
+        IrInstr &instr = block.instrs[i];
+        bool *written = nullptr;
+        switch (instr.op)
+        {
+            case IrOp::SetReg:
+                written = &writtenReg[instr.reg];
+                break;
+            case IrOp::SetIndex:
+                written = &writtenIndex;
+                break;
+            case IrOp::SetDelay:
+                written = &writtenDelay;
+                break;
+            case IrOp::SetSound:
+                written = &writtenSound;
+                break;
+            default:
+                continue;
+        }
+        if (*written)
+        {
+            instr.op = IrOp::Nop;
+        }
+        *written = true;
+    }
+}
+
+/**
+ * Removes stores to a fixed address that a later store in the block overwrites before anything reads memory
+ * @param block Block to optimise in place
+ */
+void eliminateDeadStores(IrBlock &block)
+{
+    std::vector<uint32_t> overwritten;
+    for (size_t i = block.instrs.size(); i-- > 0;)
+    {
+        IrInstr &instr = block.instrs[i];
+        if (instr.op == IrOp::Load || instr.op == IrOp::Draw)
+        {
+            overwritten.clear();
+        }
+        else if (instr.op == IrOp::Store && block.instrs[instr.a].op == IrOp::Const)
+        {
+            // Stores wrap at the end of memory; those landing at or below START_ADDRESS are refused with a message and
+            // have to stay
+            uint32_t address = block.instrs[instr.a].imm & (CHIP8_AOT_MEMORY_SIZE - 1);
+            if (address <= START_ADDRESS)
+            {
+                continue;
+            }
+            if (std::find(overwritten.begin(), overwritten.end(), address) != overwritten.end())
+            {
+                instr.op = IrOp::Nop;
+            }
+            else
+            {
+                overwritten.push_back(address);
+            }
+        }
+    }
+}
+
+/**
+ * Drops removed and unused pure instructions and renumbers the rest
+ */
+static void removeDeadValues(IrBlock &block)
+{
+    std::vector<IrInstr> &instrs = block.instrs;
+    std::vector<bool> live(instrs.size(), false);
+    if (block.condition != IrBlock::NO_VALUE)
+    {
+        live[block.condition] = true;
+    }
+    if (block.computed != IrBlock::NO_VALUE)
+    {
+        live[block.computed] = true;
+    }
+
+    for (size_t i = instrs.size(); i-- > 0;)
+    {
+        if (instrs[i].op == IrOp::Nop || (isPure(instrs[i].op) && !live[i]))
+        {
+            continue;
+        }
+        live[i] = true;
+        int operands = irOperandCount(instrs[i].op);
+        if (operands > 0)
+        {
+            live[instrs[i].a] = true;
+        }
+        if (operands > 1)
+        {
+            live[instrs[i].b] = true;
+        }
+        if (operands > 2)
+        {
+            live[instrs[i].c] = true;
+        }
+    }
+
+    std::vector<uint16_t> renumber(instrs.size(), IrBlock::NO_VALUE);
+    std::vector<IrInstr> kept;
+    for (size_t i = 0; i < instrs.size(); i++)
+    {
+        if (!live[i] || instrs[i].op == IrOp::Nop)
+        {
+            continue;
+        }
+        IrInstr instr = instrs[i];
+        int operands = irOperandCount(instr.op);
+        instr.a = operands > 0 ? renumber[instr.a] : 0;
+        instr.b = operands > 1 ? renumber[instr.b] : 0;
+        instr.c = operands > 2 ? renumber[instr.c] : 0;
+        renumber[i] = kept.size();
+        kept.push_back(instr);
+    }
+
+    if (block.condition != IrBlock::NO_VALUE)
+    {
+        block.condition = renumber[block.condition];
+    }
+    if (block.computed != IrBlock::NO_VALUE)
+    {
+        block.computed = renumber[block.computed];
+    }
+    instrs = std::move(kept);
+}
+
+/**
+ * Runs every pass over a block
+ * @param block Block to optimise in place
+ */
+void optimizeBlock(IrBlock &block)
+{
+    propagateConstants(block);
+    coalesceRegisterWrites(block);
+    eliminateDeadStores(block);
+    removeDeadValues(block);
+}
+
+/**
+ * @return Readable listing of the block, one value per line
+ */
+std::string IrBlock::toString() const
+{
+    std::string text;
+    char line[96];
+    for (size_t i = 0; i < instrs.size(); i++)
+    {
+        const IrInstr &instr = instrs[i];
+        int length = snprintf(line, sizeof(line), "  v%zu = %s", i, OP_NAMES[(int) instr.op]);
+        if (instr.op == IrOp::GetReg || instr.op == IrOp::SetReg)
+        {
+            length += snprintf(line + length, sizeof(line) - length, " V%X", instr.reg);
+        }
+        int operands = irOperandCount(instr.op);
+        const uint16_t values[] = {instr.a, instr.b, instr.c};
+        for (int operand = 0; operand < operands; operand++)
+        {
+            length += snprintf(line + length, sizeof(line) - length, " v%u", values[operand]);
+        }
+        if (instr.op == IrOp::Const || instr.op == IrOp::Offset || instr.op == IrOp::Draw)
+        {
+            snprintf(line + length, sizeof(line) - length, " #%u", instr.imm);
+        }
+        text += line;
+        text += "\n";
+    }
+    return text;
+}
+
+/**
+ * Lifts every block of a ROM's control-flow graph
+ * @param rom ROM contents
+ * @param graph Control-flow graph of the ROM, e.g. from RomAnalysis
+ * @param loadStoreQuirk Interpreter quirk to compile for
+ * @param shiftQuirk Interpreter quirk to compile for
+ * @param optimize Run the optimisation passes (off to check the passes against plain lifting)
+ * @return Program ready to run
+ */
+std::shared_ptr<const IrProgram> IrProgram::build(const std::vector<uint8_t> &rom, const ControlFlowGraph &graph,
+                                                  bool loadStoreQuirk, bool shiftQuirk, bool optimize)
+{
+    auto program = std::make_shared<IrProgram>();
+    program->loadStoreQuirk = loadStoreQuirk;
+    program->shiftQuirk = shiftQuirk;
+    memcpy(&program->image[FONT_START_ADDRESS], fontset, FONT_SET_SIZE);
+    memcpy(&program->image[START_ADDRESS], rom.data(), std::min<size_t>(rom.size(), 4096 - START_ADDRESS));
+    program->blockAt.assign(4096, -1);
+
+    for (size_t address = 0; address < 4096; address++)
+    {
+        program->codeMap[address] = graph.isCode(address) ? 1 : 0;
+    }
+
+    for (const BasicBlock &block : graph.getBlocks())
+    {
+        IrBlock lifted = liftBlock(program->image, block, loadStoreQuirk, shiftQuirk);
+        if (optimize)
+        {
+            optimizeBlock(lifted);
+        }
+        if (lifted.instrs.size() <= MAX_VALUES)
+        {
+            program->blockAt[block.start] = program->blocks.size();
+            program->lower(lifted);
+            program->blocks.push_back(std::move(lifted));
+        }
+    }
+    return program;
+}
+
+/**
+ * @return Slot holding a constant, or NO_VALUE once the pool is full
+ */
+uint16_t IrProgram::constantSlot(uint32_t value)
+{
+    auto it = std::find(constants.begin(), constants.end(), value);
+    if (it != constants.end())
+    {
+        return SLOT_CONSTANTS + (it - constants.begin());
+    }
+    if (constants.size() == MAX_CONSTANTS)
+    {
+        return IrBlock::NO_VALUE;
+    }
+    constants.push_back(value);
+    return SLOT_CONSTANTS + constants.size() - 1;
+}
+
+/**
+ * Turns a block's IR into evaluator steps. A register write moves up into the step computing the value
+ * unless the register is read or written in between, and a register read becomes the register's own slot
+ * unless the register is written before the value's last use.
+ * @param block IR of the block, with at most MAX_VALUES instructions
+ */
+void IrProgram::lower(const IrBlock &block)
+{
+    const std::vector<IrInstr> &instrs = block.instrs;
+    size_t count = instrs.size();
+
+    // Where each value is last read, count meaning the block's exit
+    std::vector<size_t> lastUse(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        lastUse[i] = i;
+        const uint16_t operands[] = {instrs[i].a, instrs[i].b, instrs[i].c};
+        for (int operand = 0; operand < irOperandCount(instrs[i].op); operand++)
+        {
+            lastUse[operands[operand]] = i;
+        }
+    }
+    for (uint16_t result : {block.condition, block.computed})
+    {
+        if (result != IrBlock::NO_VALUE)
+        {
+            lastUse[result] = count;
+        }
+    }
+
+    auto touchesRegister = [&instrs](size_t from, size_t to, unsigned int reg, size_t except)
+    {
+        for (size_t k = from + 1; k < to; k++)
+        {
+            if (k != except && (instrs[k].op == IrOp::GetReg || instrs[k].op == IrOp::SetReg) && instrs[k].reg == reg)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<int> fusedRegister(count, -1);
+    std::vector<bool> fused(count, false);
+    std::vector<size_t> writeAt(count);
+    for (size_t p = 0; p < count; p++)
+    {
+        const IrInstr &instr = instrs[p];
+        writeAt[p] = p;
+        if (instr.op != IrOp::SetReg)
+        {
+            continue;
+        }
+        size_t q = instr.a;
+        IrOp producer = instrs[q].op;
+        bool hasValue = (isPure(producer) && producer != IrOp::Const && producer != IrOp::GetReg) ||
+                        producer == IrOp::Random || producer == IrOp::Draw;
+        if (hasValue && fusedRegister[q] < 0 && !touchesRegister(q, p, instr.reg, p) &&
+            !touchesRegister(p, std::max(p, lastUse[q]), instr.reg, p))
+        {
+            fusedRegister[q] = instr.reg;
+            fused[p] = true;
+            writeAt[p] = q;
+        }
+    }
+
+    // A register read can use the register's slot while nothing writes the register before its last use
+    auto writtenBetween = [&](size_t from, size_t to, unsigned int reg)
+    {
+        for (size_t k = 0; k < count; k++)
+        {
+            if (instrs[k].op == IrOp::SetReg && instrs[k].reg == reg && writeAt[k] > from && writeAt[k] < to)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    LoweredBlock result{block.start, block.end, block.length, block.exit, block.target, 0, 0, block.waitRegister,
+                        (uint32_t) steps.size(), 0};
+    std::vector<uint16_t> slot(count, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        const IrInstr &instr = instrs[i];
+        uint16_t temp = SLOT_TEMPS + i;
+        IrStep step{instr.op, temp, slot[instr.a], slot[instr.b], slot[instr.c], instr.imm};
+        switch (instr.op)
+        {
+            case IrOp::Nop:
+                continue;
+            case IrOp::Const:
+                slot[i] = constantSlot(instr.imm);
+                if (slot[i] != IrBlock::NO_VALUE)
+                {
+                    continue;
+                }
+                break;
+            case IrOp::GetReg:
+                if (!writtenBetween(i, lastUse[i], instr.reg))
+                {
+                    slot[i] = instr.reg;
+                    continue;
+                }
+                step = {IrOp::SetReg, temp, instr.reg, 0, 0, 0};
+                break;
+            case IrOp::SetReg:
+                if (fused[i])
+                {
+                    continue;
+                }
+                step.dest = instr.reg;
+                break;
+            default:
+                if (fusedRegister[i] >= 0)
+                {
+                    step.dest = fusedRegister[i];
+                }
+                break;
+        }
+        slot[i] = step.dest;
+        steps.push_back(step);
+    }
+
+    result.condition = block.condition != IrBlock::NO_VALUE ? slot[block.condition] : 0;
+    result.computed = block.computed != IrBlock::NO_VALUE ? slot[block.computed] : 0;
+    result.stepCount = steps.size() - result.firstStep;
+    lowered.push_back(result);
+}
+
+/**
+ * Runs blocks starting at the PC, with the same contract as a compiled module's run(): stops at an address
+ * with no block, at a block whose code was overwritten, or when the block doesn't fit in the budget
+ * @param s Machine state
+ * @param budget Instructions left in the frame
+ * @return Instructions executed
+ */
+int IrProgram::run(Chip8AotState *s, int budget) const
+{
+    // Registers live in slots while blocks run, like locals in generated code
+    uint32_t slots[SLOT_TEMPS + MAX_VALUES];
+    for (int i = 0; i < 16; i++)
+    {
+        slots[i] = s->registers[i];
+    }
+    std::copy(constants.begin(), constants.end(), slots + SLOT_CONSTANTS);
+    uint16_t I = *s->indexRegister;
+    uint16_t pc = *s->pc;
+    uint8_t *memory = s->memory;
+    int executed = 0;
+
+    while (pc < 4096 && blockAt[pc] >= 0)
+    {
+        const LoweredBlock &block = lowered[blockAt[pc]];
+        if (budget - executed < block.length ||
+            (s->codeModified && memcmp(memory + block.start, image + block.start, block.end - block.start) != 0))
+        {
+            break;
+        }
+        executed += block.length;
+
+        const IrStep *step = steps.data() + block.firstStep;
+        const IrStep *last = step + block.stepCount;
+        for (; step != last; ++step)
+        {
+            uint32_t a = slots[step->a];
+            uint32_t b = slots[step->b];
+            uint32_t &dest = slots[step->dest];
+            switch (step->op)
+            {
+                case IrOp::Const:
+                    dest = step->imm;
+                    break;
+                case IrOp::GetIndex:
+                    dest = I;
+                    break;
+                case IrOp::GetDelay:
+                    dest = *s->delayRegister;
+                    break;
+                case IrOp::GetKey:
+                    dest = s->keypad[a & 0x0Fu];
+                    break;
+                case IrOp::Load:
+                    dest = memory[a & (CHIP8_AOT_MEMORY_SIZE - 1)];
+                    break;
+                case IrOp::Add:
+                    dest = (a + b) & 0xFFu;
+                    break;
+                case IrOp::Carry:
+                    dest = a + b > 255 ? 1 : 0;
+                    break;
+                case IrOp::Sub:
+                    dest = (a - b) & 0xFFu;
+                    break;
+                case IrOp::Greater:
+                    dest = a > b ? 1 : 0;
+                    break;
+                case IrOp::Or:
+                    dest = a | b;
+                    break;
+                case IrOp::And:
+                    dest = a & b;
+                    break;
+                case IrOp::Xor:
+                    dest = a ^ b;
+                    break;
+                case IrOp::Shr:
+                    dest = a >> 1u;
+                    break;
+                case IrOp::Shl:
+                    dest = (a << 1u) & 0xFFu;
+                    break;
+                case IrOp::Lsb:
+                    dest = a & 0x1u;
+                    break;
+                case IrOp::Msb:
+                    dest = (a & 0x80u) >> 7u;
+                    break;
+                case IrOp::AddIndex:
+                    dest = (a + b) & 0xFFFFu;
+                    break;
+                case IrOp::Offset:
+                    dest = a + step->imm;
+                    break;
+                case IrOp::Font:
+                    dest = FONT_START_ADDRESS + 5 * a;
+                    break;
+                case IrOp::Mod10:
+                    dest = a % 10;
+                    break;
+                case IrOp::Div10:
+                    dest = a / 10;
+                    break;
+                case IrOp::Equal:
+                    dest = a == b ? 1 : 0;
+                    break;
+                case IrOp::NotEqual:
+                    dest = a != b ? 1 : 0;
+                    break;
+                case IrOp::SetReg:
+                    dest = a;
+                    break;
+                case IrOp::SetIndex:
+                    I = a;
+                    break;
+                case IrOp::SetDelay:
+                    *s->delayRegister = a;
+                    break;
+                case IrOp::SetSound:
+                    *s->soundRegister = a;
+                    break;
+                case IrOp::Store:
+                    a &= CHIP8_AOT_MEMORY_SIZE - 1;
+                    if ((int) a > (int) START_ADDRESS)
+                    {
+                        memory[a] = b;
+                        s->codeModified |= codeMap[a];
+                    }
+                    else
+                    {
+                        s->writeMemory(s->context, a, b);
+                    }
+                    break;
+                case IrOp::Random:
+                    dest = s->random(s->context);
+                    break;
+                case IrOp::Draw:
+                    dest = chip8_aot_draw(s, memory, slots[step->c], a, b, step->imm);
+                    *s->drawFlag = true;
+                    break;
+                case IrOp::Clear:
+                    chip8_aot_clear(s);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        switch (block.exit)
+        {
+            case BlockExit::Fallthrough:
+                pc = block.end;
+                break;
+            case BlockExit::Jump:
+                pc = block.target;
+                // A jump to itself spins for the rest of the frame
+                if (block.target == block.start && block.length == 1)
+                {
+                    executed = budget;
+                    goto out;
+                }
+                break;
+            case BlockExit::Call:
+                s->stack[*s->sp] = block.end;
+                ++*s->sp;
+                pc = block.target;
+                break;
+            case BlockExit::Return:
+                --*s->sp;
+                pc = s->stack[*s->sp];
+                break;
+            case BlockExit::Skip:
+                pc = slots[block.condition] ? block.end + 2 : block.end;
+                break;
+            case BlockExit::Computed:
+                pc = slots[block.computed];
+                break;
+            case BlockExit::WaitKey:
+            {
+                int key = 0;
+                while (key < 16 && !s->keypad[key])
+                {
+                    key++;
+                }
+                // Keys can't change mid-frame, so with none down it waits out the rest of the frame
+                if (key == 16)
+                {
+                    pc = block.end - 2;
+                    executed = budget;
+                    goto out;
+                }
+                slots[block.waitRegister] = key;
+                pc = block.end;
+            }
+                break;
+            case BlockExit::Stop:
+                pc = block.end;
+                goto out;
+        }
+    }
+
+out:
+    for (int i = 0; i < 16; i++)
+    {
+        s->registers[i] = slots[i];
+    }
+    *s->indexRegister = I;
+    *s->pc = pc;
+    return executed;
+}
+
+/**
+ * @return Blocks in address order
+ */
+const std::vector<IrBlock> &IrProgram::getBlocks() const
+{
+    return blocks;
+}
+
+/**
+ * @return 4096 entries, nonzero for bytes covered by lifted code
+ */
+const uint8_t *IrProgram::getCodeMap() const
+{
+    return codeMap;
+}
+
+/**
+ * @return True if the program was built for these quirks
+ */
+bool IrProgram::hasQuirks(bool _loadStoreQuirk, bool _shiftQuirk) const
+{
+    return loadStoreQuirk == _loadStoreQuirk && shiftQuirk == _shiftQuirk;
+}
@@ -0,0 +1,173 @@
+#ifndef CHIP8_EMU_BLOCKIR_H
+#define CHIP8_EMU_BLOCKIR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AotModule.h"
+#include "ControlFlow.h"
+
+/**
+ * Operations of the block IR. Every instruction is an SSA value: instruction i defines value i, and
+ * operands refer to earlier values by index. Machine state is only touched through the Get/Set
+ * operations, memory through Load/Store.
+ */
+enum class IrOp : uint8_t
+{
+    // Pure values
+    Const,      // imm
+    GetReg,     // V[reg] at this point in the block
+    GetIndex,   // I
+    GetDelay,   // Delay timer
+    GetKey,     // keypad[a & 0xF]
+    Load,       // memory[a], wrapping like the interpreter, ordered with stores
+    Add,        // (a + b) & 0xFF
+    Carry,      // a + b > 255
+    Sub,        // (a - b) & 0xFF
+    Greater,    // a > b
+    Or,
+    And,
+    Xor,
+    Shr,        // a >> 1
+    Shl,        // (a << 1) & 0xFF
+    Lsb,        // a & 1
+    Msb,        // a >> 7
+    AddIndex,   // (a + b) & 0xFFFF
+    Offset,     // a + imm, unwrapped like the interpreter's memory indexing
+    Font,       // FONT_START_ADDRESS + 5 * a
+    Mod10,
+    Div10,
+    Equal,
+    NotEqual,
+
+    // Effects, kept in order
+    SetReg,     // V[reg] = a
+    SetIndex,   // I = a
+    SetDelay,
+    SetSound,
+    Store,      // memory[a] = b, with the interpreter's writeToMemory() rules
+    Random,     // Next byte from the interpreter's RNG
+    Draw,       // Sprite of imm rows from memory[c] at (a, b), value is the collision flag
+    Clear,
+    Nop         // Removed by a pass
+};
+
+struct IrInstr
+{
+    IrOp op;
+    uint8_t reg;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    uint32_t imm;
+};
+
+/**
+ * One basic block lifted into IR. Control flow stays in the block description; the IR computes
+ * everything else, including the skip condition and computed jump target.
+ */
+struct IrBlock
+{
+    static constexpr uint16_t NO_VALUE = 0xFFFF;
+
+    uint16_t start;
+    uint16_t end;
+    uint16_t length;            // Chip-8 instructions in the block
+    BlockExit exit;
+    uint16_t target;            // Jump and Call
+    uint16_t condition = NO_VALUE;  // Skip: nonzero to skip the next instruction
+    uint16_t computed = NO_VALUE;   // Computed: jump target
+    uint8_t waitRegister = 0;   // WaitKey: register that receives the key
+    std::vector<IrInstr> instrs;
+
+    std::string toString() const;
+};
+
+int irOperandCount(IrOp op);
+
+IrBlock liftBlock(const uint8_t *memory, const BasicBlock &block, bool loadStoreQuirk, bool shiftQuirk);
+
+void propagateConstants(IrBlock &block);
+
+void coalesceRegisterWrites(IrBlock &block);
+
+void eliminateDeadStores(IrBlock &block);
+
+void optimizeBlock(IrBlock &block);
+
+/**
+ * One step of a block lowered for the evaluator. Operands and results are slots: V registers, a constant
+ * pool and temporaries share one array, so constants and register reads cost nothing and a register
+ * write is folded into the step computing its value. SetReg copies slot a to dest.
+ */
+struct IrStep
+{
+    IrOp op;
+    uint16_t dest;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    uint32_t imm;
+};
+
+/**
+ * A whole ROM lifted into optimised IR, run by a small evaluator in place of the interpreter. Read-only
+ * once built, so one program can be shared by any number of instances and threads.
+ */
+class IrProgram
+{
+public:
+    // Blocks whose IR has more values than this are left to the interpreter
+    static const size_t MAX_VALUES = 1024;
+
+    // Slot layout seen by IrStep operands
+    static const uint16_t SLOT_CONSTANTS = 16;
+    static const uint16_t MAX_CONSTANTS = 256;
+    static const uint16_t SLOT_TEMPS = SLOT_CONSTANTS + MAX_CONSTANTS;
+
+    static std::shared_ptr<const IrProgram> build(const std::vector<uint8_t> &rom, const ControlFlowGraph &graph,
+                                                  bool loadStoreQuirk, bool shiftQuirk, bool optimize = true);
+
+    int run(Chip8AotState *state, int budget) const;
+
+    const std::vector<IrBlock> &getBlocks() const;
+
+    const uint8_t *getCodeMap() const;
+
+    bool hasQuirks(bool loadStoreQuirk, bool shiftQuirk) const;
+
+private:
+    /**
+     * Block as run by the evaluator, its steps a range of the shared step list
+     */
+    struct LoweredBlock
+    {
+        uint16_t start;
+        uint16_t end;
+        uint16_t length;
+        BlockExit exit;
+        uint16_t target;
+        uint16_t condition;
+        uint16_t computed;
+        uint8_t waitRegister;
+        uint32_t firstStep;
+        uint32_t stepCount;
+    };
+
+    std::vector<IrBlock> blocks;
+    std::vector<LoweredBlock> lowered;
+    std::vector<IrStep> steps;
+    std::vector<uint32_t> constants;
+    std::vector<int16_t> blockAt;   // Index of the block starting at each address, or -1
+    uint8_t image[4096]{};          // Memory as analysed, to detect modified code
+    uint8_t codeMap[4096]{};
+    bool loadStoreQuirk = false;
+    bool shiftQuirk = false;
+
+    void lower(const IrBlock &block);
+
+    uint16_t constantSlot(uint32_t value);
+};
+
+#endif //CHIP8_EMU_BLOCKIR_H
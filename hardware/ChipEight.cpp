@@ -1,17 +1,46 @@
 #include "ChipEight.h"
-#include <fstream>
+#include "Debugger.h"
+#include "BlockIR.h"
+#include "CompiledCode.h"
+#include "AudioRenderer.h"
+#include "InstructionTrace.h"
+#include "../rom/RomLibrary.h"
+#include "../rom/RomAnalysis.h"
+#include "../frontend/SoftwarePresenter.h"
+#include "../frontend/LatencyProbe.h"
+#include "../frontend/Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <chrono>
 #include <thread>
 
 /**
  * Initialise Chip-8
+ * @param _headless Don't touch SDL at all (no window, audio or input), for batch runs and capture
  */
-ChipEight::ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick) :
+ChipEight::ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick, bool _headless) :
         randGen(std::chrono::system_clock::now().time_since_epoch().count()),
         loadStoreQuirk(_loadStoreQuirk),
         shiftQuirk(_shiftQuirk),
+        headless(_headless),
         cyclesPerTick(_cyclesPerTick)
+{
+    reset();
+    memcpy(keyMap, DEFAULT_KEY_MAP, sizeof(keyMap));
+
+    // Initialize RNG
+    randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
+
+    // SDL video starts with the window (setupScreen) and audio with the first beep (updateSound), so runs
+    // that never need them don't pay for them
+}
+
+/**
+ * Puts the Chip-8 back into its power-on state and reloads the last loaded ROM
+ */
+void ChipEight::reset()
 {
     // Set all vars to initial values
     opcode = -1;
@@ -23,21 +52,96 @@ ChipEight::ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick)
     soundRegister = 0;
     memset(keypad, 0, sizeof(keypad));
     memset(stack, 0, sizeof(stack));
-    memset(memory, 0, sizeof(memory));
+    memset(memory, 0, memorySize);
+    markAllPagesDirty();
+    memset(planes, 0, sizeof(planes));
+    memset(video, 0, sizeof(video));
+    dirtyRows = 0;
+    hires = false;
+    planeMask = 1;
+    memset(flagRegisters, 0, sizeof(flagRegisters));
+    memset(audioPattern, 0, sizeof(audioPattern));
+    pitch = 64;
     shouldRun = true;
     drawFlag = false;
+    waitingForVblank = false;
+    compiledState.codeModified = 0;
 
     // Load font set into memory 0x00 - 0x50 (0 to 80)
     for (int i = 0; i < FONT_SET_SIZE; i++)
     {
         memory[FONT_START_ADDRESS + i] = fontset[i];
     }
+    if (variant != ChipVariant::Chip8)
+    {
+        memcpy(&memory[BIG_FONT_START_ADDRESS], bigFontset, sizeof(bigFontset));
+    }
 
-    // Initialize RNG
-    randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
+    // Load the ROM contents into the Chip8's memory, starting at 0x200
+    if (!rom.empty())
+    {
+        memcpy(&memory[START_ADDRESS], rom.data(), rom.size());
+    }
+}
 
-    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
-    beeper.init();
+/**
+ * Switches the instruction set, memory size and display modes, and goes back to the power-on state.
+ * Compiled code, IR and analysis only support CHIP-8 and are dropped for the other variants.
+ * @param _variant Instruction set to run
+ */
+void ChipEight::setVariant(ChipVariant _variant)
+{
+    variant = _variant;
+    memorySize = variant == ChipVariant::XoChip ? MEMORY_SIZE : CLASSIC_MEMORY_SIZE;
+    if (variant != ChipVariant::Chip8)
+    {
+        compiled.reset();
+        compiledModule = nullptr;
+        setIrProgram(nullptr);
+        setAnalysis(nullptr);
+    }
+    if (rom.size() > memorySize - START_ADDRESS)
+    {
+        rom.clear();
+    }
+    reset();
+}
+
+ChipVariant ChipEight::getVariant() const
+{
+    return variant;
+}
+
+/**
+ * @return Width of the display in its current mode, also the length of a row of video
+ */
+unsigned int ChipEight::getVideoWidth() const
+{
+    return hires ? VIDEO_MAX_WIDTH : VIDEO_WIDTH;
+}
+
+/**
+ * @return Height of the display in its current mode
+ */
+unsigned int ChipEight::getVideoHeight() const
+{
+    return hires ? VIDEO_MAX_HEIGHT : VIDEO_HEIGHT;
+}
+
+/**
+ * Turns the COSMAC VIP display wait on or off. While on, the frame ends after any sprite draw, as the VIP's
+ * DXYN waited for the vertical blank before drawing, so each frame is presented with at most one draw in it.
+ * Compiled code and IR draw mid-block, so they are bypassed while it is on.
+ * @param _displayWait True to wait for vblank after draws
+ */
+void ChipEight::setDisplayWait(bool _displayWait)
+{
+    displayWait = _displayWait;
+}
+
+bool ChipEight::getDisplayWait() const
+{
+    return displayWait;
 }
 
 /**
@@ -46,27 +150,235 @@ ChipEight::ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick)
  */
 void ChipEight::LoadROM(const char *path)
 {
-    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::vector<uint8_t> data;
+    if (readROM(path, data))
+    {
+        LoadROM(data.data(), data.size());
+    }
+}
+
+/**
+ * Loads Chip-8 ROM from a buffer into memory. The ROM is kept so reset() can reload it.
+ * @param data ROM contents
+ * @param size Size of the ROM in bytes
+ * @return False if the ROM doesn't fit between START_ADDRESS and the end of memory
+ */
+bool ChipEight::LoadROM(const uint8_t *data, size_t size)
+{
+    if (size > memorySize - START_ADDRESS)
+    {
+        std::cout << "ROM TOO LARGE: " << size << " bytes" << std::endl;
+        return false;
+    }
+
+    // Compiled code and analysis belong to the previous ROM
+    compiled.reset();
+    compiledModule = nullptr;
+    setIrProgram(nullptr);
+    setAnalysis(nullptr);
+
+    rom.assign(data, data + size);
+    memcpy(&memory[START_ADDRESS], rom.data(), rom.size());
+    markAllPagesDirty();
+    return true;
+}
+
+/**
+ * Swaps in a new build of the running ROM. Analysis, IR and compiled code are dropped as with LoadROM() and
+ * have to be set up again for the new ROM.
+ * @param data New ROM contents
+ * @param size Size of the new ROM in bytes
+ * @param keepState Keep registers, timers, stack, display and memory, only writing the bytes that differ
+ *                  between the old and new ROM, instead of starting from the power-on state
+ * @return False if the new ROM doesn't fit, in which case the old one keeps running
+ */
+bool ChipEight::reloadROM(const uint8_t *data, size_t size, bool keepState)
+{
+    std::vector<uint8_t> previous = rom;
+    std::vector<uint8_t> running(memory, memory + memorySize);
+    if (!LoadROM(data, size))
+    {
+        return false;
+    }
+    if (!keepState)
+    {
+        reset();
+        return true;
+    }
+
+    // Data the program has written since it started survives unless the edit touched those bytes
+    memcpy(memory, running.data(), running.size());
+    for (size_t i = 0; i < std::max(previous.size(), rom.size()); i++)
+    {
+        uint8_t before = i < previous.size() ? previous[i] : 0;
+        uint8_t after = i < rom.size() ? rom[i] : 0;
+        if (before != after)
+        {
+            memory[START_ADDRESS + i] = after;
+        }
+    }
+    return true;
+}
+
+/**
+ * Attaches the analysis of the current ROM (from RomAnalysis::get()), which lets the interpreter skip the
+ * rest of a frame spent spinning in an idle loop. Must be called after LoadROM().
+ * @param _analysis Analysis of the loaded ROM, or nullptr to run without
+ */
+void ChipEight::setAnalysis(std::shared_ptr<const RomAnalysis> _analysis)
+{
+    // The analysis covers 4 KB of CHIP-8 code, other variants always interpret
+    analysis = variant == ChipVariant::Chip8 ? std::move(_analysis) : nullptr;
+    idleLoopHeads.reset();
+    if (analysis)
+    {
+        for (const LoopInfo &loop : analysis->getLoops())
+        {
+            if (loop.flags & LoopInfo::FLAG_IDLE)
+            {
+                idleLoopHeads[loop.head] = true;
+            }
+        }
+    }
+}
+
+/**
+ * Loads a module generated by chip8_aot for the current ROM, which then runs in place of the interpreter
+ * wherever it has compiled code. Must be called after LoadROM().
+ * @param path Path to the module's shared library
+ * @return False if it couldn't be loaded, or was compiled from a different ROM or with different quirks
+ */
+bool ChipEight::loadCompiled(const char *path)
+{
+    if (variant != ChipVariant::Chip8)
+    {
+        std::cout << "Compiled ROMs only support CHIP-8" << std::endl;
+        return false;
+    }
+
+    auto code = std::make_unique<CompiledCode>();
+    if (!code->load(path))
+    {
+        return false;
+    }
+
+    const Chip8AotModule *module = code->getModule();
+    if (module->romSize != rom.size() || module->romHash != hashROM(rom.data(), rom.size()))
+    {
+        std::cout << "Compiled ROM doesn't match the loaded ROM: " << path << std::endl;
+        return false;
+    }
+    if ((module->loadStoreQuirk != 0) != loadStoreQuirk || (module->shiftQuirk != 0) != shiftQuirk)
+    {
+        std::cout << "Compiled ROM was built with different quirks: " << path << std::endl;
+        return false;
+    }
+
+    irProgram.reset();
+    bindCompiledState(module->codeMap);
+    compiled = std::move(code);
+    compiledModule = module;
+    return true;
+}
+
+/**
+ * Runs the current ROM from IR built by IrProgram::build() wherever it has a block, in place of the
+ * interpreter. Must be called after LoadROM().
+ * @param program Program built from the loaded ROM, or nullptr to interpret again
+ * @return False if the program was built with different quirks
+ */
+bool ChipEight::setIrProgram(std::shared_ptr<const IrProgram> program)
+{
+    if (program && variant != ChipVariant::Chip8)
+    {
+        std::cout << "IR only supports CHIP-8" << std::endl;
+        return false;
+    }
+    if (program && !program->hasQuirks(loadStoreQuirk, shiftQuirk))
+    {
+        std::cout << "IR was built with different quirks" << std::endl;
+        return false;
+    }
 
-    if (file.is_open())
+    irProgram = std::move(program);
+    compiledCodeMap = nullptr;
+    if (irProgram)
     {
-        // Get size of file and allocate a buffer to hold the contents
-        std::streampos size = file.tellg();
-        char *buffer = new char[size];
+        compiled.reset();
+        compiledModule = nullptr;
+        bindCompiledState(irProgram->getCodeMap());
+    }
+    return true;
+}
 
-        // Go back to the beginning of the file and fill the buffer
-        file.seekg(0, std::ios::beg);
-        file.read(buffer, size);
-        file.close();
+/**
+ * Points the state shared with compiled code at this instance
+ * @param codeMap Bytes the compiled code was built from, which it has to recheck once modified
+ */
+void ChipEight::bindCompiledState(const uint8_t *codeMap)
+{
+    compiledState.registers = registers;
+    compiledState.memory = memory;
+    compiledState.stack = stack;
+    compiledState.display = planes[0];
+    compiledState.dirtyRows = &dirtyRows;
+    compiledState.keypad = keypad;
+    compiledState.pc = &pc;
+    compiledState.indexRegister = &indexRegister;
+    compiledState.sp = &sp;
+    compiledState.delayRegister = &delayRegister;
+    compiledState.soundRegister = &soundRegister;
+    compiledState.drawFlag = &drawFlag;
+    compiledState.context = this;
+    compiledState.random = [](void *context)
+    {
+        auto *chip = (ChipEight *) context;
+        return chip->randByte(chip->randGen);
+    };
+    compiledState.writeMemory = [](void *context, int index, uint8_t value)
+    {
+        ((ChipEight *) context)->writeToMemory(index, value);
+    };
 
-        // Load the ROM contents into the Chip8's memory, starting at 0x200
-        for (auto i = 0; i < size; ++i)
+    // Code may already have been modified by the interpreter
+    compiledState.codeModified = 0;
+    for (size_t i = START_ADDRESS; i < CLASSIC_MEMORY_SIZE; i++)
+    {
+        if (codeMap[i] && memory[i] != (i - START_ADDRESS < rom.size() ? rom[i - START_ADDRESS] : 0))
         {
-            memory[START_ADDRESS + i] = buffer[i];
+            compiledState.codeModified = 1;
         }
+    }
+    compiledCodeMap = codeMap;
+}
+
+/**
+ * Seeds the random number generator used by CXKK, for reproducible runs
+ * @param seed Seed value. The generator holds less than 32 bits of state, so higher bits are mixed into the low
+ * ones rather than dropped; seeds below 2^32 give the same sequences as seeding the generator directly.
+ */
+void ChipEight::seed(uint64_t seed)
+{
+    uint64_t mixed = seed;
+    if (seed >> 32u != 0)
+    {
+        // splitmix64 finaliser, so seeds differing only in their high bits still get unrelated sequences
+        mixed = (mixed ^ (mixed >> 30u)) * 0xBF58476D1CE4E5B9ull;
+        mixed = (mixed ^ (mixed >> 27u)) * 0x94D049BB133111EBull;
+        mixed ^= mixed >> 31u;
+    }
+    randGen.seed((uint32_t) mixed);
+}
 
-        // Free the buffer
-        delete[] buffer;
+/**
+ * Sets the whole keypad at once
+ * @param mask Bit n set if key n is down
+ */
+void ChipEight::setKeypad(uint16_t mask)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        keypad[i] = (mask >> i) & 1u;
     }
 }
 
@@ -75,6 +387,8 @@ void ChipEight::LoadROM(const char *path)
  */
 void ChipEight::decrementTimers()
 {
+    TRACE_ZONE("decrementTimers");
+
     if (delayRegister > 0)
     {
         --delayRegister;
@@ -85,6 +399,26 @@ void ChipEight::decrementTimers()
         --soundRegister;
     }
 
+    if (!speculative)
+    {
+        updateSound();
+        if (audioRenderer != nullptr)
+        {
+            audioRenderer->renderFrame(soundRegister > 0);
+        }
+    }
+}
+
+/**
+ * Starts or stops the beeper to match the sound timer
+ */
+void ChipEight::updateSound()
+{
+    if (headless)
+    {
+        return;
+    }
+
     if (soundRegister > 0)
     {
         beeper.play();
@@ -96,261 +430,676 @@ void ChipEight::decrementTimers()
 }
 
 /**
- * Should be called each cycle to execute opcode and update delay & sound registers
+ * Copies the machine state out, e.g. before running frames that will be thrown away
+ * @param state Where to save it
  */
-int static count = 0;
+void ChipEight::saveState(ChipEightState &state) const
+{
+    state.randGen = randGen;
+    state.opcode = opcode;
+    memcpy(state.registers, registers, sizeof(registers));
+    state.indexRegister = indexRegister;
+    state.pc = pc;
+    state.sp = sp;
+    state.delayRegister = delayRegister;
+    state.soundRegister = soundRegister;
+    memcpy(state.keypad, keypad, sizeof(keypad));
+    memcpy(state.stack, stack, sizeof(stack));
+    memcpy(state.memory, memory, memorySize);
+    memcpy(state.planes, planes, sizeof(planes));
+    state.hires = hires;
+    state.planeMask = planeMask;
+    memcpy(state.flagRegisters, flagRegisters, sizeof(flagRegisters));
+    memcpy(state.audioPattern, audioPattern, sizeof(audioPattern));
+    state.pitch = pitch;
+    state.drawFlag = drawFlag;
+    state.codeModified = compiledState.codeModified;
+}
 
-void ChipEight::executeCycle()
+/**
+ * Puts back a state saved by this instance or one of its clones
+ * @param state State to restore
+ */
+void ChipEight::loadState(const ChipEightState &state)
 {
-    for (int i = 0; i < cyclesPerTick; i++)
+    randGen = state.randGen;
+    opcode = state.opcode;
+    memcpy(registers, state.registers, sizeof(registers));
+    indexRegister = state.indexRegister;
+    pc = state.pc;
+    sp = state.sp;
+    delayRegister = state.delayRegister;
+    soundRegister = state.soundRegister;
+    memcpy(keypad, state.keypad, sizeof(keypad));
+    memcpy(stack, state.stack, sizeof(stack));
+    memcpy(memory, state.memory, memorySize);
+    markAllPagesDirty();
+    memcpy(planes, state.planes, sizeof(planes));
+    hires = state.hires;
+    planeMask = state.planeMask;
+    memcpy(flagRegisters, state.flagRegisters, sizeof(flagRegisters));
+    memcpy(audioPattern, state.audioPattern, sizeof(audioPattern));
+    pitch = state.pitch;
+    drawFlag = state.drawFlag;
+    compiledState.codeModified = state.codeModified;
+    dirtyRows = ~0ull;
+    syncVideo();
+
+    if (!speculative)
     {
-        // Opcode is 2 bytes long, so merge two successive bytes
-        // Extend first byte to 16 bits (by shifting left 8 which pads 8 zeroes effectively), then
-        // OR with next byte to replace padded zeroes with the second byte's value
-        opcode = (memory[pc] << 8u) | memory[pc + 1];
-
-        // Pre-emptively add 2 to PC, to move to next opcode (executed opcode may overwrite this)
-        pc += 2;
-
-        executeOpCode();
+        updateSound();
     }
+}
 
-    decrementTimers();
+/**
+ * While set, frames are being run ahead to be thrown away, so they mustn't start or stop the beeper
+ * @param _speculative True before running ahead, false once the real state is back
+ */
+void ChipEight::setSpeculative(bool _speculative)
+{
+    speculative = _speculative;
 }
 
 /**
- * Handle input using SDL, and update Chip-8's keypad when keys are pressed/released
+ * Creates a headless instance running the same ROM with the same settings, which can take states saved
+ * by this one. It shares the analysis and IR but not a compiled module, so it interprets where this
+ * instance would run compiled code, with the same results. Must not outlive this instance.
+ * @return The new instance, in the power-on state
  */
-void ChipEight::processInputs()
+std::unique_ptr<ChipEight> ChipEight::cloneHeadless() const
 {
-    bool quit = false;
+    auto clone = std::make_unique<ChipEight>(loadStoreQuirk, shiftQuirk, cyclesPerTick, true);
+    setUpClone(*clone);
+    return clone;
+}
 
-    SDL_Event event;
+/**
+ * Creates a headless instance as cloneHeadless() does, in storage the caller owns (and has to destroy it in)
+ * @param storage At least sizeof(ChipEight) bytes, suitably aligned
+ * @return The new instance, in the power-on state
+ */
+ChipEight *ChipEight::cloneHeadless(void *storage) const
+{
+    auto *clone = new(storage) ChipEight(loadStoreQuirk, shiftQuirk, cyclesPerTick, true);
+    setUpClone(*clone);
+    return clone;
+}
 
-    while (SDL_PollEvent(&event))
+/**
+ * @param clone New instance to give this one's ROM and settings
+ */
+void ChipEight::setUpClone(ChipEight &clone) const
+{
+    clone.setVariant(variant);
+    clone.setDisplayWait(displayWait);
+    clone.LoadROM(rom.data(), rom.size());
+    clone.setAnalysis(analysis);
+    clone.setIrProgram(irProgram);
+
+    // Code writes are tracked against the module's map so states stay interchangeable with this instance
+    if (compiledModule != nullptr)
     {
-        switch (event.type)
-        {
-            case SDL_QUIT:
-            {
-                quit = true;
-            }
-                break;
+        clone.compiledCodeMap = compiledCodeMap;
+    }
+}
 
-            case SDL_KEYDOWN:
+/**
+ * Goes back to the state of another instance with the same ROM and settings, typically a power-on image that
+ * is never run (see InstancePool). Unlike loadState() this copies straight from the image, including its video,
+ * and only copies the memory pages stored to since the last resetFrom().
+ * @param image Instance to copy, created by cloneHeadless() of the same instance as this one or by this one's
+ * own cloneHeadless()
+ */
+void ChipEight::resetFrom(const ChipEight &image)
+{
+    randGen = image.randGen;
+    opcode = image.opcode;
+    memcpy(registers, image.registers, sizeof(registers));
+    indexRegister = image.indexRegister;
+    pc = image.pc;
+    sp = image.sp;
+    delayRegister = image.delayRegister;
+    soundRegister = image.soundRegister;
+    memcpy(keypad, image.keypad, sizeof(keypad));
+    memcpy(stack, image.stack, sizeof(stack));
+
+    // Compiled code and IR store straight into (CHIP-8's 4 KB of) memory, as can holders of getMemory()
+    if (memoryExposed || compiledModule != nullptr || irProgram)
+    {
+        memcpy(memory, image.memory, memorySize);
+    }
+    else
+    {
+        for (unsigned int word = 0; word < sizeof(dirtyPages) / sizeof(dirtyPages[0]); word++)
+        {
+            for (uint64_t pages = dirtyPages[word]; pages != 0; pages &= pages - 1)
             {
-                switch (event.key.keysym.sym)
+                unsigned int address = (word * 64 + __builtin_ctzll(pages)) * MEMORY_PAGE_SIZE;
+                if (address < memorySize)
                 {
-                    case SDLK_ESCAPE:
-                    {
-                        quit = true;
-                    }
-                        break;
+                    memcpy(&memory[address], &image.memory[address], MEMORY_PAGE_SIZE);
+                }
+            }
+        }
+    }
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+
+    memcpy(planes, image.planes, sizeof(planes));
+    hires = image.hires;
+    planeMask = image.planeMask;
+    memcpy(flagRegisters, image.flagRegisters, sizeof(flagRegisters));
+    memcpy(audioPattern, image.audioPattern, sizeof(audioPattern));
+    pitch = image.pitch;
+    memcpy(video, image.video, image.getVideoWidth() * image.getVideoHeight() * sizeof(video[0]));
+    dirtyRows = image.dirtyRows;
+    shouldRun = image.shouldRun;
+    drawFlag = image.drawFlag;
+    waitingForVblank = false;
+    compiledState.codeModified = image.compiledState.codeModified;
+
+    if (!speculative)
+    {
+        updateSound();
+    }
+}
 
-                    case SDLK_x:
-                    {
-                        keypad[0] = 1;
-                    }
-                        break;
+/**
+ * Marks all of memory as changed, after something rewrote it wholesale
+ */
+void ChipEight::markAllPagesDirty()
+{
+    memset(dirtyPages, 0xFF, sizeof(dirtyPages));
+}
 
-                    case SDLK_1:
-                    {
-                        keypad[1] = 1;
-                    }
-                        break;
+/**
+ * @return Bit n set if key n is down
+ */
+uint16_t ChipEight::getKeypadMask() const
+{
+    uint16_t mask = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        if (keypad[i])
+        {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
 
-                    case SDLK_2:
-                    {
-                        keypad[2] = 1;
-                    }
-                        break;
+/**
+ * Fetches the opcode at the PC and executes it
+ */
+inline void ChipEight::executeInstruction()
+{
+    // Opcode is 2 bytes long, so merge two successive bytes
+    // Extend first byte to 16 bits (by shifting left 8 which pads 8 zeroes effectively), then
+    // OR with next byte to replace padded zeroes with the second byte's value
+    opcode = (memory[pc] << 8u) | memory[(pc + 1) & 0xFFFFu];
 
-                    case SDLK_3:
-                    {
-                        keypad[3] = 1;
-                    }
-                        break;
+    // Pre-emptively add 2 to PC, to move to next opcode (executed opcode may overwrite this)
+    pc += 2;
 
-                    case SDLK_q:
-                    {
-                        keypad[4] = 1;
-                    }
-                        break;
+    executeOpCode();
+}
 
-                    case SDLK_w:
-                    {
-                        keypad[5] = 1;
-                    }
-                        break;
+/**
+ * Should be called each cycle to execute opcode and update delay & sound registers
+ */
+void ChipEight::executeCycle()
+{
+    if (headless || speculative || !subFrameInput)
+    {
+        runInstructions(cyclesPerTick, true);
+    }
+    else
+    {
+        // Keys that changed since the last frame go in at the instructions matching when they changed
+        keyQueue.takeFrame(std::chrono::steady_clock::now(), cyclesPerTick, frameKeys);
+        int executed = 0;
+        for (const KeyChange &change : frameKeys)
+        {
+            runInstructions(change.instruction - executed, executed == 0);
+            executed = std::max(executed, change.instruction);
+            applyKeyChange(change);
+        }
+        runInstructions(cyclesPerTick - executed, executed == 0);
+    }
 
-                    case SDLK_e:
-                    {
-                        keypad[6] = 1;
-                    }
-                        break;
+    // The vblank a draw was waiting for is the end of this frame
+    waitingForVblank = false;
+    decrementTimers();
+    syncVideo();
+}
 
-                    case SDLK_a:
-                    {
-                        keypad[7] = 1;
-                    }
-                        break;
+/**
+ * Runs part of a frame on whichever engine is attached
+ * @param budget Instructions to run
+ * @param frameStart True if they start the frame
+ */
+void ChipEight::runInstructions(int budget, bool frameStart)
+{
+    if (budget <= 0 || waitingForVblank)
+    {
+        return;
+    }
 
-                    case SDLK_s:
-                    {
-                        keypad[8] = 1;
-                    }
-                        break;
+    // Only pay for breakpoint checks while the debugger has something armed
+    if (debugger != nullptr && debugger->isActive())
+    {
+        executeCycleDebug(budget);
+    }
+    else if (instructionTrace != nullptr && !speculative)
+    {
+        // Traces need every instruction, so neither compiled code nor idle loop skipping
+        executeCycleTraced(budget, frameStart);
+    }
+    else if ((compiledModule != nullptr || irProgram) && latencyProbe == nullptr && !displayWait)
+    {
+        // Compiled code reads keys and draws without going through the instruction handlers
+        executeCycleCompiled(budget);
+    }
+    else if (analysis)
+    {
+        executeCycleAnalysed(budget);
+    }
+    else
+    {
+        for (int i = 0; i < budget && !waitingForVblank; i++)
+        {
+            executeInstruction();
+        }
+    }
+}
 
-                    case SDLK_d:
-                    {
-                        keypad[9] = 1;
-                    }
-                        break;
+/**
+ * Executes a single instruction without touching the timers, for tools that drive the Chip-8 one
+ * instruction at a time
+ */
+void ChipEight::stepInstruction()
+{
+    executeInstruction();
+    syncVideo();
+}
 
-                    case SDLK_z:
-                    {
-                        keypad[0xA] = 1;
-                    }
-                        break;
+/**
+ * Runs compiled code or IR as far as it goes, interpreting single instructions wherever it can't (computed
+ * jumps into unknown code, modified code, or the end of the frame falling mid-block)
+ */
+void ChipEight::executeCycleCompiled(int budget)
+{
+    int executed = 0;
+    while (executed < budget)
+    {
+        int left = budget - executed;
+        executed += compiledModule != nullptr ? compiledModule->run(&compiledState, left)
+                                              : irProgram->run(&compiledState, left);
+        if (executed < budget)
+        {
+            executeInstruction();
+            ++executed;
+        }
+    }
+}
 
-                    case SDLK_c:
-                    {
-                        keypad[0xB] = 1;
-                    }
-                        break;
+/**
+ * Instruction loop which fast-forwards through idle loops found by the ROM analysis
+ */
+void ChipEight::executeCycleAnalysed(int budget)
+{
+    int executed = 0;
+    while (executed < budget && !waitingForVblank)
+    {
+        if (idleLoopHeads[pc])
+        {
+            executed += skipIdleLoop(budget - executed);
+        }
+        else
+        {
+            executeInstruction();
+            ++executed;
+        }
+    }
+}
 
-                    case SDLK_4:
-                    {
-                        keypad[0xC] = 1;
-                    }
-                        break;
+/**
+ * Runs an idle loop starting at the PC. Its instructions only change V registers and I, from inputs that are
+ * fixed for the rest of the frame, so once an iteration ends where it started with those unchanged, every
+ * later iteration repeats it exactly and whole iterations can be skipped without running them. Only the
+ * leftover partial iteration is executed (by the caller), so the final state is exactly the interpreter's.
+ * @param budget Instructions left in the frame
+ * @return Instructions executed or skipped, at least 1
+ */
+int ChipEight::skipIdleLoop(int budget)
+{
+    const LoopInfo *loop = analysis->findLoop(pc);
+    uint16_t head = pc;
 
-                    case SDLK_r:
-                    {
-                        keypad[0xD] = 1;
-                    }
-                        break;
+    // The loop's code may have been overwritten since it was analysed
+    if (loop == nullptr ||
+        memcmp(&memory[loop->head], &rom[loop->head - START_ADDRESS], loop->end - loop->head) != 0)
+    {
+        executeInstruction();
+        return 1;
+    }
 
-                    case SDLK_f:
-                    {
-                        keypad[0xE] = 1;
-                    }
-                        break;
+    // Registers usually settle after the first iteration, give up if they haven't after a few
+    int executed = 0;
+    for (int iteration = 0; iteration < 4; iteration++)
+    {
+        uint8_t startRegisters[16];
+        memcpy(startRegisters, registers, sizeof(registers));
+        uint16_t startIndex = indexRegister;
 
-                    case SDLK_v:
-                    {
-                        keypad[0xF] = 1;
-                    }
-                        break;
-                }
+        int period = 0;
+        do
+        {
+            if (executed == budget)
+            {
+                return executed;
             }
-                break;
+            executeInstruction();
+            ++executed;
+            ++period;
+        }
+        while (pc != head && pc >= loop->head && pc < loop->end);
+
+        if (pc != head)
+        {
+            return executed;
+        }
 
-            case SDL_KEYUP:
+        if (indexRegister == startIndex && memcmp(startRegisters, registers, sizeof(registers)) == 0)
+        {
+            int remaining = budget - executed;
+            return executed + remaining - remaining % period;
+        }
+    }
+    return executed;
+}
+
+/**
+ * Instrumented version of the instruction loop which lets the debugger stop before each instruction
+ */
+void ChipEight::executeCycleDebug(int budget)
+{
+    for (int i = 0; i < budget && !waitingForVblank; i++)
+    {
+        if (debugger->shouldBreak(*this))
+        {
+            debugger->console(*this);
+            if (!shouldRun)
             {
-                switch (event.key.keysym.sym)
-                {
-                    case SDLK_x:
-                    {
-                        keypad[0] = 0;
-                    }
-                        break;
+                return;
+            }
+        }
 
-                    case SDLK_1:
-                    {
-                        keypad[1] = 0;
-                    }
-                        break;
+        executeInstruction();
+    }
+}
+
+/**
+ * Instruction loop which records each instruction and the state it changed into the instruction trace
+ */
+void ChipEight::executeCycleTraced(int budget, bool frameStart)
+{
+    TraceMachine before{};
+    TraceMachine after{};
+    for (int i = 0; i < budget && !waitingForVblank; i++)
+    {
+        captureTraceMachine(before);
+        executeInstruction();
+        captureTraceMachine(after);
+        instructionTrace->record(before, opcode, after, memory, memorySize, frameStart && i == 0);
+    }
+}
+
+/**
+ * @param state Filled with the registers, stack and timers
+ */
+void ChipEight::captureTraceMachine(TraceMachine &state) const
+{
+    memcpy(state.registers, registers, sizeof(registers));
+    memcpy(state.stack, stack, sizeof(stack));
+    state.indexRegister = indexRegister;
+    state.pc = pc;
+    state.sp = sp;
+    state.delayRegister = delayRegister;
+    state.soundRegister = soundRegister;
+}
+
+/**
+ * Maps keys to the Chip-8 keypad. Entries that are 0 keep the default mapping.
+ * @param keys SDL keycode for each Chip-8 key 0x0 - 0xF
+ */
+void ChipEight::setKeyMap(const int32_t keys[16])
+{
+    for (int i = 0; i < 16; i++)
+    {
+        keyMap[i] = keys[i] != 0 ? keys[i] : DEFAULT_KEY_MAP[i];
+    }
+}
+
+/**
+ * Finds which Chip-8 key a host key is mapped to
+ * @param key SDL keycode
+ * @return Chip-8 key 0x0 - 0xF, or -1 if the key isn't mapped
+ */
+int ChipEight::findKey(SDL_Keycode key) const
+{
+    for (int i = 0; i < 16; i++)
+    {
+        if (keyMap[i] == key)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @param timestamp SDL event timestamp, in milliseconds since SDL started as SDL_GetTicks() is
+ * @return The same time on the steady clock
+ */
+static std::chrono::steady_clock::time_point eventTime(uint32_t timestamp)
+{
+    return std::chrono::steady_clock::now() - std::chrono::milliseconds(SDL_GetTicks() - timestamp);
+}
 
-                    case SDLK_2:
-                    {
-                        keypad[2] = 0;
-                    }
-                        break;
+/**
+ * Handle input using SDL, queueing key presses and releases for the next frame. Can be called any number of
+ * times between frames: the more often, the closer each key change lands to the instruction it arrived at.
+ */
+void ChipEight::processInputs()
+{
+    bool quit = false;
 
-                    case SDLK_3:
-                    {
-                        keypad[3] = 0;
-                    }
-                        break;
+    SDL_Event event;
 
-                    case SDLK_q:
-                    {
-                        keypad[4] = 0;
-                    }
-                        break;
+    while (SDL_PollEvent(&event))
+    {
+        handleEvent(event, quit);
+    }
+    shouldRun = !quit;
+}
 
-                    case SDLK_w:
-                    {
-                        keypad[5] = 0;
-                    }
-                        break;
+/**
+ * Blocks until an SDL event arrives or the timeout passes, then handles every pending event as
+ * processInputs() does. For waiting while the window is in the background without spinning.
+ * @param timeout Milliseconds to wait at most, -1 to wait for an event however long it takes
+ */
+void ChipEight::waitForEvents(int timeout)
+{
+    bool quit = false;
 
-                    case SDLK_e:
-                    {
-                        keypad[6] = 0;
-                    }
-                        break;
+    SDL_Event event;
 
-                    case SDLK_a:
-                    {
-                        keypad[7] = 0;
-                    }
-                        break;
+    if (timeout < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout))
+    {
+        handleEvent(event, quit);
+        while (SDL_PollEvent(&event))
+        {
+            handleEvent(event, quit);
+        }
+    }
+    shouldRun = !quit;
+}
 
-                    case SDLK_s:
-                    {
-                        keypad[8] = 0;
-                    }
-                        break;
+/**
+ * @return False while the window is hidden or minimised
+ */
+bool ChipEight::isWindowVisible() const
+{
+    return windowVisible;
+}
 
-                    case SDLK_d:
-                    {
-                        keypad[9] = 0;
-                    }
-                        break;
+/**
+ * @return False while another window has the keyboard focus
+ */
+bool ChipEight::isWindowFocused() const
+{
+    return windowFocused;
+}
 
-                    case SDLK_z:
-                    {
-                        keypad[0xA] = 0;
-                    }
-                        break;
+/**
+ * Stops the beeper until the sound timer is next updated, for when emulation pauses with it running
+ */
+void ChipEight::stopSound()
+{
+    if (!headless)
+    {
+        beeper.stop();
+    }
+}
 
-                    case SDLK_c:
-                    {
-                        keypad[0xB] = 0;
-                    }
-                        break;
+/**
+ * @param event Event from SDL
+ * @param quit Set if the event asks to quit
+ */
+void ChipEight::handleEvent(const SDL_Event &event, bool &quit)
+{
+    switch (event.type)
+    {
+        case SDL_QUIT:
+        {
+            quit = true;
+        }
+            break;
 
-                    case SDLK_4:
+        case SDL_WINDOWEVENT:
+        {
+            switch (event.window.event)
+            {
+                case SDL_WINDOWEVENT_HIDDEN:
+                case SDL_WINDOWEVENT_MINIMIZED:
+                    windowVisible = false;
+                    break;
+                case SDL_WINDOWEVENT_SHOWN:
+                case SDL_WINDOWEVENT_RESTORED:
+                case SDL_WINDOWEVENT_MAXIMIZED:
+                case SDL_WINDOWEVENT_EXPOSED:
+                    // Frames may have gone unpresented (and software presentation may have lost the window
+                    // contents), so present the current one in full
+                    windowVisible = true;
+                    if (presenter)
                     {
-                        keypad[0xC] = 0;
+                        presenter->invalidate();
                     }
-                        break;
+                    drawFlag = true;
+                    break;
+                case SDL_WINDOWEVENT_FOCUS_GAINED:
+                    windowFocused = true;
+                    break;
+                case SDL_WINDOWEVENT_FOCUS_LOST:
+                    windowFocused = false;
+                    break;
+                default:
+                    break;
+            }
+        }
+            break;
 
-                    case SDLK_r:
-                    {
-                        keypad[0xD] = 0;
-                    }
-                        break;
+        case SDL_KEYDOWN:
+        {
+            switch (event.key.keysym.sym)
+            {
+                case SDLK_ESCAPE:
+                {
+                    quit = true;
+                }
+                    break;
 
-                    case SDLK_f:
+                case SDLK_F12:
+                {
+                    if (debugger != nullptr)
                     {
-                        keypad[0xE] = 0;
+                        debugger->requestBreak();
                     }
-                        break;
+                }
+                    break;
 
-                    case SDLK_v:
+                default:
+                {
+                    int key = findKey(event.key.keysym.sym);
+                    if (key >= 0 && !event.key.repeat)
                     {
-                        keypad[0xF] = 0;
+                        keyQueue.push(key, true, eventTime(event.key.timestamp));
                     }
-                        break;
                 }
+                    break;
+            }
+        }
+            break;
+
+        case SDL_KEYUP:
+        {
+            int key = findKey(event.key.keysym.sym);
+            if (key >= 0)
+            {
+                keyQueue.push(key, false, eventTime(event.key.timestamp));
             }
-                break;
         }
+            break;
+    }
+}
+
+/**
+ * Applies one queued key change to the keypad
+ * @param change Key change from the queue
+ */
+void ChipEight::applyKeyChange(const KeyChange &change)
+{
+    if (change.down && !keypad[change.key] && latencyProbe != nullptr)
+    {
+        latencyProbe->onKeyDown(change.key, change.time);
+    }
+    else if (!change.down && keypad[change.key] && latencyProbe != nullptr)
+    {
+        latencyProbe->onKeyUp(change.key);
+    }
+    keypad[change.key] = change.down;
+}
+
+/**
+ * Chooses where queued key events are applied
+ * @param _subFrameInput True to apply them inside the next frame at the instructions matching when they arrived,
+ * false to leave them for applyKeyEvents() (for frontends that need the keys before running a frame)
+ */
+void ChipEight::setSubFrameInput(bool _subFrameInput)
+{
+    subFrameInput = _subFrameInput;
+}
+
+/**
+ * Applies the queued key events straight away, as a frame of one instruction, so taps are still held for a frame
+ */
+void ChipEight::applyKeyEvents()
+{
+    keyQueue.takeFrame(std::chrono::steady_clock::now(), 1, frameKeys);
+    for (const KeyChange &change : frameKeys)
+    {
+        applyKeyChange(change);
     }
-    shouldRun = !quit;
 }
 
 /**
@@ -359,6 +1108,11 @@ void ChipEight::processInputs()
 ChipEight::~ChipEight()
 {
 //    registerThread.join();
+    if (headless)
+    {
+        return;
+    }
+
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -377,11 +1131,38 @@ void ChipEight::updateScreen(const void *buffer, int pitch)
         return;
     }
 
-    SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
+    if (presenter)
+    {
+        TRACE_ZONE("present");
+        presenter->present((const uint32_t *) buffer);
+    }
+    else
+    {
+        {
+            TRACE_ZONE("upload");
+
+            // The texture follows the display mode, the window stays the same size
+            int textureWidth = 0;
+            SDL_QueryTexture(texture, nullptr, nullptr, &textureWidth, nullptr);
+            if (textureWidth != (int) getVideoWidth())
+            {
+                SDL_DestroyTexture(texture);
+                texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                            getVideoWidth(), getVideoHeight());
+            }
+            SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        }
+        TRACE_ZONE("present");
+        SDL_RenderPresent(renderer);
+    }
     drawFlag = false;
+
+    if (latencyProbe != nullptr)
+    {
+        latencyProbe->onPresent();
+    }
 }
 
 /**
@@ -392,7 +1173,27 @@ void ChipEight::updateScreen(const void *buffer, int pitch)
  */
 void ChipEight::setupScreen(const char *title, unsigned int scale)
 {
+    setupScreen(title, scale, false, ScaleStyle::Plain);
+}
+
+/**
+ * Sets up the SDL window
+ *
+ * @param title Title of the window
+ * @param scale Scaling factor for the graphics
+ * @param software Upscale on the CPU into the window surface instead of using an SDL renderer
+ * @param style Block style used by the software upscaler
+ */
+void ChipEight::setupScreen(const char *title, unsigned int scale, bool software, ScaleStyle style)
+{
+    SDL_InitSubSystem(SDL_INIT_VIDEO);
     window = SDL_CreateWindow(title, 100, 200, scale * VIDEO_WIDTH, scale * VIDEO_HEIGHT, SDL_WINDOW_SHOWN);
+    if (software)
+    {
+        presenter = std::make_unique<SoftwarePresenter>(window, scale, style);
+        return;
+    }
+
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, VIDEO_WIDTH, VIDEO_HEIGHT);
 }
@@ -426,6 +1227,34 @@ void ChipEight::executeOpCode()
             {
                 OP_00EE();
             }
+            else if (variant != ChipVariant::Chip8 && (opcode & 0xFFF0u) == 0x00C0)
+            {
+                OP_00CN();
+            }
+            else if (variant == ChipVariant::XoChip && (opcode & 0xFFF0u) == 0x00D0)
+            {
+                OP_00DN();
+            }
+            else if (variant != ChipVariant::Chip8 && opcode == 0x00FB)
+            {
+                OP_00FB();
+            }
+            else if (variant != ChipVariant::Chip8 && opcode == 0x00FC)
+            {
+                OP_00FC();
+            }
+            else if (variant != ChipVariant::Chip8 && opcode == 0x00FD)
+            {
+                OP_00FD();
+            }
+            else if (variant != ChipVariant::Chip8 && opcode == 0x00FE)
+            {
+                OP_00FE();
+            }
+            else if (variant != ChipVariant::Chip8 && opcode == 0x00FF)
+            {
+                OP_00FF();
+            }
             else
             {
                 printUnimplemented(opcode);
@@ -444,7 +1273,18 @@ void ChipEight::executeOpCode()
             OP_4XKK();
             break;
         case 0x5000:
-            OP_5XY0();
+            if (variant == ChipVariant::XoChip && (opcode & 0x000Fu) == 0x2)
+            {
+                OP_5XY2();
+            }
+            else if (variant == ChipVariant::XoChip && (opcode & 0x000Fu) == 0x3)
+            {
+                OP_5XY3();
+            }
+            else
+            {
+                OP_5XY0();
+            }
             break;
         case 0x6000:
             OP_6XKK();
@@ -527,6 +1367,36 @@ void ChipEight::executeOpCode()
             uint16_t lastByte = opcode & 0x00FFu;
             switch (lastByte)
             {
+                case 0x0000:
+                    if (variant == ChipVariant::XoChip && opcode == 0xF000)
+                    {
+                        OP_F000();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
+                case 0x0001:
+                    if (variant == ChipVariant::XoChip)
+                    {
+                        OP_FN01();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
+                case 0x0002:
+                    if (variant == ChipVariant::XoChip && opcode == 0xF002)
+                    {
+                        OP_F002();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
                 case 0x0007:
                     OP_FX07();
                     break;
@@ -545,15 +1415,55 @@ void ChipEight::executeOpCode()
                 case 0x0029:
                     OP_FX29();
                     break;
+                case 0x0030:
+                    if (variant != ChipVariant::Chip8)
+                    {
+                        OP_FX30();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
                 case 0x0033:
                     OP_FX33();
                     break;
+                case 0x003A:
+                    if (variant == ChipVariant::XoChip)
+                    {
+                        OP_FX3A();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
                 case 0x0055:
                     OP_FX55();
                     break;
                 case 0x0065:
                     OP_FX65();
                     break;
+                case 0x0075:
+                    if (variant != ChipVariant::Chip8)
+                    {
+                        OP_FX75();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
+                case 0x0085:
+                    if (variant != ChipVariant::Chip8)
+                    {
+                        OP_FX85();
+                    }
+                    else
+                    {
+                        printUnimplemented(opcode);
+                    }
+                    break;
                 default:
                     printUnimplemented(opcode);
                     break;
@@ -567,20 +1477,89 @@ void ChipEight::executeOpCode()
 }
 
 /**
- *   CLS - Clear the display
+ *   CLS - Clear the display
+ */
+void ChipEight::OP_00E0()
+{
+    // Only the selected bit-planes, which is always just the first outside XO-CHIP
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; plane++)
+    {
+        if (planeMask & (1u << plane))
+        {
+            memset(planes[plane], 0, sizeof(planes[plane]));
+        }
+    }
+    dirtyRows = ~0ull;
+
+    if (latencyProbe != nullptr)
+    {
+        latencyProbe->onVideoChanged();
+    }
+}
+
+/**
+ *   RET - Return from a subroutine
+ */
+void ChipEight::OP_00EE()
+{
+    --sp;
+    pc = stack[sp];
+}
+
+/**
+ *   SCD n - Scroll the display down n rows (SUPER-CHIP)
+ */
+void ChipEight::OP_00CN()
+{
+    scrollVertical(opcode & 0x000Fu);
+}
+
+/**
+ *   SCU n - Scroll the display up n rows (XO-CHIP)
+ */
+void ChipEight::OP_00DN()
+{
+    scrollVertical(-(int) (opcode & 0x000Fu));
+}
+
+/**
+ *   SCR - Scroll the display right 4 pixels (SUPER-CHIP)
+ */
+void ChipEight::OP_00FB()
+{
+    scrollHorizontal(4);
+}
+
+/**
+ *   SCL - Scroll the display left 4 pixels (SUPER-CHIP)
+ */
+void ChipEight::OP_00FC()
+{
+    scrollHorizontal(-4);
+}
+
+/**
+ *   EXIT - Stop the interpreter (SUPER-CHIP)
+ */
+void ChipEight::OP_00FD()
+{
+    shouldRun = false;
+}
+
+/**
+ *   LOW - Switch to the 64x32 display (SUPER-CHIP)
  */
-void ChipEight::OP_00E0()
+void ChipEight::OP_00FE()
 {
-    memset(video, 0, sizeof(video));
+    setResolution(false);
 }
 
 /**
- *   RET - Return from a subroutine
+ *   HIGH - Switch to the 128x64 display (SUPER-CHIP)
  */
-void ChipEight::OP_00EE()
+void ChipEight::OP_00FF()
 {
-    --sp;
-    pc = stack[sp];
+    setResolution(true);
 }
 
 /**
@@ -616,7 +1595,7 @@ void ChipEight::OP_3XKK()
 
     if (registers[x] == kk)
     {
-        pc += 2;
+        skipNextInstruction();
     }
 }
 
@@ -630,7 +1609,7 @@ void ChipEight::OP_4XKK()
 
     if (registers[x] != kk)
     {
-        pc += 2;
+        skipNextInstruction();
     }
 }
 
@@ -644,7 +1623,37 @@ void ChipEight::OP_5XY0()
 
     if (registers[Vx] == registers[Vy])
     {
-        pc += 2;
+        skipNextInstruction();
+    }
+}
+
+/**
+ *   LD [I], Vx - Vy - Store Vx to Vy in memory starting at I, in either order, leaving I alone (XO-CHIP)
+ */
+void ChipEight::OP_5XY2()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    int step = Vx <= Vy ? 1 : -1;
+
+    for (int i = 0; i <= std::abs(Vy - Vx); i++)
+    {
+        writeToMemory(indexRegister + i, registers[Vx + i * step]);
+    }
+}
+
+/**
+ *   LD Vx - Vy, [I] - Load Vx to Vy from memory starting at I, in either order, leaving I alone (XO-CHIP)
+ */
+void ChipEight::OP_5XY3()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    int step = Vx <= Vy ? 1 : -1;
+
+    for (int i = 0; i <= std::abs(Vy - Vx); i++)
+    {
+        registers[Vx + i * step] = memory[(indexRegister + i) & (memorySize - 1)];
     }
 }
 
@@ -815,7 +1824,7 @@ void ChipEight::OP_9XY0()
 
     if (registers[Vx] != registers[Vy])
     {
-        pc += 2;
+        skipNextInstruction();
     }
 }
 
@@ -848,6 +1857,77 @@ void ChipEight::OP_CXKK()
     registers[Vx] = randByte(randGen) & kk;
 }
 
+/**
+ * Moves a display row right, within a row of the given width
+ * @param row Row to move, PLANE_ROW_WORDS words with the leftmost pixel in the top bit
+ * @param pixels Distance, less than width
+ * @param width VIDEO_WIDTH or VIDEO_MAX_WIDTH
+ * @param wrap Bring pixels moved off the right edge back in on the left
+ * @param result Moved row
+ */
+static inline void shiftRowRight(const uint64_t *row, unsigned int pixels, unsigned int width, bool wrap,
+                                 uint64_t *result)
+{
+    if (pixels == 0)
+    {
+        result[0] = row[0];
+        result[1] = row[1];
+        return;
+    }
+
+    if (width == VIDEO_WIDTH)
+    {
+        result[0] = (row[0] >> pixels) | (wrap ? row[0] << (64u - pixels) : 0);
+        result[1] = 0;
+        return;
+    }
+
+    // Both words as one 128 bit row
+    if (pixels < 64)
+    {
+        result[0] = row[0] >> pixels;
+        result[1] = (row[1] >> pixels) | (row[0] << (64u - pixels));
+    }
+    else
+    {
+        result[0] = 0;
+        result[1] = row[0] >> (pixels - 64u);
+    }
+    if (wrap)
+    {
+        unsigned int back = 128u - pixels;
+        if (back < 64)
+        {
+            result[0] |= (row[0] << back) | (row[1] >> (64u - back));
+            result[1] |= row[1] << back;
+        }
+        else
+        {
+            result[0] |= row[1] << (back - 64u);
+        }
+    }
+}
+
+/**
+ * Moves a display row left without wrapping
+ * @param row Row to move, PLANE_ROW_WORDS words with the leftmost pixel in the top bit
+ * @param pixels Distance, 1 to 63
+ * @param width VIDEO_WIDTH or VIDEO_MAX_WIDTH
+ * @param result Moved row
+ */
+static inline void shiftRowLeft(const uint64_t *row, unsigned int pixels, unsigned int width, uint64_t *result)
+{
+    if (width == VIDEO_WIDTH)
+    {
+        result[0] = row[0] << pixels;
+        result[1] = 0;
+        return;
+    }
+
+    result[0] = (row[0] << pixels) | (row[1] >> (64u - pixels));
+    result[1] = row[1] << pixels;
+}
+
 /**
  *  DRW Vx, Vy, n - Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
  */
@@ -858,42 +1938,210 @@ void ChipEight::OP_DXYN()
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
 
-    // Extract x & y from registers
-    uint8_t x = registers[Vx];
-    uint8_t y = registers[Vy];
-
-    // Set VF register to 0
-    registers[0xF] = 0;
-
-    for (unsigned int row = 0; row < height; ++row)
+    // Sprites start at x, y wrapped onto the screen
+    unsigned int width = getVideoWidth();
+    unsigned int screenHeight = getVideoHeight();
+    unsigned int x = registers[Vx] % width;
+    unsigned int y = registers[Vy] % screenHeight;
+
+    // SUPER-CHIP and XO-CHIP draw a 16x16 sprite for DXY0, CHIP-8 draws nothing
+    bool large = height == 0 && variant != ChipVariant::Chip8;
+    unsigned int rows = large ? 16 : height;
+    unsigned int spriteWidth = large ? 16 : 8;
+
+    // The SUPER-CHIP clips sprites at the edges of the screen, CHIP-8 and XO-CHIP wrap them around
+    bool wrap = variant != ChipVariant::SuperChip;
+
+    // Each row of the sprite is one shift and one XOR per word. With several planes selected, each plane's
+    // sprite follows the previous one's in memory.
+    uint16_t address = indexRegister;
+    uint64_t collision = 0;
+    bool changed = false;
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; plane++)
     {
-        uint8_t spriteByte = memory[indexRegister + row];
-
-        for (unsigned int col = 0; col < 8; ++col)
+        if (!(planeMask & (1u << plane)))
         {
-            // Get each pixel by shifting (0x80 = 1000 0000)
-            uint8_t spritePixel = spriteByte & (0x80u >> col);
+            continue;
+        }
 
-            // Get pixel index in 1D array using: X + (Y * WIDTH) and modulo to wrap around x,y coords
-            // - without wrapping index goes outside video array
-            uint32_t *screenPixel = &video[((x + col) % VIDEO_WIDTH) + (((y + row) % VIDEO_HEIGHT) * VIDEO_WIDTH)];
+        for (unsigned int row = 0; row < rows; ++row)
+        {
+            uint64_t spriteBits = memory[address & (memorySize - 1)];
+            if (large)
+            {
+                spriteBits = (spriteBits << 8u) | memory[(address + 1) & (memorySize - 1)];
+            }
+            address += large ? 2 : 1;
 
-            // Sprite pixel is on
-            if (spritePixel)
+            unsigned int line = y + row;
+            if (line >= screenHeight)
             {
-                // Screen pixel also on - collision
-                if (*screenPixel == 0xFFFFFFFF)
+                if (!wrap)
                 {
-                    registers[0xF] = 1;
+                    continue;
                 }
+                line -= screenHeight;
+            }
+
+            uint64_t sprite[PLANE_ROW_WORDS] = {spriteBits << (64u - spriteWidth), 0};
+            uint64_t bits[PLANE_ROW_WORDS];
+            shiftRowRight(sprite, x, width, wrap, bits);
+
+            uint64_t *screenRow = &planes[plane][line * PLANE_ROW_WORDS];
+            for (unsigned int word = 0; word < PLANE_ROW_WORDS; word++)
+            {
+                // Screen pixel also on - collision
+                collision |= screenRow[word] & bits[word];
+                screenRow[word] ^= bits[word];
+            }
+            dirtyRows |= 1ull << line;
+            changed |= spriteBits != 0;
+        }
+    }
+
+    registers[0xF] = collision != 0;
+    drawFlag = true;
+    waitingForVblank = displayWait;
+
+    // Any sprite pixel that is on flips a screen pixel
+    if (latencyProbe != nullptr && changed)
+    {
+        latencyProbe->onVideoChanged();
+    }
+}
+
+/**
+ * Scrolls the selected planes up or down, blank rows come in at the edge
+ * @param rows Rows to scroll down, negative to scroll up
+ */
+void ChipEight::scrollVertical(int rows)
+{
+    unsigned int height = getVideoHeight();
+    unsigned int distance = std::min<unsigned int>(std::abs(rows), height);
+    size_t moved = (height - distance) * PLANE_ROW_WORDS * sizeof(uint64_t);
+    size_t cleared = distance * PLANE_ROW_WORDS * sizeof(uint64_t);
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; plane++)
+    {
+        if (!(planeMask & (1u << plane)))
+        {
+            continue;
+        }
+
+        uint64_t *words = planes[plane];
+        if (rows > 0)
+        {
+            memmove(words + distance * PLANE_ROW_WORDS, words, moved);
+            memset(words, 0, cleared);
+        }
+        else
+        {
+            memmove(words, words + distance * PLANE_ROW_WORDS, moved);
+            memset(words + (height - distance) * PLANE_ROW_WORDS, 0, cleared);
+        }
+    }
+    dirtyRows = ~0ull;
+    drawFlag = true;
+}
+
+/**
+ * Scrolls the selected planes left or right, blank columns come in at the edge
+ * @param pixels Pixels to scroll right, negative to scroll left
+ */
+void ChipEight::scrollHorizontal(int pixels)
+{
+    unsigned int width = getVideoWidth();
+    unsigned int height = getVideoHeight();
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; plane++)
+    {
+        if (!(planeMask & (1u << plane)))
+        {
+            continue;
+        }
 
-                // Effectively XOR with the sprite pixel
-                *screenPixel ^= 0xFFFFFFFF;
+        for (unsigned int y = 0; y < height; y++)
+        {
+            uint64_t *row = &planes[plane][y * PLANE_ROW_WORDS];
+            uint64_t shifted[PLANE_ROW_WORDS];
+            if (pixels > 0)
+            {
+                shiftRowRight(row, pixels, width, false, shifted);
+            }
+            else
+            {
+                shiftRowLeft(row, -pixels, width, shifted);
             }
+            memcpy(row, shifted, sizeof(shifted));
         }
     }
+    dirtyRows = ~0ull;
+    drawFlag = true;
+}
 
+/**
+ * Switches between the 64x32 and 128x64 display, which clears it
+ * @param _hires True for 128x64
+ */
+void ChipEight::setResolution(bool _hires)
+{
+    hires = _hires;
+    memset(planes, 0, sizeof(planes));
+    dirtyRows = ~0ull;
     drawFlag = true;
+
+    if (latencyProbe != nullptr)
+    {
+        latencyProbe->onVideoChanged();
+    }
+}
+
+/**
+ * Rebuilds the rows of video that changed in the bit-planes since the last call
+ */
+void ChipEight::syncVideo()
+{
+    if (dirtyRows == 0)
+    {
+        return;
+    }
+
+    // Off, first plane (white as always for CHIP-8), second plane, both
+    static const uint32_t palette[4] = {0x00000000, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF};
+
+    unsigned int width = getVideoWidth();
+    unsigned int height = getVideoHeight();
+    for (unsigned int y = 0; y < height; y++)
+    {
+        if (!((dirtyRows >> y) & 1u))
+        {
+            continue;
+        }
+
+        const uint64_t *first = &planes[0][y * PLANE_ROW_WORDS];
+        const uint64_t *second = &planes[1][y * PLANE_ROW_WORDS];
+        uint32_t *line = &video[y * width];
+        for (unsigned int x = 0; x < width; x++)
+        {
+            unsigned int word = x / 64;
+            unsigned int bit = 63 - x % 64;
+            line[x] = palette[((first[word] >> bit) & 1u) | (((second[word] >> bit) & 1u) << 1u)];
+        }
+    }
+    dirtyRows = 0;
+}
+
+/**
+ * Skips the next instruction, which is four bytes long if it's XO-CHIP's F000 NNNN
+ */
+void ChipEight::skipNextInstruction()
+{
+    if (variant == ChipVariant::XoChip && memory[pc] == 0xF0 && memory[(pc + 1) & 0xFFFFu] == 0x00)
+    {
+        pc += 4;
+    }
+    else
+    {
+        pc += 2;
+    }
 }
 
 /**
@@ -903,9 +2151,16 @@ void ChipEight::OP_EX9E()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
-    if (keypad[registers[Vx]] == 1)
+    // Only the low nibble picks the key, as on the COSMAC VIP
+    uint8_t key = registers[Vx] & 0x0Fu;
+    if (keypad[key] == 1)
     {
-        pc += 2;
+        skipNextInstruction();
+
+        if (latencyProbe != nullptr)
+        {
+            latencyProbe->onKeysRead(1u << key);
+        }
     }
 }
 
@@ -916,9 +2171,14 @@ void ChipEight::OP_EXA1()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
-    if (keypad[registers[Vx]] == 0)
+    uint8_t key = registers[Vx] & 0x0Fu;
+    if (keypad[key] == 0)
     {
-        pc += 2;
+        skipNextInstruction();
+    }
+    else if (latencyProbe != nullptr)
+    {
+        latencyProbe->onKeysRead(1u << key);
     }
 }
 
@@ -938,6 +2198,11 @@ void ChipEight::OP_FX0A()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
+    if (latencyProbe != nullptr)
+    {
+        latencyProbe->onKeysRead(getKeypadMask());
+    }
+
     if (keypad[0])
     {
         registers[Vx] = 0;
@@ -1025,6 +2290,34 @@ void ChipEight::OP_FX0A()
 //    }
 }
 
+/**
+ *  LD I, NNNN - Set I to the 16 bit address in the next two bytes (XO-CHIP)
+ */
+void ChipEight::OP_F000()
+{
+    indexRegister = (memory[pc] << 8u) | memory[(pc + 1) & 0xFFFFu];
+    pc += 2;
+}
+
+/**
+ *  PLANE n - Select the bit-planes drawn, cleared and scrolled (XO-CHIP)
+ */
+void ChipEight::OP_FN01()
+{
+    planeMask = ((opcode & 0x0F00u) >> 8u) & 0x3u;
+}
+
+/**
+ *  AUDIO - Load the 16 byte audio pattern from I (XO-CHIP)
+ */
+void ChipEight::OP_F002()
+{
+    for (unsigned int i = 0; i < sizeof(audioPattern); i++)
+    {
+        audioPattern[i] = memory[(indexRegister + i) & (memorySize - 1)];
+    }
+}
+
 /**
  *  LD DT, Vx - Set delay register = Vx
  */
@@ -1063,6 +2356,17 @@ void ChipEight::OP_FX29()
     indexRegister = FONT_START_ADDRESS + (5 * digit);
 }
 
+/**
+ *  LD HF, Vx - Set I = location of the large sprite for digit Vx (SUPER-CHIP)
+ */
+void ChipEight::OP_FX30()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t digit = registers[Vx] & 0x0Fu;
+
+    indexRegister = BIG_FONT_START_ADDRESS + (10 * digit);
+}
+
 /**
  *  LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2
  */
@@ -1110,7 +2414,7 @@ void ChipEight::OP_FX65()
 
     for (int i = 0; i <= Vx; i++)
     {
-        registers[i] = memory[indexRegister + i];
+        registers[i] = memory[(indexRegister + i) & (memorySize - 1)];
     }
 
     if (!loadStoreQuirk)
@@ -1119,6 +2423,35 @@ void ChipEight::OP_FX65()
     }
 }
 
+/**
+ *  PITCH Vx - Set the playback rate of the audio pattern (XO-CHIP)
+ */
+void ChipEight::OP_FX3A()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    pitch = registers[Vx];
+}
+
+/**
+ *  LD R, Vx - Save V0 through Vx in the flag registers (SUPER-CHIP has 8, XO-CHIP 16)
+ */
+void ChipEight::OP_FX75()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    int last = variant == ChipVariant::XoChip ? Vx : std::min<int>(Vx, 7);
+    memcpy(flagRegisters, registers, last + 1);
+}
+
+/**
+ *  LD Vx, R - Load V0 through Vx from the flag registers
+ */
+void ChipEight::OP_FX85()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    int last = variant == ChipVariant::XoChip ? Vx : std::min<int>(Vx, 7);
+    memcpy(registers, flagRegisters, last + 1);
+}
+
 /**
  * Function for writing to values into memory
  * @param index Index of byte to replace
@@ -1126,10 +2459,20 @@ void ChipEight::OP_FX65()
  */
 void ChipEight::writeToMemory(int index, uint8_t value)
 {
+    // Stores running past the end of memory wrap around to the start, like loads do
+    index &= (int) memorySize - 1;
+
     // Ensure we're not writing inside the ROM area (0x000 - 0x200)
     if (index > START_ADDRESS)
     {
         memory[index] = value;
+        dirtyPages[index / (MEMORY_PAGE_SIZE * 64)] |= 1ull << (index / MEMORY_PAGE_SIZE % 64);
+
+        // Compiled blocks have to check their code is unchanged from now on
+        if (compiledCodeMap != nullptr && index < (int) CLASSIC_MEMORY_SIZE)
+        {
+            compiledState.codeModified |= compiledCodeMap[index];
+        }
     }
     else
     {
@@ -1137,3 +2480,96 @@ void ChipEight::writeToMemory(int index, uint8_t value)
     }
 }
 
+
+/**
+ * Direct access to machine state for embedders (e.g. the C library), valid for the lifetime of this object
+ */
+uint8_t *ChipEight::getRegisters()
+{
+    return registers;
+}
+
+uint8_t *ChipEight::getMemory()
+{
+    // Stores through the pointer can't be tracked from now on
+    memoryExposed = true;
+    return memory;
+}
+
+uint8_t *ChipEight::getKeypad()
+{
+    return keypad;
+}
+
+uint16_t *ChipEight::getStack()
+{
+    return stack;
+}
+
+uint16_t *ChipEight::getPC()
+{
+    return &pc;
+}
+
+uint16_t *ChipEight::getIndexRegister()
+{
+    return &indexRegister;
+}
+
+uint8_t *ChipEight::getStackPointer()
+{
+    return &sp;
+}
+
+uint8_t *ChipEight::getDelayRegister()
+{
+    return &delayRegister;
+}
+
+uint8_t *ChipEight::getSoundRegister()
+{
+    return &soundRegister;
+}
+
+/**
+ * Parses a --variant name
+ * @param text "chip8", "schip" or "xochip"
+ * @param variant Parsed variant
+ * @return False if the name isn't known
+ */
+bool parseVariant(const std::string &text, ChipVariant &variant)
+{
+    if (text == "chip8")
+    {
+        variant = ChipVariant::Chip8;
+    }
+    else if (text == "schip")
+    {
+        variant = ChipVariant::SuperChip;
+    }
+    else if (text == "xochip")
+    {
+        variant = ChipVariant::XoChip;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return Name of a variant as accepted by parseVariant()
+ */
+const char *variantName(ChipVariant variant)
+{
+    switch (variant)
+    {
+        case ChipVariant::SuperChip:
+            return "schip";
+        case ChipVariant::XoChip:
+            return "xochip";
+        default:
+            return "chip8";
+    }
+}
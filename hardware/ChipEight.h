@@ -5,7 +5,33 @@
 #include <SDL2/SDL.h>
 #include <random>
 #include "Sound.h"
+#include "AotModule.h"
+#include "../frontend/KeyQueue.h"
 #include <thread>
+#include <bitset>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Debugger;
+
+class SoftwarePresenter;
+
+class CompiledCode;
+
+class RomAnalysis;
+
+class IrProgram;
+
+class LatencyProbe;
+
+class AudioRenderer;
+
+class InstructionTraceWriter;
+
+struct TraceMachine;
+
+enum class ScaleStyle;
 
 /**
  * Starting point in memory where programs can begin writing
@@ -45,14 +71,125 @@ const static uint8_t fontset[FONT_SET_SIZE] =
                 0xF0, 0x80, 0xF0, 0x80, 0x80  // F
         };
 
+/**
+ * Address of the SUPER-CHIP/XO-CHIP large font (16 chars of 10 bytes), after the small one
+ */
+const static unsigned int BIG_FONT_START_ADDRESS = FONT_START_ADDRESS + FONT_SET_SIZE;
+
+const static unsigned int BIG_FONT_SET_SIZE = 160;
+
+/**
+ * Large font set for FX30, digits 0-9 as on the SUPER-CHIP and A-F as added by XO-CHIP
+ */
+const static uint8_t bigFontset[BIG_FONT_SET_SIZE] =
+        {
+                0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+                0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+                0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+                0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+                0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+                0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+                0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+                0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+        };
+
 /**
  * Width and height of Chip-8 display
  */
 const unsigned int VIDEO_HEIGHT = 32;
 const unsigned int VIDEO_WIDTH = 64;
 
+/**
+ * SUPER-CHIP/XO-CHIP high resolution display, and the number of XO-CHIP bit-planes
+ */
+const unsigned int VIDEO_MAX_HEIGHT = 64;
+const unsigned int VIDEO_MAX_WIDTH = 128;
+const unsigned int VIDEO_PLANES = 2;
+
+/**
+ * Words per display row in a bit-plane, each row holds VIDEO_MAX_WIDTH pixels with the leftmost in the top bit
+ */
+const unsigned int PLANE_ROW_WORDS = VIDEO_MAX_WIDTH / 64;
+
+/**
+ * XO-CHIP address space. CHIP-8 and SUPER-CHIP only use the first CLASSIC_MEMORY_SIZE bytes.
+ */
+const unsigned int MEMORY_SIZE = 0x10000;
+const unsigned int CLASSIC_MEMORY_SIZE = 0x1000;
+
+/**
+ * Granularity of tracking memory writes for ChipEight::resetFrom()
+ */
+const unsigned int MEMORY_PAGE_SIZE = 256;
+
+/**
+ * Instruction set the machine implements
+ */
+enum class ChipVariant : uint8_t
+{
+    Chip8,      // Original 64x32 CHIP-8
+    SuperChip,  // SUPER-CHIP 1.1: 128x64 mode, scrolling, 16x16 sprites, large font, flag registers
+    XoChip      // XO-CHIP: SUPER-CHIP plus two bit-planes, 64 KB memory and audio patterns
+};
+
+bool parseVariant(const std::string &text, ChipVariant &variant);
+
+const char *variantName(ChipVariant variant);
+
+/**
+ * Default host keys for the Chip-8 keypad, laid out as:
+ *   1 2 3 4        1 2 3 C
+ *   Q W E R   ->   4 5 6 D
+ *   A S D F        7 8 9 E
+ *   Z X C V        A 0 B F
+ */
+const SDL_Keycode DEFAULT_KEY_MAP[16] =
+        {
+                SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+                SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+                SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+                SDLK_4, SDLK_r, SDLK_f, SDLK_v
+        };
+
+/**
+ * Everything that changes while a ROM runs, so a machine can be saved and put back in a few microseconds.
+ * Only valid for the instance (or a clone of it) that saved it.
+ */
+struct ChipEightState
+{
+    std::default_random_engine randGen;
+    uint16_t opcode;
+    uint8_t registers[16];
+    uint16_t indexRegister;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delayRegister;
+    uint8_t soundRegister;
+    uint8_t keypad[16];
+    uint16_t stack[16];
+    uint8_t memory[MEMORY_SIZE];    // Only the variant's memory size is saved
+    uint64_t planes[VIDEO_PLANES][VIDEO_MAX_HEIGHT * PLANE_ROW_WORDS];
+    bool hires;
+    uint8_t planeMask;
+    uint8_t flagRegisters[16];
+    uint8_t audioPattern[16];
+    uint8_t pitch;
+    bool drawFlag;
+    uint8_t codeModified;
+};
+
 class ChipEight
 {
+    friend class Debugger;
+
 private:
     std::default_random_engine randGen;
     std::uniform_int_distribution<uint8_t> randByte;
@@ -65,17 +202,87 @@ private:
     uint8_t soundRegister{};
     uint8_t keypad[16]{};
     uint16_t stack[16]{};
-    uint8_t memory[4096]{};
+    uint8_t memory[MEMORY_SIZE]{};
+
+    // Pages of memory stored to since the last resetFrom(), one bit per MEMORY_PAGE_SIZE bytes. Stores that
+    // can't be tracked (compiled code, IR, or through getMemory()) make resetFrom() copy all of memory.
+    uint64_t dirtyPages[MEMORY_SIZE / MEMORY_PAGE_SIZE / 64]{};
+    bool memoryExposed = false;
+
+    // Display as bit-planes, the source of truth for video. Rows changed since video was last rebuilt are
+    // marked in dirtyRows.
+    uint64_t planes[VIDEO_PLANES][VIDEO_MAX_HEIGHT * PLANE_ROW_WORDS]{};
+    uint64_t dirtyRows{};
+    bool hires{};
+    uint8_t planeMask = 1;
+
+    // SUPER-CHIP/XO-CHIP state: FX75/FX85 flag registers, and the XO-CHIP audio pattern and pitch
+    uint8_t flagRegisters[16]{};
+    uint8_t audioPattern[16]{};
+    uint8_t pitch = 64;
+
+    ChipVariant variant = ChipVariant::Chip8;
+    unsigned int memorySize = CLASSIC_MEMORY_SIZE;
+
+    // Host key for each Chip-8 key
+    SDL_Keycode keyMap[16]{};
+
+    // Key events from processInputs(), applied by the next frame at the instructions matching their arrival
+    KeyQueue keyQueue;
+    std::vector<KeyChange> frameKeys;
+    bool subFrameInput = true;
+
+    // Window state from SDL window events, for throttling while nobody can see the window
+    bool windowVisible = true;
+    bool windowFocused = true;
+
+    // Copy of the loaded ROM, used by reset()
+    std::vector<uint8_t> rom;
 
     bool loadStoreQuirk;
     bool shiftQuirk;
+
+    // COSMAC VIP display wait: a sprite draw waits for the next vblank, so it ends the frame it is drawn in
+    bool displayWait = false;
+    bool waitingForVblank = false;
+    bool headless;
     Sound beeper;
     int cyclesPerTick;
 
+    // Frames run ahead of the real state leave the beeper alone
+    bool speculative = false;
+
+    // Ahead-of-time compiled version of the ROM, run in place of the interpreter where it can be
+    std::unique_ptr<CompiledCode> compiled;
+    const Chip8AotModule *compiledModule{};
+    Chip8AotState compiledState{};
+    const uint8_t *compiledCodeMap{};
+
+    // ROM lifted into optimised IR, the alternative to a compiled module that needs no build step
+    std::shared_ptr<const IrProgram> irProgram;
+
+    // Static analysis of the ROM, used to fast-forward through idle loops
+    std::shared_ptr<const RomAnalysis> analysis;
+    std::bitset<4096> idleLoopHeads;
+
     void OP_00E0();
 
     void OP_00EE();
 
+    void OP_00CN();
+
+    void OP_00DN();
+
+    void OP_00FB();
+
+    void OP_00FC();
+
+    void OP_00FD();
+
+    void OP_00FE();
+
+    void OP_00FF();
+
     void OP_1NNN();
 
     void OP_2NNN();
@@ -86,6 +293,10 @@ private:
 
     void OP_5XY0();
 
+    void OP_5XY2();
+
+    void OP_5XY3();
+
     void OP_6XKK();
 
     void OP_7XKK();
@@ -120,6 +331,12 @@ private:
 
     void OP_EX9E();
 
+    void OP_F000();
+
+    void OP_FN01();
+
+    void OP_F002();
+
     void OP_EXA1();
 
     void OP_FX07();
@@ -134,44 +351,184 @@ private:
 
     void OP_FX29();
 
+    void OP_FX30();
+
     void OP_FX33();
 
     void OP_FX55();
 
     void OP_FX65();
 
+    void OP_FX3A();
+
+    void OP_FX75();
+
+    void OP_FX85();
+
+    void skipNextInstruction();
+
+    void scrollVertical(int rows);
+
+    void scrollHorizontal(int pixels);
+
+    void setResolution(bool _hires);
+
+    void syncVideo();
+
     void executeOpCode();
 
+    void executeInstruction();
+
+    void runInstructions(int budget, bool frameStart);
+
+    void applyKeyChange(const KeyChange &change);
+
+    void handleEvent(const SDL_Event &event, bool &quit);
+
+    void executeCycleDebug(int budget);
+
+    void executeCycleTraced(int budget, bool frameStart);
+
+    void captureTraceMachine(TraceMachine &state) const;
+
+    void executeCycleCompiled(int budget);
+
+    void bindCompiledState(const uint8_t *codeMap);
+
+    void executeCycleAnalysed(int budget);
+
+    int skipIdleLoop(int budget);
+
+    void updateSound();
+
+    void setUpClone(ChipEight &clone) const;
+
+    void markAllPagesDirty();
 
 public:
 
     bool shouldRun;
     bool drawFlag;
 
-    // 32 bit int to work with SDL easier (could just be bool array
-    // as Chip8 video is monochrome (black + white))
-    uint32_t video[64 * 32]{};
+    // 32 bit int to work with SDL easier, rebuilt from the bit-planes at the end of each cycle. Rows are
+    // getVideoWidth() pixels long: 64x32 is laid out as it always was, 128x64 uses the whole buffer.
+    uint32_t video[VIDEO_MAX_WIDTH * VIDEO_MAX_HEIGHT]{};
 
     // SDL stuff
     SDL_Texture *texture{};
     SDL_Renderer *renderer{};
     SDL_Window *window{};
 
+    // CPU upscaler used instead of the renderer when presenting in software
+    std::unique_ptr<SoftwarePresenter> presenter;
+
+    // Optional debugger, only consulted while it has something armed
+    Debugger *debugger{};
+
+    // Optional input latency instrumentation, fed by the key and drawing instructions
+    LatencyProbe *latencyProbe{};
+
+    // Optional offline audio output, fed one frame at a time in emulated time
+    AudioRenderer *audioRenderer{};
+
+    // Optional instruction trace, recorded one instruction at a time on the interpreter
+    InstructionTraceWriter *instructionTrace{};
+
     void LoadROM(char const *path);
 
+    bool LoadROM(const uint8_t *data, size_t size);
+
+    bool reloadROM(const uint8_t *data, size_t size, bool keepState);
+
+    bool loadCompiled(const char *path);
+
+    bool setIrProgram(std::shared_ptr<const IrProgram> program);
+
+    void setAnalysis(std::shared_ptr<const RomAnalysis> _analysis);
+
+    void reset();
+
+    void setVariant(ChipVariant _variant);
+
+    ChipVariant getVariant() const;
+
+    unsigned int getVideoWidth() const;
+
+    unsigned int getVideoHeight() const;
+
+    void setDisplayWait(bool _displayWait);
+
+    bool getDisplayWait() const;
+
+    void seed(uint64_t seed);
+
+    void saveState(ChipEightState &state) const;
+
+    void loadState(const ChipEightState &state);
+
+    void setSpeculative(bool _speculative);
+
+    std::unique_ptr<ChipEight> cloneHeadless() const;
+
+    ChipEight *cloneHeadless(void *storage) const;
+
+    void resetFrom(const ChipEight &image);
+
+    uint16_t getKeypadMask() const;
+
+    void setKeypad(uint16_t mask);
+
+    void setKeyMap(const int32_t keys[16]);
+
+    void setSubFrameInput(bool _subFrameInput);
+
+    void applyKeyEvents();
+
+    int findKey(SDL_Keycode key) const;
+
+    uint8_t *getRegisters();
+
+    uint8_t *getMemory();
+
+    uint8_t *getKeypad();
+
+    uint16_t *getStack();
+
+    uint16_t *getPC();
+
+    uint16_t *getIndexRegister();
+
+    uint8_t *getStackPointer();
+
+    uint8_t *getDelayRegister();
+
+    uint8_t *getSoundRegister();
+
     void executeCycle();
 
+    void stepInstruction();
+
     void processInputs();
 
+    void waitForEvents(int timeout);
+
+    bool isWindowVisible() const;
+
+    bool isWindowFocused() const;
+
+    void stopSound();
+
     void updateScreen(const void *buffer, int pitch);
 
     void setupScreen(const char *title, unsigned int scale);
 
+    void setupScreen(const char *title, unsigned int scale, bool software, ScaleStyle style);
+
     void writeToMemory(int index, uint8_t value);
 
     void decrementTimers();
 
-    ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick);
+    ChipEight(bool _loadStoreQuirk, bool _shiftQuirk, int _cyclesPerTick, bool _headless = false);
 
     ~ChipEight();
 };
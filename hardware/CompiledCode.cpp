@@ -0,0 +1,79 @@
+#include "CompiledCode.h"
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+CompiledCode::~CompiledCode()
+{
+    unload();
+}
+
+/**
+ * Closes the library, if one is open
+ */
+void CompiledCode::unload()
+{
+    if (handle != nullptr)
+    {
+#ifdef _WIN32
+        FreeLibrary((HMODULE) handle);
+#else
+        dlclose(handle);
+#endif
+    }
+    handle = nullptr;
+    module = nullptr;
+}
+
+/**
+ * Opens a module and checks it was built against this version of the interface
+ * @param path Path to the shared library
+ * @return False if it couldn't be loaded or is from an incompatible version
+ */
+bool CompiledCode::load(const std::string &path)
+{
+    unload();
+
+#ifdef _WIN32
+    handle = (void *) LoadLibraryA(path.c_str());
+    Chip8AotEntry entry = handle != nullptr ? (Chip8AotEntry) GetProcAddress((HMODULE) handle, CHIP8_AOT_ENTRY) : nullptr;
+#else
+    // A bare file name would make dlopen search the library path instead of the current directory
+    std::string file = path.find('/') == std::string::npos ? "./" + path : path;
+    handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        std::cout << "Failed to load compiled ROM: " << dlerror() << std::endl;
+        return false;
+    }
+    auto entry = (Chip8AotEntry) dlsym(handle, CHIP8_AOT_ENTRY);
+#endif
+
+    if (entry == nullptr)
+    {
+        std::cout << "Not a compiled ROM module: " << path << std::endl;
+        unload();
+        return false;
+    }
+
+    module = entry();
+    if (module == nullptr || module->abiVersion != CHIP8_AOT_ABI_VERSION)
+    {
+        std::cout << "Compiled ROM was built for another version: " << path << std::endl;
+        unload();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return The loaded module, or nullptr
+ */
+const Chip8AotModule *CompiledCode::getModule() const
+{
+    return module;
+}
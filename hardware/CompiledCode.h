@@ -0,0 +1,32 @@
+#ifndef CHIP8_EMU_COMPILEDCODE_H
+#define CHIP8_EMU_COMPILEDCODE_H
+
+#include <string>
+#include "AotModule.h"
+
+/**
+ * A ROM module built from chip8_aot output, loaded as a shared library
+ */
+class CompiledCode
+{
+public:
+    CompiledCode() = default;
+
+    CompiledCode(const CompiledCode &) = delete;
+
+    CompiledCode &operator=(const CompiledCode &) = delete;
+
+    ~CompiledCode();
+
+    bool load(const std::string &path);
+
+    const Chip8AotModule *getModule() const;
+
+private:
+    void *handle = nullptr;
+    const Chip8AotModule *module = nullptr;
+
+    void unload();
+};
+
+#endif //CHIP8_EMU_COMPILEDCODE_H
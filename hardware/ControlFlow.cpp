@@ -0,0 +1,247 @@
+#include "ControlFlow.h"
+#include <algorithm>
+
+/**
+ * Whether executeOpCode() implements an opcode
+ * @param opcode Opcode to check
+ */
+bool ControlFlowGraph::isValidOpcode(uint16_t opcode)
+{
+    uint16_t low = opcode & 0x00FFu;
+    switch (opcode & 0xF000u)
+    {
+        case 0x0000:
+            return opcode == 0x00E0 || opcode == 0x00EE;
+        case 0x8000:
+        {
+            uint16_t lastNibble = opcode & 0x000Fu;
+            return lastNibble <= 0x7 || lastNibble == 0xE;
+        }
+        case 0xE000:
+            return low == 0x9E || low == 0xA1;
+        case 0xF000:
+            return low == 0x07 || low == 0x0A || low == 0x15 || low == 0x18 || low == 0x1E || low == 0x29 ||
+                   low == 0x33 || low == 0x55 || low == 0x65;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Whether an opcode stores to memory (FX33, FX55), which may overwrite code
+ * @param opcode Opcode to check
+ */
+bool ControlFlowGraph::writesMemory(uint16_t opcode)
+{
+    return (opcode & 0xF0FFu) == 0xF033 || (opcode & 0xF0FFu) == 0xF055;
+}
+
+/**
+ * Follows every path from the entry point and splits the code found into basic blocks
+ * @param memory Memory image, normally the font set and ROM as laid out by ChipEight
+ * @param size Size of the image
+ * @param entry Address execution starts at
+ */
+void ControlFlowGraph::build(const uint8_t *memory, size_t size, uint16_t entry)
+{
+    blocks.clear();
+    code.reset();
+
+    size = std::min<size_t>(size, 4096);
+    std::vector<uint8_t> leader(size, 0);
+    std::vector<uint8_t> visited(size, 0);
+    std::vector<uint16_t> pending{entry};
+
+    auto opcodeAt = [memory](uint16_t address)
+    {
+        return (uint16_t) ((memory[address] << 8u) | memory[address + 1]);
+    };
+
+    auto addTarget = [&](uint16_t address)
+    {
+        if (address < size)
+        {
+            leader[address] = 1;
+            pending.push_back(address);
+        }
+    };
+
+    if (entry < size)
+    {
+        leader[entry] = 1;
+    }
+
+    // Walk each path until it ends or joins code already seen, noting where blocks must start
+    while (!pending.empty())
+    {
+        uint16_t address = pending.back();
+        pending.pop_back();
+
+        while (address + 1u < size && !visited[address])
+        {
+            uint16_t opcode = opcodeAt(address);
+            if (!isValidOpcode(opcode))
+            {
+                break;
+            }
+
+            visited[address] = 1;
+            code[address] = true;
+            code[address + 1] = true;
+
+            uint16_t next = address + 2;
+            uint16_t family = opcode & 0xF000u;
+            uint16_t nnn = opcode & 0x0FFFu;
+            uint16_t low = opcode & 0x00FFu;
+
+            if (family == 0x1000)
+            {
+                addTarget(nnn);
+                break;
+            }
+            if (family == 0x2000)
+            {
+                addTarget(nnn);
+                addTarget(next);
+                break;
+            }
+            if (opcode == 0x00EE || family == 0xB000)
+            {
+                break;
+            }
+            if (family == 0x3000 || family == 0x4000 || family == 0x5000 || family == 0x9000 ||
+                family == 0xE000)
+            {
+                addTarget(next);
+                addTarget(next + 2);
+                break;
+            }
+            if ((family == 0xF000 && low == 0x0A) || writesMemory(opcode))
+            {
+                addTarget(next);
+                break;
+            }
+            address = next;
+        }
+    }
+
+    // Cut blocks at each leader, ending at the first exit or where the next block begins
+    for (size_t start = 0; start < size; start++)
+    {
+        if (!leader[start] || !visited[start])
+        {
+            continue;
+        }
+
+        BasicBlock block{(uint16_t) start, (uint16_t) start, BlockExit::Stop, 0};
+        uint16_t address = start;
+        while (true)
+        {
+            if (address + 1u >= size || !visited[address])
+            {
+                block.end = address;
+                block.exit = BlockExit::Stop;
+                break;
+            }
+
+            uint16_t opcode = opcodeAt(address);
+            uint16_t family = opcode & 0xF000u;
+            uint16_t next = address + 2;
+            block.end = next;
+
+            if (family == 0x1000)
+            {
+                block.exit = BlockExit::Jump;
+                block.target = opcode & 0x0FFFu;
+                break;
+            }
+            if (family == 0x2000)
+            {
+                block.exit = BlockExit::Call;
+                block.target = opcode & 0x0FFFu;
+                break;
+            }
+            if (opcode == 0x00EE)
+            {
+                block.exit = BlockExit::Return;
+                break;
+            }
+            if (family == 0xB000)
+            {
+                block.exit = BlockExit::Computed;
+                break;
+            }
+            if (family == 0x3000 || family == 0x4000 || family == 0x5000 || family == 0x9000 ||
+                family == 0xE000)
+            {
+                block.exit = BlockExit::Skip;
+                break;
+            }
+            if ((opcode & 0xF0FFu) == 0xF00A)
+            {
+                block.exit = BlockExit::WaitKey;
+                break;
+            }
+            if (writesMemory(opcode) || (next < size && leader[next]))
+            {
+                block.exit = BlockExit::Fallthrough;
+                break;
+            }
+            address = next;
+        }
+
+        if (block.end > block.start)
+        {
+            blocks.push_back(block);
+        }
+    }
+}
+
+/**
+ * Sets the graph to one built earlier, e.g. loaded from a cache
+ * @param _blocks Blocks sorted by start address
+ * @param _code Bytes covered by instructions
+ */
+void ControlFlowGraph::restore(std::vector<BasicBlock> _blocks, const std::bitset<4096> &_code)
+{
+    blocks = std::move(_blocks);
+    code = _code;
+}
+
+/**
+ * @return Blocks sorted by start address
+ */
+const std::vector<BasicBlock> &ControlFlowGraph::getBlocks() const
+{
+    return blocks;
+}
+
+/**
+ * @param start Address to look up
+ * @return Block starting at that address, or nullptr
+ */
+const BasicBlock *ControlFlowGraph::findBlock(uint16_t start) const
+{
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), start, [](const BasicBlock &block, uint16_t value)
+    {
+        return block.start < value;
+    });
+    return it != blocks.end() && it->start == start ? &*it : nullptr;
+}
+
+/**
+ * @param address Memory address
+ * @return True if a reachable instruction covers the byte
+ */
+bool ControlFlowGraph::isCode(uint16_t address) const
+{
+    return address < code.size() && code[address];
+}
+
+/**
+ * @return Bytes covered by a reachable instruction
+ */
+const std::bitset<4096> &ControlFlowGraph::getCode() const
+{
+    return code;
+}
@@ -0,0 +1,67 @@
+#ifndef CHIP8_EMU_CONTROLFLOW_H
+#define CHIP8_EMU_CONTROLFLOW_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * How control leaves a basic block
+ */
+enum class BlockExit
+{
+    Fallthrough,    // Runs into the next block (another block starts there, or after a memory store)
+    Jump,           // 1NNN to target
+    Call,           // 2NNN to target, returning to end
+    Return,         // 00EE, target comes from the stack
+    Skip,           // 3XKK/4XKK/5XY0/9XY0/EX9E/EXA1 to end or end + 2
+    Computed,       // BNNN, target only known at run time
+    WaitKey,        // FX0A, repeats until a key is down then continues at end
+    Stop            // Next instruction isn't valid code (unknown opcode or end of memory)
+};
+
+/**
+ * Instructions [start, end) that always run in sequence, the last one being the exit (except for Stop,
+ * where end is the invalid instruction)
+ */
+struct BasicBlock
+{
+    uint16_t start;
+    uint16_t end;
+    BlockExit exit;
+    uint16_t target;    // Jump and Call only
+};
+
+/**
+ * Control flow recovered statically from a memory image, by following every branch reachable from an
+ * entry point. Computed jumps (BNNN) and returns aren't followed beyond the return sites of calls, so
+ * code only reached that way isn't found.
+ */
+class ControlFlowGraph
+{
+public:
+    void build(const uint8_t *memory, size_t size, uint16_t entry);
+
+    void restore(std::vector<BasicBlock> _blocks, const std::bitset<4096> &_code);
+
+    const std::vector<BasicBlock> &getBlocks() const;
+
+    const BasicBlock *findBlock(uint16_t start) const;
+
+    bool isCode(uint16_t address) const;
+
+    const std::bitset<4096> &getCode() const;
+
+    static bool isValidOpcode(uint16_t opcode);
+
+    static bool writesMemory(uint16_t opcode);
+
+private:
+    std::vector<BasicBlock> blocks;
+
+    // Bytes covered by a decoded instruction
+    std::bitset<4096> code;
+};
+
+#endif //CHIP8_EMU_CONTROLFLOW_H
@@ -0,0 +1,588 @@
+#include "Debugger.h"
+#include "ChipEight.h"
+#include "Disassembler.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+/**
+ * Parses a hex number, accepting an optional 0x prefix
+ * @param token Text to parse
+ * @param value Parsed value
+ * @return True if the token was a valid number
+ */
+static bool parseHex(const std::string &token, unsigned long &value)
+{
+    try
+    {
+        size_t used = 0;
+        value = std::stoul(token, &used, 16);
+        return used == token.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+/**
+ * Parses a decimal number, such as the condition numbers "l" lists
+ * @param token Text to parse
+ * @param value Parsed value
+ * @return True if the token was a valid number
+ */
+static bool parseDecimal(const std::string &token, unsigned long &value)
+{
+    if (token.empty() || !isdigit((unsigned char) token[0]))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    value = strtoul(token.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * Parses a register name such as "V3", "vA" or "3"
+ * @param token Text to parse
+ * @param reg Parsed register index
+ * @return True if the token named a register
+ */
+static bool parseRegister(std::string token, uint8_t &reg)
+{
+    if (!token.empty() && (token[0] == 'V' || token[0] == 'v'))
+    {
+        token = token.substr(1);
+    }
+
+    unsigned long value;
+    if (!parseHex(token, value) || value > 0xF)
+    {
+        return false;
+    }
+    reg = value;
+    return true;
+}
+
+/**
+ * Adds a breakpoint on a program counter value
+ * @param address Address of the instruction to break on
+ */
+void Debugger::addBreakpoint(uint16_t address)
+{
+    if (!breakpoints[address])
+    {
+        breakpoints[address] = true;
+        ++breakpointCount;
+    }
+}
+
+/**
+ * Removes a breakpoint on a program counter value
+ * @param address Address of the breakpoint
+ */
+void Debugger::removeBreakpoint(uint16_t address)
+{
+    if (breakpoints[address])
+    {
+        breakpoints[address] = false;
+        --breakpointCount;
+    }
+}
+
+/**
+ * Adds a memory watchpoint, which breaks before an instruction that accesses the range
+ * @param address First address to watch
+ * @param length Number of bytes to watch
+ * @param onRead Break on reads (DXYN sprite fetches, FX65)
+ * @param onWrite Break on writes (FX33, FX55)
+ */
+void Debugger::addWatchpoint(uint16_t address, uint16_t length, bool onRead, bool onWrite)
+{
+    watchpoints.push_back({address, length, onRead, onWrite});
+}
+
+/**
+ * Removes every watchpoint starting at the given address
+ * @param address Start address of the watchpoint
+ */
+void Debugger::removeWatchpoint(uint16_t address)
+{
+    for (auto it = watchpoints.begin(); it != watchpoints.end();)
+    {
+        it = it->address == address ? watchpoints.erase(it) : it + 1;
+    }
+}
+
+/**
+ * Adds a breakpoint which triggers when a register comparison becomes true
+ * @param reg Register index (0x0 - 0xF)
+ * @param comparison Comparison to apply
+ * @param value Value to compare the register against
+ */
+void Debugger::addRegisterCondition(uint8_t reg, Comparison comparison, uint8_t value)
+{
+    conditions.push_back({reg, comparison, value, false});
+}
+
+/**
+ * Removes a register condition
+ * @param index Position of the condition as printed by the "list" command
+ */
+void Debugger::removeRegisterCondition(size_t index)
+{
+    if (index < conditions.size())
+    {
+        conditions.erase(conditions.begin() + index);
+    }
+}
+
+/**
+ * Stops execution before the next instruction
+ */
+void Debugger::requestBreak()
+{
+    breakRequested = true;
+}
+
+/**
+ * Whether anything is armed - the Chip-8 only uses its instrumented loop while this is true
+ * @return True if the debugger needs to inspect every instruction
+ */
+bool Debugger::isActive() const
+{
+    return breakRequested || stepsRemaining > 0 || runningToReturn || breakpointCount > 0 ||
+           !watchpoints.empty() || !conditions.empty();
+}
+
+/**
+ * Checks if the instruction about to be executed touches a watched memory range
+ * @param chip Chip-8 being debugged
+ * @param opcode Instruction about to be executed
+ * @return True if a watchpoint was hit
+ */
+bool Debugger::checkWatchpoints(const ChipEight &chip, uint16_t opcode)
+{
+    // Work out which bytes the instruction will read or write from its encoding
+    uint16_t x = (opcode & 0x0F00u) >> 8u;
+    uint16_t start = chip.indexRegister;
+    uint16_t length = 0;
+    bool isWrite = false;
+
+    bool xoChip = chip.variant == ChipVariant::XoChip;
+    if ((opcode & 0xF000u) == 0xD000)
+    {
+        // DXY0 is a 16x16 sprite of 32 bytes outside CHIP-8, and each selected plane reads its own sprite
+        bool large = (opcode & 0x000Fu) == 0 && chip.variant != ChipVariant::Chip8;
+        unsigned int planes = ((chip.planeMask & 1u) != 0) + ((chip.planeMask & 2u) != 0);
+        length = (large ? 32 : opcode & 0x000Fu) * planes;
+    }
+    else if (xoChip && (opcode & 0xF00Fu) == 0x5002)
+    {
+        length = std::abs((int) x - (int) ((opcode & 0x00F0u) >> 4u)) + 1;
+        isWrite = true;
+    }
+    else if (xoChip && (opcode & 0xF00Fu) == 0x5003)
+    {
+        length = std::abs((int) x - (int) ((opcode & 0x00F0u) >> 4u)) + 1;
+    }
+    else if (xoChip && opcode == 0xF000)
+    {
+        // The 16-bit address follows the instruction
+        start = chip.pc + 2;
+        length = 2;
+    }
+    else if (xoChip && opcode == 0xF002)
+    {
+        length = sizeof(chip.audioPattern);
+    }
+    else if ((opcode & 0xF0FFu) == 0xF065)
+    {
+        length = x + 1;
+    }
+    else if ((opcode & 0xF0FFu) == 0xF055)
+    {
+        length = x + 1;
+        isWrite = true;
+    }
+    else if ((opcode & 0xF0FFu) == 0xF033)
+    {
+        length = 3;
+        isWrite = true;
+    }
+
+    if (length == 0)
+    {
+        return false;
+    }
+
+    for (const Watchpoint &watch : watchpoints)
+    {
+        bool wanted = isWrite ? watch.onWrite : watch.onRead;
+        if (wanted && start < watch.address + watch.length && watch.address < start + length)
+        {
+            std::ostringstream text;
+            text << "watchpoint " << std::hex << std::uppercase << "0x" << watch.address << ": "
+                 << (isWrite ? "write" : "read") << " of 0x" << start << "-0x" << (start + length - 1);
+            reason = text.str();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Called by the instrumented loop before each instruction
+ * @param chip Chip-8 being debugged
+ * @return True if execution should stop and enter the console
+ */
+bool Debugger::shouldBreak(const ChipEight &chip)
+{
+    uint16_t pc = chip.pc;
+    bool stop = false;
+
+    if (breakRequested)
+    {
+        breakRequested = false;
+        reason = "break";
+        stop = true;
+    }
+
+    if (stepsRemaining > 0 && --stepsRemaining == 0)
+    {
+        reason = "step";
+        stop = true;
+    }
+
+    if (runningToReturn && chip.sp <= returnDepth && (!matchReturnAddress || pc == returnAddress))
+    {
+        runningToReturn = false;
+        reason = "step";
+        stop = true;
+    }
+
+    if (breakpoints[pc])
+    {
+        std::ostringstream text;
+        text << "breakpoint 0x" << std::hex << std::uppercase << pc;
+        reason = text.str();
+        stop = true;
+    }
+
+    // Conditions are edge triggered, otherwise they would fire on every instruction while true
+    for (size_t i = 0; i < conditions.size(); i++)
+    {
+        RegisterCondition &condition = conditions[i];
+        uint8_t value = chip.registers[condition.reg];
+        bool isTrue = false;
+        switch (condition.comparison)
+        {
+            case Comparison::Equal:
+                isTrue = value == condition.value;
+                break;
+            case Comparison::NotEqual:
+                isTrue = value != condition.value;
+                break;
+            case Comparison::Less:
+                isTrue = value < condition.value;
+                break;
+            case Comparison::Greater:
+                isTrue = value > condition.value;
+                break;
+        }
+
+        if (isTrue && !condition.wasTrue)
+        {
+            reason = "condition " + std::to_string(i);
+            stop = true;
+        }
+        condition.wasTrue = isTrue;
+    }
+
+    if (!watchpoints.empty())
+    {
+        uint16_t opcode = (chip.memory[pc] << 8u) | chip.memory[(pc + 1) & 0xFFFFu];
+        stop |= checkWatchpoints(chip, opcode);
+    }
+
+    return stop;
+}
+
+/**
+ * Prints registers, timers, stack and the next instruction
+ * @param chip Chip-8 being debugged
+ */
+void Debugger::printState(const ChipEight &chip) const
+{
+    std::cout << std::hex << std::uppercase << std::setfill('0');
+    for (int i = 0; i < 16; i++)
+    {
+        std::cout << "V" << i << "=" << std::setw(2) << (int) chip.registers[i] << (i % 8 == 7 ? "\n" : " ");
+    }
+    std::cout << "I=" << std::setw(3) << chip.indexRegister << " PC=" << std::setw(3) << chip.pc
+              << " SP=" << (int) chip.sp << " DT=" << std::setw(2) << (int) chip.delayRegister
+              << " ST=" << std::setw(2) << (int) chip.soundRegister << "\nstack:";
+    for (int i = 0; i < chip.sp; i++)
+    {
+        std::cout << " " << std::setw(3) << chip.stack[i];
+    }
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+    printDisassembly(chip, chip.pc, 1);
+}
+
+/**
+ * Hex dumps a range of memory
+ * @param chip Chip-8 being debugged
+ * @param address First byte to print
+ * @param length Number of bytes to print
+ */
+void Debugger::printMemory(const ChipEight &chip, uint16_t address, uint16_t length) const
+{
+    std::cout << std::hex << std::uppercase << std::setfill('0');
+    for (unsigned int i = 0; i < length && address + i < chip.memorySize; i++)
+    {
+        if (i % 16 == 0)
+        {
+            std::cout << (i ? "\n" : "") << std::setw(3) << address + i << ":";
+        }
+        std::cout << " " << std::setw(2) << (int) chip.memory[address + i];
+    }
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+}
+
+/**
+ * Prints disassembled instructions
+ * @param chip Chip-8 being debugged
+ * @param address Address of the first instruction
+ * @param count Number of instructions to print
+ */
+void Debugger::printDisassembly(const ChipEight &chip, uint16_t address, unsigned int count) const
+{
+    std::cout << std::hex << std::uppercase << std::setfill('0');
+    for (unsigned int i = 0; i < count && address + 1u < chip.memorySize; i++, address += 2)
+    {
+        uint16_t opcode = (chip.memory[address] << 8u) | chip.memory[address + 1];
+        std::cout << (address == chip.pc ? "=> " : "   ") << std::setw(3) << address << ": " << std::setw(4)
+                  << opcode << "  " << disassemble(opcode) << "\n";
+    }
+    std::cout << std::dec << std::setfill(' ') << std::flush;
+}
+
+/**
+ * Lists all breakpoints, watchpoints and register conditions
+ */
+void Debugger::printBreakpoints() const
+{
+    std::cout << std::hex << std::uppercase;
+    for (size_t address = 0; address < breakpoints.size(); address++)
+    {
+        if (breakpoints[address])
+        {
+            std::cout << "break 0x" << address << "\n";
+        }
+    }
+    for (const Watchpoint &watch : watchpoints)
+    {
+        std::cout << "watch 0x" << watch.address << " len 0x" << watch.length << (watch.onRead ? " r" : "")
+                  << (watch.onWrite ? " w" : "") << "\n";
+    }
+    static const char *const comparisonNames[] = {"==", "!=", "<", ">"};
+    for (size_t i = 0; i < conditions.size(); i++)
+    {
+        std::cout << std::dec << "cond " << i << ": V" << std::hex << (int) conditions[i].reg << " "
+                  << comparisonNames[(int) conditions[i].comparison] << " 0x" << (int) conditions[i].value << "\n";
+    }
+    std::cout << std::dec << std::flush;
+}
+
+/**
+ * Text console which runs when execution stops. Blocks until the user continues, steps or quits.
+ * @param chip Chip-8 being debugged
+ */
+void Debugger::console(ChipEight &chip)
+{
+    // Any other stop cancels a pending step
+    stepsRemaining = 0;
+    runningToReturn = false;
+
+    std::cout << "Stopped (" << reason << ")" << std::endl;
+    printState(chip);
+
+    std::string line;
+    while (std::cout << "(c8db) " << std::flush && std::getline(std::cin, line))
+    {
+        std::istringstream input(line);
+        std::string command, arg1, arg2, arg3;
+        input >> command >> arg1 >> arg2 >> arg3;
+        unsigned long value = 0, length = 0;
+
+        if (command.empty())
+        {
+            continue;
+        }
+        else if (command == "c" || command == "continue")
+        {
+            return;
+        }
+        else if (command == "s" || command == "step")
+        {
+            stepsRemaining = 1;
+            if (!arg1.empty() && parseHex(arg1, value) && value > 0)
+            {
+                stepsRemaining = value;
+            }
+            return;
+        }
+        else if (command == "n" || command == "next")
+        {
+            // Step over a CALL by running until the stack returns to this depth at the following instruction
+            uint16_t opcode = (chip.memory[chip.pc] << 8u) | chip.memory[(chip.pc + 1) & 0xFFFFu];
+            if ((opcode & 0xF000u) == 0x2000)
+            {
+                runningToReturn = true;
+                matchReturnAddress = true;
+                returnDepth = chip.sp;
+                returnAddress = chip.pc + 2;
+            }
+            else
+            {
+                stepsRemaining = 1;
+            }
+            return;
+        }
+        else if (command == "f" || command == "finish")
+        {
+            // Step out by running until the RET of the current subroutine
+            if (chip.sp == 0)
+            {
+                std::cout << "Not inside a subroutine" << std::endl;
+                continue;
+            }
+            runningToReturn = true;
+            matchReturnAddress = false;
+            returnDepth = chip.sp - 1;
+            return;
+        }
+        else if ((command == "b" || command == "break") && parseHex(arg1, value))
+        {
+            addBreakpoint(value);
+        }
+        else if ((command == "db" || command == "delete") && parseHex(arg1, value))
+        {
+            removeBreakpoint(value);
+        }
+        else if ((command == "w" || command == "watch") && parseHex(arg1, value))
+        {
+            if (arg2.empty() || !parseHex(arg2, length) || length == 0)
+            {
+                length = 1;
+            }
+            bool onRead = arg3.empty() || arg3.find('r') != std::string::npos;
+            bool onWrite = arg3.empty() || arg3.find('w') != std::string::npos;
+            addWatchpoint(value, length, onRead, onWrite);
+        }
+        else if ((command == "dw" || command == "unwatch") && parseHex(arg1, value))
+        {
+            removeWatchpoint(value);
+        }
+        else if (command == "cond")
+        {
+            uint8_t reg;
+            Comparison comparison;
+            if (arg2 == "==")
+            {
+                comparison = Comparison::Equal;
+            }
+            else if (arg2 == "!=")
+            {
+                comparison = Comparison::NotEqual;
+            }
+            else if (arg2 == "<")
+            {
+                comparison = Comparison::Less;
+            }
+            else if (arg2 == ">")
+            {
+                comparison = Comparison::Greater;
+            }
+            else
+            {
+                std::cout << "Usage: cond V<x> <==|!=|<|>> <hex value>" << std::endl;
+                continue;
+            }
+
+            if (!parseRegister(arg1, reg) || !parseHex(arg3, value) || value > 0xFF)
+            {
+                std::cout << "Usage: cond V<x> <==|!=|<|>> <hex value>" << std::endl;
+                continue;
+            }
+            addRegisterCondition(reg, comparison, value);
+        }
+        else if (command == "dc" && !arg1.empty())
+        {
+            unsigned long index;
+            if (!parseDecimal(arg1, index))
+            {
+                std::cout << "Usage: dc <n>" << std::endl;
+                continue;
+            }
+            removeRegisterCondition(index);
+        }
+        else if (command == "l" || command == "list")
+        {
+            printBreakpoints();
+        }
+        else if (command == "r" || command == "regs")
+        {
+            printState(chip);
+        }
+        else if ((command == "x" || command == "mem") && parseHex(arg1, value))
+        {
+            if (arg2.empty() || !parseHex(arg2, length))
+            {
+                length = 16;
+            }
+            printMemory(chip, value, length);
+        }
+        else if (command == "dis")
+        {
+            if (arg1.empty() || !parseHex(arg1, value))
+            {
+                value = chip.pc;
+            }
+            if (arg2.empty() || !parseHex(arg2, length))
+            {
+                length = 8;
+            }
+            printDisassembly(chip, value, length);
+        }
+        else if (command == "q" || command == "quit")
+        {
+            chip.shouldRun = false;
+            return;
+        }
+        else
+        {
+            std::cout << "Commands (numbers are hex):\n"
+                         "  c                      continue\n"
+                         "  s [n]                  step n instructions\n"
+                         "  n                      step over CALL\n"
+                         "  f                      run until RET of the current subroutine\n"
+                         "  b <addr> / db <addr>   add/delete PC breakpoint\n"
+                         "  w <addr> [len] [r|w|rw] / dw <addr>   add/delete memory watchpoint\n"
+                         "  cond V<x> <op> <val> / dc <n>         add/delete register condition\n"
+                         "  l                      list breakpoints\n"
+                         "  r                      show registers\n"
+                         "  x <addr> [len]         dump memory\n"
+                         "  dis [addr] [count]     disassemble\n"
+                         "  q                      quit emulator" << std::endl;
+        }
+    }
+
+    // stdin closed - nothing else can control the debugger, so stop the emulator
+    chip.shouldRun = false;
+}
@@ -0,0 +1,101 @@
+#ifndef CHIP8_EMU_DEBUGGER_H
+#define CHIP8_EMU_DEBUGGER_H
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ChipEight;
+
+/**
+ * Interactive debugger with PC breakpoints, memory watchpoints, register conditions and stepping.
+ *
+ * The Chip-8 only switches to its instrumented instruction loop while isActive() returns true, so an
+ * attached debugger with nothing armed costs a single branch per tick.
+ */
+class Debugger
+{
+public:
+    /**
+     * Comparison used by a register condition breakpoint
+     */
+    enum class Comparison
+    {
+        Equal, NotEqual, Less, Greater
+    };
+
+    /**
+     * Breaks when a register comparison becomes true (e.g. V3 == 0x05)
+     */
+    struct RegisterCondition
+    {
+        uint8_t reg;
+        Comparison comparison;
+        uint8_t value;
+        bool wasTrue;
+    };
+
+    /**
+     * Breaks when an instruction reads and/or writes memory in [address, address + length)
+     */
+    struct Watchpoint
+    {
+        uint16_t address;
+        uint16_t length;
+        bool onRead;
+        bool onWrite;
+    };
+
+    void addBreakpoint(uint16_t address);
+
+    void removeBreakpoint(uint16_t address);
+
+    void addWatchpoint(uint16_t address, uint16_t length, bool onRead, bool onWrite);
+
+    void removeWatchpoint(uint16_t address);
+
+    void addRegisterCondition(uint8_t reg, Comparison comparison, uint8_t value);
+
+    void removeRegisterCondition(size_t index);
+
+    void requestBreak();
+
+    bool isActive() const;
+
+    bool shouldBreak(const ChipEight &chip);
+
+    void console(ChipEight &chip);
+
+private:
+    // One per PC value, which covers XO-CHIP's 64 KB
+    std::bitset<0x10000> breakpoints;
+    size_t breakpointCount = 0;
+    std::vector<Watchpoint> watchpoints;
+    std::vector<RegisterCondition> conditions;
+
+    bool breakRequested = false;
+
+    // Remaining instructions for "step", 0 when not stepping
+    unsigned int stepsRemaining = 0;
+
+    // Step over/out target: break once sp drops back to this depth (and pc matches, for step over)
+    bool runningToReturn = false;
+    uint8_t returnDepth = 0;
+    uint16_t returnAddress = 0;
+    bool matchReturnAddress = false;
+
+    std::string reason;
+
+    bool checkWatchpoints(const ChipEight &chip, uint16_t opcode);
+
+    void printState(const ChipEight &chip) const;
+
+    void printMemory(const ChipEight &chip, uint16_t address, uint16_t length) const;
+
+    void printDisassembly(const ChipEight &chip, uint16_t address, unsigned int count) const;
+
+    void printBreakpoints() const;
+};
+
+#endif //CHIP8_EMU_DEBUGGER_H
@@ -0,0 +1,197 @@
+#include "Disassembler.h"
+#include <cstdio>
+
+/**
+ * Converts an opcode into its assembly mnemonic (e.g. 0x6A05 -> "LD VA, 0x05")
+ * @param opcode Opcode to disassemble
+ * @return Human readable form of the opcode, or "DW 0x...." if it isn't an instruction
+ */
+std::string disassemble(uint16_t opcode)
+{
+    char text[32];
+    unsigned int x = (opcode & 0x0F00u) >> 8u;
+    unsigned int y = (opcode & 0x00F0u) >> 4u;
+    unsigned int n = opcode & 0x000Fu;
+    unsigned int kk = opcode & 0x00FFu;
+    unsigned int nnn = opcode & 0x0FFFu;
+
+    switch (opcode & 0xF000u)
+    {
+        case 0x0000:
+            if (opcode == 0x00E0)
+            {
+                return "CLS";
+            }
+            if (opcode == 0x00EE)
+            {
+                return "RET";
+            }
+            // SUPER-CHIP and XO-CHIP
+            if ((opcode & 0xFFF0u) == 0x00C0 || (opcode & 0xFFF0u) == 0x00D0)
+            {
+                snprintf(text, sizeof(text), "%s %u", (opcode & 0xFFF0u) == 0x00C0 ? "SCD" : "SCU", n);
+                return text;
+            }
+            switch (opcode)
+            {
+                case 0x00FB:
+                    return "SCR";
+                case 0x00FC:
+                    return "SCL";
+                case 0x00FD:
+                    return "EXIT";
+                case 0x00FE:
+                    return "LOW";
+                case 0x00FF:
+                    return "HIGH";
+                default:
+                    break;
+            }
+            break;
+        case 0x1000:
+            snprintf(text, sizeof(text), "JP 0x%03X", nnn);
+            return text;
+        case 0x2000:
+            snprintf(text, sizeof(text), "CALL 0x%03X", nnn);
+            return text;
+        case 0x3000:
+            snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, kk);
+            return text;
+        case 0x4000:
+            snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, kk);
+            return text;
+        case 0x5000:
+            if (n == 0)
+            {
+                snprintf(text, sizeof(text), "SE V%X, V%X", x, y);
+                return text;
+            }
+            if (n == 2 || n == 3)
+            {
+                snprintf(text, sizeof(text), n == 2 ? "LD [I], V%X-V%X" : "LD V%X-V%X, [I]", x, y);
+                return text;
+            }
+            break;
+        case 0x6000:
+            snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, kk);
+            return text;
+        case 0x7000:
+            snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, kk);
+            return text;
+        case 0x8000:
+        {
+            static const char *const aluNames[16] = {"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                                                     nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL",
+                                                     nullptr};
+            if (aluNames[n] != nullptr)
+            {
+                snprintf(text, sizeof(text), "%s V%X, V%X", aluNames[n], x, y);
+                return text;
+            }
+        }
+            break;
+        case 0x9000:
+            if (n == 0)
+            {
+                snprintf(text, sizeof(text), "SNE V%X, V%X", x, y);
+                return text;
+            }
+            break;
+        case 0xA000:
+            snprintf(text, sizeof(text), "LD I, 0x%03X", nnn);
+            return text;
+        case 0xB000:
+            snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn);
+            return text;
+        case 0xC000:
+            snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, kk);
+            return text;
+        case 0xD000:
+            snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n);
+            return text;
+        case 0xE000:
+            if (kk == 0x9E)
+            {
+                snprintf(text, sizeof(text), "SKP V%X", x);
+                return text;
+            }
+            if (kk == 0xA1)
+            {
+                snprintf(text, sizeof(text), "SKNP V%X", x);
+                return text;
+            }
+            break;
+        case 0xF000:
+        {
+            if (opcode == 0xF000)
+            {
+                return "LD I, LONG";
+            }
+            if (opcode == 0xF002)
+            {
+                return "AUDIO";
+            }
+            if (kk == 0x01)
+            {
+                snprintf(text, sizeof(text), "PLANE %u", x);
+                return text;
+            }
+            const char *format = nullptr;
+            switch (kk)
+            {
+                case 0x07:
+                    format = "LD V%X, DT";
+                    break;
+                case 0x0A:
+                    format = "LD V%X, K";
+                    break;
+                case 0x15:
+                    format = "LD DT, V%X";
+                    break;
+                case 0x18:
+                    format = "LD ST, V%X";
+                    break;
+                case 0x1E:
+                    format = "ADD I, V%X";
+                    break;
+                case 0x29:
+                    format = "LD F, V%X";
+                    break;
+                case 0x30:
+                    format = "LD HF, V%X";
+                    break;
+                case 0x33:
+                    format = "LD B, V%X";
+                    break;
+                case 0x3A:
+                    format = "PITCH V%X";
+                    break;
+                case 0x55:
+                    format = "LD [I], V%X";
+                    break;
+                case 0x65:
+                    format = "LD V%X, [I]";
+                    break;
+                case 0x75:
+                    format = "LD R, V%X";
+                    break;
+                case 0x85:
+                    format = "LD V%X, R";
+                    break;
+                default:
+                    break;
+            }
+            if (format != nullptr)
+            {
+                snprintf(text, sizeof(text), format, x);
+                return text;
+            }
+        }
+            break;
+        default:
+            break;
+    }
+
+    snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+    return text;
+}
@@ -0,0 +1,14 @@
+#ifndef CHIP8_EMU_DISASSEMBLER_H
+#define CHIP8_EMU_DISASSEMBLER_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Converts an opcode into its assembly mnemonic (e.g. 0x6A05 -> "LD VA, 0x05")
+ * @param opcode Opcode to disassemble
+ * @return Human readable form of the opcode, or "DW 0x...." if it isn't an instruction
+ */
+std::string disassemble(uint16_t opcode);
+
+#endif //CHIP8_EMU_DISASSEMBLER_H
@@ -0,0 +1,80 @@
+#include "InstancePool.h"
+#include <algorithm>
+#include <new>
+
+// Instances start on their own cache lines, so threads stepping neighbours don't share any
+static const size_t CACHE_LINE_SIZE = 64;
+
+InstancePool::InstancePool(std::unique_ptr<ChipEight> _image, size_t _capacity) : image(std::move(_image)),
+    stride((sizeof(ChipEight) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+{
+    arena = ::operator new(stride * _capacity, std::align_val_t(CACHE_LINE_SIZE));
+    available.reserve(_capacity);
+    for (; instanceCount < _capacity; instanceCount++)
+    {
+        ChipEight *instance = image->cloneHeadless((uint8_t *) arena + instanceCount * stride);
+        instance->resetFrom(*image);
+        available.push_back(instance);
+    }
+
+    // Handed out from the front of the arena first
+    std::reverse(available.begin(), available.end());
+}
+
+InstancePool::~InstancePool()
+{
+    for (size_t i = 0; i < instanceCount; i++)
+    {
+        get(i).~ChipEight();
+    }
+    ::operator delete(arena, std::align_val_t(CACHE_LINE_SIZE));
+}
+
+/**
+ * @return An instance in the template's state, or nullptr if all of them are in use
+ */
+ChipEight *InstancePool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (available.empty())
+    {
+        return nullptr;
+    }
+    ChipEight *instance = available.back();
+    available.pop_back();
+    return instance;
+}
+
+/**
+ * Puts an instance back into the template's state and makes it available again
+ * @param instance From acquire()
+ */
+void InstancePool::release(ChipEight *instance)
+{
+    reset(*instance);
+    std::lock_guard<std::mutex> lock(mutex);
+    available.push_back(instance);
+}
+
+/**
+ * Puts an instance back into the template's state, keeping it in use. Instances can be reset from different
+ * threads at once.
+ * @param instance One of the pool's instances
+ */
+void InstancePool::reset(ChipEight &instance) const
+{
+    instance.resetFrom(*image);
+}
+
+/**
+ * @param index 0 to capacity() - 1, in arena order whether or not the instance is in use
+ */
+ChipEight &InstancePool::get(size_t index)
+{
+    return *(ChipEight *) ((uint8_t *) arena + index * stride);
+}
+
+size_t InstancePool::capacity() const
+{
+    return instanceCount;
+}
@@ -0,0 +1,51 @@
+#ifndef CHIP8_EMU_INSTANCEPOOL_H
+#define CHIP8_EMU_INSTANCEPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ChipEight.h"
+
+/**
+ * Headless instances of one ROM, all created up front in a single cache line aligned block. A template
+ * instance is set up once (ROM loaded, analysis attached) and never run; handing an instance out again copies
+ * the template's state into it with ChipEight::resetFrom(), which only rewrites the memory pages it stored to,
+ * instead of constructing a new one or clearing and reloading it with reset().
+ */
+class InstancePool
+{
+public:
+    /**
+     * @param _image Template every instance starts from and goes back to, set up with its ROM
+     * @param _capacity Instances to create
+     */
+    InstancePool(std::unique_ptr<ChipEight> _image, size_t _capacity);
+
+    ~InstancePool();
+
+    InstancePool(const InstancePool &) = delete;
+
+    InstancePool &operator=(const InstancePool &) = delete;
+
+    ChipEight *acquire();
+
+    void release(ChipEight *instance);
+
+    void reset(ChipEight &instance) const;
+
+    ChipEight &get(size_t index);
+
+    size_t capacity() const;
+
+private:
+    std::unique_ptr<ChipEight> image;
+    size_t instanceCount = 0;
+    size_t stride;
+    void *arena = nullptr;
+
+    std::mutex mutex;
+    std::vector<ChipEight *> available;
+};
+
+#endif //CHIP8_EMU_INSTANCEPOOL_H
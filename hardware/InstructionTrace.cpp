@@ -0,0 +1,774 @@
+#include "InstructionTrace.h"
+#include "../frontend/Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(InstructionTraceHeader) == 64, "trace header layout");
+
+// Record flags: what follows the flags byte and opcode
+static const uint8_t RECORD_JUMP = 0x01;        // u16 PC after the instruction, when it isn't PC + 2
+static const uint8_t RECORD_REGISTERS = 0x02;   // u16 mask of changed V registers, then their new values
+static const uint8_t RECORD_INDEX = 0x04;       // u16 new I
+static const uint8_t RECORD_SP = 0x08;          // u8 new SP
+static const uint8_t RECORD_DELAY = 0x10;       // u8 delay timer set by the instruction
+static const uint8_t RECORD_SOUND = 0x20;       // u8 sound timer set by the instruction
+static const uint8_t RECORD_MEMORY = 0x40;      // u16 address, u8 count, bytes stored
+static const uint8_t RECORD_FRAME = 0x80;       // first instruction of a frame, timers ticked before it
+
+// Compression: sequences of literals followed by a match in the previous 64 KB, LZ4 style
+static const size_t MIN_MATCH = 4;
+static const unsigned int HASH_BITS = 14;
+
+static void putLength(std::vector<uint8_t> &output, size_t length)
+{
+    while (length >= 255)
+    {
+        output.push_back(255);
+        length -= 255;
+    }
+    output.push_back((uint8_t) length);
+}
+
+/**
+ * Compresses a block on its own, so every chunk can be decompressed without the ones before it
+ * @param input Data to compress
+ * @param size Size of the data
+ * @param output Compressed data
+ * @return Compressed size
+ */
+size_t compressTrace(const uint8_t *input, size_t size, std::vector<uint8_t> &output)
+{
+    output.clear();
+    std::vector<int64_t> table((size_t) 1 << HASH_BITS, -1);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + MIN_MATCH <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, input + i, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        int64_t candidate = table[hash];
+        table[hash] = (int64_t) i;
+        if (candidate < 0 || i - candidate > 0xFFFF || memcmp(input + candidate, input + i, MIN_MATCH) != 0)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t length = MIN_MATCH;
+        while (i + length < size && input[candidate + length] == input[i + length])
+        {
+            ++length;
+        }
+
+        size_t literals = i - anchor;
+        size_t extra = length - MIN_MATCH;
+        output.push_back((uint8_t) (std::min<size_t>(literals, 15) << 4u | std::min<size_t>(extra, 15)));
+        if (literals >= 15)
+        {
+            putLength(output, literals - 15);
+        }
+        output.insert(output.end(), input + anchor, input + i);
+        size_t distance = i - candidate;
+        output.push_back(distance & 0xFFu);
+        output.push_back(distance >> 8u);
+        if (extra >= 15)
+        {
+            putLength(output, extra - 15);
+        }
+
+        i += length;
+        anchor = i;
+    }
+
+    // Whatever is left goes out as literals with no match
+    size_t literals = size - anchor;
+    output.push_back((uint8_t) (std::min<size_t>(literals, 15) << 4u));
+    if (literals >= 15)
+    {
+        putLength(output, literals - 15);
+    }
+    output.insert(output.end(), input + anchor, input + size);
+    return output.size();
+}
+
+/**
+ * @param input Data from compressTrace()
+ * @param size Its size
+ * @param output Buffer for the original data
+ * @param outputSize Original size
+ * @return False if the data is corrupt
+ */
+bool decompressTrace(const uint8_t *input, size_t size, uint8_t *output, size_t outputSize)
+{
+    const uint8_t *end = input + size;
+    size_t written = 0;
+    auto getLength = [&input, end](size_t &length)
+    {
+        uint8_t byte;
+        do
+        {
+            if (input >= end)
+            {
+                return false;
+            }
+            byte = *input++;
+            length += byte;
+        }
+        while (byte == 255);
+        return true;
+    };
+
+    while (input < end)
+    {
+        uint8_t token = *input++;
+        size_t literals = token >> 4u;
+        if (literals == 15 && !getLength(literals))
+        {
+            return false;
+        }
+        if (literals > (size_t) (end - input) || literals > outputSize - written)
+        {
+            return false;
+        }
+        memcpy(output + written, input, literals);
+        input += literals;
+        written += literals;
+        if (input == end)
+        {
+            break;
+        }
+
+        if (end - input < 2)
+        {
+            return false;
+        }
+        size_t distance = input[0] | (size_t) input[1] << 8u;
+        input += 2;
+        size_t length = token & 0x0Fu;
+        if (length == 15 && !getLength(length))
+        {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (distance == 0 || distance > written || length > outputSize - written)
+        {
+            return false;
+        }
+
+        // Byte by byte, matches may overlap what they produce
+        for (size_t i = 0; i < length; i++, written++)
+        {
+            output[written] = output[written - distance];
+        }
+    }
+    return written == outputSize;
+}
+
+InstructionTraceWriter::InstructionTraceWriter(std::string _path, uint64_t _romHash, uint32_t _cyclesPerTick)
+        : path(std::move(_path)),
+          romHash(_romHash),
+          cyclesPerTick(_cyclesPerTick)
+{
+}
+
+InstructionTraceWriter::~InstructionTraceWriter()
+{
+    close();
+}
+
+/**
+ * Creates the file and starts the writer thread
+ * @return False if the file couldn't be created
+ */
+bool InstructionTraceWriter::open()
+{
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cout << "ERROR: Couldn't create instruction trace: " << path << std::endl;
+        return false;
+    }
+
+    // Counts and the index offset are filled in by close()
+    InstructionTraceHeader header{};
+    fwrite(&header, sizeof(header), 1, file);
+    offset = sizeof(header);
+    current.header.instructions = 0;
+    writer = std::thread(&InstructionTraceWriter::writerLoop, this);
+    return true;
+}
+
+/**
+ * Adds one executed instruction
+ * @param before State before it ran
+ * @param opcode The instruction
+ * @param after State after it ran
+ * @param memory Machine memory after it ran, for the bytes it stored
+ * @param memorySize Bytes of memory the machine uses, stores wrap at it
+ * @param frameStart True for the first instruction of a frame
+ */
+void InstructionTraceWriter::record(const TraceMachine &before, uint16_t opcode, const TraceMachine &after,
+                                    const uint8_t *memory, uint32_t memorySize, bool frameStart)
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    if (frameStart)
+    {
+        ++frames;
+    }
+    if (current.header.instructions == 0)
+    {
+        startChunk(before);
+    }
+
+    uint16_t changed = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        changed |= (before.registers[i] != after.registers[i]) << i;
+    }
+
+    uint16_t memoryAddress = before.indexRegister & (memorySize - 1);
+    uint8_t memoryCount = 0;
+    if ((opcode & 0xF0FFu) == 0xF033)
+    {
+        memoryCount = 3;
+    }
+    else if ((opcode & 0xF0FFu) == 0xF055)
+    {
+        memoryCount = ((opcode & 0x0F00u) >> 8u) + 1;
+    }
+    else if ((opcode & 0xF00Fu) == 0x5002 && memorySize > 4096)
+    {
+        // XO-CHIP, the only variant with 64 KB, stores Vx to Vy in either order
+        memoryCount = std::abs((int) ((opcode & 0x0F00u) >> 8u) - (int) ((opcode & 0x00F0u) >> 4u)) + 1;
+    }
+    // Bytes wrapping around to the start land below START_ADDRESS, where stores are refused, so they're left out
+    memoryCount = (uint8_t) std::min<int>(memoryCount, (int) memorySize - memoryAddress);
+
+    uint8_t flags = (frameStart ? RECORD_FRAME : 0) |
+                    (after.pc != (uint16_t) (before.pc + 2) ? RECORD_JUMP : 0) |
+                    (changed != 0 ? RECORD_REGISTERS : 0) |
+                    (after.indexRegister != before.indexRegister ? RECORD_INDEX : 0) |
+                    (after.sp != before.sp ? RECORD_SP : 0) |
+                    (after.delayRegister != before.delayRegister ? RECORD_DELAY : 0) |
+                    (after.soundRegister != before.soundRegister ? RECORD_SOUND : 0) |
+                    (memoryCount != 0 ? RECORD_MEMORY : 0);
+
+    std::vector<uint8_t> &out = current.records;
+    out.push_back(flags);
+    out.push_back(opcode & 0xFFu);
+    out.push_back(opcode >> 8u);
+    if (flags & RECORD_JUMP)
+    {
+        out.push_back(after.pc & 0xFFu);
+        out.push_back(after.pc >> 8u);
+    }
+    if (flags & RECORD_REGISTERS)
+    {
+        out.push_back(changed & 0xFFu);
+        out.push_back(changed >> 8u);
+        for (int i = 0; i < 16; i++)
+        {
+            if (changed & (1u << i))
+            {
+                out.push_back(after.registers[i]);
+            }
+        }
+    }
+    if (flags & RECORD_INDEX)
+    {
+        out.push_back(after.indexRegister & 0xFFu);
+        out.push_back(after.indexRegister >> 8u);
+    }
+    if (flags & RECORD_SP)
+    {
+        out.push_back(after.sp);
+    }
+    if (flags & RECORD_DELAY)
+    {
+        out.push_back(after.delayRegister);
+    }
+    if (flags & RECORD_SOUND)
+    {
+        out.push_back(after.soundRegister);
+    }
+    if (flags & RECORD_MEMORY)
+    {
+        out.push_back(memoryAddress & 0xFFu);
+        out.push_back(memoryAddress >> 8u);
+        out.push_back(memoryCount);
+        out.insert(out.end(), memory + memoryAddress, memory + memoryAddress + memoryCount);
+    }
+
+    ++instructions;
+    if (++current.header.instructions == CHUNK_INSTRUCTIONS)
+    {
+        flushChunk();
+    }
+}
+
+/**
+ * Writes out the last partial chunk, the index and the final header
+ */
+void InstructionTraceWriter::close()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    if (current.header.instructions > 0)
+    {
+        flushChunk();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    InstructionTraceHeader header{};
+    header.magic = InstructionTraceHeader::MAGIC;
+    header.version = InstructionTraceHeader::VERSION;
+    header.instructions = instructions;
+    header.chunks = index.size();
+    header.indexOffset = offset;
+    header.romHash = romHash;
+    header.cyclesPerTick = cyclesPerTick;
+    fwrite(index.data(), sizeof(InstructionTraceIndexEntry), index.size(), file);
+    offset += index.size() * sizeof(InstructionTraceIndexEntry);
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = nullptr;
+}
+
+/**
+ * @return Instructions recorded so far
+ */
+uint64_t InstructionTraceWriter::instructionsRecorded() const
+{
+    return instructions;
+}
+
+/**
+ * @return Size of the file, once closed
+ */
+uint64_t InstructionTraceWriter::bytesWritten() const
+{
+    return offset;
+}
+
+/**
+ * Begins a chunk at the current instruction
+ * @param state State before its first instruction
+ */
+void InstructionTraceWriter::startChunk(const TraceMachine &state)
+{
+    current.header.firstInstruction = instructions;
+    current.header.firstFrame = frames > 0 ? frames - 1 : 0;
+    current.header.start = state;
+    current.records.reserve(CHUNK_INSTRUCTIONS * 6);
+}
+
+/**
+ * Hands the current chunk to the writer thread, waiting if it has fallen behind
+ */
+void InstructionTraceWriter::flushChunk()
+{
+    TRACE_ZONE("traceFlush");
+    std::unique_lock<std::mutex> lock(mutex);
+    space.wait(lock, [this]
+    { return pending.size() < MAX_PENDING; });
+    pending.push_back(std::move(current));
+    lock.unlock();
+    wake.notify_one();
+
+    current = PendingChunk();
+    current.header.instructions = 0;
+}
+
+/**
+ * Writer thread: compresses and writes chunks in order
+ */
+void InstructionTraceWriter::writerLoop()
+{
+    Trace::setThreadName("instruction trace");
+    std::vector<uint8_t> compressed;
+    while (true)
+    {
+        PendingChunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]
+            { return stopping || !pending.empty(); });
+            if (pending.empty())
+            {
+                return;
+            }
+            chunk = std::move(pending.front());
+            pending.pop_front();
+        }
+        space.notify_one();
+
+        TRACE_ZONE("traceCompress");
+        InstructionTraceChunk &header = chunk.header;
+        header.rawSize = chunk.records.size();
+        const uint8_t *data = chunk.records.data();
+        header.storedSize = header.rawSize;
+        header.flags = 0;
+        if (compressTrace(chunk.records.data(), chunk.records.size(), compressed) < chunk.records.size())
+        {
+            data = compressed.data();
+            header.storedSize = compressed.size();
+            header.flags = InstructionTraceChunk::FLAG_COMPRESSED;
+        }
+
+        index.push_back({header.firstInstruction, offset});
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(data, 1, header.storedSize, file);
+        offset += sizeof(header) + header.storedSize;
+    }
+}
+
+InstructionTraceReader::~InstructionTraceReader()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+#endif
+}
+
+/**
+ * Maps a trace file and checks its header and index
+ * @param path Trace file
+ * @return False if it can't be read or isn't a complete trace
+ */
+bool InstructionTraceReader::open(const std::string &path)
+{
+#ifdef _WIN32
+    std::cout << "ERROR: Reading instruction traces needs mmap" << std::endl;
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info{};
+    if (fd == -1 || fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(InstructionTraceHeader))
+    {
+        std::cout << "ERROR: Couldn't read instruction trace: " << path << std::endl;
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    mappingSize = info.st_size;
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        std::cout << "ERROR: Couldn't map instruction trace: " << path << std::endl;
+        return false;
+    }
+
+    header = (const InstructionTraceHeader *) mapping;
+    if (header->magic != InstructionTraceHeader::MAGIC || header->version != InstructionTraceHeader::VERSION ||
+        header->indexOffset > mappingSize ||
+        header->chunks > (mappingSize - header->indexOffset) / sizeof(InstructionTraceIndexEntry))
+    {
+        std::cout << "ERROR: Not a complete instruction trace: " << path << std::endl;
+        return false;
+    }
+    entries = (const InstructionTraceIndexEntry *) ((const uint8_t *) mapping + header->indexOffset);
+    return true;
+#endif
+}
+
+const InstructionTraceHeader &InstructionTraceReader::getHeader() const
+{
+    return *header;
+}
+
+/**
+ * @return Instructions in the trace
+ */
+uint64_t InstructionTraceReader::size() const
+{
+    return header->instructions;
+}
+
+/**
+ * Positions the reader so next() returns the given instruction
+ * @param instruction Instruction index
+ * @return False if it's past the end or the chunk is corrupt
+ */
+bool InstructionTraceReader::seek(uint64_t instruction)
+{
+    if (instruction >= size())
+    {
+        return false;
+    }
+
+    // Last chunk starting at or before the instruction
+    const InstructionTraceIndexEntry *found = std::upper_bound(
+            entries, entries + header->chunks, instruction,
+            [](uint64_t value, const InstructionTraceIndexEntry &entry)
+            { return value < entry.firstInstruction; }) - 1;
+    if (!loadChunk(found - entries))
+    {
+        return false;
+    }
+
+    TraceRecord skipped{};
+    while (nextInstruction < instruction)
+    {
+        if (!next(skipped))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decodes the next instruction
+ * @param record The instruction and the state around it
+ * @return False at the end of the trace or on corrupt data
+ */
+bool InstructionTraceReader::next(TraceRecord &record)
+{
+    if (chunkHeader == nullptr || position >= records.size())
+    {
+        return false;
+    }
+
+    const uint8_t *data = records.data();
+    size_t end = records.size();
+    auto has = [this, end](size_t bytes)
+    { return end - position >= bytes; };
+    auto get8 = [this, data]()
+    { return data[position++]; };
+    auto get16 = [this, data]()
+    {
+        uint16_t value = data[position] | data[position + 1] << 8u;
+        position += 2;
+        return value;
+    };
+
+    if (!has(3))
+    {
+        return false;
+    }
+    uint8_t flags = get8();
+    uint16_t opcode = get16();
+
+    // The chunk's start state already has the first instruction's timer tick applied
+    if ((flags & RECORD_FRAME) && nextInstruction != chunkHeader->firstInstruction)
+    {
+        ++frame;
+        state.delayRegister -= state.delayRegister > 0;
+        state.soundRegister -= state.soundRegister > 0;
+    }
+
+    record.index = nextInstruction;
+    record.frame = frame;
+    record.pc = state.pc;
+    record.opcode = opcode;
+    record.before = state;
+    record.memoryCount = 0;
+
+    state.pc += 2;
+    if ((opcode & 0xF000u) == 0x2000)
+    {
+        state.stack[state.sp & 0x0Fu] = state.pc;
+    }
+    if (flags & RECORD_JUMP)
+    {
+        if (!has(2))
+        {
+            return false;
+        }
+        state.pc = get16();
+    }
+    if (flags & RECORD_REGISTERS)
+    {
+        if (!has(2))
+        {
+            return false;
+        }
+        uint16_t changed = get16();
+        for (int i = 0; i < 16; i++)
+        {
+            if (changed & (1u << i))
+            {
+                if (!has(1))
+                {
+                    return false;
+                }
+                state.registers[i] = get8();
+            }
+        }
+    }
+    if (flags & RECORD_INDEX)
+    {
+        if (!has(2))
+        {
+            return false;
+        }
+        state.indexRegister = get16();
+    }
+    if (flags & RECORD_SP)
+    {
+        if (!has(1))
+        {
+            return false;
+        }
+        state.sp = get8();
+    }
+    if (flags & RECORD_DELAY)
+    {
+        if (!has(1))
+        {
+            return false;
+        }
+        state.delayRegister = get8();
+    }
+    if (flags & RECORD_SOUND)
+    {
+        if (!has(1))
+        {
+            return false;
+        }
+        state.soundRegister = get8();
+    }
+    if (flags & RECORD_MEMORY)
+    {
+        if (!has(3))
+        {
+            return false;
+        }
+        record.memoryAddress = get16();
+        record.memoryCount = get8();
+        if (record.memoryCount > sizeof(record.memory) || !has(record.memoryCount))
+        {
+            return false;
+        }
+        memcpy(record.memory, data + position, record.memoryCount);
+        position += record.memoryCount;
+    }
+    record.after = state;
+    ++nextInstruction;
+
+    // Move on to the next chunk straight away, so chunk boundaries can be compared before decoding
+    if (position == records.size() && chunk + 1 < header->chunks)
+    {
+        return loadChunk(chunk + 1);
+    }
+    return true;
+}
+
+/**
+ * Whether both readers are at the start of chunks with identical contents, so they can be skipped when diffing
+ */
+bool InstructionTraceReader::sameChunkAs(const InstructionTraceReader &other) const
+{
+    if (chunkHeader == nullptr || other.chunkHeader == nullptr || position != 0 || other.position != 0)
+    {
+        return false;
+    }
+
+    const InstructionTraceChunk &a = *chunkHeader;
+    const InstructionTraceChunk &b = *other.chunkHeader;
+    return a.firstInstruction == b.firstInstruction && a.instructions == b.instructions &&
+           a.storedSize == b.storedSize && a.flags == b.flags && memcmp(&a.start, &b.start, sizeof(a.start)) == 0 &&
+           memcmp(&a + 1, &b + 1, a.storedSize) == 0;
+}
+
+/**
+ * Moves to the start of the next chunk without decoding the rest of this one
+ */
+void InstructionTraceReader::skipChunk()
+{
+    if (chunk + 1 < header->chunks)
+    {
+        loadChunk(chunk + 1);
+    }
+    else
+    {
+        position = records.size();
+        nextInstruction = size();
+    }
+}
+
+/**
+ * @return Size of the trace file
+ */
+uint64_t InstructionTraceReader::compressedBytes() const
+{
+    return mappingSize;
+}
+
+/**
+ * Decompresses a chunk and resets the state to its start
+ * @param index Chunk number
+ * @return False if the chunk is corrupt
+ */
+bool InstructionTraceReader::loadChunk(uint64_t index)
+{
+    chunkHeader = nullptr;
+    records.clear();
+    position = 0;
+
+    uint64_t chunkOffset = entries[index].offset;
+    if (chunkOffset > mappingSize || mappingSize - chunkOffset < sizeof(InstructionTraceChunk))
+    {
+        return false;
+    }
+    const auto *found = (const InstructionTraceChunk *) ((const uint8_t *) mapping + chunkOffset);
+    if (found->storedSize > mappingSize - chunkOffset - sizeof(InstructionTraceChunk))
+    {
+        return false;
+    }
+
+    const auto *data = (const uint8_t *) (found + 1);
+    records.resize(found->rawSize);
+    if (found->flags & InstructionTraceChunk::FLAG_COMPRESSED)
+    {
+        if (!decompressTrace(data, found->storedSize, records.data(), records.size()))
+        {
+            return false;
+        }
+    }
+    else if (found->storedSize == found->rawSize)
+    {
+        memcpy(records.data(), data, records.size());
+    }
+    else
+    {
+        return false;
+    }
+
+    chunk = index;
+    chunkHeader = found;
+    nextInstruction = found->firstInstruction;
+    frame = found->firstFrame;
+    state = found->start;
+    return true;
+}
@@ -0,0 +1,215 @@
+#ifndef CHIP8_EMU_INSTRUCTIONTRACE_H
+#define CHIP8_EMU_INSTRUCTIONTRACE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Machine state that traces follow from instruction to instruction (memory and display are not tracked, apart
+ * from the bytes instructions store)
+ */
+struct TraceMachine
+{
+    uint8_t registers[16];
+    uint16_t stack[16];
+    uint16_t indexRegister;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delayRegister;
+    uint8_t soundRegister;
+    uint8_t reserved;
+};
+
+/**
+ * Start of a trace file. Chunks follow, then an index of chunk offsets at indexOffset.
+ */
+struct InstructionTraceHeader
+{
+    static const uint32_t MAGIC = 0x54493843; // "C8IT"
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t instructions;
+    uint64_t chunks;
+    uint64_t indexOffset;
+    uint64_t romHash;
+    uint32_t cyclesPerTick;
+    uint32_t reserved[5];
+};
+
+/**
+ * Header of one chunk of instructions, followed by its (possibly compressed) records. Each chunk starts from a
+ * full TraceMachine so it can be decoded on its own.
+ */
+struct InstructionTraceChunk
+{
+    static const uint32_t FLAG_COMPRESSED = 1;
+
+    uint64_t firstInstruction;
+    uint64_t firstFrame;
+    uint32_t instructions;
+    uint32_t rawSize;
+    uint32_t storedSize;
+    uint32_t flags;
+    TraceMachine start;
+};
+
+/**
+ * Where each chunk is in the file, for seeking by instruction index
+ */
+struct InstructionTraceIndexEntry
+{
+    uint64_t firstInstruction;
+    uint64_t offset;
+};
+
+/**
+ * One decoded instruction with the state before and after it
+ */
+struct TraceRecord
+{
+    uint64_t index;
+    uint64_t frame;
+    uint16_t pc;
+    uint16_t opcode;
+    TraceMachine before;
+    TraceMachine after;
+    uint16_t memoryAddress;
+    uint8_t memoryCount;
+    uint8_t memory[16];
+};
+
+/**
+ * Records every executed instruction: its PC and opcode, and what it changed (registers, I, SP, timers, bytes
+ * stored to memory and jumps). Records are a few bytes each, packed into chunks that a background thread
+ * compresses and writes, so the emulator only pays for encoding.
+ */
+class InstructionTraceWriter
+{
+public:
+    // Instructions per chunk, also the granularity of seeking
+    static const uint32_t CHUNK_INSTRUCTIONS = 65536;
+
+    /**
+     * @param _path Output file
+     * @param _romHash hashROM() of the traced ROM
+     * @param _cyclesPerTick Instructions per frame
+     */
+    InstructionTraceWriter(std::string _path, uint64_t _romHash, uint32_t _cyclesPerTick);
+
+    ~InstructionTraceWriter();
+
+    InstructionTraceWriter(const InstructionTraceWriter &) = delete;
+
+    InstructionTraceWriter &operator=(const InstructionTraceWriter &) = delete;
+
+    bool open();
+
+    void record(const TraceMachine &before, uint16_t opcode, const TraceMachine &after, const uint8_t *memory,
+                uint32_t memorySize, bool frameStart);
+
+    void close();
+
+    uint64_t instructionsRecorded() const;
+
+    uint64_t bytesWritten() const;
+
+private:
+    struct PendingChunk
+    {
+        InstructionTraceChunk header;
+        std::vector<uint8_t> records;
+    };
+
+    // Chunks waiting for the writer thread before record() has to wait
+    static const size_t MAX_PENDING = 4;
+
+    std::string path;
+    uint64_t romHash;
+    uint32_t cyclesPerTick;
+    FILE *file = nullptr;
+
+    PendingChunk current;
+    uint64_t instructions = 0;
+    uint64_t frames = 0;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable space;
+    std::deque<PendingChunk> pending;
+    bool stopping = false;
+
+    // Only touched by the writer thread until it has been joined
+    std::vector<InstructionTraceIndexEntry> index;
+    uint64_t offset = 0;
+
+    void startChunk(const TraceMachine &state);
+
+    void flushChunk();
+
+    void writerLoop();
+};
+
+/**
+ * Reads a trace written by InstructionTraceWriter through a read-only memory mapping, decoding only the chunk
+ * being read
+ */
+class InstructionTraceReader
+{
+public:
+    InstructionTraceReader() = default;
+
+    ~InstructionTraceReader();
+
+    InstructionTraceReader(const InstructionTraceReader &) = delete;
+
+    InstructionTraceReader &operator=(const InstructionTraceReader &) = delete;
+
+    bool open(const std::string &path);
+
+    const InstructionTraceHeader &getHeader() const;
+
+    uint64_t size() const;
+
+    bool seek(uint64_t instruction);
+
+    bool next(TraceRecord &record);
+
+    bool sameChunkAs(const InstructionTraceReader &other) const;
+
+    void skipChunk();
+
+    uint64_t compressedBytes() const;
+
+private:
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    const InstructionTraceHeader *header = nullptr;
+    const InstructionTraceIndexEntry *entries = nullptr;
+
+    // Current chunk, decompressed
+    uint64_t chunk = UINT64_MAX;
+    const InstructionTraceChunk *chunkHeader = nullptr;
+    std::vector<uint8_t> records;
+    size_t position = 0;
+    uint64_t nextInstruction = 0;
+    uint64_t frame = 0;
+    TraceMachine state{};
+
+    bool loadChunk(uint64_t index);
+};
+
+size_t compressTrace(const uint8_t *input, size_t size, std::vector<uint8_t> &output);
+
+bool decompressTrace(const uint8_t *input, size_t size, uint8_t *output, size_t outputSize);
+
+#endif //CHIP8_EMU_INSTRUCTIONTRACE_H
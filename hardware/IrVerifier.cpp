@@ -0,0 +1,138 @@
+#include "IrVerifier.h"
+#include "ChipEight.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+/**
+ * @param _rom ROM the program was built from
+ * @param _loadStoreQuirk Quirks the program was built with
+ * @param _shiftQuirk Quirks the program was built with
+ */
+IrVerifier::IrVerifier(const std::vector<uint8_t> &_rom, bool _loadStoreQuirk, bool _shiftQuirk)
+        : rom(_rom),
+          loadStoreQuirk(_loadStoreQuirk),
+          shiftQuirk(_shiftQuirk)
+{
+}
+
+/**
+ * Verifies every block of a program, printing the IR of any that differ from the interpreter
+ * @param program Program built from the ROM
+ * @param trials Random states to try per block
+ * @return Number of blocks that failed
+ */
+int IrVerifier::verify(const std::shared_ptr<const IrProgram> &program, int trials) const
+{
+    int failed = 0;
+    for (const IrBlock &block : program->getBlocks())
+    {
+        if (block.length > 0 && !verifyBlock(program, block, trials))
+        {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/**
+ * Runs one block from random states. Everything the block might read is randomised except its own code,
+ * and states the interpreter has no defined behaviour for (stack overflow, memory indexed past the end, a
+ * key number above F) are avoided.
+ * @return True if the IR matched the interpreter in every trial
+ */
+bool IrVerifier::verifyBlock(const std::shared_ptr<const IrProgram> &program, const IrBlock &block, int trials) const
+{
+    // A frame of exactly the block's length runs the whole block through the IR
+    ChipEight reference(loadStoreQuirk, shiftQuirk, block.length, true);
+    ChipEight lifted(loadStoreQuirk, shiftQuirk, block.length, true);
+    reference.LoadROM(rom.data(), rom.size());
+    lifted.LoadROM(rom.data(), rom.size());
+    lifted.setIrProgram(program);
+
+    const uint8_t *codeMap = program->getCodeMap();
+    uint16_t lastOpcode = (reference.getMemory()[block.end - 2] << 8u) | reference.getMemory()[block.end - 1];
+    bool keySkip = block.exit == BlockExit::Skip && (lastOpcode & 0xF000u) == 0xE000;
+    uint32_t random = 0x9E3779B9u ^ block.start;
+    auto next = [&random]()
+    {
+        random ^= random << 13u;
+        random ^= random >> 17u;
+        random ^= random << 5u;
+        return random;
+    };
+
+    auto display = std::make_unique<ChipEightState>();
+    for (int trial = 0; trial < trials; trial++)
+    {
+        reference.reset();
+        lifted.reset();
+        uint32_t seed = next();
+        reference.seed(seed);
+        lifted.seed(seed);
+
+        for (ChipEight *chip : {&reference, &lifted})
+        {
+            chip->drawFlag = false;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            // Half the trials of a key skip keep registers to valid key numbers so both branches get tried
+            uint8_t value = next();
+            reference.getRegisters()[i] = lifted.getRegisters()[i] = keySkip && trial % 2 ? value & 0x0Fu : value;
+            reference.getKeypad()[i] = lifted.getKeypad()[i] = next() & 1u;
+            reference.getStack()[i] = lifted.getStack()[i] = next() & 0x0FFEu;
+        }
+        // Every fourth trial puts I at the end of memory, where loads and stores wrap
+        uint16_t index = trial % 4 == 3 ? 0xFF0 + next() % 0x20 : START_ADDRESS + 1 + next() % 0xCFF;
+        *reference.getIndexRegister() = *lifted.getIndexRegister() = index;
+        *reference.getStackPointer() = *lifted.getStackPointer() = 1 + next() % 14;
+        *reference.getDelayRegister() = *lifted.getDelayRegister() = next();
+        *reference.getSoundRegister() = *lifted.getSoundRegister() = next();
+        *reference.getPC() = *lifted.getPC() = block.start;
+        for (size_t i = START_ADDRESS; i < 4096; i++)
+        {
+            if (!codeMap[i])
+            {
+                reference.getMemory()[i] = lifted.getMemory()[i] = next();
+            }
+        }
+
+        // The display lives in the bit-planes, so it goes in through a saved state
+        reference.saveState(*display);
+        for (size_t y = 0; y < VIDEO_HEIGHT; y++)
+        {
+            uint64_t high = next();
+            display->planes[0][y * PLANE_ROW_WORDS] = high << 32u | next();
+        }
+        reference.loadState(*display);
+        lifted.loadState(*display);
+
+        reference.executeCycle();
+        lifted.executeCycle();
+
+        if (keySkip && reference.getRegisters()[(lastOpcode & 0x0F00u) >> 8u] > 0xF)
+        {
+            continue;
+        }
+
+        bool same = memcmp(reference.getRegisters(), lifted.getRegisters(), 16) == 0 &&
+                    memcmp(reference.getMemory(), lifted.getMemory(), MEMORY_SIZE) == 0 &&
+                    memcmp(reference.getStack(), lifted.getStack(), 16 * sizeof(uint16_t)) == 0 &&
+                    memcmp(reference.video, lifted.video, sizeof(reference.video)) == 0 &&
+                    *reference.getPC() == *lifted.getPC() &&
+                    *reference.getIndexRegister() == *lifted.getIndexRegister() &&
+                    *reference.getStackPointer() == *lifted.getStackPointer() &&
+                    *reference.getDelayRegister() == *lifted.getDelayRegister() &&
+                    *reference.getSoundRegister() == *lifted.getSoundRegister() &&
+                    reference.drawFlag == lifted.drawFlag;
+        if (!same)
+        {
+            std::cout << "IR differs from the interpreter in block " << std::hex << std::uppercase
+                      << std::setfill('0') << std::setw(3) << block.start << std::dec << " (trial " << trial
+                      << ", seed " << seed << "):\n" << block.toString() << std::flush;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef CHIP8_EMU_IRVERIFIER_H
+#define CHIP8_EMU_IRVERIFIER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "BlockIR.h"
+
+/**
+ * Checks an IrProgram against the interpreter: every block is run from many random machine states, once
+ * through the IR and once through executeOpCode(), and the resulting states must be identical
+ */
+class IrVerifier
+{
+public:
+    IrVerifier(const std::vector<uint8_t> &_rom, bool _loadStoreQuirk, bool _shiftQuirk);
+
+    int verify(const std::shared_ptr<const IrProgram> &program, int trials) const;
+
+private:
+    std::vector<uint8_t> rom;
+    bool loadStoreQuirk;
+    bool shiftQuirk;
+
+    bool verifyBlock(const std::shared_ptr<const IrProgram> &program, const IrBlock &block, int trials) const;
+};
+
+#endif //CHIP8_EMU_IRVERIFIER_H
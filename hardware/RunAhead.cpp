@@ -0,0 +1,227 @@
+#include "RunAhead.h"
+#include "AudioRenderer.h"
+#include "../frontend/Trace.h"
+#include <algorithm>
+#include <cstring>
+
+RunAhead::RunAhead(ChipEight &_chip, unsigned int _frames, unsigned int branchThreads) : chip(_chip), frames(_frames)
+{
+    for (unsigned int i = 0; i < branchThreads; i++)
+    {
+        auto branch = std::make_unique<Branch>();
+        branch->chip = chip.cloneHeadless();
+        branch->thread = std::thread(&RunAhead::branchLoop, this, std::ref(*branch));
+        branches.push_back(std::move(branch));
+    }
+}
+
+RunAhead::~RunAhead()
+{
+    for (auto &branch : branches)
+    {
+        {
+            std::lock_guard<std::mutex> lock(branch->mutex);
+            branch->stopping = true;
+        }
+        branch->wake.notify_one();
+        branch->thread.join();
+    }
+}
+
+/**
+ * Runs one real frame with the keys currently down and prepares the picture to present for it
+ */
+void RunAhead::runFrame()
+{
+    uint16_t mask = chip.getKeypadMask();
+    for (uint8_t key = 0; key < 16; key++)
+    {
+        if ((mask & ~lastMask) & (1u << key))
+        {
+            recentKeys.erase(std::remove(recentKeys.begin(), recentKeys.end(), key), recentKeys.end());
+            recentKeys.insert(recentKeys.begin(), key);
+        }
+    }
+    lastMask = mask;
+
+    if (!branches.empty() && takeBranch(mask))
+    {
+        ++hits;
+    }
+    else
+    {
+        if (!branches.empty())
+        {
+            ++misses;
+        }
+
+        chip.executeCycle();
+        if (frames > 0)
+        {
+            TRACE_ZONE("runAhead");
+            chip.saveState(real);
+            chip.setSpeculative(true);
+            for (unsigned int i = 0; i < frames; i++)
+            {
+                chip.executeCycle();
+            }
+            memcpy(frame, chip.video, sizeof(frame));
+            chip.setSpeculative(false);
+            chip.loadState(real);
+        }
+        else
+        {
+            memcpy(frame, chip.video, sizeof(frame));
+        }
+    }
+
+    // The screen only needs presenting when the picture shown changes, whatever the real frame drew
+    chip.drawFlag = memcmp(frame, shown, sizeof(frame)) != 0;
+    if (chip.drawFlag)
+    {
+        memcpy(shown, frame, sizeof(shown));
+    }
+
+    startBranches();
+}
+
+/**
+ * @return The frame to present, run ahead of the real state
+ */
+const uint32_t *RunAhead::getFrame() const
+{
+    return frame;
+}
+
+/**
+ * @return Frames taken from a branch computed ahead of time
+ */
+uint64_t RunAhead::getBranchHits() const
+{
+    return hits;
+}
+
+/**
+ * @return Frames computed on the emulator thread because no branch matched or was finished in time
+ */
+uint64_t RunAhead::getBranchMisses() const
+{
+    return misses;
+}
+
+/**
+ * Uses a finished branch for this frame if one ran with the keys now down
+ * @param mask Keys down
+ * @return False if the frame still has to be run
+ */
+bool RunAhead::takeBranch(uint16_t mask)
+{
+    for (auto &branch : branches)
+    {
+        std::lock_guard<std::mutex> lock(branch->mutex);
+        if (branch->done && branch->resultGeneration == generation && branch->resultMask == mask)
+        {
+            chip.loadState(branch->first);
+            memcpy(frame, branch->video, sizeof(frame));
+
+            // The real machine never ran this frame, so its audio is rendered from the state it ended in, as
+            // decrementTimers() would have
+            if (chip.audioRenderer != nullptr)
+            {
+                chip.audioRenderer->renderFrame(*chip.getSoundRegister() > 0);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Hands each worker the real state and one of the likeliest key masks for the next frame
+ */
+void RunAhead::startBranches()
+{
+    if (branches.empty())
+    {
+        return;
+    }
+
+    std::vector<uint16_t> masks{lastMask};
+    if (lastMask != 0)
+    {
+        masks.push_back(0);
+    }
+    for (uint8_t key : recentKeys)
+    {
+        uint16_t toggled = lastMask ^ (1u << key);
+        if (toggled != 0)
+        {
+            masks.push_back(toggled);
+        }
+    }
+
+    chip.saveState(real);
+    ++generation;
+    for (size_t i = 0; i < branches.size() && i < masks.size(); i++)
+    {
+        Branch &branch = *branches[i];
+        {
+            std::lock_guard<std::mutex> lock(branch.mutex);
+            branch.start = real;
+            branch.mask = masks[i];
+            branch.generation = generation;
+            branch.pending = true;
+        }
+        branch.wake.notify_one();
+    }
+}
+
+/**
+ * Worker thread: runs the real frame with its key mask, keeping that state, then the frames ahead of it
+ * @param branch Branch owned by this thread
+ */
+void RunAhead::branchLoop(Branch &branch)
+{
+    Trace::setThreadName("run-ahead branch");
+    ChipEightState first;
+    uint32_t video[64 * 32];
+    while (true)
+    {
+        uint16_t mask;
+        uint64_t jobGeneration;
+        {
+            std::unique_lock<std::mutex> lock(branch.mutex);
+            branch.wake.wait(lock, [&branch]()
+            {
+                return branch.pending || branch.stopping;
+            });
+            if (branch.stopping)
+            {
+                return;
+            }
+            branch.chip->loadState(branch.start);
+            mask = branch.mask;
+            jobGeneration = branch.generation;
+            branch.pending = false;
+        }
+
+        {
+            TRACE_ZONE("branch");
+            branch.chip->setKeypad(mask);
+            branch.chip->executeCycle();
+            branch.chip->saveState(first);
+            for (unsigned int i = 0; i < frames; i++)
+            {
+                branch.chip->executeCycle();
+            }
+            memcpy(video, branch.chip->video, sizeof(video));
+        }
+
+        std::lock_guard<std::mutex> lock(branch.mutex);
+        branch.first = first;
+        memcpy(branch.video, video, sizeof(video));
+        branch.resultMask = mask;
+        branch.resultGeneration = jobGeneration;
+        branch.done = true;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef CHIP8_EMU_RUNAHEAD_H
+#define CHIP8_EMU_RUNAHEAD_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ChipEight.h"
+
+/**
+ * Hides the frames a ROM takes to react to input. Each host frame runs the real frame, saves the state,
+ * runs a few more frames with the same keys and presents the last of them, then puts the real state back.
+ *
+ * With branch threads, idle cores also run the next frame ahead of time for the key changes most likely
+ * to happen (nothing changes, a recently used key goes down or up, everything is released). When the
+ * keys read next frame match a finished branch, its state and picture are taken as they are.
+ */
+class RunAhead
+{
+public:
+    /**
+     * @param _chip Instance to run, already set up with its ROM
+     * @param _frames Frames to run ahead of the real state (0 just runs the real frame)
+     * @param branchThreads Threads precomputing likely key changes (0 for none)
+     */
+    RunAhead(ChipEight &_chip, unsigned int _frames, unsigned int branchThreads);
+
+    ~RunAhead();
+
+    void runFrame();
+
+    const uint32_t *getFrame() const;
+
+    uint64_t getBranchHits() const;
+
+    uint64_t getBranchMisses() const;
+
+private:
+    /**
+     * One worker and the key change it is running ahead for
+     */
+    struct Branch
+    {
+        std::unique_ptr<ChipEight> chip;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+
+        // Job, written by the emulator thread
+        ChipEightState start;
+        uint16_t mask = 0;
+        uint64_t generation = 0;
+        bool pending = false;
+        bool stopping = false;
+
+        // Result of the last job finished, written by the worker
+        ChipEightState first;
+        uint32_t video[64 * 32]{};
+        uint16_t resultMask = 0;
+        uint64_t resultGeneration = 0;
+        bool done = false;
+    };
+
+    ChipEight &chip;
+    unsigned int frames;
+
+    ChipEightState real;
+    uint32_t frame[64 * 32]{};
+    uint32_t shown[64 * 32]{};
+
+    std::vector<std::unique_ptr<Branch>> branches;
+    uint64_t generation = 0;
+
+    // Keys in the order they were last pressed, most recent first
+    std::vector<uint8_t> recentKeys;
+    uint16_t lastMask = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    bool takeBranch(uint16_t mask);
+
+    void startBranches();
+
+    void branchLoop(Branch &branch);
+};
+
+#endif //CHIP8_EMU_RUNAHEAD_H
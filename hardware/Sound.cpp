@@ -13,14 +13,21 @@ Sound::Sound()
 
 Sound::~Sound()
 {
-    SDL_CloseAudioDevice(m_device);
+    if (m_device != 0)
+    {
+        SDL_CloseAudioDevice(m_device);
+    }
 }
 
 /**
- * Plays beep
+ * Plays beep, opening the audio device the first time
  */
 void Sound::play()
 {
+    if (m_device == 0 && !m_initFailed)
+    {
+        init();
+    }
     SDL_PauseAudioDevice(m_device, 0);
 }
 
@@ -29,7 +36,10 @@ void Sound::play()
  */
 void Sound::stop()
 {
-    SDL_PauseAudioDevice(m_device, 1);
+    if (m_device != 0)
+    {
+        SDL_PauseAudioDevice(m_device, 1);
+    }
 }
 
 /**
@@ -56,6 +66,13 @@ void Sound::SDLAudioCallback(void *data, Uint8 *raw_buffer, int bytes)
  */
 void Sound::init()
 {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    {
+        std::cout << "Failed to initialise audio: " << SDL_GetError() << std::endl;
+        m_initFailed = true;
+        return;
+    }
+
     SDL_AudioSpec wantSpec, haveSpec;
 
     SDL_zero(wantSpec);
@@ -70,5 +87,6 @@ void Sound::init()
     if (m_device == 0)
     {
         std::cout << "Failed to open audio: " << SDL_GetError() << std::endl;
+        m_initFailed = true;
     }
 }
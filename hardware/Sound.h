@@ -23,4 +23,5 @@ private:
     static void SDLAudioCallback(void *data, Uint8 *buffer, int length);
 
     SDL_AudioDeviceID m_device{};
+    bool m_initFailed = false;
 };
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "WorkerPool.h"
+#include "../frontend/Trace.h"
+#include <algorithm>
+
+/**
+ * @param threads Total threads to use including the calling thread, 0 = one per hardware thread
+ */
+WorkerPool::WorkerPool(unsigned int threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // The caller works too, so it needs one fewer background thread
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * @return Number of threads that run jobs, including the caller
+ */
+unsigned int WorkerPool::threadCount() const
+{
+    return workers.size() + 1;
+}
+
+/**
+ * Runs task(begin, end) over [0, count) in chunks, spread over all threads. Returns once every chunk is done.
+ * If a chunk throws, no more chunks are started and the first exception is rethrown here.
+ * @param count Number of items
+ * @param chunk Items handed to a thread at a time
+ * @param task Work for a range of items
+ */
+void WorkerPool::parallelFor(size_t count, size_t chunk, const std::function<void(size_t, size_t)> &task)
+{
+    chunk = std::max<size_t>(chunk, 1);
+    if (workers.empty() || count <= chunk)
+    {
+        task(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        jobCount = count;
+        jobChunk = chunk;
+        nextIndex.store(0, std::memory_order_relaxed);
+        busyWorkers = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]
+    { return busyWorkers == 0; });
+    job = nullptr;
+    std::exception_ptr error = failure;
+    failure = nullptr;
+    lock.unlock();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * Claims and runs chunks of the current job until none are left
+ */
+void WorkerPool::runChunks()
+{
+    while (true)
+    {
+        size_t begin = nextIndex.fetch_add(jobChunk, std::memory_order_relaxed);
+        if (begin >= jobCount)
+        {
+            return;
+        }
+        TRACE_ZONE("chunk");
+        try
+        {
+            (*job)(begin, std::min(begin + jobChunk, jobCount));
+        }
+        catch (...)
+        {
+            // Left for parallelFor() to rethrow on the caller's thread, where it can be handled
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure)
+            {
+                failure = std::current_exception();
+            }
+            nextIndex.store(jobCount, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+/**
+ * Background thread: sleeps until a job is posted, helps finish it, then sleeps again
+ */
+void WorkerPool::workerLoop()
+{
+    Trace::setThreadName("worker");
+    uint64_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+            { return stopping || generation != seenGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runChunks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0)
+        {
+            done.notify_one();
+        }
+    }
+}
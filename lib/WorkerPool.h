@@ -0,0 +1,50 @@
+#ifndef CHIP8_EMU_WORKERPOOL_H
+#define CHIP8_EMU_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent worker threads for splitting a range of independent jobs (e.g. emulator instances)
+ * across cores. Threads are created once and sleep between calls, so each call only pays for a
+ * wake-up rather than thread creation.
+ */
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned int threads);
+
+    ~WorkerPool();
+
+    void parallelFor(size_t count, size_t chunk, const std::function<void(size_t, size_t)> &task);
+
+    unsigned int threadCount() const;
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t, size_t)> *job = nullptr;
+    size_t jobCount = 0;
+    size_t jobChunk = 1;
+    std::atomic<size_t> nextIndex{0};
+    unsigned int busyWorkers = 0;
+    std::exception_ptr failure;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void workerLoop();
+
+    void runChunks();
+};
+
+#endif //CHIP8_EMU_WORKERPOOL_H
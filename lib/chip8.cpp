@@ -0,0 +1,191 @@
+#include "chip8.h"
+#include "WorkerPool.h"
+#include "../hardware/ChipEight.h"
+#include "../hardware/InstancePool.h"
+#include "../rom/RomAnalysis.h"
+#include <memory>
+#include <new>
+#include <vector>
+
+static_assert(CHIP8_VIDEO_WIDTH == VIDEO_WIDTH && CHIP8_VIDEO_HEIGHT == VIDEO_HEIGHT, "C API display size");
+
+/**
+ * Instances that share a ROM and configuration, plus the threads that step them. The instances all come from
+ * one InstancePool, so resetting them copies the power-on state from its template.
+ */
+struct chip8_batch
+{
+    chip8_config config;
+    std::unique_ptr<InstancePool> instancePool;
+    std::vector<ChipEight *> instances;
+    std::unique_ptr<WorkerPool> pool;
+};
+
+/**
+ * Instances handed to a thread at a time - big enough to amortise claiming work, small enough to balance
+ */
+static const size_t STEP_CHUNK = 16;
+
+uint32_t chip8_abi_version(void)
+{
+    return CHIP8_ABI_VERSION;
+}
+
+void chip8_default_config(chip8_config *config)
+{
+    if (config == nullptr)
+    {
+        return;
+    }
+    config->cycles_per_frame = 8;
+    config->threads = 0;
+    config->seed = 0;
+    config->load_store_quirk = 0;
+    config->shift_quirk = 0;
+    config->cache_directory = nullptr;
+}
+
+chip8_batch *chip8_create(const uint8_t *rom, size_t rom_size, uint32_t count, const chip8_config *config)
+{
+    if (rom == nullptr || count == 0)
+    {
+        return nullptr;
+    }
+
+    // Nothing may be thrown across the C interface
+    try
+    {
+        auto batch = std::make_unique<chip8_batch>();
+        if (config != nullptr)
+        {
+            batch->config = *config;
+        }
+        else
+        {
+            chip8_default_config(&batch->config);
+        }
+
+        // One analysis shared by every instance, from the caller's disk cache when another run already made it.
+        // The path isn't kept, the caller's string only has to last for this call.
+        const char *cacheDirectory = batch->config.cache_directory;
+        batch->config.cache_directory = nullptr;
+        std::shared_ptr<const RomAnalysis> analysis;
+        if (rom_size <= 4096 - START_ADDRESS)
+        {
+            analysis = RomAnalysis::get(std::vector<uint8_t>(rom, rom + rom_size),
+                                        cacheDirectory != nullptr ? cacheDirectory : "");
+        }
+
+        auto image = std::make_unique<ChipEight>(batch->config.load_store_quirk != 0,
+                                                 batch->config.shift_quirk != 0, batch->config.cycles_per_frame,
+                                                 true);
+        if (!image->LoadROM(rom, rom_size))
+        {
+            return nullptr;
+        }
+        image->setAnalysis(analysis);
+
+        batch->instancePool = std::make_unique<InstancePool>(std::move(image), count);
+        batch->instances.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            ChipEight *instance = batch->instancePool->acquire();
+            instance->seed(batch->config.seed + i);
+            batch->instances.push_back(instance);
+        }
+
+        batch->pool = std::make_unique<WorkerPool>(batch->config.threads);
+        return batch.release();
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void chip8_destroy(chip8_batch *batch)
+{
+    delete batch;
+}
+
+uint32_t chip8_count(const chip8_batch *batch)
+{
+    return batch == nullptr ? 0 : batch->instances.size();
+}
+
+int chip8_reset(chip8_batch *batch, int32_t index)
+{
+    if (batch == nullptr || index < -1 || index >= (int64_t) batch->instances.size())
+    {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+
+    try
+    {
+        size_t begin = index == -1 ? 0 : index;
+        size_t end = index == -1 ? batch->instances.size() : index + 1;
+        for (size_t i = begin; i < end; i++)
+        {
+            batch->instancePool->reset(*batch->instances[i]);
+            batch->instances[i]->seed(batch->config.seed + i);
+        }
+    }
+    catch (...)
+    {
+        return CHIP8_ERROR_INTERNAL;
+    }
+    return CHIP8_OK;
+}
+
+int chip8_step(chip8_batch *batch, uint32_t frames, const uint16_t *keypad_masks)
+{
+    if (batch == nullptr)
+    {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+
+    try
+    {
+        batch->pool->parallelFor(batch->instances.size(), STEP_CHUNK, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                ChipEight &instance = *batch->instances[i];
+                if (keypad_masks != nullptr)
+                {
+                    instance.setKeypad(keypad_masks[i]);
+                }
+                for (uint32_t frame = 0; frame < frames; frame++)
+                {
+                    instance.executeCycle();
+                }
+            }
+        });
+    }
+    catch (...)
+    {
+        return CHIP8_ERROR_INTERNAL;
+    }
+    return CHIP8_OK;
+}
+
+int chip8_get_view(chip8_batch *batch, uint32_t index, chip8_view *view)
+{
+    if (batch == nullptr || view == nullptr || index >= batch->instances.size())
+    {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+
+    ChipEight &instance = *batch->instances[index];
+    view->video = instance.video;
+    view->registers = instance.getRegisters();
+    view->memory = instance.getMemory();
+    view->keypad = instance.getKeypad();
+    view->stack = instance.getStack();
+    view->pc = instance.getPC();
+    view->index = instance.getIndexRegister();
+    view->sp = instance.getStackPointer();
+    view->delay_timer = instance.getDelayRegister();
+    view->sound_timer = instance.getSoundRegister();
+    return CHIP8_OK;
+}
@@ -0,0 +1,87 @@
+/*
+ * libchip8 - C interface for running many Chip-8 instances as batched environments.
+ *
+ * All instances in a batch run the same ROM. chip8_step() advances every instance by a number of
+ * 60 Hz frames using worker threads. Pointers returned by chip8_get_view() point straight at each
+ * instance's state and stay valid until chip8_destroy(), so no copies are needed between steps.
+ */
+#ifndef CHIP8_LIB_H
+#define CHIP8_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define CHIP8_API __declspec(dllexport)
+#else
+#define CHIP8_API __attribute__((visibility("default")))
+#endif
+
+/* Bumped whenever a struct layout or function signature changes */
+#define CHIP8_ABI_VERSION 2
+
+#define CHIP8_VIDEO_WIDTH 64
+#define CHIP8_VIDEO_HEIGHT 32
+#define CHIP8_MEMORY_SIZE 4096
+
+/* Return codes */
+#define CHIP8_OK 0
+#define CHIP8_ERROR_ARGUMENT (-1)
+#define CHIP8_ERROR_INTERNAL (-2) /* out of memory or another failure inside the library */
+
+typedef struct chip8_batch chip8_batch;
+
+typedef struct chip8_config
+{
+    uint32_t cycles_per_frame; /* instructions executed per 60 Hz frame */
+    uint32_t threads;          /* worker threads for chip8_step, 0 = one per hardware thread */
+    uint64_t seed;             /* instance i uses seed + i for CXKK */
+    uint8_t load_store_quirk;
+    uint8_t shift_quirk;
+    const char *cache_directory; /* where ROM analyses are cached, NULL or "" to keep them in memory only */
+} chip8_config;
+
+typedef struct chip8_view
+{
+    const uint32_t *video;  /* CHIP8_VIDEO_WIDTH * CHIP8_VIDEO_HEIGHT pixels, 0 = off, 0xFFFFFFFF = on */
+    uint8_t *registers;     /* V0 - VF */
+    uint8_t *memory;        /* CHIP8_MEMORY_SIZE bytes */
+    uint8_t *keypad;        /* 16 keys, 1 = down */
+    uint16_t *stack;        /* 16 entries */
+    uint16_t *pc;
+    uint16_t *index;
+    uint8_t *sp;
+    uint8_t *delay_timer;
+    uint8_t *sound_timer;
+} chip8_view;
+
+CHIP8_API uint32_t chip8_abi_version(void);
+
+CHIP8_API void chip8_default_config(chip8_config *config);
+
+/* Creates count instances running rom. Returns NULL if the ROM is too large, arguments are invalid or memory
+ * runs out. */
+CHIP8_API chip8_batch *chip8_create(const uint8_t *rom, size_t rom_size, uint32_t count, const chip8_config *config);
+
+CHIP8_API void chip8_destroy(chip8_batch *batch);
+
+CHIP8_API uint32_t chip8_count(const chip8_batch *batch);
+
+/* Resets one instance to its power-on state, or every instance if index is -1 */
+CHIP8_API int chip8_reset(chip8_batch *batch, int32_t index);
+
+/* Runs frames 60 Hz frames on every instance. keypad_masks holds one 16 bit key mask (bit n = key n)
+ * per instance, applied before the first frame; pass NULL to leave the keypads unchanged. */
+CHIP8_API int chip8_step(chip8_batch *batch, uint32_t frames, const uint16_t *keypad_masks);
+
+CHIP8_API int chip8_get_view(chip8_batch *batch, uint32_t index, chip8_view *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHIP8_LIB_H */
@@ -0,0 +1,152 @@
+#include "chip8_shm.h"
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(chip8_shm_header) == 64 && sizeof(chip8_shm_slot) % 64 == 0, "shared layout alignment");
+
+/**
+ * A mapped object
+ */
+struct chip8_shm_reader
+{
+    void *mapping;
+    size_t size;
+    const chip8_shm_header *header;
+    const uint8_t *slots;
+};
+
+chip8_shm_reader *chip8_shm_open(const char *name)
+{
+#ifdef _WIN32
+    (void) name;
+    return nullptr;
+#else
+    if (name == nullptr)
+    {
+        return nullptr;
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(chip8_shm_header))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t size = info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    // The emulator stores the magic last, so everything else is set up once it's seen
+    const auto *header = (const chip8_shm_header *) mapping;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != CHIP8_SHM_MAGIC || header->version != CHIP8_SHM_VERSION ||
+        header->slot_count == 0 || header->slot_size < sizeof(chip8_shm_slot) ||
+        sizeof(chip8_shm_header) + (size_t) header->slot_count * header->slot_size > size)
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    auto *reader = new(std::nothrow) chip8_shm_reader();
+    if (reader == nullptr)
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+    reader->mapping = mapping;
+    reader->size = size;
+    reader->header = header;
+    reader->slots = (const uint8_t *) mapping + sizeof(chip8_shm_header);
+    return reader;
+#endif
+}
+
+void chip8_shm_close(chip8_shm_reader *reader)
+{
+    if (reader == nullptr)
+    {
+        return;
+    }
+#ifndef _WIN32
+    munmap(reader->mapping, reader->size);
+#endif
+    delete reader;
+}
+
+uint64_t chip8_shm_published(const chip8_shm_reader *reader)
+{
+    return reader != nullptr ? __atomic_load_n(&reader->header->published, __ATOMIC_ACQUIRE) : 0;
+}
+
+const chip8_shm_slot *chip8_shm_latest(const chip8_shm_reader *reader, uint64_t *sequence)
+{
+    uint64_t published = chip8_shm_published(reader);
+    if (published == 0 || sequence == nullptr)
+    {
+        return nullptr;
+    }
+
+    uint64_t frame = published - 1;
+    const auto *slot = (const chip8_shm_slot *) (reader->slots +
+                                                 (frame % reader->header->slot_count) * reader->header->slot_size);
+    *sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (*sequence & 1u)
+    {
+        return nullptr;
+    }
+    return slot;
+}
+
+int chip8_shm_validate(const chip8_shm_slot *slot, uint64_t sequence)
+{
+    // Orders the caller's reads of the slot before the second look at its sequence
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+int chip8_shm_copy_latest(const chip8_shm_reader *reader, chip8_shm_slot *out)
+{
+    if (reader == nullptr || out == nullptr)
+    {
+        return -1;
+    }
+
+    // A slot is only reused after the emulator has gone round the whole ring, so a retry almost always works
+    for (int attempt = 0; attempt < 16; attempt++)
+    {
+        uint64_t sequence;
+        const chip8_shm_slot *slot = chip8_shm_latest(reader, &sequence);
+        if (slot == nullptr)
+        {
+            if (chip8_shm_published(reader) == 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        *out = *slot;
+        if (chip8_shm_validate(slot, sequence))
+        {
+            out->sequence = sequence;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,80 @@
+/*
+ * chip8_shm - reading frames published by chip8_emu --publish from other processes.
+ *
+ * The emulator writes every finished frame into a ring of slots in a POSIX shared-memory object. Each
+ * slot is guarded by a sequence counter (a seqlock): it is odd while the emulator writes the slot and
+ * even once the slot is complete. Readers never block the emulator and never make syscalls to read; they
+ * use the slot in place and check afterwards that it wasn't overwritten meanwhile. With CHIP8_SHM_SLOTS
+ * slots a reader has that many frames to finish with a slot before it is reused.
+ */
+#ifndef CHIP8_SHM_H
+#define CHIP8_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIP8_SHM_MAGIC 0x48533843u /* "C8SH" */
+#define CHIP8_SHM_VERSION 1
+#define CHIP8_SHM_SLOTS 8
+
+#define CHIP8_SHM_VIDEO_WIDTH 64
+#define CHIP8_SHM_VIDEO_HEIGHT 32
+
+/* One published frame. Slots start on 64 byte boundaries. */
+typedef struct chip8_shm_slot
+{
+    uint64_t sequence;  /* odd while being written */
+    uint64_t frame;     /* emulated frame number */
+    uint32_t video[CHIP8_SHM_VIDEO_WIDTH * CHIP8_SHM_VIDEO_HEIGHT]; /* 0 = off, 0xFFFFFFFF = on */
+    uint16_t stack[16];
+    uint16_t pc;
+    uint16_t index;
+    uint16_t keypad;    /* bit n = key n down */
+    uint8_t registers[16];
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t reserved[55];
+} chip8_shm_slot;
+
+/* Start of the shared-memory object, followed by slot_count slots of slot_size bytes */
+typedef struct chip8_shm_header
+{
+    uint32_t magic;     /* written last, once the rest is set up */
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint64_t published; /* frames published so far, the newest is in slot (published - 1) % slot_count */
+    uint64_t reserved[5];
+} chip8_shm_header;
+
+typedef struct chip8_shm_reader chip8_shm_reader;
+
+/* Maps a published object, e.g. "/chip8". Returns NULL if it doesn't exist or isn't a compatible layout. */
+chip8_shm_reader *chip8_shm_open(const char *name);
+
+void chip8_shm_close(chip8_shm_reader *reader);
+
+/* Frames published so far, 0 if none yet */
+uint64_t chip8_shm_published(const chip8_shm_reader *reader);
+
+/* Newest complete slot, read in place, or NULL if nothing has been published (or the emulator is lapping
+ * the reader). Check chip8_shm_validate(slot, sequence) after using it: if it fails, the slot was reused
+ * while it was being read and anything taken from it must be discarded. */
+const chip8_shm_slot *chip8_shm_latest(const chip8_shm_reader *reader, uint64_t *sequence);
+
+/* 1 if the slot is unchanged since chip8_shm_latest() returned it with this sequence */
+int chip8_shm_validate(const chip8_shm_slot *slot, uint64_t sequence);
+
+/* Copies the newest complete frame, retrying if it is overwritten during the copy. Returns 0 on success. */
+int chip8_shm_copy_latest(const chip8_shm_reader *reader, chip8_shm_slot *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHIP8_SHM_H */
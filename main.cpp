@@ -1,21 +1,34 @@
 #include <iostream>
 #include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <sys/stat.h>
 #include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
 #include "hardware/ChipEight.h"
+#include "hardware/Debugger.h"
+#include "hardware/BlockIR.h"
+#include "hardware/RunAhead.h"
+#include "hardware/AudioRenderer.h"
+#include "hardware/InstructionTrace.h"
+#include "frontend/FrameCapture.h"
+#include "frontend/Upscaler.h"
+#include "frontend/LatencyProbe.h"
+#include "frontend/Trace.h"
+#include "frontend/GridView.h"
+#include "frontend/ShmPublisher.h"
+#include "rom/RomLibrary.h"
+#include "rom/AutoTuner.h"
+#include "rom/RomAnalysis.h"
+#include "rom/InputScript.h"
+#include "rom/RomWatcher.h"
 
 
-/**
- * Checks if a file exists at the given path
- * @param path Path to file
- * @return True if exists, false otherwise
- */
-bool fileExists(const char *path)
-{
-    struct stat buffer{};
-    return (stat(path, &buffer) == 0);
-}
-
 /**
  * Attempts to extracts rom name from a path
  * @param path Path to file
@@ -44,48 +57,1086 @@ std::string extractROMName(const char *path)
     }
 }
 
+/**
+ * Parses a key mapping such as "x,1,2,3,q,w,e,a,s,d,z,c,4,r,f,v"
+ * @param names 16 comma separated SDL key names for Chip-8 keys 0-F
+ * @param keyMap Parsed SDL keycodes
+ * @return False if there weren't 16 valid key names
+ */
+bool parseKeyMap(const std::string &names, int32_t keyMap[16])
+{
+    std::stringstream stream(names);
+    std::string name;
+    int key = 0;
+    while (std::getline(stream, name, ','))
+    {
+        SDL_Keycode code = SDL_GetKeyFromName(name.c_str());
+        if (key >= 16 || code == SDLK_UNKNOWN)
+        {
+            return false;
+        }
+        keyMap[key++] = code;
+    }
+    return key == 16;
+}
+
+/**
+ * What the emulator does while its window is in the background (hidden or minimised, or optionally just
+ * unfocused)
+ */
+enum class BackgroundPolicy
+{
+    Run,    // Carry on as in the foreground
+    Skip,   // Keep emulating at full rate, but don't upload or present frames
+    Slow,   // Emulate at a lower frame rate, without presenting
+    Pause   // Stop emulating and block until the window comes back
+};
+
+/**
+ * Parses a whole decimal number from the command line
+ * @param text Text to parse
+ * @param value Parsed value
+ * @return False unless the text is only digits and fits
+ */
+bool parseUnsigned(const std::string &text, unsigned long &value)
+{
+    if (text.empty() || !isdigit((unsigned char) text[0]))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    value = strtoul(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * @param name run, skip, slow or pause
+ * @param policy Parsed policy
+ * @return False if the name isn't a policy
+ */
+bool parseBackgroundPolicy(const std::string &name, BackgroundPolicy &policy)
+{
+    static const char *const names[] = {"run", "skip", "slow", "pause"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (name == names[i])
+        {
+            policy = (BackgroundPolicy) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return Name of a policy, as parseBackgroundPolicy() takes it
+ */
+const char *backgroundPolicyName(BackgroundPolicy policy)
+{
+    static const char *const names[] = {"run", "skip", "slow", "pause"};
+    return names[(int) policy];
+}
+
+/**
+ * Scans a directory into the ROM library index
+ * @param indexPath Index file
+ * @param directory Directory to scan
+ * @return Exit code
+ */
+int scanLibrary(const std::string &indexPath, const char *directory)
+{
+    RomLibrary library(indexPath);
+    library.open();
+
+    RomScanStats stats;
+    if (!library.scan(directory, stats))
+    {
+        return -1;
+    }
+
+    std::cout << "Indexed " << stats.files << " ROMs (" << stats.hashed << " new or changed, " << stats.removed
+              << " removed), " << library.size() << " entries in " << indexPath << std::endl;
+    return 0;
+}
+
+/**
+ * Attaches static analysis and IR for a freshly loaded ROM
+ * @param chip Instance the ROM was loaded into
+ * @param romData ROM contents
+ * @param useAnalysis Use (and cache) the static analysis of the ROM
+ * @param useIr Run the ROM from IR
+ * @param loadStoreQuirk Quirk the IR is built for
+ * @param shiftQuirk Quirk the IR is built for
+ * @param analysis Analysis that was attached, if any
+ * @param irProgram IR that was attached, if any
+ */
+void attachEngines(ChipEight &chip, const std::vector<uint8_t> &romData, bool useAnalysis, bool useIr,
+                   bool loadStoreQuirk, bool shiftQuirk, std::shared_ptr<const RomAnalysis> &analysis,
+                   std::shared_ptr<const IrProgram> &irProgram)
+{
+    analysis.reset();
+    irProgram.reset();
+
+    // Analysis and IR cover 4 KB of CHIP-8 code, SUPER-CHIP and XO-CHIP ROMs are interpreted
+    if (chip.getVariant() != ChipVariant::Chip8)
+    {
+        return;
+    }
+    if (useAnalysis)
+    {
+        analysis = RomAnalysis::get(romData, AnalysisCache::defaultDirectory());
+        chip.setAnalysis(analysis);
+    }
+    if (useIr)
+    {
+        if (!analysis)
+        {
+            analysis = RomAnalysis::get(romData, "");
+        }
+        irProgram = IrProgram::build(romData, analysis->getGraph(), loadStoreQuirk, shiftQuirk);
+        chip.setIrProgram(irProgram);
+    }
+}
+
+/**
+ * Runs the ROM headless at a range of instruction rates and stores the lowest one that keeps up
+ * @return Exit code
+ */
+int tuneROM(const std::vector<uint8_t> &romData, bool loadStoreQuirk, bool shiftQuirk, unsigned int frames,
+            const std::string &inputPath, RomLibrary &library, uint64_t romHash, const char *path, RomProfile profile)
+{
+    AutoTuner tuner(romData, loadStoreQuirk, shiftQuirk);
+    tuner.setFrames(frames);
+    if (!inputPath.empty() && !tuner.loadInputScript(inputPath))
+    {
+        std::cout << "ERROR: Couldn't read tuning input: " << inputPath << std::endl;
+        return -1;
+    }
+
+    std::vector<TuneResult> results = tuner.run(AutoTuner::defaultRates());
+    std::cout << "rate   idle    kept up" << std::endl;
+    for (const TuneResult &result : results)
+    {
+        printf("%4d  %5.1f%%  %6.1f%%\n", result.cyclesPerTick, result.idleFraction * 100,
+               result.keptUpFraction * 100);
+    }
+
+    int rate = AutoTuner::recommend(results, 0.95);
+    if (rate == -1)
+    {
+        std::cout << "ROM never waits for the timer or input, can't pick a rate automatically" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Recommended rate: " << rate << " instructions per frame" << std::endl;
+    if (profile.title[0] == '\0')
+    {
+        snprintf(profile.title, sizeof(profile.title), "%s", extractROMName(path).c_str());
+    }
+    profile.cyclesPerTick = rate;
+    profile.loadStoreQuirk = loadStoreQuirk;
+    profile.shiftQuirk = shiftQuirk;
+    if (!library.setProfile(romHash, romData.size(), path, profile))
+    {
+        return -1;
+    }
+    std::cout << "Saved to ROM library" << std::endl;
+    return 0;
+}
+
+/**
+ * Runs several instances of the ROM side by side in one window
+ * @param instances Instances to run, already set up
+ * @param title Window title
+ * @param scale Window pixels per Chip-8 pixel, 0 to fit the grid on screen
+ * @param turbo Run as fast as possible instead of 60 ticks per second
+ * @param maxFrames Stop after this many frames, 0 to run until closed
+ * @return Exit code
+ */
+int runGrid(const std::vector<std::unique_ptr<ChipEight>> &instances, const std::string &title, unsigned int scale,
+            bool turbo, uint64_t maxFrames)
+{
+    std::vector<ChipEight *> chips;
+    for (const auto &chip : instances)
+    {
+        chips.push_back(chip.get());
+    }
+
+    GridView grid(chips, scale);
+    if (!grid.open(title))
+    {
+        return -1;
+    }
+
+    auto lastCycleTime = std::chrono::high_resolution_clock::now();
+    uint64_t frame = 0;
+    while (maxFrames == 0 || frame < maxFrames)
+    {
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+        if (!turbo && dt < (float) 1000 / 60)
+        {
+            continue;
+        }
+        lastCycleTime = currentTime;
+
+        TRACE_ZONE("frame");
+        if (!grid.processInputs())
+        {
+            break;
+        }
+        {
+            TRACE_ZONE("executeCycle");
+            for (ChipEight *chip : chips)
+            {
+                chip->executeCycle();
+            }
+        }
+        grid.present();
+        ++frame;
+    }
+
+    std::cout << "Ran " << chips.size() << " instances for " << frame << " frames, " << grid.tilesUploaded()
+              << " tile uploads" << std::endl;
+    return 0;
+}
+
+/**
+ * Prints command line usage
+ */
+void printUsage()
+{
+    std::cout << "Usage: chip8_emu <rom_path> [cycle_delay] [options]\n"
+                 "       chip8_emu --scan <directory> [--library <index>]\n"
+                 "  --library <index>          ROM library index (default $CHIP8_LIBRARY or ~/.chip8/library.idx)\n"
+                 "  --no-library               don't load settings from the ROM library\n"
+                 "  --save-profile             store this launch's settings as the ROM's profile\n"
+                 "  --title <title>            title stored with --save-profile\n"
+                 "  --load-store-quirk         FX55/FX65 don't increment I\n"
+                 "  --shift-quirk              8XY6/8XYE shift VX instead of VY\n"
+                 "  --display-wait             sprite draws wait for vblank, ending the frame (COSMAC VIP)\n"
+                 "  --no-display-wait          turn off a display wait stored in the ROM's profile\n"
+                 "  --variant <name>           chip8, schip (SUPER-CHIP) or xochip (default from the profile, or\n"
+                 "                             schip for .sc8 and xochip for .xo8 files)\n"
+                 "  --keys <k0,k1,...,kF>      SDL key names for Chip-8 keys 0-F\n"
+                 "  --autotune                 find the lowest instruction rate the ROM needs and store it\n"
+                 "  --tune-frames <n>          frames to run per rate when tuning (default 1800)\n"
+                 "  --tune-input <file>        recorded input for tuning (\"<frame> <hex key mask>\" per line)\n"
+                 "  --compiled <module>        run a ROM module built with chip8_aot where possible\n"
+                 "  --no-analysis              don't use (or cache) static analysis of the ROM\n"
+                 "  --ir                       run the ROM from optimised IR instead of interpreting it\n"
+                 "  --run-ahead <n>            present frames n frames ahead to hide the ROM's input lag\n"
+                 "  --run-ahead-threads <n>    threads running ahead for likely key changes (default 0)\n"
+                 "  --debug                    start in the debugger console\n"
+                 "  --scale <n>                window scale, 1 to 64 (default 20)\n"
+                 "  --software                 upscale on the CPU instead of using the GPU renderer\n"
+                 "  --style <style>            software upscale style: plain, scanlines or grid\n"
+                 "  --background <policy>      while the window is hidden or minimised: run, skip (keep emulating\n"
+                 "                             but don't present, default), slow or pause\n"
+                 "  --background-fps <n>       frame rate for --background slow (default 10)\n"
+                 "  --background-unfocused     also apply the background policy while the window is unfocused\n"
+                 "  --headless                 run without a window, audio or input\n"
+                 "  --grid <n>                 run n instances side by side in one window (keys go to the\n"
+                 "                             clicked one, Tab cycles)\n"
+                 "  --turbo                    run as fast as possible instead of 60 ticks per second\n"
+                 "  --frames <n>               stop after n frames\n"
+                 "  --report-first-frame       print FIRST FRAME once the first frame is presented\n"
+                 "  --watch                    reload the ROM from the start whenever the file changes\n"
+                 "  --watch-keep-state         reload the ROM on change, keeping registers and untouched memory\n"
+                 "  --capture <format>:<path>  record frames (y4m, raw, png, ffmpeg)\n"
+                 "  --capture-scale <n>        integer upscale for captured frames (default 1)\n"
+                 "  --capture-changed          only record frames that differ from the previous one\n"
+                 "  --latency                  measure key-to-screen latency and report it on exit\n"
+                 "  --latency-input <file>     drive --latency from an input script instead of the keyboard\n"
+                 "                             (\"<frame> <hex key mask>\" per line, or \"taps\" for random taps)\n"
+                 "  --latency-budget <n>       exit with an error if the 99th percentile exceeds n frames\n"
+                 "  --trace <path>             record frame phases and write Chrome trace-event JSON on exit\n"
+                 "  --publish <name>           publish frames and state to POSIX shared memory (e.g. /chip8)\n"
+                 "  --audio-out <path>         render the beeper in emulated time to a WAV (.wav) or raw PCM file\n"
+                 "  --audio-hash               print a hash of the rendered audio on exit\n"
+                 "  --audio-golden <hash>      exit with an error if the rendered audio's hash differs\n"
+                 "  --record-trace <path>      record every executed instruction to a compressed trace (see chip8_trace)"
+              << std::endl;
+}
+
 int main(int argc, char **args)
 {
+    // Library maintenance mode
+    if (argc >= 3 && std::string(args[1]) == "--scan")
+    {
+        std::string indexPath = RomLibrary::defaultIndexPath();
+        if (argc >= 5 && std::string(args[3]) == "--library")
+        {
+            indexPath = args[4];
+        }
+        return scanLibrary(indexPath, args[2]);
+    }
+
     // Ensure correct number of args are supplied
-    if (argc != 3)
+    if (argc < 2)
     {
 
-        std::cout << "ERROR: Requires 2 args: <rom_path> <cycle_delay>";
+        std::cout << "ERROR: Requires a ROM path" << std::endl;
+        printUsage();
         exit(-1);
     }
 
-    // Extract command line args
+    // Extract command line args, cycle delay is optional when the ROM library knows the ROM
     const char *path = args[1];
-    int cyclesPerTick = std::stoi(args[2]);
+    int firstOption = 2;
+    int cyclesPerTick = 0;
+    if (argc > 2 && args[2][0] != '-')
+    {
+        cyclesPerTick = std::stoi(args[2]);
+        firstOption = 3;
+    }
+    std::string indexPath = RomLibrary::defaultIndexPath();
+    bool useLibrary = true;
+    bool saveProfile = false;
+    std::string profileTitle;
+    int loadStoreQuirk = -1;
+    int shiftQuirk = -1;
+    int displayWait = -1;
+    std::string variantText;
+    std::string keyNames;
+    bool autoTune = false;
+    unsigned int tuneFrames = 1800;
+    std::string tuneInput;
+    std::string compiledPath;
+    bool useAnalysis = true;
+    bool useIr = false;
+    unsigned int runAheadFrames = 0;
+    unsigned int runAheadThreads = 0;
+    bool debug = false;
+    bool headless = false;
+    unsigned int gridSize = 0;
+    bool turbo = false;
+    uint64_t maxFrames = 0;
+    std::string captureSpec;
+    unsigned int captureScale = 1;
+    bool captureChangedOnly = false;
+    bool measureLatency = false;
+    std::string latencyInput;
+    int latencyBudget = -1;
+    std::string tracePath;
+    std::string publishName;
+    bool reportFirstFrame = false;
+    bool watch = false;
+    bool watchKeepState = false;
+    bool renderAudio = false;
+    std::string audioPath;
+    std::string audioGolden;
+    std::string instructionTracePath;
+    unsigned int scale = 0;
+    bool software = false;
+    ScaleStyle style = ScaleStyle::Plain;
+    BackgroundPolicy backgroundPolicy = BackgroundPolicy::Skip;
+    unsigned int backgroundFps = 10;
+    bool backgroundUnfocused = false;
+
+    for (int i = firstOption; i < argc; i++)
+    {
+        std::string arg = args[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--library" && hasValue)
+        {
+            indexPath = args[++i];
+        }
+        else if (arg == "--no-library")
+        {
+            useLibrary = false;
+        }
+        else if (arg == "--save-profile")
+        {
+            saveProfile = true;
+        }
+        else if (arg == "--title" && hasValue)
+        {
+            profileTitle = args[++i];
+        }
+        else if (arg == "--load-store-quirk")
+        {
+            loadStoreQuirk = 1;
+        }
+        else if (arg == "--variant" && hasValue)
+        {
+            variantText = args[++i];
+        }
+        else if (arg == "--shift-quirk")
+        {
+            shiftQuirk = 1;
+        }
+        else if (arg == "--display-wait")
+        {
+            displayWait = 1;
+        }
+        else if (arg == "--no-display-wait")
+        {
+            displayWait = 0;
+        }
+        else if (arg == "--keys" && hasValue)
+        {
+            keyNames = args[++i];
+        }
+        else if (arg == "--autotune")
+        {
+            autoTune = true;
+        }
+        else if (arg == "--tune-frames" && hasValue)
+        {
+            tuneFrames = std::stoi(args[++i]);
+        }
+        else if (arg == "--tune-input" && hasValue)
+        {
+            tuneInput = args[++i];
+        }
+        else if (arg == "--compiled" && hasValue)
+        {
+            compiledPath = args[++i];
+        }
+        else if (arg == "--no-analysis")
+        {
+            useAnalysis = false;
+        }
+        else if (arg == "--ir")
+        {
+            useIr = true;
+        }
+        else if (arg == "--run-ahead" && hasValue)
+        {
+            runAheadFrames = std::stoi(args[++i]);
+        }
+        else if (arg == "--run-ahead-threads" && hasValue)
+        {
+            runAheadThreads = std::stoi(args[++i]);
+        }
+        else if (arg == "--debug")
+        {
+            debug = true;
+        }
+        else if (arg == "--scale" && hasValue)
+        {
+            unsigned long value = 0;
+            if (!parseUnsigned(args[++i], value) || value < 1 || value > MAX_SCALE)
+            {
+                std::cout << "ERROR: --scale must be between 1 and " << MAX_SCALE << std::endl;
+                exit(-1);
+            }
+            scale = value;
+        }
+        else if (arg == "--software")
+        {
+            software = true;
+        }
+        else if (arg == "--style" && hasValue && parseScaleStyle(args[i + 1], style))
+        {
+            ++i;
+        }
+        else if (arg == "--background" && hasValue)
+        {
+            if (!parseBackgroundPolicy(args[++i], backgroundPolicy))
+            {
+                std::cout << "ERROR: --background must be run, skip, slow or pause" << std::endl;
+                exit(-1);
+            }
+        }
+        else if (arg == "--background-fps" && hasValue)
+        {
+            backgroundFps = std::max(1, std::stoi(args[++i]));
+        }
+        else if (arg == "--background-unfocused")
+        {
+            backgroundUnfocused = true;
+        }
+        else if (arg == "--headless")
+        {
+            headless = true;
+        }
+        else if (arg == "--grid" && hasValue)
+        {
+            gridSize = std::stoi(args[++i]);
+        }
+        else if (arg == "--turbo")
+        {
+            turbo = true;
+        }
+        else if (arg == "--frames" && hasValue)
+        {
+            maxFrames = std::stoull(args[++i]);
+        }
+        else if (arg == "--report-first-frame")
+        {
+            reportFirstFrame = true;
+        }
+        else if (arg == "--watch")
+        {
+            watch = true;
+        }
+        else if (arg == "--watch-keep-state")
+        {
+            watch = true;
+            watchKeepState = true;
+        }
+        else if (arg == "--capture" && hasValue)
+        {
+            captureSpec = args[++i];
+        }
+        else if (arg == "--capture-scale" && hasValue)
+        {
+            captureScale = std::stoi(args[++i]);
+        }
+        else if (arg == "--capture-changed")
+        {
+            captureChangedOnly = true;
+        }
+        else if (arg == "--latency")
+        {
+            measureLatency = true;
+        }
+        else if (arg == "--latency-input" && hasValue)
+        {
+            measureLatency = true;
+            latencyInput = args[++i];
+        }
+        else if (arg == "--latency-budget" && hasValue)
+        {
+            measureLatency = true;
+            latencyBudget = std::stoi(args[++i]);
+        }
+        else if (arg == "--trace" && hasValue)
+        {
+            tracePath = args[++i];
+        }
+        else if (arg == "--publish" && hasValue)
+        {
+            publishName = args[++i];
+        }
+        else if (arg == "--audio-out" && hasValue)
+        {
+            audioPath = args[++i];
+            renderAudio = true;
+        }
+        else if (arg == "--audio-hash")
+        {
+            renderAudio = true;
+        }
+        else if (arg == "--audio-golden" && hasValue)
+        {
+            audioGolden = args[++i];
+            renderAudio = true;
+        }
+        else if (arg == "--record-trace" && hasValue)
+        {
+            instructionTracePath = args[++i];
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown option: " << arg << std::endl;
+            printUsage();
+            exit(-1);
+        }
+    }
+
+    // Started before anything else so worker threads are traced from the beginning
+    Trace::setThreadName("emulator");
+    if (!tracePath.empty())
+    {
+        Trace::enable();
+    }
+
+    // Read the whole ROM in one go, refusing anything that wouldn't fit in memory
+    std::vector<uint8_t> romData;
+    if (!readROM(path, romData))
+    {
+        exit(-1);
+    }
+    uint64_t romHash = hashROM(romData.data(), romData.size());
+
+    // Fill in anything not given on the command line from the ROM's stored profile
+    RomLibrary library(indexPath);
+    RomProfile profile{};
+    if (useLibrary && library.open())
+    {
+        const RomIndexEntry *entry = library.find(romHash);
+        if (entry != nullptr)
+        {
+            profile = entry->profile;
+        }
+    }
+    bool hasProfile = profile.flags & RomProfile::FLAG_SET;
+
+    if (cyclesPerTick == 0)
+    {
+        cyclesPerTick = hasProfile && profile.cyclesPerTick != 0 ? profile.cyclesPerTick : 8;
+    }
+    if (loadStoreQuirk == -1)
+    {
+        loadStoreQuirk = hasProfile && profile.loadStoreQuirk;
+    }
+    if (shiftQuirk == -1)
+    {
+        shiftQuirk = hasProfile && profile.shiftQuirk;
+    }
+    if (displayWait == -1)
+    {
+        displayWait = hasProfile && profile.displayWait;
+    }
+    ChipVariant variant = ChipVariant::Chip8;
+    std::string pathText = path;
+    std::string extension = pathText.substr(std::min(pathText.rfind('.'), pathText.size()));
+    if (!variantText.empty())
+    {
+        if (!parseVariant(variantText, variant))
+        {
+            std::cout << "ERROR: --variant must be chip8, schip or xochip" << std::endl;
+            exit(-1);
+        }
+    }
+    else if (hasProfile && profile.variant <= (uint8_t) ChipVariant::XoChip)
+    {
+        variant = (ChipVariant) profile.variant;
+    }
+    else if (extension == ".sc8")
+    {
+        variant = ChipVariant::SuperChip;
+    }
+    else if (extension == ".xo8")
+    {
+        variant = ChipVariant::XoChip;
+    }
+    if (!keyNames.empty() && !parseKeyMap(keyNames, profile.keyMap))
+    {
+        std::cout << "ERROR: --keys needs 16 comma separated SDL key names" << std::endl;
+        exit(-1);
+    }
+    if (!profileTitle.empty())
+    {
+        snprintf(profile.title, sizeof(profile.title), "%s", profileTitle.c_str());
+    }
+
+    std::string title = "Chip-8: " + (profile.title[0] != '\0' ? std::string(profile.title) : extractROMName(path));
+
+    if (autoTune && variant != ChipVariant::Chip8)
+    {
+        std::cout << "ERROR: --autotune only supports CHIP-8 ROMs" << std::endl;
+        exit(-1);
+    }
+    if (autoTune)
+    {
+        return tuneROM(romData, loadStoreQuirk, shiftQuirk, tuneFrames, tuneInput, library, romHash, path, profile);
+    }
+
+    if (saveProfile)
+    {
+        if (profile.title[0] == '\0')
+        {
+            snprintf(profile.title, sizeof(profile.title), "%s", extractROMName(path).c_str());
+        }
+        profile.cyclesPerTick = cyclesPerTick;
+        profile.loadStoreQuirk = loadStoreQuirk;
+        profile.shiftQuirk = shiftQuirk;
+        profile.variant = (uint8_t) variant;
+        profile.displayWait = displayWait;
+        if (library.setProfile(romHash, romData.size(), path, profile))
+        {
+            std::cout << "Saved profile for " << profile.title << " to " << indexPath << std::endl;
+        }
+    }
+
+    if (gridSize > 0 && headless)
+    {
+        std::cout << "ERROR: --grid needs a window" << std::endl;
+        exit(-1);
+    }
+
+    // These frontends still only handle the 64x32 display
+    if (variant != ChipVariant::Chip8 && (gridSize > 0 || runAheadFrames > 0 || runAheadThreads > 0 ||
+                                          !captureSpec.empty() || !publishName.empty() || software))
+    {
+        std::cout << "ERROR: --grid, --run-ahead, --capture, --publish and --software only support CHIP-8 ROMs"
+                  << std::endl;
+        exit(-1);
+    }
+
+    // A frame taken from a branch never runs on the real machine, so it would be missing from both
+    if (runAheadThreads > 0 && (!instructionTracePath.empty() || measureLatency))
+    {
+        std::cout << "ERROR: --record-trace and --latency can't be combined with --run-ahead-threads" << std::endl;
+        exit(-1);
+    }
+
+    if (displayWait && (useIr || !compiledPath.empty()))
+    {
+        std::cout << "Display wait runs on the interpreter, --compiled and --ir only apply without it" << std::endl;
+    }
 
-    // Check ROM file exists
-    if (!fileExists(path))
+    // Set up Chip-8, load the ROM and create the SDL window (grid instances share one window instead)
+    ChipEight chipEight(loadStoreQuirk, shiftQuirk, cyclesPerTick, headless || gridSize > 0);
+    chipEight.setVariant(variant);
+    chipEight.setDisplayWait(displayWait);
+    if (!chipEight.LoadROM(romData.data(), romData.size()))
     {
-        std::cout << "ROM DOES NOT EXIST: " << path << std::endl;
         exit(-1);
     }
-    std::string title = "Chip-8: " + extractROMName(path);
+    chipEight.setKeyMap(profile.keyMap);
+    std::shared_ptr<const RomAnalysis> analysis;
+    std::shared_ptr<const IrProgram> irProgram;
+    attachEngines(chipEight, romData, useAnalysis, useIr, loadStoreQuirk, shiftQuirk, analysis, irProgram);
+    if (!compiledPath.empty() && !chipEight.loadCompiled(compiledPath.c_str()))
+    {
+        std::cout << "Running interpreted" << std::endl;
+    }
+    if (gridSize > 0)
+    {
+        std::vector<std::unique_ptr<ChipEight>> instances;
+        for (unsigned int i = 0; i < gridSize; i++)
+        {
+            auto instance = std::make_unique<ChipEight>(loadStoreQuirk, shiftQuirk, cyclesPerTick, true);
+            instance->setDisplayWait(displayWait);
+            instance->LoadROM(romData.data(), romData.size());
+            instance->setKeyMap(profile.keyMap);
+            instance->setAnalysis(analysis);
+            instance->setIrProgram(irProgram);
+            if (!compiledPath.empty())
+            {
+                instance->loadCompiled(compiledPath.c_str());
+            }
+            instances.push_back(std::move(instance));
+        }
+        int result = runGrid(instances, title, scale, turbo, maxFrames);
+        if (!tracePath.empty())
+        {
+            Trace::write(tracePath);
+        }
+        return result;
+    }
+    if (!headless)
+    {
+        chipEight.setupScreen(title.c_str(), scale != 0 ? scale : 20, software, style);
+    }
+
+    // Debugger starts stopped with --debug so breakpoints can be set. Otherwise it stays attached but idle, which
+    // costs one branch per frame, so F12 can break into it at any point.
+    Debugger debugger;
+    if (debug)
+    {
+        debugger.requestBreak();
+    }
+
+    // Running ahead would step the debugger through frames that are thrown away
+    std::unique_ptr<RunAhead> runAhead;
+    if ((runAheadFrames > 0 || runAheadThreads > 0) && debug)
+    {
+        std::cout << "Run-ahead is disabled while debugging" << std::endl;
+    }
+    else if (runAheadFrames > 0 || runAheadThreads > 0)
+    {
+        runAhead = std::make_unique<RunAhead>(chipEight, runAheadFrames, runAheadThreads);
+        chipEight.setSubFrameInput(false);
+    }
+    if (!runAhead)
+    {
+        chipEight.debugger = &debugger;
+    }
+
+    // Frame capture, encoded on a background thread. Headless runs are exports, so never drop frames.
+    std::unique_ptr<FrameCapture> capture;
+    if (!captureSpec.empty())
+    {
+        FrameCapture::Format format;
+        size_t separator = captureSpec.find(':');
+        if (separator == std::string::npos || !FrameCapture::parseFormat(captureSpec.substr(0, separator), format))
+        {
+            std::cout << "ERROR: Capture must be <y4m|raw|png|ffmpeg>:<path>" << std::endl;
+            exit(-1);
+        }
+
+        capture = std::make_unique<FrameCapture>(format, captureSpec.substr(separator + 1), captureScale,
+                                                 captureChangedOnly, headless);
+        if (!capture->open())
+        {
+            exit(-1);
+        }
+    }
+
+    // Latency measurement, from the keyboard or from scripted input so it can run headless
+    std::unique_ptr<LatencyProbe> latencyProbe;
+    std::vector<InputEvent> latencyScript;
+    size_t nextLatencyEvent = 0;
+    if (measureLatency)
+    {
+        latencyProbe = std::make_unique<LatencyProbe>();
+        chipEight.latencyProbe = latencyProbe.get();
+        if (latencyInput == "taps")
+        {
+            latencyScript = generateKeyTaps(maxFrames != 0 ? maxFrames : 36000);
+        }
+        else if (!latencyInput.empty() && !loadInputScript(latencyInput, latencyScript))
+        {
+            std::cout << "ERROR: Couldn't read latency input: " << latencyInput << std::endl;
+            exit(-1);
+        }
+        if (headless && latencyInput.empty())
+        {
+            std::cout << "ERROR: --latency needs --latency-input when running headless" << std::endl;
+            exit(-1);
+        }
+    }
+
+    // Frames and state for other processes, read straight from shared memory
+    std::unique_ptr<ShmPublisher> publisher;
+    if (!publishName.empty())
+    {
+        publisher = std::make_unique<ShmPublisher>(publishName);
+        if (!publisher->open())
+        {
+            exit(-1);
+        }
+    }
+
+    // Offline audio, rendered from the sound timer in emulated time (alongside the live beeper, if any)
+    std::unique_ptr<AudioRenderer> audioRenderer;
+    if (renderAudio)
+    {
+        audioRenderer = std::make_unique<AudioRenderer>(audioPath);
+        if (!audioRenderer->open())
+        {
+            exit(-1);
+        }
+        chipEight.audioRenderer = audioRenderer.get();
+    }
+
+    // Every instruction executed, for chip8_trace to search and diff afterwards
+    std::unique_ptr<InstructionTraceWriter> instructionTrace;
+    if (!instructionTracePath.empty())
+    {
+        instructionTrace = std::make_unique<InstructionTraceWriter>(instructionTracePath, romHash, cyclesPerTick);
+        if (!instructionTrace->open())
+        {
+            exit(-1);
+        }
+        chipEight.instructionTrace = instructionTrace.get();
+    }
 
-    // Set up Chip-8, load the ROM and create the SDL window
-    ChipEight chipEight(false, false, cyclesPerTick);
-    chipEight.LoadROM(path);
-    chipEight.setupScreen(title.c_str(), 20);
+    // ROM rebuilds are loaded into this process, keeping the window, audio and settings
+    std::unique_ptr<RomWatcher> watcher;
+    if (watch)
+    {
+        watcher = std::make_unique<RomWatcher>(path);
+        if (!watcher->open())
+        {
+            exit(-1);
+        }
+    }
 
     auto lastCycleTime = std::chrono::high_resolution_clock::now();
+    uint64_t frame = 0;
+    uint64_t frameEnd = 0;
+    uint64_t backgroundFrames = 0;
+    std::chrono::steady_clock::duration pausedTime{};
 
     // Emulation cycle
-    while (chipEight.shouldRun)
+    while (chipEight.shouldRun && (maxFrames == 0 || frame < maxFrames))
     {
+        bool background = !headless && backgroundPolicy != BackgroundPolicy::Run &&
+                          (!chipEight.isWindowVisible() || (backgroundUnfocused && !chipEight.isWindowFocused()));
+        if (background && backgroundPolicy == BackgroundPolicy::Pause)
+        {
+            TRACE_ZONE("paused");
+            auto pauseStart = std::chrono::steady_clock::now();
+            chipEight.stopSound();
+            chipEight.waitForEvents(-1);
+            pausedTime += std::chrono::steady_clock::now() - pauseStart;
+
+            // Emulated time stands still while paused rather than catching up afterwards
+            lastCycleTime = std::chrono::high_resolution_clock::now();
+            continue;
+        }
+        bool slow = background && backgroundPolicy == BackgroundPolicy::Slow;
+        float period = (float) 1000 / (slow ? backgroundFps : 60);
+
         auto currentTime = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
 
-        if (dt >= (float) 1000 / 60)
+        // The first frame runs straight away rather than a frame period after startup
+        if ((turbo && !slow) || frame == 0 || dt >= period)
         {
+            // Time the scheduler spent waiting for this frame to be due
+            if (frameEnd != 0)
+            {
+                Trace::record("wait", frameEnd, Trace::now());
+            }
+            TRACE_ZONE("frame");
+
             lastCycleTime = currentTime;
+            if (watcher && watcher->changed())
+            {
+                TRACE_ZONE("reload");
+                auto reloadStart = std::chrono::steady_clock::now();
+                std::vector<uint8_t> newRomData;
+                if (readROM(path, newRomData) && !newRomData.empty() &&
+                    chipEight.reloadROM(newRomData.data(), newRomData.size(), watchKeepState))
+                {
+                    romData = std::move(newRomData);
+                    attachEngines(chipEight, romData, useAnalysis, useIr, loadStoreQuirk, shiftQuirk, analysis,
+                                  irProgram);
+
+                    // Branch threads run their own copies of the old ROM
+                    if (runAhead)
+                    {
+                        runAhead.reset();
+                        runAhead = std::make_unique<RunAhead>(chipEight, runAheadFrames, runAheadThreads);
+                    }
+                    chipEight.drawFlag = true;
+                    std::cout << "Reloaded " << path << " (" << romData.size() << " bytes) in " << std::fixed
+                              << std::setprecision(2) << std::chrono::duration<double, std::milli>(
+                                      std::chrono::steady_clock::now() - reloadStart).count() << " ms"
+                              << std::defaultfloat << std::endl;
+                }
+            }
+            if (latencyProbe)
+            {
+                latencyProbe->beginFrame();
+            }
+            if (!headless)
+            {
+                TRACE_ZONE("processInputs");
+                chipEight.processInputs();
+                if (runAhead)
+                {
+                    // Run-ahead predicts whole frames from the keys held at the start of each
+                    chipEight.applyKeyEvents();
+                }
+            }
+
+            // Scripted keys are pressed at the start of their frame, as if the events had just arrived
+            while (nextLatencyEvent < latencyScript.size() && latencyScript[nextLatencyEvent].frame <= frame)
+            {
+                uint16_t keys = latencyScript[nextLatencyEvent++].keys;
+                uint16_t previous = chipEight.getKeypadMask();
+                auto now = std::chrono::steady_clock::now();
+                for (uint8_t key = 0; key < 16; key++)
+                {
+                    if ((keys & ~previous) & (1u << key))
+                    {
+                        latencyProbe->onKeyDown(key, now);
+                    }
+                    else if ((previous & ~keys) & (1u << key))
+                    {
+                        latencyProbe->onKeyUp(key);
+                    }
+                }
+                chipEight.setKeypad(keys);
+            }
+            {
+                TRACE_ZONE("executeCycle");
+                if (runAhead)
+                {
+                    runAhead->runFrame();
+                }
+                else
+                {
+                    chipEight.executeCycle();
+                }
+            }
+
+            if (capture)
+            {
+                TRACE_ZONE("capture");
+                capture->submit(chipEight.video, frame);
+            }
+
+            if (publisher)
+            {
+                TRACE_ZONE("publish");
+                publisher->publish(chipEight, frame);
+            }
+
+            if (background)
+            {
+                // Nobody can see the window: drawFlag stays set, so the latest frame is presented on return
+                ++backgroundFrames;
+            }
+            else if (!headless)
+            {
+                TRACE_ZONE("updateScreen");
+                chipEight.updateScreen(runAhead ? runAhead->getFrame() : chipEight.video,
+                                       sizeof(chipEight.video[0]) * chipEight.getVideoWidth());
+            }
+            else if (latencyProbe)
+            {
+                // Headless frames count as presented once they finish
+                latencyProbe->onPresent();
+            }
+            if (frame == 0 && reportFirstFrame)
+            {
+                std::cout << "FIRST FRAME" << std::endl;
+            }
+            ++frame;
+            frameEnd = Trace::isEnabled() ? Trace::now() : 0;
+        }
+        else if (background)
+        {
+            // Sleep until the frame is due instead of spinning, waking early for events
+            chipEight.waitForEvents(std::max(1, (int) (period - dt)));
+        }
+        else if (!headless)
+        {
+            // Keys are sampled while waiting for the next frame, which places each one at its own instruction
             chipEight.processInputs();
-            chipEight.executeCycle();
-            chipEight.updateScreen(chipEight.video, sizeof(chipEight.video[0]) * VIDEO_WIDTH);
+        }
+    }
+
+    if (backgroundFrames > 0 || pausedTime.count() > 0)
+    {
+        std::cout << "Background (" << backgroundPolicyName(backgroundPolicy) << "): " << backgroundFrames
+                  << " frames run unpresented, " << std::fixed << std::setprecision(1)
+                  << std::chrono::duration<double>(pausedTime).count() << " s paused" << std::defaultfloat
+                  << std::endl;
+    }
+    if (capture)
+    {
+        capture->close();
+        std::cout << "Captured " << capture->framesWritten() << " frames (" << capture->framesDropped()
+                  << " dropped)" << std::endl;
+    }
+    if (runAhead && runAheadThreads > 0)
+    {
+        std::cout << "Run-ahead branches: " << runAhead->getBranchHits() << " hits, " << runAhead->getBranchMisses()
+                  << " misses" << std::endl;
+    }
+    if (!tracePath.empty())
+    {
+        Trace::write(tracePath);
+    }
+    if (instructionTrace)
+    {
+        instructionTrace->close();
+        std::cout << "Instruction trace: " << instructionTrace->instructionsRecorded() << " instructions, "
+                  << instructionTrace->bytesWritten() << " bytes" << std::endl;
+    }
+    if (audioRenderer)
+    {
+        audioRenderer->close();
+        std::stringstream hash;
+        hash << std::hex << std::setw(16) << std::setfill('0') << audioRenderer->getHash();
+        std::cout << "Audio: " << audioRenderer->samplesRendered() << " samples, hash " << hash.str() << std::endl;
+        if (!audioGolden.empty() && audioGolden != hash.str())
+        {
+            std::cout << "ERROR: Audio differs from golden hash " << audioGolden << std::endl;
+            return 1;
+        }
+    }
+    if (latencyProbe)
+    {
+        latencyProbe->printReport();
+        if (latencyBudget >= 0 && (latencyProbe->getSamples().empty() ||
+                                   latencyProbe->percentileFrames(99) > (uint64_t) latencyBudget))
+        {
+            std::cout << "ERROR: Input latency over budget of " << latencyBudget << " frames" << std::endl;
+            return 1;
         }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,249 @@
+#include "AnalysisCache.h"
+#include "RomLibrary.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+AnalysisCache::AnalysisCache(std::string _directory)
+        : directory(std::move(_directory))
+{
+}
+
+AnalysisCache::~AnalysisCache()
+{
+    close();
+}
+
+/**
+ * @return $CHIP8_CACHE if set, otherwise ~/.chip8/cache
+ */
+std::string AnalysisCache::defaultDirectory()
+{
+    const char *overridePath = getenv("CHIP8_CACHE");
+    if (overridePath != nullptr && *overridePath != '\0')
+    {
+        return overridePath;
+    }
+
+    const char *home = getenv("HOME");
+    if (home == nullptr)
+    {
+        home = getenv("USERPROFILE");
+    }
+    return std::string(home != nullptr ? home : ".") + "/.chip8/cache";
+}
+
+/**
+ * @param romHash Hash from hashROM()
+ * @return Path of the cache file for a ROM
+ */
+std::string AnalysisCache::pathFor(uint64_t romHash) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.c8a", (unsigned long long) romHash);
+    return directory + "/" + name;
+}
+
+/**
+ * Unmaps the current file
+ */
+void AnalysisCache::close()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+    fallbackCopy.clear();
+    data = nullptr;
+    size = 0;
+}
+
+/**
+ * Maps the cache file for a ROM
+ * @param romHash Hash from hashROM()
+ * @param romSize ROM size in bytes
+ * @param contentVersion Version of whatever the caller stores, files from other versions are ignored
+ * @return False if there is no valid file for this ROM and version
+ */
+bool AnalysisCache::open(uint64_t romHash, uint64_t romSize, uint32_t contentVersion)
+{
+    close();
+    std::string path = pathFor(romHash);
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            mapping = mapped;
+            mappingSize = info.st_size;
+            data = (const uint8_t *) mapped;
+            size = mappingSize;
+        }
+    }
+    ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    fallbackCopy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = fallbackCopy.data();
+    size = fallbackCopy.size();
+#endif
+
+    if (data == nullptr || !validate(romHash, romSize, contentVersion))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Checks the mapped file is complete, intact and for the expected ROM and version
+ */
+bool AnalysisCache::validate(uint64_t romHash, uint64_t romSize, uint32_t contentVersion) const
+{
+    if (size < sizeof(Header))
+    {
+        return false;
+    }
+
+    const auto *header = (const Header *) data;
+    if (memcmp(header->magic, "C8AC", 4) != 0 || header->formatVersion != FORMAT_VERSION ||
+        header->contentVersion != contentVersion || header->romHash != romHash || header->romSize != romSize)
+    {
+        return false;
+    }
+
+    uint64_t tableEnd = sizeof(Header) + (uint64_t) header->sectionCount * sizeof(SectionEntry);
+    if (tableEnd > size)
+    {
+        return false;
+    }
+
+    const auto *sections = (const SectionEntry *) (data + sizeof(Header));
+    for (uint32_t i = 0; i < header->sectionCount; i++)
+    {
+        if (sections[i].offset < tableEnd || sections[i].offset % 8 != 0 || sections[i].offset > size ||
+            sections[i].size > size - sections[i].offset)
+        {
+            return false;
+        }
+    }
+
+    return header->checksum == hashROM(data + sizeof(Header), size - sizeof(Header));
+}
+
+/**
+ * Finds a section in the open file
+ * @param tag Section tag
+ * @param sectionSize Set to the section's size in bytes
+ * @return Start of the section (8 byte aligned), or nullptr if the file doesn't have it
+ */
+const uint8_t *AnalysisCache::find(uint32_t tag, size_t &sectionSize) const
+{
+    if (data == nullptr)
+    {
+        return nullptr;
+    }
+
+    const auto *header = (const Header *) data;
+    const auto *sections = (const SectionEntry *) (data + sizeof(Header));
+    for (uint32_t i = 0; i < header->sectionCount; i++)
+    {
+        if (sections[i].tag == tag)
+        {
+            sectionSize = sections[i].size;
+            return data + sections[i].offset;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Writes (or replaces) the cache file for a ROM. Doesn't affect a file this object has open.
+ * @param romHash Hash from hashROM()
+ * @param romSize ROM size in bytes
+ * @param contentVersion Version of the stored data
+ * @param sections Sections to store
+ * @return False if the file couldn't be written
+ */
+bool AnalysisCache::write(uint64_t romHash, uint64_t romSize, uint32_t contentVersion,
+                          const std::vector<CacheSection> &sections) const
+{
+    // Lay the whole file out in memory so the checksum can go in the header
+    std::vector<uint8_t> file(sizeof(Header) + sections.size() * sizeof(SectionEntry));
+    std::vector<SectionEntry> table;
+    for (const CacheSection &section : sections)
+    {
+        file.resize((file.size() + 7) & ~(size_t) 7);
+        table.push_back({section.tag, 0, file.size(), section.data.size()});
+        file.insert(file.end(), section.data.begin(), section.data.end());
+    }
+    if (!table.empty())
+    {
+        memcpy(file.data() + sizeof(Header), table.data(), table.size() * sizeof(SectionEntry));
+    }
+
+    Header header{{'C', '8', 'A', 'C'}, FORMAT_VERSION, contentVersion, (uint32_t) sections.size(), romHash, romSize, 0};
+    header.checksum = hashROM(file.data() + sizeof(Header), file.size() - sizeof(Header));
+    memcpy(file.data(), &header, sizeof(header));
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+
+    // Unique temporary name so concurrent writers (processes or threads) never share a partial file
+    static std::atomic<uint32_t> writeCount{0};
+    std::string path = pathFor(romHash);
+#ifndef _WIN32
+    std::string temporaryPath = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(writeCount++);
+#else
+    std::string temporaryPath = path + ".tmp" + std::to_string(writeCount++);
+#endif
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        output.write((const char *) file.data(), file.size());
+        if (!output)
+        {
+            fs::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    fs::rename(temporaryPath, path, error);
+    if (error)
+    {
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
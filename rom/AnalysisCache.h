@@ -0,0 +1,87 @@
+#ifndef CHIP8_EMU_ANALYSISCACHE_H
+#define CHIP8_EMU_ANALYSISCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * One tagged blob of cached data (tags are four characters packed with CACHE_TAG)
+ */
+struct CacheSection
+{
+    uint32_t tag;
+    std::vector<uint8_t> data;
+};
+
+#define CACHE_TAG(a, b, c, d) ((uint32_t) (a) | ((uint32_t) (b) << 8u) | ((uint32_t) (c) << 16u) | ((uint32_t) (d) << 24u))
+
+/**
+ * Per-ROM cache of analysis results and other derived data, one file per ROM hash.
+ *
+ * Files are memory mapped read-only and fully validated on open (magic, format and content versions, ROM hash
+ * and size, section bounds and a checksum over the payload), so a truncated, corrupt or stale file just reads
+ * as missing. Writers build a complete file under a unique temporary name and rename it into place, so any
+ * number of processes can read and populate the same cache at once; readers keep the version they mapped.
+ */
+class AnalysisCache
+{
+public:
+    static const uint32_t FORMAT_VERSION = 1;
+
+    explicit AnalysisCache(std::string _directory);
+
+    ~AnalysisCache();
+
+    AnalysisCache(const AnalysisCache &) = delete;
+
+    AnalysisCache &operator=(const AnalysisCache &) = delete;
+
+    static std::string defaultDirectory();
+
+    bool open(uint64_t romHash, uint64_t romSize, uint32_t contentVersion);
+
+    const uint8_t *find(uint32_t tag, size_t &sectionSize) const;
+
+    bool write(uint64_t romHash, uint64_t romSize, uint32_t contentVersion,
+               const std::vector<CacheSection> &sections) const;
+
+    void close();
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t formatVersion;
+        uint32_t contentVersion;
+        uint32_t sectionCount;
+        uint64_t romHash;
+        uint64_t romSize;
+        uint64_t checksum;      // hashROM() of everything after the header
+    };
+
+    struct SectionEntry
+    {
+        uint32_t tag;
+        uint32_t reserved;
+        uint64_t offset;        // From the start of the file, 8 byte aligned
+        uint64_t size;
+    };
+
+    std::string directory;
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    // Either a memory mapping of the file, or (where mmap isn't available) a copy of it
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<uint8_t> fallbackCopy;
+
+    std::string pathFor(uint64_t romHash) const;
+
+    bool validate(uint64_t romHash, uint64_t romSize, uint32_t contentVersion) const;
+};
+
+#endif //CHIP8_EMU_ANALYSISCACHE_H
@@ -0,0 +1,217 @@
+#include "AutoTuner.h"
+#include "../hardware/ChipEight.h"
+#include <cstring>
+
+AutoTuner::AutoTuner(std::vector<uint8_t> _rom, bool _loadStoreQuirk, bool _shiftQuirk)
+        : rom(std::move(_rom)),
+          loadStoreQuirk(_loadStoreQuirk),
+          shiftQuirk(_shiftQuirk)
+{
+}
+
+/**
+ * Loads recorded input to play back instead of the built-in random presses. Each line is
+ * "<frame> <hex key mask>" and holds that keypad state from the frame onwards; # starts a comment.
+ * @param path Input script file
+ * @return False if the file couldn't be read
+ */
+bool AutoTuner::loadInputScript(const std::string &path)
+{
+    return ::loadInputScript(path, script);
+}
+
+/**
+ * @param _frames Number of 60 Hz frames to run for each rate
+ */
+void AutoTuner::setFrames(unsigned int _frames)
+{
+    frames = _frames;
+}
+
+/**
+ * Runs the ROM at one instruction rate and measures idle time
+ * @param cyclesPerTick Instructions per frame
+ * @return Measurements for this rate
+ */
+TuneResult AutoTuner::measure(int cyclesPerTick) const
+{
+    ChipEight chip(loadStoreQuirk, shiftQuirk, cyclesPerTick, true);
+    chip.LoadROM(rom.data(), rom.size());
+    chip.seed(1);
+
+    const uint8_t *memory = chip.getMemory();
+    const uint8_t *registers = chip.getRegisters();
+    const uint8_t *keypad = chip.getKeypad();
+    const uint16_t *pc = chip.getPC();
+    const uint16_t *indexRegister = chip.getIndexRegister();
+
+    std::vector<InputEvent> input = script.empty() ? generateKeyTaps(frames) : script;
+    size_t nextEvent = 0;
+    unsigned int frame = 0;
+
+    // Current loop being watched: state at its head, and what happened since the last visit
+    uint16_t loopHead = 0xFFFF;
+    uint8_t headRegisters[16];
+    uint16_t headIndex = 0;
+    uint64_t pending = 0;
+    bool sideEffect = false;
+    uint16_t timerRegisters = 0;
+    unsigned int iterationFrame = 0;
+    bool lastIterationIdle = false;
+
+    auto iterationChanged = [&]
+    {
+        bool changed = sideEffect || *indexRegister != headIndex;
+        for (int reg = 0; reg < 16 && !changed; reg++)
+        {
+            changed = !((timerRegisters >> reg) & 1u) && registers[reg] != headRegisters[reg];
+        }
+        return changed;
+    };
+
+    auto startIteration = [&]
+    {
+        memcpy(headRegisters, registers, sizeof(headRegisters));
+        headIndex = *indexRegister;
+        pending = 0;
+        sideEffect = false;
+        timerRegisters = 0;
+        iterationFrame = frame;
+    };
+
+    // Ignore the first part of the run, which is usually a title screen
+    unsigned int warmUpFrames = frames / 10;
+    uint64_t idle = 0;
+    uint64_t total = 0;
+    unsigned int keptUp = 0;
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        while (nextEvent < input.size() && input[nextEvent].frame <= frame)
+        {
+            chip.setKeypad(input[nextEvent++].keys);
+        }
+
+        bool reachedIdle = false;
+        for (int i = 0; i < cyclesPerTick; i++)
+        {
+            uint16_t address = *pc;
+            if (address + 1u >= 4096)
+            {
+                break;
+            }
+            uint16_t opcode = (memory[address] << 8u) | memory[address + 1];
+            uint16_t x = (opcode & 0x0F00u) >> 8u;
+
+            // Back at the head of the loop: the iteration was idle if it only changed timer copies.
+            // It only shows this frame kept up if the frame ran all of it, otherwise the waiting
+            // happened in an earlier frame.
+            if (address == loopHead)
+            {
+                lastIterationIdle = !iterationChanged() && pending > 0;
+                if (lastIterationIdle)
+                {
+                    idle += pending;
+                    reachedIdle |= iterationFrame == frame;
+                }
+                startIteration();
+            }
+
+            bool anyKey = false;
+            for (int key = 0; key < 16; key++)
+            {
+                anyKey |= keypad[key] != 0;
+            }
+
+            if (((opcode & 0xF0FFu) == 0xF00A && !anyKey) ||
+                ((opcode & 0xF000u) == 0x1000 && (opcode & 0x0FFFu) == address))
+            {
+                ++idle;
+                reachedIdle = true;
+            }
+            else
+            {
+                ++pending;
+                uint16_t family = opcode & 0xF000u;
+                uint16_t low = opcode & 0x00FFu;
+                if ((opcode & 0xF0FFu) == 0xF007)
+                {
+                    timerRegisters |= 1u << x;
+                }
+                else if (opcode == 0x00E0 || opcode == 0x00EE || family == 0x2000 || family == 0xC000 ||
+                         family == 0xD000 ||
+                         (family == 0xF000 && (low == 0x15 || low == 0x18 || low == 0x33 || low == 0x55)))
+                {
+                    sideEffect = true;
+                }
+            }
+
+            chip.stepInstruction();
+            ++total;
+
+            // A backwards jump starts watching a new loop
+            uint16_t target = opcode & 0x0FFFu;
+            if ((opcode & 0xF000u) == 0x1000 && target < address && target != loopHead)
+            {
+                loopHead = target;
+                lastIterationIdle = false;
+                startIteration();
+            }
+        }
+        chip.decrementTimers();
+
+        // Ending the frame part way through another idle iteration also counts
+        reachedIdle |= lastIterationIdle && !iterationChanged();
+
+        if (frame >= warmUpFrames && reachedIdle)
+        {
+            ++keptUp;
+        }
+    }
+
+    unsigned int measuredFrames = frames - warmUpFrames;
+    return {cyclesPerTick, total ? (double) idle / total : 0.0,
+            measuredFrames ? (double) keptUp / measuredFrames : 0.0};
+}
+
+/**
+ * Measures a list of rates
+ * @param rates Instructions per frame to try
+ * @return One result per rate
+ */
+std::vector<TuneResult> AutoTuner::run(const std::vector<int> &rates) const
+{
+    std::vector<TuneResult> results;
+    for (int rate : rates)
+    {
+        results.push_back(measure(rate));
+    }
+    return results;
+}
+
+/**
+ * Picks the lowest rate at which enough frames kept up
+ * @param results Results from run(), in any order
+ * @param threshold Required share of frames that kept up (e.g. 0.95)
+ * @return Recommended instructions per frame, or -1 if no rate kept up (the ROM never waits)
+ */
+int AutoTuner::recommend(const std::vector<TuneResult> &results, double threshold)
+{
+    int best = -1;
+    for (const TuneResult &result : results)
+    {
+        if (result.keptUpFraction >= threshold && (best == -1 || result.cyclesPerTick < best))
+        {
+            best = result.cyclesPerTick;
+        }
+    }
+    return best;
+}
+
+/**
+ * @return Rates tried by default, denser at the low end where most ROMs settle
+ */
+std::vector<int> AutoTuner::defaultRates()
+{
+    return {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 16, 18, 20, 24, 28, 32, 40, 48, 56, 64, 80, 100, 128, 160, 200};
+}
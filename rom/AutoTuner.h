@@ -0,0 +1,53 @@
+#ifndef CHIP8_EMU_AUTOTUNER_H
+#define CHIP8_EMU_AUTOTUNER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "InputScript.h"
+
+/**
+ * How one instruction rate performed
+ */
+struct TuneResult
+{
+    int cyclesPerTick;
+    double idleFraction;     // Share of all instructions spent waiting (FX0A, self-jumps, polling loops)
+    double keptUpFraction;   // Share of frames which finished their work and started waiting
+};
+
+/**
+ * Finds the lowest instruction rate a ROM needs by running it headless at a range of rates and
+ * measuring how much of each frame is spent idling.
+ *
+ * An instruction is idle if it's an FX0A with no key down, a jump to itself, or part of a loop
+ * iteration which changed nothing but the registers it loaded from the delay timer (the usual
+ * "wait for DT to reach 0" loop). A frame has kept up if it reached such an idle state before its
+ * budget ran out - at lower rates the game logic no longer finishes within a frame.
+ */
+class AutoTuner
+{
+public:
+    AutoTuner(std::vector<uint8_t> _rom, bool _loadStoreQuirk, bool _shiftQuirk);
+
+    bool loadInputScript(const std::string &path);
+
+    void setFrames(unsigned int _frames);
+
+    TuneResult measure(int cyclesPerTick) const;
+
+    std::vector<TuneResult> run(const std::vector<int> &rates) const;
+
+    static int recommend(const std::vector<TuneResult> &results, double threshold);
+
+    static std::vector<int> defaultRates();
+
+private:
+    std::vector<uint8_t> rom;
+    bool loadStoreQuirk;
+    bool shiftQuirk;
+    unsigned int frames = 1800;
+    std::vector<InputEvent> script;
+};
+
+#endif //CHIP8_EMU_AUTOTUNER_H
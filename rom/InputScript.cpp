@@ -0,0 +1,62 @@
+#include "InputScript.h"
+#include <fstream>
+#include <sstream>
+
+/**
+ * Loads recorded input to play back. Each line is "<frame> <hex key mask>" and holds that keypad state
+ * from the frame onwards; # starts a comment.
+ * @param path Input script file
+ * @param events Input in frame order
+ * @return False if the file couldn't be read
+ */
+bool loadInputScript(const std::string &path, std::vector<InputEvent> &events)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    events.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        unsigned int frame;
+        unsigned int keys;
+        if (fields >> frame >> std::hex >> keys)
+        {
+            events.push_back({frame, (uint16_t) keys});
+        }
+    }
+    return true;
+}
+
+/**
+ * Built-in input: a random single key tapped for a few frames every so often, so games get past "press any
+ * key" screens and react to input. Fixed seed so every run sees the same input.
+ * @param frames Length of the run
+ * @return Input in frame order
+ */
+std::vector<InputEvent> generateKeyTaps(unsigned int frames)
+{
+    std::vector<InputEvent> events;
+    uint32_t state = 0x2545F491u;
+    auto next = [&state](uint32_t range)
+    {
+        state ^= state << 13u;
+        state ^= state >> 17u;
+        state ^= state << 5u;
+        return state % range;
+    };
+
+    for (unsigned int frame = 30; frame < frames;)
+    {
+        events.push_back({frame, (uint16_t) (1u << next(16))});
+        frame += 3 + next(12);
+        events.push_back({frame, 0});
+        frame += 20 + next(40);
+    }
+    return events;
+}
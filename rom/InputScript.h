@@ -0,0 +1,21 @@
+#ifndef CHIP8_EMU_INPUTSCRIPT_H
+#define CHIP8_EMU_INPUTSCRIPT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Keypad state from a frame onwards
+ */
+struct InputEvent
+{
+    unsigned int frame;
+    uint16_t keys;
+};
+
+bool loadInputScript(const std::string &path, std::vector<InputEvent> &events);
+
+std::vector<InputEvent> generateKeyTaps(unsigned int frames);
+
+#endif //CHIP8_EMU_INPUTSCRIPT_H
@@ -0,0 +1,254 @@
+#include "RomAnalysis.h"
+#include "RomLibrary.h"
+#include "../hardware/ChipEight.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+/**
+ * Basic block as stored in the cache
+ */
+struct BlockRecord
+{
+    uint16_t start;
+    uint16_t end;
+    uint16_t target;
+    uint8_t exit;
+    uint8_t reserved;
+};
+
+static const uint32_t TAG_BLOCKS = CACHE_TAG('C', 'F', 'G', 'B');
+static const uint32_t TAG_CODE = CACHE_TAG('C', 'O', 'D', 'E');
+static const uint32_t TAG_LOOPS = CACHE_TAG('L', 'O', 'O', 'P');
+
+/**
+ * Loads the analysis of a ROM from the cache, or analyses it and stores the result for next time
+ * @param rom ROM contents
+ * @param cacheDirectory Cache to use, or empty to always analyse
+ * @return Analysis to share between instances running the ROM
+ */
+std::shared_ptr<const RomAnalysis> RomAnalysis::get(const std::vector<uint8_t> &rom, const std::string &cacheDirectory)
+{
+    auto analysis = std::make_shared<RomAnalysis>();
+    if (cacheDirectory.empty())
+    {
+        analysis->build(rom);
+        return analysis;
+    }
+
+    uint64_t hash = hashROM(rom.data(), rom.size());
+    AnalysisCache cache(cacheDirectory);
+    if (cache.open(hash, rom.size(), VERSION) && analysis->load(cache))
+    {
+        return analysis;
+    }
+
+    // Losing a race with another process writing the same file is fine, both wrote the same thing
+    analysis->build(rom);
+    cache.write(hash, rom.size(), VERSION, analysis->toSections());
+    return analysis;
+}
+
+/**
+ * Whether an instruction leaves memory, the screen, timers and the stack alone and reads nothing that
+ * changes during a frame except through V registers and I
+ */
+bool RomAnalysis::isIdleInstruction(uint16_t opcode)
+{
+    uint16_t low = opcode & 0x00FFu;
+    switch (opcode & 0xF000u)
+    {
+        case 0x1000:
+        case 0x3000:
+        case 0x4000:
+        case 0x5000:
+        case 0x6000:
+        case 0x7000:
+        case 0x8000:
+        case 0x9000:
+        case 0xA000:
+        case 0xE000:
+            return true;
+        case 0xF000:
+            return low == 0x07 || low == 0x0A || low == 0x1E || low == 0x29 || low == 0x65;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Analyses a ROM as laid out in memory by ChipEight
+ * @param rom ROM contents
+ */
+void RomAnalysis::build(const std::vector<uint8_t> &rom)
+{
+    uint8_t memory[4096]{};
+    memcpy(&memory[FONT_START_ADDRESS], fontset, FONT_SET_SIZE);
+    memcpy(&memory[START_ADDRESS], rom.data(), std::min<size_t>(rom.size(), sizeof(memory) - START_ADDRESS));
+
+    graph.build(memory, sizeof(memory), START_ADDRESS);
+    fromCache = false;
+
+    // Loops are closed by backwards jumps, and FX0A is a loop on its own. Back edges to the same head
+    // are merged into one loop covering all of them.
+    std::map<uint16_t, uint16_t> loopEnds;
+    for (const BasicBlock &block : graph.getBlocks())
+    {
+        uint16_t last = block.end - 2;
+        if (block.exit == BlockExit::Jump && block.target <= last)
+        {
+            loopEnds[block.target] = std::max<uint16_t>(loopEnds[block.target], block.end);
+        }
+        else if (block.exit == BlockExit::WaitKey)
+        {
+            loopEnds[last] = std::max<uint16_t>(loopEnds[last], block.end);
+        }
+    }
+
+    loops.clear();
+    size_t romEnd = START_ADDRESS + rom.size();
+    for (const auto &loop : loopEnds)
+    {
+        LoopInfo info{loop.first, loop.second, 0, 0};
+
+        // Idle loops are checked against the ROM at run time, so they must lie inside it
+        bool idle = info.head >= START_ADDRESS && info.end <= romEnd;
+        for (uint16_t address = info.head; idle && address < info.end; address += 2)
+        {
+            uint16_t opcode = (memory[address] << 8u) | memory[address + 1];
+            uint16_t target = opcode & 0x0FFFu;
+            idle = ControlFlowGraph::isValidOpcode(opcode) && isIdleInstruction(opcode) &&
+                   ((opcode & 0xF000u) != 0x1000 || target < info.head || target >= info.end ||
+                    (target - info.head) % 2 == 0);
+        }
+        if (idle)
+        {
+            info.flags |= LoopInfo::FLAG_IDLE;
+        }
+        loops.push_back(info);
+    }
+}
+
+/**
+ * Restores an analysis from an open cache file, checking the contents make sense
+ * @param cache Cache opened for the ROM with RomAnalysis::VERSION
+ * @return False if sections are missing or malformed
+ */
+bool RomAnalysis::load(const AnalysisCache &cache)
+{
+    size_t blocksSize = 0;
+    size_t codeSize = 0;
+    size_t loopsSize = 0;
+    const uint8_t *blockData = cache.find(TAG_BLOCKS, blocksSize);
+    const uint8_t *codeData = cache.find(TAG_CODE, codeSize);
+    const uint8_t *loopData = cache.find(TAG_LOOPS, loopsSize);
+    if (blockData == nullptr || codeData == nullptr || loopData == nullptr || blocksSize % sizeof(BlockRecord) != 0 ||
+        codeSize != 4096 / 8 || loopsSize % sizeof(LoopInfo) != 0)
+    {
+        return false;
+    }
+
+    std::vector<BasicBlock> blocks;
+    const auto *records = (const BlockRecord *) blockData;
+    for (size_t i = 0; i < blocksSize / sizeof(BlockRecord); i++)
+    {
+        const BlockRecord &record = records[i];
+        if (record.start >= record.end || record.end > 4096 || record.exit > (uint8_t) BlockExit::Stop ||
+            (!blocks.empty() && blocks.back().start >= record.start))
+        {
+            return false;
+        }
+        blocks.push_back({record.start, record.end, (BlockExit) record.exit, record.target});
+    }
+
+    std::bitset<4096> code;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        code[i] = (codeData[i / 8] >> (i % 8)) & 1u;
+    }
+
+    std::vector<LoopInfo> newLoops(loopsSize / sizeof(LoopInfo));
+    memcpy(newLoops.data(), loopData, loopsSize);
+    for (size_t i = 0; i < newLoops.size(); i++)
+    {
+        if (newLoops[i].head >= newLoops[i].end || newLoops[i].end > 4096 ||
+            (i > 0 && newLoops[i - 1].head >= newLoops[i].head))
+        {
+            return false;
+        }
+    }
+
+    graph.restore(std::move(blocks), code);
+    loops = std::move(newLoops);
+    fromCache = true;
+    return true;
+}
+
+/**
+ * @return The analysis in the form stored in the cache
+ */
+std::vector<CacheSection> RomAnalysis::toSections() const
+{
+    std::vector<BlockRecord> records;
+    for (const BasicBlock &block : graph.getBlocks())
+    {
+        records.push_back({block.start, block.end, block.target, (uint8_t) block.exit, 0});
+    }
+
+    std::vector<CacheSection> sections(3);
+    sections[0].tag = TAG_BLOCKS;
+    sections[0].data.resize(records.size() * sizeof(BlockRecord));
+    if (!records.empty())
+    {
+        memcpy(sections[0].data.data(), records.data(), sections[0].data.size());
+    }
+
+    sections[1].tag = TAG_CODE;
+    sections[1].data.resize(4096 / 8);
+    for (size_t i = 0; i < 4096; i++)
+    {
+        sections[1].data[i / 8] |= graph.getCode()[i] << (i % 8);
+    }
+
+    sections[2].tag = TAG_LOOPS;
+    sections[2].data.resize(loops.size() * sizeof(LoopInfo));
+    if (!loops.empty())
+    {
+        memcpy(sections[2].data.data(), loops.data(), sections[2].data.size());
+    }
+    return sections;
+}
+
+const ControlFlowGraph &RomAnalysis::getGraph() const
+{
+    return graph;
+}
+
+/**
+ * @return Loops sorted by head address
+ */
+const std::vector<LoopInfo> &RomAnalysis::getLoops() const
+{
+    return loops;
+}
+
+/**
+ * @param head Address to look up
+ * @return Loop starting at that address, or nullptr
+ */
+const LoopInfo *RomAnalysis::findLoop(uint16_t head) const
+{
+    auto it = std::lower_bound(loops.begin(), loops.end(), head, [](const LoopInfo &loop, uint16_t value)
+    {
+        return loop.head < value;
+    });
+    return it != loops.end() && it->head == head ? &*it : nullptr;
+}
+
+/**
+ * @return True if this came from the cache rather than being analysed in this process
+ */
+bool RomAnalysis::isLoadedFromCache() const
+{
+    return fromCache;
+}
@@ -0,0 +1,61 @@
+#ifndef CHIP8_EMU_ROMANALYSIS_H
+#define CHIP8_EMU_ROMANALYSIS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AnalysisCache.h"
+#include "../hardware/ControlFlow.h"
+
+/**
+ * A loop closed by a backwards jump, covering instructions [head, end)
+ */
+struct LoopInfo
+{
+    // Every instruction in the loop only reads the timers, keys and memory and only writes V registers
+    // and I, so once an iteration leaves them unchanged the rest of the frame repeats it exactly
+    static const uint16_t FLAG_IDLE = 0x01;
+
+    uint16_t head;
+    uint16_t end;
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+/**
+ * What static analysis knows about a ROM: its control-flow graph and loops. Built once per ROM and shared
+ * read-only between every instance running it, and stored in the AnalysisCache so later launches don't
+ * redo it.
+ */
+class RomAnalysis
+{
+public:
+    // Bump whenever the analysis or its cached layout changes, so old cache files are ignored
+    static const uint32_t VERSION = 1;
+
+    static std::shared_ptr<const RomAnalysis> get(const std::vector<uint8_t> &rom, const std::string &cacheDirectory);
+
+    void build(const std::vector<uint8_t> &rom);
+
+    bool load(const AnalysisCache &cache);
+
+    std::vector<CacheSection> toSections() const;
+
+    const ControlFlowGraph &getGraph() const;
+
+    const std::vector<LoopInfo> &getLoops() const;
+
+    const LoopInfo *findLoop(uint16_t head) const;
+
+    bool isLoadedFromCache() const;
+
+private:
+    ControlFlowGraph graph;
+    std::vector<LoopInfo> loops;
+    bool fromCache = false;
+
+    static bool isIdleInstruction(uint16_t opcode);
+};
+
+#endif //CHIP8_EMU_ROMANALYSIS_H
@@ -0,0 +1,472 @@
+#include "RomLibrary.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/**
+ * 64 bit FNV-1a hash of a ROM's contents
+ * @param data ROM contents
+ * @param size Size in bytes
+ * @return Content hash
+ */
+uint64_t hashROM(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/**
+ * Reads a ROM file with a single read, after checking it fits in memory
+ * @param path Path to file
+ * @param data ROM contents
+ * @return False (with the reason printed) if it doesn't exist, is too large or couldn't be read
+ */
+bool readROM(const char *path, std::vector<uint8_t> &data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        std::cout << "ROM DOES NOT EXIST: " << path << std::endl;
+        return false;
+    }
+
+    std::streamoff size = file.tellg();
+    if (size < 0 || (uint64_t) size > MAX_ROM_SIZE)
+    {
+        std::cout << "ROM TOO LARGE: " << size << " bytes (at most " << MAX_ROM_SIZE << ")" << std::endl;
+        return false;
+    }
+
+    data.resize(size);
+    file.seekg(0, std::ios::beg);
+    if (!file.read((char *) data.data(), size))
+    {
+        std::cout << "ERROR: Couldn't read ROM: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return The file's extension in lower case, e.g. ".ch8"
+ */
+static std::string lowerExtension(const fs::path &path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+/**
+ * Whether a file looks like a Chip-8 ROM (common extensions, or none as in most classic ROM packs), including
+ * SUPER-CHIP and XO-CHIP ones
+ */
+static bool isROMFile(const fs::path &path)
+{
+    std::string extension = lowerExtension(path);
+    return extension.empty() || extension == ".ch8" || extension == ".c8" || extension == ".rom" ||
+           extension == ".sc8" || extension == ".xo8";
+}
+
+/**
+ * Default profile for a ROM that has never been configured: title from the file name, the variant its
+ * extension implies, no settings
+ */
+static RomProfile defaultProfile(const fs::path &path)
+{
+    RomProfile profile{};
+    snprintf(profile.title, sizeof(profile.title), "%s", path.stem().string().c_str());
+
+    // ChipVariant::SuperChip and ChipVariant::XoChip, as chip8_emu picks them for these extensions
+    std::string extension = lowerExtension(path);
+    profile.variant = extension == ".sc8" ? 1 : extension == ".xo8" ? 2 : 0;
+    return profile;
+}
+
+/**
+ * Whether a path lies inside a directory, comparing whole path components so that /roms doesn't contain
+ * /roms-old/game.ch8
+ * @param path Path of a file, absolute and normalised like directory
+ * @param directory Directory to test against
+ */
+static bool isInsideDirectory(const fs::path &path, fs::path directory)
+{
+    // "/roms/" has an empty last component that no file path shares
+    if (!directory.has_filename())
+    {
+        directory = directory.parent_path();
+    }
+    auto mismatch = std::mismatch(directory.begin(), directory.end(), path.begin(), path.end());
+    return mismatch.first == directory.end() && mismatch.second != path.end();
+}
+
+RomLibrary::RomLibrary(std::string _indexPath)
+        : indexPath(std::move(_indexPath))
+{
+}
+
+RomLibrary::~RomLibrary()
+{
+    close();
+}
+
+/**
+ * @return $CHIP8_LIBRARY if set, otherwise ~/.chip8/library.idx
+ */
+std::string RomLibrary::defaultIndexPath()
+{
+    const char *overridePath = getenv("CHIP8_LIBRARY");
+    if (overridePath != nullptr && *overridePath != '\0')
+    {
+        return overridePath;
+    }
+
+    const char *home = getenv("HOME");
+    if (home == nullptr)
+    {
+        home = getenv("USERPROFILE");
+    }
+    return std::string(home != nullptr ? home : ".") + "/.chip8/library.idx";
+}
+
+/**
+ * Unmaps the current index
+ */
+void RomLibrary::close()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+    fallbackCopy.clear();
+    entries = nullptr;
+    count = 0;
+}
+
+/**
+ * Maps the index file. A missing index is treated as empty.
+ * @return False if the index exists but is corrupt or from another version
+ */
+bool RomLibrary::open()
+{
+    close();
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+#ifndef _WIN32
+    int fd = ::open(indexPath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return true;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            mapping = mapped;
+            mappingSize = info.st_size;
+            data = (const uint8_t *) mapped;
+            size = mappingSize;
+        }
+    }
+    ::close(fd);
+#else
+    std::ifstream file(indexPath, std::ios::binary);
+    if (!file.is_open())
+    {
+        return true;
+    }
+    fallbackCopy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = fallbackCopy.data();
+    size = fallbackCopy.size();
+#endif
+
+    if (data == nullptr)
+    {
+        return true;
+    }
+
+    const auto *header = (const IndexHeader *) data;
+    if (size < sizeof(IndexHeader) || memcmp(header->magic, "C8IX", 4) != 0 ||
+        header->version != INDEX_VERSION ||
+        size != sizeof(IndexHeader) + header->count * sizeof(RomIndexEntry))
+    {
+        std::cout << "Ignoring invalid ROM library index: " << indexPath << std::endl;
+        close();
+        return false;
+    }
+
+    entries = (const RomIndexEntry *) (data + sizeof(IndexHeader));
+    count = header->count;
+    return true;
+}
+
+/**
+ * Looks up a ROM by content hash. Prefers an entry with a stored profile if the ROM exists at several paths.
+ * @param hash Hash from hashROM()
+ * @return Entry, or nullptr if the ROM isn't in the index
+ */
+const RomIndexEntry *RomLibrary::find(uint64_t hash) const
+{
+    const RomIndexEntry *first = std::lower_bound(begin(), end(), hash, [](const RomIndexEntry &entry, uint64_t value)
+    {
+        return entry.hash < value;
+    });
+
+    for (const RomIndexEntry *entry = first; entry != end() && entry->hash == hash; ++entry)
+    {
+        if (entry->profile.flags & RomProfile::FLAG_SET)
+        {
+            return entry;
+        }
+    }
+    return first != end() && first->hash == hash ? first : nullptr;
+}
+
+/**
+ * Scans a directory tree for ROMs and rewrites the index. Files with the same size and modification
+ * time as their existing entry aren't read again. Profiles follow the content hash, so a renamed
+ * or copied ROM keeps its settings.
+ * @param directory Directory to scan recursively
+ * @param stats Counts of what was found
+ * @return False if the directory or index couldn't be accessed
+ */
+bool RomLibrary::scan(const std::string &directory, RomScanStats &stats)
+{
+    std::error_code error;
+    fs::path rootPath = fs::weakly_canonical(directory, error).lexically_normal();
+    std::string root = rootPath.string();
+    if (error || !fs::is_directory(root, error))
+    {
+        std::cout << "Not a directory: " << directory << std::endl;
+        return false;
+    }
+
+    std::map<std::string, const RomIndexEntry *> existingByPath;
+    std::map<uint64_t, RomProfile> profilesByHash;
+    for (const RomIndexEntry &entry : *this)
+    {
+        existingByPath[entry.path] = &entry;
+        if (entry.profile.flags & RomProfile::FLAG_SET)
+        {
+            profilesByHash[entry.hash] = entry.profile;
+        }
+    }
+
+    std::vector<RomIndexEntry> newEntries;
+    std::map<uint64_t, bool> hashSeen;
+
+    for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, error), last;
+         it != last; it.increment(error))
+    {
+        if (error || !it->is_regular_file(error) || !isROMFile(it->path()))
+        {
+            continue;
+        }
+
+        uint64_t size = it->file_size(error);
+        if (error || size == 0 || size > MAX_ROM_SIZE)
+        {
+            continue;
+        }
+
+        std::string path = it->path().string();
+        if (path.size() >= sizeof(RomIndexEntry::path))
+        {
+            continue;
+        }
+        int64_t modifiedTime = it->last_write_time(error).time_since_epoch().count();
+
+        RomIndexEntry entry{};
+        auto existing = existingByPath.find(path);
+        if (existing != existingByPath.end() && existing->second->size == size &&
+            existing->second->modifiedTime == modifiedTime)
+        {
+            entry = *existing->second;
+        }
+        else
+        {
+            std::ifstream file(path, std::ios::binary);
+            std::vector<uint8_t> data(size);
+            if (!file.read((char *) data.data(), size))
+            {
+                continue;
+            }
+
+            entry.hash = hashROM(data.data(), data.size());
+            entry.size = size;
+            entry.modifiedTime = modifiedTime;
+            snprintf(entry.path, sizeof(entry.path), "%s", path.c_str());
+            auto profile = profilesByHash.find(entry.hash);
+            entry.profile = profile != profilesByHash.end() ? profile->second : defaultProfile(it->path());
+            ++stats.hashed;
+        }
+
+        hashSeen[entry.hash] = true;
+        newEntries.push_back(entry);
+        ++stats.files;
+    }
+
+    // Keep entries outside the scanned directory, and the profiles of ROMs that disappeared
+    for (const RomIndexEntry &entry : *this)
+    {
+        std::string path = entry.path;
+        bool insideRoot = !path.empty() && isInsideDirectory(fs::path(path).lexically_normal(), rootPath);
+        if (!insideRoot && !path.empty() && fs::exists(path, error))
+        {
+            newEntries.push_back(entry);
+            hashSeen[entry.hash] = true;
+        }
+        else if ((entry.profile.flags & RomProfile::FLAG_SET) && !hashSeen[entry.hash])
+        {
+            RomIndexEntry orphan = entry;
+            orphan.path[0] = '\0';
+            newEntries.push_back(orphan);
+            hashSeen[entry.hash] = true;
+        }
+        else if (!path.empty() && (!insideRoot || !fs::exists(path, error)))
+        {
+            ++stats.removed;
+        }
+    }
+
+    return write(newEntries);
+}
+
+/**
+ * Stores the profile for a ROM (for every path it's indexed under), adding it to the index if needed
+ * @param hash Content hash
+ * @param size ROM size in bytes
+ * @param path Path to the ROM, used if it isn't indexed yet
+ * @param profile Settings to store, FLAG_SET is added automatically
+ * @return False if the index couldn't be written
+ */
+bool RomLibrary::setProfile(uint64_t hash, uint64_t size, const std::string &path, const RomProfile &profile)
+{
+    std::vector<RomIndexEntry> newEntries(begin(), end());
+    RomProfile stored = profile;
+    stored.flags |= RomProfile::FLAG_SET;
+
+    bool found = false;
+    for (RomIndexEntry &entry : newEntries)
+    {
+        if (entry.hash == hash)
+        {
+            entry.profile = stored;
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        std::error_code error;
+        RomIndexEntry entry{};
+        entry.hash = hash;
+        entry.size = size;
+        std::string absolute = fs::absolute(path, error).string();
+        if (absolute.size() < sizeof(entry.path))
+        {
+            snprintf(entry.path, sizeof(entry.path), "%s", absolute.c_str());
+            entry.modifiedTime = fs::last_write_time(absolute, error).time_since_epoch().count();
+        }
+        entry.profile = stored;
+        newEntries.push_back(entry);
+    }
+
+    return write(newEntries);
+}
+
+/**
+ * Sorts the entries by hash, writes them to a temporary file, renames it over the index and maps the result
+ * @param newEntries Complete contents of the new index
+ * @return False if the index couldn't be written
+ */
+bool RomLibrary::write(std::vector<RomIndexEntry> &newEntries)
+{
+    std::stable_sort(newEntries.begin(), newEntries.end(), [](const RomIndexEntry &a, const RomIndexEntry &b)
+    {
+        return a.hash < b.hash;
+    });
+
+    std::error_code error;
+    fs::path parent = fs::path(indexPath).parent_path();
+    if (!parent.empty())
+    {
+        fs::create_directories(parent, error);
+    }
+
+    // Unique temporary name so concurrent writers don't clobber each other's partial files
+#ifndef _WIN32
+    std::string temporaryPath = indexPath + ".tmp" + std::to_string(getpid());
+#else
+    std::string temporaryPath = indexPath + ".tmp";
+#endif
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        IndexHeader header{{'C', '8', 'I', 'X'}, INDEX_VERSION, newEntries.size()};
+        file.write((const char *) &header, sizeof(header));
+        file.write((const char *) newEntries.data(), newEntries.size() * sizeof(RomIndexEntry));
+        if (!file)
+        {
+            std::cout << "Failed to write ROM library index: " << temporaryPath << std::endl;
+            fs::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    close();
+    fs::rename(temporaryPath, indexPath, error);
+    if (error)
+    {
+        std::cout << "Failed to replace ROM library index: " << indexPath << std::endl;
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+    return open();
+}
+
+/**
+ * @return Number of entries in the index
+ */
+size_t RomLibrary::size() const
+{
+    return count;
+}
+
+const RomIndexEntry *RomLibrary::begin() const
+{
+    return entries;
+}
+
+const RomIndexEntry *RomLibrary::end() const
+{
+    return entries + count;
+}
@@ -0,0 +1,116 @@
+#ifndef CHIP8_EMU_ROMLIBRARY_H
+#define CHIP8_EMU_ROMLIBRARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Known-good settings for a ROM. Stored as-is in the index file, so the layout must only change
+ * together with RomLibrary::INDEX_VERSION.
+ */
+struct RomProfile
+{
+    // Set once an operator or the tuner has stored settings, otherwise the fields are defaults
+    static const uint8_t FLAG_SET = 0x01;
+
+    char title[64];
+    uint8_t flags;
+    uint8_t loadStoreQuirk;
+    uint8_t shiftQuirk;
+    uint8_t variant;        // ChipVariant, 0 = CHIP-8
+    uint16_t cyclesPerTick; // 0 = unknown
+    uint8_t displayWait;    // Draws wait for vblank, as on the COSMAC VIP
+    uint8_t reserved2;
+    int32_t keyMap[16];     // SDL keycode for each Chip-8 key, 0 = default mapping
+};
+
+/**
+ * One ROM file in the index
+ */
+struct RomIndexEntry
+{
+    uint64_t hash;
+    uint64_t size;
+    int64_t modifiedTime;
+    char path[256];         // Empty if the file is gone but its profile was kept
+    RomProfile profile;
+};
+
+/**
+ * Counts reported by RomLibrary::scan()
+ */
+struct RomScanStats
+{
+    size_t files = 0;     // ROM files found
+    size_t hashed = 0;    // New or changed files that had to be read
+    size_t removed = 0;   // Entries dropped because their file is gone
+};
+
+/**
+ * Largest ROM that fits in memory after START_ADDRESS, for XO-CHIP's 64 KB (CHIP-8 and SUPER-CHIP ROMs are
+ * checked against 4 KB when they are loaded)
+ */
+const static uint64_t MAX_ROM_SIZE = 0x10000 - 0x200;
+
+uint64_t hashROM(const uint8_t *data, size_t size);
+
+bool readROM(const char *path, std::vector<uint8_t> &data);
+
+/**
+ * On-disk index of ROM files keyed by content hash, each with a profile of known-good settings.
+ *
+ * The index is a sorted array of fixed size entries which is memory mapped, so a lookup at startup
+ * is a binary search over the mapping without parsing anything. Updates write a new file and rename
+ * it over the old one, so readers never see a partial index.
+ */
+class RomLibrary
+{
+public:
+    static const uint32_t INDEX_VERSION = 1;
+
+    explicit RomLibrary(std::string _indexPath);
+
+    ~RomLibrary();
+
+    static std::string defaultIndexPath();
+
+    bool open();
+
+    const RomIndexEntry *find(uint64_t hash) const;
+
+    bool scan(const std::string &directory, RomScanStats &stats);
+
+    bool setProfile(uint64_t hash, uint64_t size, const std::string &path, const RomProfile &profile);
+
+    size_t size() const;
+
+    const RomIndexEntry *begin() const;
+
+    const RomIndexEntry *end() const;
+
+private:
+    struct IndexHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+    };
+
+    std::string indexPath;
+
+    const RomIndexEntry *entries = nullptr;
+    size_t count = 0;
+
+    // Either a memory mapping of the index, or (where mmap isn't available) a copy of it
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<uint8_t> fallbackCopy;
+
+    void close();
+
+    bool write(std::vector<RomIndexEntry> &newEntries);
+};
+
+#endif //CHIP8_EMU_ROMLIBRARY_H
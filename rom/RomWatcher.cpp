@@ -0,0 +1,105 @@
+#include "RomWatcher.h"
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/**
+ * @param _path ROM file to watch
+ */
+RomWatcher::RomWatcher(std::string _path) : path(std::move(_path))
+{
+    fileName = fs::path(path).filename().string();
+}
+
+RomWatcher::~RomWatcher()
+{
+#ifdef __linux__
+    if (fd != -1)
+    {
+        close(fd);
+    }
+#endif
+}
+
+/**
+ * Starts watching
+ * @return False if the file's directory can't be watched
+ */
+bool RomWatcher::open()
+{
+    modifiedTime = readModifiedTime();
+#ifdef __linux__
+    fs::path directory = fs::path(path).parent_path();
+    if (directory.empty())
+    {
+        directory = ".";
+    }
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+    {
+        std::cout << "ERROR: Couldn't watch " << directory.string() << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+ * Checks for changes since the last call without blocking
+ * @return True if the ROM has been written or replaced
+ */
+bool RomWatcher::changed()
+{
+#ifdef __linux__
+    // Events only arrive once a writer closes the file or renames it into place, so the ROM is complete
+    bool found = false;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *next = buffer; next < buffer + length;)
+        {
+            auto *event = (const inotify_event *) next;
+            if (event->len > 0 && fileName == event->name)
+            {
+                found = true;
+            }
+            next += sizeof(inotify_event) + event->len;
+        }
+    }
+    return found;
+#else
+    if (++polls < POLL_INTERVAL)
+    {
+        return false;
+    }
+    polls = 0;
+
+    int64_t time = readModifiedTime();
+    if (time == modifiedTime)
+    {
+        return false;
+    }
+    modifiedTime = time;
+    return true;
+#endif
+}
+
+/**
+ * @return Modification time of the ROM, 0 if it can't be read
+ */
+int64_t RomWatcher::readModifiedTime() const
+{
+    std::error_code error;
+    auto time = fs::last_write_time(path, error);
+    return error ? 0 : (int64_t) time.time_since_epoch().count();
+}
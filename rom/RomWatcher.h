@@ -0,0 +1,42 @@
+#ifndef CHIP8_EMU_ROMWATCHER_H
+#define CHIP8_EMU_ROMWATCHER_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Notices when a ROM file is rewritten, for reloading it into the running emulator.
+ *
+ * On Linux this watches the file's directory with inotify, so files replaced by rename (as many editors and
+ * assemblers do) are seen as well as ones written in place; checking costs one non-blocking read. Elsewhere it
+ * falls back to looking at the modification time a few times a second.
+ */
+class RomWatcher
+{
+public:
+    explicit RomWatcher(std::string _path);
+
+    ~RomWatcher();
+
+    RomWatcher(const RomWatcher &) = delete;
+
+    RomWatcher &operator=(const RomWatcher &) = delete;
+
+    bool open();
+
+    bool changed();
+
+private:
+    // Frames between modification time checks without inotify
+    static const unsigned int POLL_INTERVAL = 15;
+
+    std::string path;
+    std::string fileName;
+    int fd = -1;
+    int64_t modifiedTime = 0;
+    unsigned int polls = 0;
+
+    int64_t readModifiedTime() const;
+};
+
+#endif //CHIP8_EMU_ROMWATCHER_H
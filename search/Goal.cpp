@@ -0,0 +1,164 @@
+#include "Goal.h"
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+
+/**
+ * Parses a decimal or 0x prefixed hex number
+ * @return False if text isn't one
+ */
+static bool parseNumber(const std::string &text, uint32_t &value)
+{
+    try
+    {
+        size_t used;
+        value = std::stoul(text, &used, 0);
+        return used == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+static std::string trim(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t");
+    return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+}
+
+/**
+ * Builds a predicate from "<value> <op> <number>", where value is one of V0-VF, I, PC, SP, DT, ST, mem[addr],
+ * pixel[x,y] (1 if lit) or pixels (lit pixel count), and op is one of == != < <= > >=. E.g. "mem[0x3F0] == 9".
+ * @param expression Goal as text
+ * @param goal Predicate
+ * @return False (with the reason printed) if the expression isn't understood
+ */
+bool parseGoal(const std::string &expression, GoalPredicate &goal)
+{
+    static const char *const operators[] = {"==", "!=", "<=", ">=", "<", ">"};
+    size_t position = std::string::npos;
+    std::string op;
+    for (const char *candidate : operators)
+    {
+        size_t found = expression.find(candidate);
+        if (found != std::string::npos && (found < position || (found == position && op.size() < 2)))
+        {
+            position = found;
+            op = candidate;
+        }
+    }
+
+    uint32_t target;
+    std::string name = position != std::string::npos ? trim(expression.substr(0, position)) : "";
+    if (name.empty() || !parseNumber(trim(expression.substr(position + op.size())), target))
+    {
+        std::cout << "ERROR: Goal must be \"<value> <op> <number>\": " << expression << std::endl;
+        return false;
+    }
+    for (char &c : name)
+    {
+        c = (char) toupper(c);
+    }
+
+    std::function<uint32_t(const ChipEightState &)> value;
+    uint32_t first;
+    uint32_t second;
+    size_t comma = name.find(',');
+    if (name.size() == 2 && name[0] == 'V' && isxdigit(name[1]))
+    {
+        unsigned int index = std::stoul(name.substr(1), nullptr, 16);
+        value = [index](const ChipEightState &state)
+        { return state.registers[index]; };
+    }
+    else if (name == "I")
+    {
+        value = [](const ChipEightState &state)
+        { return state.indexRegister; };
+    }
+    else if (name == "PC")
+    {
+        value = [](const ChipEightState &state)
+        { return state.pc; };
+    }
+    else if (name == "SP")
+    {
+        value = [](const ChipEightState &state)
+        { return state.sp; };
+    }
+    else if (name == "DT")
+    {
+        value = [](const ChipEightState &state)
+        { return state.delayRegister; };
+    }
+    else if (name == "ST")
+    {
+        value = [](const ChipEightState &state)
+        { return state.soundRegister; };
+    }
+    else if (name.rfind("MEM[", 0) == 0 && name.back() == ']' &&
+             parseNumber(name.substr(4, name.size() - 5), first) && first < CLASSIC_MEMORY_SIZE)
+    {
+        value = [first](const ChipEightState &state)
+        { return state.memory[first]; };
+    }
+    else if (name.rfind("PIXEL[", 0) == 0 && name.back() == ']' && comma != std::string::npos &&
+             parseNumber(trim(name.substr(6, comma - 6)), first) &&
+             parseNumber(trim(name.substr(comma + 1, name.size() - comma - 2)), second) &&
+             first < VIDEO_WIDTH && second < VIDEO_HEIGHT)
+    {
+        value = [first, second](const ChipEightState &state)
+        { return (uint32_t) (state.planes[0][second * PLANE_ROW_WORDS] >> (63 - first)) & 1u; };
+    }
+    else if (name == "PIXELS")
+    {
+        value = [](const ChipEightState &state)
+        {
+            uint32_t lit = 0;
+            for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+            {
+                lit += std::bitset<64>(state.planes[0][y * PLANE_ROW_WORDS]).count();
+            }
+            return lit;
+        };
+    }
+    else
+    {
+        std::cout << "ERROR: Unknown goal value: " << name << std::endl;
+        return false;
+    }
+
+    if (op == "==")
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) == target; };
+    }
+    else if (op == "!=")
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) != target; };
+    }
+    else if (op == "<=")
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) <= target; };
+    }
+    else if (op == ">=")
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) >= target; };
+    }
+    else if (op == "<")
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) < target; };
+    }
+    else
+    {
+        goal = [value, target](const ChipEightState &state)
+        { return value(state) > target; };
+    }
+    return true;
+}
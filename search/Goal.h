@@ -0,0 +1,16 @@
+#ifndef CHIP8_EMU_GOAL_H
+#define CHIP8_EMU_GOAL_H
+
+#include <functional>
+#include <string>
+#include "../hardware/ChipEight.h"
+
+/**
+ * Test for whether a state is a solution. Any function of the machine state works; parseGoal() builds the common
+ * ones from the command line.
+ */
+using GoalPredicate = std::function<bool(const ChipEightState &)>;
+
+bool parseGoal(const std::string &expression, GoalPredicate &goal);
+
+#endif //CHIP8_EMU_GOAL_H
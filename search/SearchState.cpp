@@ -0,0 +1,96 @@
+#include "SearchState.h"
+#include <cstring>
+
+static const size_t HASHED_BYTES = offsetof(PackedState, id);
+static_assert(HASHED_BYTES % 8 == 0, "hashed block is whole words");
+
+/**
+ * @param state Full state from ChipEight::saveState()
+ * @param packed Compact copy (id is left alone)
+ */
+void packState(const ChipEightState &state, PackedState &packed)
+{
+    memcpy(packed.memory, state.memory, sizeof(packed.memory));
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        packed.video[y] = state.planes[0][y * PLANE_ROW_WORDS];
+    }
+    memcpy(packed.stack, state.stack, sizeof(packed.stack));
+    memcpy(packed.registers, state.registers, sizeof(packed.registers));
+    packed.indexRegister = state.indexRegister;
+    packed.pc = state.pc;
+    packed.sp = state.sp;
+    packed.delayRegister = state.delayRegister;
+    packed.soundRegister = state.soundRegister;
+    packed.reserved = 0;
+    packed.randGen = state.randGen;
+    packed.codeModified = state.codeModified;
+}
+
+/**
+ * @param packed Compact state
+ * @param state Full state for ChipEight::loadState(), with no keys down
+ */
+void unpackState(const PackedState &packed, ChipEightState &state)
+{
+    state.randGen = packed.randGen;
+    state.opcode = 0;
+    memcpy(state.registers, packed.registers, sizeof(state.registers));
+    state.indexRegister = packed.indexRegister;
+    state.pc = packed.pc;
+    state.sp = packed.sp;
+    state.delayRegister = packed.delayRegister;
+    state.soundRegister = packed.soundRegister;
+    memset(state.keypad, 0, sizeof(state.keypad));
+    memcpy(state.stack, packed.stack, sizeof(state.stack));
+    memcpy(state.memory, packed.memory, sizeof(packed.memory));
+    memset(state.planes, 0, sizeof(state.planes));
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        state.planes[0][y * PLANE_ROW_WORDS] = packed.video[y];
+    }
+    state.hires = false;
+    state.planeMask = 1;
+    memset(state.flagRegisters, 0, sizeof(state.flagRegisters));
+    memset(state.audioPattern, 0, sizeof(state.audioPattern));
+    state.pitch = 64;
+    state.drawFlag = false;
+    state.codeModified = packed.codeModified;
+}
+
+/**
+ * 64 bit hash of the identifying part of a state, eight bytes at a time over four independent lanes so it runs
+ * at memory speed rather than one multiply chain
+ * @param packed State to hash
+ * @return Hash, used as the state's fingerprint in the visited table
+ */
+uint64_t hashState(const PackedState &packed)
+{
+    const auto *bytes = (const uint8_t *) &packed;
+    uint64_t lanes[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull};
+    size_t i = 0;
+    for (; i + 32 <= HASHED_BYTES; i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * 0xFF51AFD7ED558CCDull;
+            lanes[lane] ^= lanes[lane] >> 29u;
+        }
+    }
+    for (; i < HASHED_BYTES; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        lanes[0] = (lanes[0] ^ word) * 0xFF51AFD7ED558CCDull;
+        lanes[0] ^= lanes[0] >> 29u;
+    }
+
+    uint64_t hash = lanes[0] ^ (lanes[1] * 0xC4CEB9FE1A85EC53ull) ^ (lanes[2] * 0x94D049BB133111EBull) ^
+                    (lanes[3] * 0xBF58476D1CE4E5B9ull);
+    hash ^= hash >> 33u;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33u;
+    return hash;
+}
@@ -0,0 +1,40 @@
+#ifndef CHIP8_EMU_SEARCHSTATE_H
+#define CHIP8_EMU_SEARCHSTATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include "../hardware/ChipEight.h"
+
+/**
+ * A CHIP-8 machine state as stored in the search frontier: ChipEightState with only the 4 KB of CHIP-8 memory and
+ * the first bit-plane of the 64x32 display (4.4 KB instead of 70 KB). The fields that identify a state come first
+ * so they can be hashed as one block.
+ */
+struct PackedState
+{
+    // Hashed: memory, display, stack, registers, I, PC, SP and timers
+    uint8_t memory[CLASSIC_MEMORY_SIZE];
+    uint64_t video[VIDEO_HEIGHT];
+    uint16_t stack[16];
+    uint8_t registers[16];
+    uint16_t indexRegister;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delayRegister;
+    uint8_t soundRegister;
+    uint8_t reserved;
+
+    // Not hashed: where the state came from and what only affects how it continues
+    uint64_t id;
+    std::default_random_engine randGen;
+    uint8_t codeModified;
+};
+
+void packState(const ChipEightState &state, PackedState &packed);
+
+void unpackState(const PackedState &packed, ChipEightState &state);
+
+uint64_t hashState(const PackedState &packed);
+
+#endif //CHIP8_EMU_SEARCHSTATE_H
@@ -0,0 +1,131 @@
+#include "StateQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+
+StateQueue::StateQueue(size_t _memoryLimit, std::string _spillDirectory)
+        : memoryLimit(_memoryLimit),
+          spillDirectory(std::move(_spillDirectory))
+{
+}
+
+StateQueue::~StateQueue()
+{
+    clear();
+}
+
+/**
+ * Appends states after everything already pushed. Must not be called while reading.
+ * @param states States to add
+ * @param count Number of states
+ * @return False if the spill file couldn't be written
+ */
+bool StateQueue::push(const PackedState *states, size_t count)
+{
+    // Once anything has spilled the rest has to follow it into the file to keep the order
+    size_t capacity = memoryLimit / sizeof(PackedState);
+    size_t inMemory = spillCount == 0 && memoryStates.size() < capacity ? std::min(count, capacity - memoryStates.size())
+                                                                        : 0;
+    memoryStates.insert(memoryStates.end(), states, states + inMemory);
+    states += inMemory;
+    count -= inMemory;
+    if (count == 0)
+    {
+        return true;
+    }
+
+    if (spillFile == nullptr)
+    {
+        // Unique per queue, so several searches can share a directory
+        static std::atomic<unsigned int> queues{0};
+        spillPath = (std::filesystem::path(spillDirectory) /
+                     ("chip8_search_" + std::to_string(std::random_device()()) + "_" +
+                      std::to_string(queues.fetch_add(1)) + ".spill")).string();
+        spillFile = fopen(spillPath.c_str(), "w+b");
+        if (spillFile == nullptr)
+        {
+            std::cout << "ERROR: Couldn't create spill file " << spillPath << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    if (fwrite(states, sizeof(PackedState), count, spillFile) != count)
+    {
+        std::cout << "ERROR: Couldn't write spill file " << spillPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    spillCount += count;
+    return true;
+}
+
+/**
+ * Reads the next states in push order
+ * @param batch Replaced by up to maxCount states
+ * @param maxCount Most states to return
+ * @return States returned, 0 once everything has been read
+ */
+size_t StateQueue::read(std::vector<PackedState> &batch, size_t maxCount)
+{
+    batch.clear();
+    if (readIndex < memoryStates.size())
+    {
+        size_t count = std::min<uint64_t>(maxCount, memoryStates.size() - readIndex);
+        batch.assign(memoryStates.begin() + readIndex, memoryStates.begin() + readIndex + count);
+        readIndex += count;
+        return count;
+    }
+
+    uint64_t fileIndex = readIndex - memoryStates.size();
+    if (spillFile == nullptr || fileIndex >= spillCount)
+    {
+        return 0;
+    }
+    if (fileIndex == 0)
+    {
+        fflush(spillFile);
+        fseek(spillFile, 0, SEEK_SET);
+    }
+
+    size_t count = std::min<uint64_t>(maxCount, spillCount - fileIndex);
+    batch.resize(count);
+    count = fread(batch.data(), sizeof(PackedState), count, spillFile);
+    batch.resize(count);
+    readIndex += count;
+    return count;
+}
+
+/**
+ * Empties the queue and removes its spill file
+ */
+void StateQueue::clear()
+{
+    memoryStates.clear();
+    if (spillFile != nullptr)
+    {
+        fclose(spillFile);
+        std::filesystem::remove(spillPath);
+        spillFile = nullptr;
+    }
+    spillCount = 0;
+    readIndex = 0;
+}
+
+/**
+ * @return States pushed since the last clear()
+ */
+uint64_t StateQueue::size() const
+{
+    return memoryStates.size() + spillCount;
+}
+
+/**
+ * @return How many of them went to the spill file
+ */
+uint64_t StateQueue::spilled() const
+{
+    return spillCount;
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_EMU_STATEQUEUE_H
+#define CHIP8_EMU_STATEQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "SearchState.h"
+
+/**
+ * One breadth-first level of states: written in full, then read back in order. States beyond the memory limit are
+ * appended to a spill file in the given directory instead of being kept in memory, so the frontier can grow past
+ * RAM; the file is removed once the queue is cleared or destroyed.
+ */
+class StateQueue
+{
+public:
+    /**
+     * @param _memoryLimit Bytes of states to hold in memory before spilling
+     * @param _spillDirectory Where to create the spill file
+     */
+    StateQueue(size_t _memoryLimit, std::string _spillDirectory);
+
+    ~StateQueue();
+
+    StateQueue(const StateQueue &) = delete;
+
+    StateQueue &operator=(const StateQueue &) = delete;
+
+    bool push(const PackedState *states, size_t count);
+
+    size_t read(std::vector<PackedState> &batch, size_t maxCount);
+
+    void clear();
+
+    uint64_t size() const;
+
+    uint64_t spilled() const;
+
+private:
+    size_t memoryLimit;
+    std::string spillDirectory;
+    std::vector<PackedState> memoryStates;
+
+    std::string spillPath;
+    FILE *spillFile = nullptr;
+    uint64_t spillCount = 0;
+
+    // Read position, first through memory then through the file
+    uint64_t readIndex = 0;
+};
+
+#endif //CHIP8_EMU_STATEQUEUE_H
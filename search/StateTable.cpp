@@ -0,0 +1,79 @@
+#include "StateTable.h"
+
+StateTable::StateTable(size_t maxStates)
+{
+    size_t capacity = 1024;
+    while (capacity / 4 * 3 < maxStates)
+    {
+        capacity *= 2;
+    }
+
+    slots = std::make_unique<std::atomic<uint64_t>[]>(capacity);
+    for (size_t i = 0; i < capacity; i++)
+    {
+        slots[i].store(0, std::memory_order_relaxed);
+    }
+    mask = capacity - 1;
+    limit = capacity / 4 * 3;
+}
+
+/**
+ * Adds a state
+ * @param hash hashState() of the state
+ * @return True if it wasn't seen before (or the table is full), false if it was
+ */
+bool StateTable::insert(uint64_t hash)
+{
+    // 0 marks an empty slot
+    if (hash == 0)
+    {
+        hash = 1;
+    }
+
+    for (size_t index = hash & mask, probes = 0; probes <= mask; index = (index + 1) & mask, probes++)
+    {
+        uint64_t current = slots[index].load(std::memory_order_relaxed);
+        if (current == hash)
+        {
+            return false;
+        }
+        if (current == 0)
+        {
+            if (slots[index].compare_exchange_strong(current, hash, std::memory_order_relaxed))
+            {
+                count.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            // Another thread took the slot first, possibly for the same state
+            if (current == hash)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @return States inserted so far
+ */
+size_t StateTable::size() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+/**
+ * @return True once the table holds as many states as it was sized for
+ */
+bool StateTable::full() const
+{
+    return size() >= limit;
+}
+
+/**
+ * @return Bytes used by the slots
+ */
+size_t StateTable::memoryUsed() const
+{
+    return (mask + 1) * sizeof(uint64_t);
+}
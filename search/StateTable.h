@@ -0,0 +1,40 @@
+#ifndef CHIP8_EMU_STATETABLE_H
+#define CHIP8_EMU_STATETABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Lock-free set of visited state hashes shared by all search threads.
+ *
+ * Open addressing over a fixed array of 64 bit slots: an insert probes linearly and claims an empty slot with a
+ * single compare-and-swap, so threads never wait on each other. Only the hash is kept (8 bytes per state), so two
+ * different states with the same 64 bit hash count as one; with a well mixed hash that takes billions of states
+ * to become likely.
+ */
+class StateTable
+{
+public:
+    /**
+     * @param maxStates States to make room for; the table is sized to stay at most 3/4 full
+     */
+    explicit StateTable(size_t maxStates);
+
+    bool insert(uint64_t hash);
+
+    size_t size() const;
+
+    bool full() const;
+
+    size_t memoryUsed() const;
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    size_t mask;
+    size_t limit;
+    std::atomic<size_t> count{0};
+};
+
+#endif //CHIP8_EMU_STATETABLE_H
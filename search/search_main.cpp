@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Goal.h"
+#include "SearchState.h"
+#include "StateQueue.h"
+#include "StateTable.h"
+#include "../hardware/ChipEight.h"
+#include "../lib/WorkerPool.h"
+#include "../rom/AnalysisCache.h"
+#include "../rom/RomAnalysis.h"
+#include "../rom/RomLibrary.h"
+
+// Marks the initial state in the parent links
+static const uint64_t NO_PARENT = (1ull << 48u) - 1;
+
+// States read from the frontier and expanded in parallel at a time
+static const size_t BATCH_SIZE = 16384;
+
+static void printUsage()
+{
+    std::cout << "Usage: chip8_search <rom_path> --goal <expr> [options]\n"
+                 "Breadth-first search for the shortest key sequence that reaches a goal state.\n"
+                 "  --goal <expr>              \"<value> <op> <number>\", value one of V0-VF, I, PC, SP, DT, ST,\n"
+                 "                             mem[addr], pixel[x,y], pixels; repeat to require several\n"
+                 "  --keys <k,k,...>           hex keys to try (default all 16); releasing all keys is always tried\n"
+                 "  --step-frames <n>          frames each input is held for (default 1)\n"
+                 "  --cycles <n>               instructions per frame (default 8)\n"
+                 "  --load-store-quirk         FX55/FX65 don't increment I\n"
+                 "  --shift-quirk              8XY6/8XYE shift VX instead of VY\n"
+                 "  --display-wait             sprite draws end the frame (COSMAC VIP vblank wait)\n"
+                 "  --seed <n>                 random seed for CXKK (default 1)\n"
+                 "  --no-analysis              don't skip idle loops using static analysis\n"
+                 "  --threads <n>              worker threads (default one per core)\n"
+                 "  --max-depth <n>            give up after n steps (default unlimited)\n"
+                 "  --max-states <n>           size the visited table for n states (default 16M, 8 bytes each)\n"
+                 "  --memory <MB>              frontier memory before spilling to disk (default 1024)\n"
+                 "  --spill-dir <dir>          where to spill the frontier (default the temp directory)\n"
+                 "  --solution <path>          write the solution as an input script (\"<frame> <hex key mask>\")"
+              << std::endl;
+}
+
+/**
+ * Parses "2,4,6,8" style hex key lists
+ * @return False if a key isn't 0-F
+ */
+static bool parseKeys(const std::string &text, std::vector<uint16_t> &masks)
+{
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t end = std::min(text.find(',', start), text.size());
+        std::string key = text.substr(start, end - start);
+        if (key.size() != 1 || !isxdigit(key[0]))
+        {
+            return false;
+        }
+        masks.push_back(1u << std::stoul(key, nullptr, 16));
+        start = end + 1;
+    }
+    return true;
+}
+
+int main(int argc, char **args)
+{
+    if (argc < 2 || strcmp(args[1], "-h") == 0 || strcmp(args[1], "--help") == 0)
+    {
+        printUsage();
+        return argc < 2 ? -1 : 0;
+    }
+
+    const char *path = args[1];
+    std::vector<GoalPredicate> goals;
+    std::vector<uint16_t> masks{0};
+    for (unsigned int key = 0; key < 16; key++)
+    {
+        masks.push_back(1u << key);
+    }
+    unsigned int stepFrames = 1;
+    int cyclesPerTick = 8;
+    bool loadStoreQuirk = false;
+    bool shiftQuirk = false;
+    bool displayWait = false;
+    uint32_t seed = 1;
+    bool useAnalysis = true;
+    unsigned int threads = 0;
+    uint64_t maxDepth = 0;
+    size_t maxStates = 16 << 20;
+    size_t memoryLimit = (size_t) 1024 << 20;
+    std::string spillDirectory = std::filesystem::temp_directory_path().string();
+    std::string solutionPath;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = args[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--goal" && hasValue)
+        {
+            GoalPredicate goal;
+            if (!parseGoal(args[++i], goal))
+            {
+                return -1;
+            }
+            goals.push_back(goal);
+        }
+        else if (arg == "--keys" && hasValue)
+        {
+            masks = {0};
+            if (!parseKeys(args[++i], masks))
+            {
+                std::cout << "ERROR: Keys must be hex digits separated by commas" << std::endl;
+                return -1;
+            }
+        }
+        else if (arg == "--step-frames" && hasValue)
+        {
+            stepFrames = std::max(1, std::stoi(args[++i]));
+        }
+        else if (arg == "--cycles" && hasValue)
+        {
+            cyclesPerTick = std::stoi(args[++i]);
+        }
+        else if (arg == "--load-store-quirk")
+        {
+            loadStoreQuirk = true;
+        }
+        else if (arg == "--shift-quirk")
+        {
+            shiftQuirk = true;
+        }
+        else if (arg == "--display-wait")
+        {
+            displayWait = true;
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            seed = std::stoul(args[++i]);
+        }
+        else if (arg == "--no-analysis")
+        {
+            useAnalysis = false;
+        }
+        else if (arg == "--threads" && hasValue)
+        {
+            threads = std::stoi(args[++i]);
+        }
+        else if (arg == "--max-depth" && hasValue)
+        {
+            maxDepth = std::stoull(args[++i]);
+        }
+        else if (arg == "--max-states" && hasValue)
+        {
+            maxStates = std::stoull(args[++i]);
+        }
+        else if (arg == "--memory" && hasValue)
+        {
+            memoryLimit = std::stoull(args[++i]) << 20u;
+        }
+        else if (arg == "--spill-dir" && hasValue)
+        {
+            spillDirectory = args[++i];
+        }
+        else if (arg == "--solution" && hasValue)
+        {
+            solutionPath = args[++i];
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown option: " << arg << std::endl;
+            printUsage();
+            return -1;
+        }
+    }
+    if (goals.empty())
+    {
+        std::cout << "ERROR: No --goal given" << std::endl;
+        return -1;
+    }
+    auto isGoal = [&goals](const ChipEightState &state)
+    {
+        return std::all_of(goals.begin(), goals.end(), [&state](const GoalPredicate &goal)
+        { return goal(state); });
+    };
+
+    std::vector<uint8_t> rom;
+    if (!readROM(path, rom))
+    {
+        return -1;
+    }
+
+    // Every thread gets its own machine; states move between them through PackedState
+    ChipEight root(loadStoreQuirk, shiftQuirk, cyclesPerTick, true);
+    root.LoadROM(rom.data(), rom.size());
+    root.seed(seed);
+    root.setDisplayWait(displayWait);
+    if (useAnalysis)
+    {
+        root.setAnalysis(RomAnalysis::get(rom, AnalysisCache::defaultDirectory()));
+    }
+    WorkerPool pool(threads);
+    std::vector<std::unique_ptr<ChipEight>> machines;
+    std::vector<ChipEight *> idleMachines;
+    for (unsigned int i = 0; i < pool.threadCount(); i++)
+    {
+        machines.push_back(root.cloneHeadless());
+        machines.back()->setSpeculative(true);
+        idleMachines.push_back(machines.back().get());
+    }
+
+    StateTable visited(maxStates);
+    auto current = std::make_unique<StateQueue>(memoryLimit / 2, spillDirectory);
+    auto next = std::make_unique<StateQueue>(memoryLimit / 2, spillDirectory);
+
+    // Parent and input of every state by id, to rebuild the solution: parent in the low 48 bits, keys above
+    std::vector<uint64_t> links;
+    std::mutex mutex;
+    uint64_t found = NO_PARENT;
+
+    auto initial = std::make_unique<ChipEightState>();
+    root.saveState(*initial);
+    auto packed = std::make_unique<PackedState>();
+    packState(*initial, *packed);
+    packed->id = 0;
+    links.push_back(NO_PARENT);
+    visited.insert(hashState(*packed));
+    current->push(packed.get(), 1);
+    if (isGoal(*initial))
+    {
+        found = 0;
+    }
+
+    std::cout << "Searching " << path << " with " << pool.threadCount() << " threads, " << masks.size()
+              << " inputs held for " << stepFrames << " frame(s)" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t expanded = 0;
+    uint64_t depth = 0;
+    bool failed = false;
+    std::vector<PackedState> batch;
+    while (found == NO_PARENT && !failed && current->size() > 0 && (maxDepth == 0 || depth < maxDepth) &&
+           !visited.full())
+    {
+        while (found == NO_PARENT && !failed && current->read(batch, BATCH_SIZE) > 0)
+        {
+            pool.parallelFor(batch.size(), 32, [&](size_t begin, size_t end)
+            {
+                ChipEight *chip;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chip = idleMachines.back();
+                    idleMachines.pop_back();
+                }
+
+                auto base = std::make_unique<ChipEightState>();
+                auto result = std::make_unique<ChipEightState>();
+                std::vector<PackedState> produced;
+                std::vector<uint64_t> producedLinks;
+                size_t goalIndex = SIZE_MAX;
+                for (size_t i = begin; i < end && goalIndex == SIZE_MAX; i++)
+                {
+                    unpackState(batch[i], *base);
+                    for (uint16_t mask : masks)
+                    {
+                        chip->loadState(*base);
+                        chip->setKeypad(mask);
+                        for (unsigned int frame = 0; frame < stepFrames; frame++)
+                        {
+                            chip->executeCycle();
+                        }
+                        chip->saveState(*result);
+
+                        produced.emplace_back();
+                        packState(*result, produced.back());
+                        if (!visited.insert(hashState(produced.back())))
+                        {
+                            produced.pop_back();
+                            continue;
+                        }
+                        producedLinks.push_back(batch[i].id | (uint64_t) mask << 48u);
+                        if (isGoal(*result))
+                        {
+                            goalIndex = produced.size() - 1;
+                            break;
+                        }
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < produced.size(); i++)
+                {
+                    produced[i].id = links.size();
+                    links.push_back(producedLinks[i]);
+                }
+                if (goalIndex != SIZE_MAX && found == NO_PARENT)
+                {
+                    found = produced[goalIndex].id;
+                }
+                failed |= !next->push(produced.data(), produced.size());
+                idleMachines.push_back(chip);
+            });
+            expanded += batch.size();
+        }
+
+        ++depth;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "depth " << std::setw(4) << depth << ": " << std::setw(10) << next->size() << " new, "
+                  << std::setw(11) << visited.size() << " visited, " << std::setw(10) << std::fixed
+                  << std::setprecision(0) << expanded * masks.size() / std::max(seconds, 1e-9) << " states/s";
+        if (next->spilled() > 0)
+        {
+            std::cout << ", " << next->spilled() << " spilled";
+        }
+        std::cout << std::endl;
+
+        current->clear();
+        std::swap(current, next);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Explored " << visited.size() << " states in " << std::setprecision(2) << seconds << " s" << std::endl;
+    if (failed)
+    {
+        return -1;
+    }
+    if (found == NO_PARENT)
+    {
+        if (visited.full())
+        {
+            std::cout << "Visited table is full, raise --max-states" << std::endl;
+        }
+        else if (current->size() == 0)
+        {
+            std::cout << "Goal is unreachable with these inputs" << std::endl;
+        }
+        else
+        {
+            std::cout << "No solution within " << depth << " steps" << std::endl;
+        }
+        return 1;
+    }
+
+    // Walk back from the goal to the initial state
+    std::vector<uint16_t> solution;
+    for (uint64_t id = found; links[id] != NO_PARENT; id = links[id] & NO_PARENT)
+    {
+        solution.push_back(links[id] >> 48u);
+    }
+    std::reverse(solution.begin(), solution.end());
+
+    std::cout << "Solution in " << solution.size() << " steps (" << solution.size() * stepFrames << " frames):";
+    for (uint16_t mask : solution)
+    {
+        std::cout << " " << std::hex << std::setw(4) << std::setfill('0') << mask;
+    }
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+
+    if (!solutionPath.empty())
+    {
+        std::ofstream file(solutionPath);
+        file << "# " << path << ": " << solution.size() << " steps of " << stepFrames << " frame(s)\n";
+        for (size_t i = 0; i < solution.size(); i++)
+        {
+            file << i * stepFrames << " " << std::hex << solution[i] << std::dec << "\n";
+        }
+        file << solution.size() * stepFrames << " 0\n";
+        if (!file)
+        {
+            std::cout << "ERROR: Couldn't write " << solutionPath << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
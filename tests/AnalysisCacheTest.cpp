@@ -0,0 +1,91 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../rom/AnalysisCache.h"
+#include "../rom/RomAnalysis.h"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const uint32_t TAG_TEST = CACHE_TAG('T', 'E', 'S', 'T');
+static const uint32_t TAG_MORE = CACHE_TAG('M', 'O', 'R', 'E');
+
+/**
+ * @return The only file in a directory
+ */
+static fs::path onlyFile(const std::string &directory)
+{
+    fs::path found;
+    for (const fs::directory_entry &entry : fs::directory_iterator(directory))
+    {
+        EXPECT_TRUE(found.empty()) << "more than one file in " << directory;
+        found = entry.path();
+    }
+    return found;
+}
+
+TEST(AnalysisCacheTest, RoundTrip)
+{
+    std::string directory = makeTestDirectory("analysis_round_trip");
+    std::vector<uint8_t> first = {1, 2, 3, 4, 5};
+    std::vector<uint8_t> second(1000, 0xAB);
+    ASSERT_TRUE(AnalysisCache(directory).write(0x1234, 300, 7, {{TAG_TEST, first}, {TAG_MORE, second}}));
+
+    AnalysisCache cache(directory);
+    ASSERT_TRUE(cache.open(0x1234, 300, 7));
+    size_t size = 0;
+    const uint8_t *data = cache.find(TAG_TEST, size);
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(std::vector<uint8_t>(data, data + size), first);
+    data = cache.find(TAG_MORE, size);
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(std::vector<uint8_t>(data, data + size), second);
+    EXPECT_EQ(cache.find(CACHE_TAG('N', 'O', 'N', 'E'), size), nullptr);
+    fs::remove_all(directory);
+}
+
+TEST(AnalysisCacheTest, RejectsStaleAndCorruptFiles)
+{
+    std::string directory = makeTestDirectory("analysis_corrupt");
+    ASSERT_TRUE(AnalysisCache(directory).write(0x1234, 300, 7, {{TAG_TEST, std::vector<uint8_t>(64, 1)}}));
+    fs::path path = onlyFile(directory);
+
+    AnalysisCache cache(directory);
+    EXPECT_FALSE(cache.open(0x1234, 300, 8)) << "content version";
+    EXPECT_FALSE(cache.open(0x1234, 301, 7)) << "ROM size";
+    EXPECT_FALSE(cache.open(0x9999, 300, 7)) << "ROM hash";
+    ASSERT_TRUE(cache.open(0x1234, 300, 7));
+    cache.close();
+
+    // A flipped payload byte fails the checksum
+    corruptByte(path.string(), (long) fs::file_size(path) - 1);
+    EXPECT_FALSE(cache.open(0x1234, 300, 7)) << "payload";
+    corruptByte(path.string(), (long) fs::file_size(path) - 1);
+    ASSERT_TRUE(cache.open(0x1234, 300, 7));
+    cache.close();
+
+    fs::resize_file(path, fs::file_size(path) - 8);
+    EXPECT_FALSE(cache.open(0x1234, 300, 7)) << "truncated";
+    fs::remove_all(directory);
+}
+
+TEST(AnalysisCacheTest, CachedAnalysisMatchesFreshOne)
+{
+    std::string directory = makeTestDirectory("analysis_rom");
+    std::vector<uint8_t> rom = generateROM(5);
+    std::shared_ptr<const RomAnalysis> fresh = RomAnalysis::get(rom, "");
+    std::shared_ptr<const RomAnalysis> written = RomAnalysis::get(rom, directory);
+    std::shared_ptr<const RomAnalysis> loaded = RomAnalysis::get(rom, directory);
+
+    std::vector<CacheSection> expected = fresh->toSections();
+    for (const std::shared_ptr<const RomAnalysis> &analysis : {written, loaded})
+    {
+        std::vector<CacheSection> sections = analysis->toSections();
+        ASSERT_EQ(sections.size(), expected.size());
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            EXPECT_EQ(sections[i].tag, expected[i].tag);
+            EXPECT_EQ(sections[i].data, expected[i].data);
+        }
+    }
+    fs::remove_all(directory);
+}
@@ -0,0 +1,152 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../hardware/ChipEight.h"
+#include "../hardware/InstructionTrace.h"
+#include "../rom/RomLibrary.h"
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const int CYCLES_PER_FRAME = 20;
+
+// Enough instructions for a few chunks, the last one partial
+static const uint32_t FRAMES = InstructionTraceWriter::CHUNK_INSTRUCTIONS * 5 / 2 / CYCLES_PER_FRAME;
+
+/**
+ * Describes the first difference between a decoded state and the machine's, or returns an empty string
+ */
+static std::string compareState(const TraceMachine &decoded, ChipEight &machine)
+{
+    if (decoded.pc != *machine.getPC())
+    {
+        return "PC";
+    }
+    if (memcmp(decoded.registers, machine.getRegisters(), 16) != 0)
+    {
+        return "registers";
+    }
+    if (decoded.indexRegister != *machine.getIndexRegister())
+    {
+        return "I";
+    }
+    if (decoded.sp != *machine.getStackPointer() ||
+        memcmp(decoded.stack, machine.getStack(), std::min<int>(decoded.sp, 16) * sizeof(uint16_t)) != 0)
+    {
+        return "stack";
+    }
+    if (decoded.delayRegister != *machine.getDelayRegister() || decoded.soundRegister != *machine.getSoundRegister())
+    {
+        return "timers";
+    }
+    return "";
+}
+
+class InstructionTraceTest : public ::testing::Test
+{
+protected:
+    std::string directory;
+    std::string path;
+    std::vector<uint8_t> rom = generateROM(11, false);
+
+    void SetUp() override
+    {
+        directory = makeTestDirectory("trace");
+        path = (fs::path(directory) / "run.c8t").string();
+
+        ChipEight machine(false, false, CYCLES_PER_FRAME, true);
+        ASSERT_TRUE(machine.LoadROM(rom.data(), rom.size()));
+        machine.seed(5);
+        InstructionTraceWriter writer(path, hashROM(rom.data(), rom.size()), CYCLES_PER_FRAME);
+        ASSERT_TRUE(writer.open());
+        machine.instructionTrace = &writer;
+        for (uint32_t frame = 0; frame < FRAMES; frame++)
+        {
+            machine.setKeypad(testKeypad(frame));
+            machine.executeCycle();
+        }
+        machine.instructionTrace = nullptr;
+        writer.close();
+        ASSERT_EQ(writer.instructionsRecorded(), (uint64_t) FRAMES * CYCLES_PER_FRAME);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(directory);
+    }
+};
+
+TEST_F(InstructionTraceTest, DecodesEveryInstruction)
+{
+    InstructionTraceReader reader;
+    ASSERT_TRUE(reader.open(path));
+    EXPECT_EQ(reader.getHeader().romHash, hashROM(rom.data(), rom.size()));
+    EXPECT_EQ(reader.getHeader().cyclesPerTick, (uint32_t) CYCLES_PER_FRAME);
+    ASSERT_EQ(reader.size(), (uint64_t) FRAMES * CYCLES_PER_FRAME);
+    EXPECT_GT(reader.getHeader().chunks, 1u);
+
+    // The same run one instruction at a time, to check every decoded record against
+    ChipEight machine(false, false, CYCLES_PER_FRAME, true);
+    ASSERT_TRUE(machine.LoadROM(rom.data(), rom.size()));
+    machine.seed(5);
+
+    ASSERT_TRUE(reader.seek(0));
+    TraceRecord record{};
+    for (uint32_t frame = 0; frame < FRAMES; frame++)
+    {
+        machine.setKeypad(testKeypad(frame));
+        for (int i = 0; i < CYCLES_PER_FRAME; i++)
+        {
+            uint64_t index = (uint64_t) frame * CYCLES_PER_FRAME + i;
+            ASSERT_TRUE(reader.next(record)) << "instruction " << index;
+            ASSERT_EQ(record.index, index);
+            ASSERT_EQ(record.frame, frame);
+            ASSERT_EQ(compareState(record.before, machine), "") << "before instruction " << index;
+
+            machine.stepInstruction();
+            ASSERT_EQ(compareState(record.after, machine), "") << "after instruction " << index;
+            if (record.memoryCount != 0)
+            {
+                EXPECT_EQ(memcmp(record.memory, machine.getMemory() + record.memoryAddress, record.memoryCount), 0)
+                                    << "stored bytes of instruction " << index;
+            }
+        }
+        machine.decrementTimers();
+    }
+    EXPECT_FALSE(reader.next(record));
+}
+
+TEST_F(InstructionTraceTest, SeeksIntoTheMiddleOfChunks)
+{
+    InstructionTraceReader sequential;
+    ASSERT_TRUE(sequential.open(path));
+    ASSERT_TRUE(sequential.seek(0));
+    std::vector<TraceRecord> records(sequential.size());
+    for (TraceRecord &record : records)
+    {
+        ASSERT_TRUE(sequential.next(record));
+    }
+
+    InstructionTraceReader reader;
+    ASSERT_TRUE(reader.open(path));
+    for (uint64_t target : {(uint64_t) 0, (uint64_t) 12345, (uint64_t) InstructionTraceWriter::CHUNK_INSTRUCTIONS,
+                            (uint64_t) records.size() - 1, (uint64_t) 70000, (uint64_t) 3})
+    {
+        ASSERT_TRUE(reader.seek(target)) << target;
+        TraceRecord record{};
+        ASSERT_TRUE(reader.next(record)) << target;
+        EXPECT_EQ(record.index, target);
+        EXPECT_EQ(record.frame, records[target].frame) << target;
+        EXPECT_EQ(record.pc, records[target].pc) << target;
+        EXPECT_EQ(record.opcode, records[target].opcode) << target;
+        EXPECT_EQ(memcmp(record.after.registers, records[target].after.registers, 16), 0) << target;
+    }
+    EXPECT_FALSE(reader.seek(records.size()));
+}
+
+TEST_F(InstructionTraceTest, RejectsTruncatedFiles)
+{
+    fs::resize_file(path, fs::file_size(path) / 2);
+    InstructionTraceReader reader;
+    EXPECT_FALSE(reader.open(path));
+}
@@ -0,0 +1,104 @@
+#include "gtest/gtest.h"
+#include "../frontend/KeyQueue.h"
+
+using std::chrono::milliseconds;
+
+static const int INSTRUCTIONS = 100;
+
+/**
+ * Queue that has seen one (empty) frame at start, so the next frame spans start to start + 100 ms
+ */
+class KeyQueueTest : public ::testing::Test
+{
+protected:
+    KeyQueue queue;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<KeyChange> changes;
+
+    void SetUp() override
+    {
+        queue.takeFrame(start, INSTRUCTIONS, changes);
+    }
+
+    /**
+     * Takes the frame that starts at start + frame * 100 ms
+     */
+    void takeFrame(int frame)
+    {
+        queue.takeFrame(start + milliseconds(100 * frame), INSTRUCTIONS, changes);
+    }
+};
+
+TEST_F(KeyQueueTest, PlacesEventsAtTheirArrivalTime)
+{
+    queue.push(0x5, true, start + milliseconds(25));
+    queue.push(0xA, true, start + milliseconds(60));
+    takeFrame(1);
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].key, 0x5);
+    EXPECT_EQ(changes[0].instruction, 25);
+    EXPECT_EQ(changes[1].key, 0xA);
+    EXPECT_EQ(changes[1].instruction, 60);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(KeyQueueTest, KeepsArrivalOrder)
+{
+    // Stamped out of order, applied in the order they came in
+    queue.push(0x1, true, start + milliseconds(70));
+    queue.push(0x2, true, start + milliseconds(30));
+    takeFrame(1);
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].key, 0x1);
+    EXPECT_EQ(changes[1].key, 0x2);
+    EXPECT_LE(changes[0].instruction, changes[1].instruction);
+}
+
+TEST_F(KeyQueueTest, HoldsShortTapsForAFrame)
+{
+    queue.push(0x7, true, start + milliseconds(25));
+    queue.push(0x7, false, start + milliseconds(50));
+    takeFrame(1);
+
+    // The release is held back until a frame's worth of instructions after the press
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_TRUE(changes[0].down);
+    EXPECT_EQ(changes[0].instruction, 25);
+    EXPECT_FALSE(queue.empty());
+
+    takeFrame(2);
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_FALSE(changes[0].down);
+    EXPECT_EQ(changes[0].instruction, 25);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(KeyQueueTest, LongPressesAreNotDelayed)
+{
+    queue.push(0x3, true, start + milliseconds(10));
+    takeFrame(1);
+    queue.push(0x3, false, start + milliseconds(180));
+    takeFrame(2);
+
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_FALSE(changes[0].down);
+    EXPECT_EQ(changes[0].instruction, 80);
+}
+
+TEST_F(KeyQueueTest, PressDuringHeldReleaseKeepsTheKeyDown)
+{
+    queue.push(0x9, true, start + milliseconds(50));
+    queue.push(0x9, false, start + milliseconds(60));
+    takeFrame(1);
+    ASSERT_EQ(changes.size(), 1u);
+
+    // Pressed again before the held back release was due, so neither shows up
+    queue.push(0x9, true, start + milliseconds(120));
+    takeFrame(2);
+    EXPECT_TRUE(changes.empty());
+    takeFrame(3);
+    EXPECT_TRUE(changes.empty());
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,133 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../hardware/BlockIR.h"
+#include "../hardware/ChipEight.h"
+#include "../rom/RomAnalysis.h"
+#include <string>
+
+static const int CYCLES_PER_FRAME = 20;
+static const uint32_t FRAMES = 300;
+
+/**
+ * Runs two machines side by side, comparing them after every frame
+ * @param romSize Comparing stops once the program counter leaves the ROM
+ * @return Empty, or where they first differ
+ */
+static std::string runLockstep(ChipEight &reference, ChipEight &other, size_t romSize)
+{
+    reference.seed(7);
+    other.seed(7);
+    for (uint32_t frame = 0; frame < FRAMES; frame++)
+    {
+        reference.setKeypad(testKeypad(frame));
+        other.setKeypad(testKeypad(frame));
+        reference.executeCycle();
+        other.executeCycle();
+
+        std::string difference = compareMachines(reference, other);
+        if (!difference.empty())
+        {
+            return "frame " + std::to_string(frame) + ": " + difference;
+        }
+
+        // Stores into the program can send it anywhere, stop comparing once it has left
+        if (*reference.getPC() >= START_ADDRESS + romSize || *reference.getStackPointer() >= 15)
+        {
+            break;
+        }
+    }
+    return "";
+}
+
+/**
+ * @return Interpreter with the ROM loaded
+ */
+static std::unique_ptr<ChipEight> makeMachine(const std::vector<uint8_t> &rom, bool loadStoreQuirk, bool shiftQuirk)
+{
+    auto machine = std::make_unique<ChipEight>(loadStoreQuirk, shiftQuirk, CYCLES_PER_FRAME, true);
+    EXPECT_TRUE(machine->LoadROM(rom.data(), rom.size()));
+    return machine;
+}
+
+/**
+ * Lowers the ROM to IR and runs it against the interpreter
+ */
+static std::string runIrLockstep(const std::vector<uint8_t> &rom, bool loadStoreQuirk, bool shiftQuirk, bool optimize)
+{
+    auto reference = makeMachine(rom, loadStoreQuirk, shiftQuirk);
+    auto ir = makeMachine(rom, loadStoreQuirk, shiftQuirk);
+    std::shared_ptr<const RomAnalysis> analysis = RomAnalysis::get(rom, "");
+    if (!ir->setIrProgram(IrProgram::build(rom, analysis->getGraph(), loadStoreQuirk, shiftQuirk, optimize)))
+    {
+        return "IR program not accepted";
+    }
+    return runLockstep(*reference, *ir, rom.size());
+}
+
+TEST(LockstepTest, IrMatchesInterpreterOnGeneratedRoms)
+{
+    for (uint32_t seed = 1; seed <= 40; seed++)
+    {
+        std::vector<uint8_t> rom = generateROM(seed);
+        for (int quirks = 0; quirks < 4; quirks++)
+        {
+            EXPECT_EQ(runIrLockstep(rom, quirks & 1, quirks & 2, true), "")
+                                << "seed " << seed << ", quirks " << quirks;
+        }
+        EXPECT_EQ(runIrLockstep(rom, false, false, false), "") << "seed " << seed << ", unoptimised";
+    }
+}
+
+TEST(LockstepTest, IrMatchesInterpreterAtEndOfMemory)
+{
+    std::vector<uint8_t> rom = edgeROM();
+    for (int quirks = 0; quirks < 4; quirks++)
+    {
+        EXPECT_EQ(runIrLockstep(rom, quirks & 1, quirks & 2, true), "") << "quirks " << quirks;
+    }
+}
+
+TEST(LockstepTest, AnalysedInterpreterMatchesPlainInterpreter)
+{
+    for (uint32_t seed = 1; seed <= 20; seed++)
+    {
+        std::vector<uint8_t> rom = generateROM(seed);
+        auto reference = makeMachine(rom, false, false);
+        auto analysed = makeMachine(rom, false, false);
+        analysed->setAnalysis(RomAnalysis::get(rom, ""));
+        EXPECT_EQ(runLockstep(*reference, *analysed, rom.size()), "") << "seed " << seed;
+    }
+}
+
+#ifdef CHIP8_TEST_MODULE_DIR
+
+/**
+ * Runs a ROM that the build compiled with chip8_aot (see tests/CMakeLists.txt) against the interpreter
+ */
+static std::string runCompiledLockstep(const std::vector<uint8_t> &rom, const std::string &name)
+{
+    std::string path = std::string(CHIP8_TEST_MODULE_DIR) + "/" + name + CHIP8_TEST_MODULE_SUFFIX;
+    auto reference = makeMachine(rom, false, false);
+    auto compiled = makeMachine(rom, false, false);
+    if (!compiled->loadCompiled(path.c_str()))
+    {
+        return "couldn't load " + path;
+    }
+    return runLockstep(*reference, *compiled, rom.size());
+}
+
+TEST(LockstepTest, CompiledMatchesInterpreterOnGeneratedRoms)
+{
+    for (uint32_t seed = 1; seed <= 3; seed++)
+    {
+        EXPECT_EQ(runCompiledLockstep(generateROM(seed), "lockstep_" + std::to_string(seed)), "")
+                            << "seed " << seed;
+    }
+}
+
+TEST(LockstepTest, CompiledMatchesInterpreterAtEndOfMemory)
+{
+    EXPECT_EQ(runCompiledLockstep(edgeROM(), "lockstep_edge"), "");
+}
+
+#endif
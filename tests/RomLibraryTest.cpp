@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../rom/RomLibrary.h"
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+TEST(RomLibraryTest, ScanAndProfilesRoundTrip)
+{
+    std::string directory = makeTestDirectory("library");
+    std::vector<uint8_t> rom = generateROM(9);
+    fs::create_directories(fs::path(directory) / "roms");
+    std::string romPath = (fs::path(directory) / "roms" / "game.sc8").string();
+    std::ofstream(romPath, std::ios::binary).write((const char *) rom.data(), (std::streamsize) rom.size());
+    std::string indexPath = (fs::path(directory) / "library.idx").string();
+    uint64_t hash = hashROM(rom.data(), rom.size());
+
+    {
+        RomLibrary library(indexPath);
+        ASSERT_TRUE(library.open());
+        RomScanStats stats;
+        ASSERT_TRUE(library.scan((fs::path(directory) / "roms").string(), stats));
+        EXPECT_EQ(stats.files, 1u);
+        EXPECT_EQ(stats.hashed, 1u);
+    }
+
+    {
+        RomLibrary library(indexPath);
+        ASSERT_TRUE(library.open());
+        const RomIndexEntry *entry = library.find(hash);
+        ASSERT_NE(entry, nullptr);
+        EXPECT_EQ(entry->size, rom.size());
+        EXPECT_STREQ(entry->profile.title, "game");
+        EXPECT_EQ(entry->profile.variant, 1);
+        EXPECT_FALSE(entry->profile.flags & RomProfile::FLAG_SET);
+
+        RomProfile profile = entry->profile;
+        profile.cyclesPerTick = 30;
+        profile.shiftQuirk = 1;
+        ASSERT_TRUE(library.setProfile(hash, rom.size(), romPath, profile));
+    }
+
+    RomLibrary library(indexPath);
+    ASSERT_TRUE(library.open());
+    const RomIndexEntry *entry = library.find(hash);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_TRUE(entry->profile.flags & RomProfile::FLAG_SET);
+    EXPECT_EQ(entry->profile.cyclesPerTick, 30);
+    EXPECT_EQ(entry->profile.shiftQuirk, 1);
+    EXPECT_EQ(library.find(hash + 1), nullptr);
+
+    // Scanning again reads nothing and keeps the profile
+    RomScanStats stats;
+    ASSERT_TRUE(library.scan((fs::path(directory) / "roms").string(), stats));
+    EXPECT_EQ(stats.hashed, 0u);
+    ASSERT_TRUE(library.open());
+    ASSERT_NE(library.find(hash), nullptr);
+    EXPECT_EQ(library.find(hash)->profile.cyclesPerTick, 30);
+    fs::remove_all(directory);
+}
+
+TEST(RomLibraryTest, RejectsCorruptIndex)
+{
+    std::string directory = makeTestDirectory("library_corrupt");
+    std::string indexPath = (fs::path(directory) / "library.idx").string();
+    RomProfile profile{};
+    {
+        RomLibrary library(indexPath);
+        ASSERT_TRUE(library.open());
+        ASSERT_TRUE(library.setProfile(0x42, 100, indexPath, profile));
+    }
+
+    // Bad magic
+    corruptByte(indexPath, 0);
+    {
+        RomLibrary library(indexPath);
+        EXPECT_FALSE(library.open());
+        EXPECT_EQ(library.size(), 0u);
+    }
+    corruptByte(indexPath, 0);
+
+    // Size doesn't match the entry count
+    fs::resize_file(indexPath, fs::file_size(indexPath) - 1);
+    RomLibrary library(indexPath);
+    EXPECT_FALSE(library.open());
+    EXPECT_EQ(library.find(0x42), nullptr);
+    fs::remove_all(directory);
+}
@@ -0,0 +1,101 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../hardware/ChipEight.h"
+#include "../hardware/InstancePool.h"
+#include "../rom/RomAnalysis.h"
+
+static const int CYCLES_PER_FRAME = 20;
+
+/**
+ * Runs frames with the test keypad
+ * @param first Number of the first frame, which picks the keys
+ */
+static void runFrames(ChipEight &machine, uint32_t first, uint32_t count)
+{
+    for (uint32_t frame = first; frame < first + count; frame++)
+    {
+        machine.setKeypad(testKeypad(frame));
+        machine.executeCycle();
+    }
+}
+
+static std::unique_ptr<ChipEight> makeMachine(const std::vector<uint8_t> &rom, ChipVariant variant)
+{
+    auto machine = std::make_unique<ChipEight>(false, false, CYCLES_PER_FRAME, true);
+    machine->setVariant(variant);
+    EXPECT_TRUE(machine->LoadROM(rom.data(), rom.size()));
+    machine->seed(3);
+    return machine;
+}
+
+TEST(StateTest, LoadStateReplaysTheSameFrames)
+{
+    for (ChipVariant variant : {ChipVariant::Chip8, ChipVariant::SuperChip, ChipVariant::XoChip})
+    {
+        for (uint32_t seed = 1; seed <= 10; seed++)
+        {
+            std::vector<uint8_t> rom = generateROM(seed, false);
+            auto machine = makeMachine(rom, variant);
+            auto reference = makeMachine(rom, variant);
+            runFrames(*machine, 0, 50);
+            runFrames(*reference, 0, 50);
+
+            auto state = std::make_unique<ChipEightState>();
+            machine->saveState(*state);
+            runFrames(*machine, 50, 100);
+            machine->loadState(*state);
+
+            runFrames(*machine, 50, 100);
+            runFrames(*reference, 50, 100);
+            EXPECT_EQ(compareMachines(*machine, *reference), "")
+                                << variantName(variant) << ", seed " << seed;
+        }
+    }
+}
+
+TEST(StateTest, ResetFromRestoresTheTemplate)
+{
+    for (uint32_t seed = 1; seed <= 10; seed++)
+    {
+        std::vector<uint8_t> rom = generateROM(seed, false);
+        auto image = makeMachine(rom, ChipVariant::Chip8);
+        image->setAnalysis(RomAnalysis::get(rom, ""));
+        InstancePool pool(std::move(image), 2);
+        ChipEight &used = *pool.acquire();
+        ChipEight &fresh = *pool.acquire();
+
+        // Only the pages the ROM stored to are copied back
+        runFrames(used, 0, 200);
+        pool.reset(used);
+        EXPECT_EQ(compareMachines(used, fresh), "") << "seed " << seed;
+
+        runFrames(used, 0, 100);
+        runFrames(fresh, 0, 100);
+        EXPECT_EQ(compareMachines(used, fresh), "") << "seed " << seed << ", after running again";
+
+        // With memory handed out (compareMachines() did that), stores from outside are undone too
+        used.getMemory()[0x300] ^= 0xFFu;
+        pool.reset(used);
+        pool.reset(fresh);
+        EXPECT_EQ(compareMachines(used, fresh), "") << "seed " << seed << ", outside store";
+    }
+}
+
+TEST(StateTest, ResetFromRestoresXoChipMemoryAboveFourKilobytes)
+{
+    // I = 0x2000, store V0 there, loop
+    std::vector<uint8_t> rom = assemble({0xF000, 0x2000, 0x6055, 0xF055, 0x1208});
+    auto image = makeMachine(rom, ChipVariant::XoChip);
+    InstancePool pool(std::move(image), 2);
+    ChipEight &used = *pool.acquire();
+    ChipEight &fresh = *pool.acquire();
+
+    // Looked at through a saved state, so the memory isn't handed out and only dirty pages are copied back
+    runFrames(used, 0, 1);
+    auto state = std::make_unique<ChipEightState>();
+    used.saveState(*state);
+    EXPECT_EQ(state->memory[0x2000], 0x55);
+    pool.reset(used);
+    EXPECT_EQ(compareMachines(used, fresh), "");
+    EXPECT_EQ(used.getMemory()[0x2000], 0);
+}
@@ -0,0 +1,313 @@
+#include "TestRoms.h"
+#include "../hardware/ChipEight.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <random>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+/**
+ * Picks the instructions for generateROM(). Jumps only go forwards and subroutines always return, so every run
+ * goes round the whole main loop instead of getting stuck in a corner of it.
+ */
+class RomGenerator
+{
+public:
+    RomGenerator(uint32_t seed, bool _selfModifying) : random(seed), selfModifying(_selfModifying)
+    {
+    }
+
+    std::vector<uint16_t> generate()
+    {
+        int mainLength = range(30, 150);
+        while ((int) code.size() < mainLength)
+        {
+            addMainInstruction(mainLength);
+        }
+
+        // The instruction before the loop's end or a subroutine's return never skips, so neither is jumped over
+        size_t loopEnd = code.size();
+        add(0x7E01, true);
+        add(0x1000u | START_ADDRESS, true);
+
+        std::vector<uint16_t> subroutines;
+        for (int count = range(1, 4); count > 0; count--)
+        {
+            subroutines.push_back(addressOf(code.size()));
+            for (int length = range(3, 20); length > 0; length--)
+            {
+                add(instruction(), false);
+            }
+            add(0x7E01, false);
+            add(0x00EE, false);
+        }
+
+        for (const Fixup &fixup : fixups)
+        {
+            if (fixup.call)
+            {
+                code[fixup.at] = 0x2000u | subroutines[fixup.target % subroutines.size()];
+                continue;
+            }
+            size_t target = std::min(fixup.target, loopEnd);
+            while (!landing[target])
+            {
+                target++;
+            }
+            code[fixup.at] = 0x1000u | addressOf(target);
+        }
+        return code;
+    }
+
+private:
+    /**
+     * A jump or call whose address is filled in once everything is laid out
+     */
+    struct Fixup
+    {
+        size_t at;
+        size_t target;  // Instruction index for jumps, subroutine number for calls
+        bool call;
+    };
+
+    std::mt19937 random;
+    bool selfModifying;
+    std::vector<uint16_t> code;
+    std::vector<bool> landing;      // Whether a jump may land on each instruction, false inside sequences
+    std::vector<Fixup> fixups;
+
+    /**
+     * @return Uniform integer in [low, high]
+     */
+    int range(int low, int high)
+    {
+        return std::uniform_int_distribution<int>(low, high)(random);
+    }
+
+    uint16_t pick(std::initializer_list<uint16_t> values)
+    {
+        return values.begin()[range(0, (int) values.size() - 1)];
+    }
+
+    static uint16_t addressOf(size_t index)
+    {
+        return (uint16_t) (START_ADDRESS + 2 * index);
+    }
+
+    void add(uint16_t opcode, bool jumpTarget)
+    {
+        code.push_back(opcode);
+        landing.push_back(jumpTarget);
+    }
+
+    void addMainInstruction(int mainLength)
+    {
+        double kind = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        if (kind < 0.06)
+        {
+            fixups.push_back({code.size(), code.size() + range(1, 8), false});
+            add(0, true);
+        }
+        else if (kind < 0.10)
+        {
+            fixups.push_back({code.size(), (size_t) range(0, 3), true});
+            add(0, true);
+        }
+        else if (kind < 0.13)
+        {
+            // Draw a font digit, then point I back at data so stores don't land in the font
+            add(0xF029u | (uint16_t) (range(0, 15) << 8u), true);
+            add(0xD005u | (uint16_t) (range(0, 15) << 8u) | (uint16_t) (range(0, 15) << 4u), false);
+            add(0xA000u | (uint16_t) range(0x400, 0xD00), false);
+        }
+        else if (kind < 0.15 && (int) code.size() + 12 <= mainLength)
+        {
+            // Computed jump into the next eight instructions, V0 masked to 0 - 14 first. A skip just before only
+            // skips the filler.
+            add(0x7E01, true);
+            add(0x6F0E, false);
+            add(0x80F2, false);
+            add(0xB000u | addressOf(code.size() + 1), false);
+        }
+        else
+        {
+            add(instruction(), true);
+        }
+    }
+
+    /**
+     * @return Any instruction but jumps, calls and returns
+     */
+    uint16_t instruction()
+    {
+        double kind = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        auto x = (uint16_t) (range(0, 15) << 8u);
+        auto y = (uint16_t) (range(0, 15) << 4u);
+        auto kk = (uint16_t) range(0, 255);
+
+        if (kind < 0.20)
+        {
+            return pick({0x3000, 0x4000}) | x | kk;
+        }
+        if (kind < 0.25)
+        {
+            return pick({0x5000, 0x9000}) | x | y;
+        }
+        if (kind < 0.37)
+        {
+            return 0x6000u | x | kk;
+        }
+        if (kind < 0.48)
+        {
+            return 0x7000u | x | kk;
+        }
+        if (kind < 0.63)
+        {
+            return 0x8000u | x | y | pick({0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE});
+        }
+        if (kind < 0.70)
+        {
+            // Data past the program, the last bytes of memory where stores and loads must stop or wrap, and now
+            // and then the program itself
+            int target = range(0, selfModifying ? 7 : 6);
+            int address = target < 4 ? range(0x400, 0xD00) : target < 7 ? range(0xFF0, 0xFFF)
+                                                                          : (int) addressOf(range(0, 40));
+            return 0xA000u | (uint16_t) address;
+        }
+        if (kind < 0.73)
+        {
+            return 0xC000u | x | kk;
+        }
+        if (kind < 0.79)
+        {
+            return 0xD000u | x | y | range(0, 15);
+        }
+        if (kind < 0.81)
+        {
+            return 0xE000u | x | pick({0x9E, 0xA1});
+        }
+        if (kind < 0.815)
+        {
+            return 0xF00Au | x;
+        }
+        if (kind < 0.84)
+        {
+            return 0xF000u | x | pick({0x07, 0x15, 0x18});
+        }
+        if (kind < 0.95)
+        {
+            return 0xF000u | x | pick({0x33, 0x55, 0x65});
+        }
+        if (kind < 0.98)
+        {
+            return 0xF01Eu | x;
+        }
+        return 0x00E0;
+    }
+};
+
+std::vector<uint8_t> generateROM(uint32_t seed, bool selfModifying)
+{
+    return assemble(RomGenerator(seed, selfModifying).generate());
+}
+
+std::vector<uint8_t> edgeROM()
+{
+    return assemble({
+            0xAFFE, 0x6012, 0x6134, 0x6256, 0x6378,
+            0xF355,     // Two bytes fit, two wrap around into the refused low memory, I moves past the end
+            0xF365,     // Reads wrap around to the start of memory
+            0xAFFF, 0xF033,
+            0xAFFD, 0xD015,
+            0xAFF0, 0x74F7, 0xF41E, 0xF765,
+            0x65FF, 0xAF00, 0xF51E, 0xF51E, 0xF51E, 0xF51E,
+            0xF355,     // I is 0x12FC, the stores wrap to 0x2FC
+            0xF365,
+            0x7001, 0x1200
+    });
+}
+
+std::vector<uint8_t> assemble(const std::vector<uint16_t> &opcodes)
+{
+    std::vector<uint8_t> rom;
+    for (uint16_t opcode : opcodes)
+    {
+        rom.push_back(opcode >> 8u);
+        rom.push_back(opcode & 0xFFu);
+    }
+    return rom;
+}
+
+uint16_t testKeypad(uint32_t frame)
+{
+    // xorshift, so keys come and go irregularly but the same way every run
+    uint32_t state = frame * 2654435761u + 1;
+    state ^= state << 13u;
+    state ^= state >> 17u;
+    state ^= state << 5u;
+    return state % 5 == 0 ? (uint16_t) (1u << ((state >> 8u) % 16)) : 0;
+}
+
+std::string makeTestDirectory(const std::string &name)
+{
+    auto stamp = (unsigned long long) std::chrono::steady_clock::now().time_since_epoch().count();
+    fs::path path = fs::temp_directory_path() / ("chip8_tests_" + std::to_string(stamp) + "_" + name);
+    fs::remove_all(path);
+    fs::create_directories(path);
+    return path.string();
+}
+
+void corruptByte(const std::string &path, long offset)
+{
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(offset);
+    char value = 0;
+    file.read(&value, 1);
+    value ^= 0x5A;
+    file.seekp(offset);
+    file.write(&value, 1);
+}
+
+std::string compareMachines(ChipEight &a, ChipEight &b)
+{
+    std::ostringstream difference;
+    if (*a.getPC() != *b.getPC())
+    {
+        difference << "PC " << std::hex << *a.getPC() << " vs " << *b.getPC();
+    }
+    else if (memcmp(a.getRegisters(), b.getRegisters(), 16) != 0)
+    {
+        difference << "registers";
+    }
+    else if (*a.getIndexRegister() != *b.getIndexRegister())
+    {
+        difference << "I " << std::hex << *a.getIndexRegister() << " vs " << *b.getIndexRegister();
+    }
+    else if (*a.getStackPointer() != *b.getStackPointer() || memcmp(a.getStack(), b.getStack(), 32) != 0)
+    {
+        difference << "stack";
+    }
+    else if (*a.getDelayRegister() != *b.getDelayRegister() || *a.getSoundRegister() != *b.getSoundRegister())
+    {
+        difference << "timers";
+    }
+    else if (memcmp(a.getMemory(), b.getMemory(), MEMORY_SIZE) != 0)
+    {
+        size_t address = 0;
+        while (a.getMemory()[address] == b.getMemory()[address])
+        {
+            address++;
+        }
+        difference << "memory at " << std::hex << address;
+    }
+    else if (memcmp(a.video, b.video, sizeof(a.video)) != 0)
+    {
+        difference << "display";
+    }
+    return difference.str();
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_EMU_TESTROMS_H
+#define CHIP8_EMU_TESTROMS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ChipEight;
+
+/**
+ * Random but well-formed CHIP-8 program for lockstep tests: a main loop of mixed instructions (skips, arithmetic,
+ * draws, stores, key waits, forward jumps, computed jumps, calls) ending in a jump back to 0x200, plus a few
+ * subroutines that don't call further. I is often pointed at the last bytes of memory, so memory edges are covered
+ * as well.
+ * @param seed Same seed, same ROM
+ * @param selfModifying Whether stores into the program itself happen now and then. They can turn it into anything,
+ * including returns with an empty stack, which the interpreter doesn't guard against.
+ * @return ROM bytes, to be loaded at START_ADDRESS
+ */
+std::vector<uint8_t> generateROM(uint32_t seed, bool selfModifying = true);
+
+/**
+ * Loop of stores, loads, BCD, draws and I arithmetic around the end of CHIP-8's 4 KB, where the interpreter wraps
+ * stores and loads and compiled code has to do the same
+ */
+std::vector<uint8_t> edgeROM();
+
+/**
+ * @return The opcodes as a ROM, high byte first
+ */
+std::vector<uint8_t> assemble(const std::vector<uint16_t> &opcodes);
+
+/**
+ * Keypad mask to hold during a frame of a test run, so runs with the same frame numbers press the same keys
+ */
+uint16_t testKeypad(uint32_t frame);
+
+/**
+ * @return New empty directory under the system's temporary directory
+ */
+std::string makeTestDirectory(const std::string &name);
+
+/**
+ * Flips the bits of one byte of a file in place
+ */
+void corruptByte(const std::string &path, long offset);
+
+/**
+ * Describes the first difference between two machines (registers, I, PC, stack, timers, memory, display), or
+ * returns an empty string if there is none. Both machines' memory counts as handed out afterwards.
+ */
+std::string compareMachines(ChipEight &a, ChipEight &b);
+
+#endif //CHIP8_EMU_TESTROMS_H
@@ -0,0 +1,183 @@
+#include "gtest/gtest.h"
+#include "TestRoms.h"
+#include "../hardware/ChipEight.h"
+#include <cstring>
+
+// Colours of a pixel lit in only the first plane, and only the second
+static const uint32_t FIRST_PLANE = 0xFFFFFFFF;
+static const uint32_t SECOND_PLANE = 0xAAAAAAFF;
+
+/**
+ * Runs a program one instruction at a time until it reaches its data
+ * @param opcodes Program, starting at 0x200
+ * @param data Bytes placed right after the program, so their address is 0x200 + 2 * opcodes.size()
+ */
+static std::unique_ptr<ChipEight> run(ChipVariant variant, const std::vector<uint16_t> &opcodes,
+                                      const std::vector<uint8_t> &data = {})
+{
+    std::vector<uint8_t> rom = assemble(opcodes);
+    rom.insert(rom.end(), data.begin(), data.end());
+
+    auto machine = std::make_unique<ChipEight>(false, false, 20, true);
+    machine->setVariant(variant);
+    EXPECT_TRUE(machine->LoadROM(rom.data(), rom.size()));
+    for (int steps = 0; *machine->getPC() < START_ADDRESS + 2 * opcodes.size() && steps < 1000; steps++)
+    {
+        machine->stepInstruction();
+    }
+    return machine;
+}
+
+static uint32_t pixel(const ChipEight &machine, unsigned int x, unsigned int y)
+{
+    return machine.video[y * machine.getVideoWidth() + x];
+}
+
+/**
+ * @return How many pixels are lit
+ */
+static int litPixels(const ChipEight &machine)
+{
+    int lit = 0;
+    for (unsigned int i = 0; i < machine.getVideoWidth() * machine.getVideoHeight(); i++)
+    {
+        lit += machine.video[i] != 0;
+    }
+    return lit;
+}
+
+/**
+ * 16x16 sprite with a diagonal line from the top left, 32 bytes
+ */
+static std::vector<uint8_t> diagonalSprite()
+{
+    std::vector<uint8_t> sprite;
+    for (int row = 0; row < 16; row++)
+    {
+        uint16_t bits = 0x8000u >> row;
+        sprite.push_back(bits >> 8u);
+        sprite.push_back(bits & 0xFFu);
+    }
+    return sprite;
+}
+
+TEST(VariantTest, SuperChipDrawsSixteenBySixteenSprites)
+{
+    // hires, V0 = 10, V1 = 20, I = sprite, draw it, VF to V2, draw it again
+    auto machine = run(ChipVariant::SuperChip,
+                       {0x00FF, 0x600A, 0x6114, 0xA210, 0xD010, 0x82F0, 0xD010, 0x1300}, diagonalSprite());
+    EXPECT_EQ(machine->getVideoWidth(), 128u);
+    EXPECT_EQ(machine->getRegisters()[2], 0);
+    EXPECT_EQ(machine->getRegisters()[0xF], 1);
+    EXPECT_EQ(litPixels(*machine), 0);
+
+    machine = run(ChipVariant::SuperChip, {0x00FF, 0x600A, 0x6114, 0xA20C, 0xD010, 0x1300}, diagonalSprite());
+    EXPECT_EQ(litPixels(*machine), 16);
+    for (unsigned int row = 0; row < 16; row++)
+    {
+        EXPECT_EQ(pixel(*machine, 10 + row, 20 + row), FIRST_PLANE) << row;
+    }
+}
+
+TEST(VariantTest, ChipEightDrawsNothingForDXY0)
+{
+    auto machine = run(ChipVariant::Chip8, {0x600A, 0x6114, 0xA20A, 0xD010, 0x1300}, diagonalSprite());
+    EXPECT_EQ(litPixels(*machine), 0);
+    EXPECT_EQ(machine->getRegisters()[0xF], 0);
+}
+
+TEST(VariantTest, SuperChipClipsAndXoChipWrapsAtTheEdge)
+{
+    // 16x16 sprite of solid rows at x = 120, y = 56 in hires
+    std::vector<uint8_t> solid(32, 0xFF);
+    std::vector<uint16_t> program = {0x00FF, 0x6078, 0x6138, 0xA20E, 0xD010, 0x1300, 0x0000};
+
+    auto superChip = run(ChipVariant::SuperChip, program, solid);
+    EXPECT_EQ(litPixels(*superChip), 8 * 8);
+    EXPECT_EQ(pixel(*superChip, 127, 63), FIRST_PLANE);
+    EXPECT_EQ(pixel(*superChip, 0, 0), 0u);
+
+    auto xoChip = run(ChipVariant::XoChip, program, solid);
+    EXPECT_EQ(litPixels(*xoChip), 16 * 16);
+    EXPECT_EQ(pixel(*xoChip, 127, 63), FIRST_PLANE);
+    EXPECT_EQ(pixel(*xoChip, 0, 0), FIRST_PLANE);
+    EXPECT_EQ(pixel(*xoChip, 7, 7), FIRST_PLANE);
+    EXPECT_EQ(pixel(*xoChip, 8, 8), 0u);
+}
+
+TEST(VariantTest, SuperChipScrolls)
+{
+    // One pixel at (8, 8), scrolled down 3, then right 8, then left 12 off the screen
+    std::vector<uint8_t> dot = {0x80};
+
+    auto machine = run(ChipVariant::SuperChip, {0x00FF, 0x6008, 0xA20C, 0xD001, 0x00C3, 0x1300}, dot);
+    EXPECT_EQ(litPixels(*machine), 1);
+    EXPECT_EQ(pixel(*machine, 8, 11), FIRST_PLANE);
+
+    machine = run(ChipVariant::SuperChip, {0x00FF, 0x6008, 0xA210, 0xD001, 0x00C3, 0x00FB, 0x00FB, 0x1300}, dot);
+    EXPECT_EQ(litPixels(*machine), 1);
+    EXPECT_EQ(pixel(*machine, 16, 11), FIRST_PLANE);
+
+    machine = run(ChipVariant::SuperChip, {0x00FF, 0x6008, 0xA210, 0xD001, 0x00FC, 0x00FC, 0x00FC, 0x1300}, dot);
+    EXPECT_EQ(litPixels(*machine), 0);
+
+    // Pixels scrolled past the bottom are gone
+    machine = run(ChipVariant::SuperChip, {0x00FF, 0x6008, 0xA212, 0xD001, 0x00CF, 0x00CF, 0x00CF, 0x00CF, 0x1300},
+                  dot);
+    EXPECT_EQ(litPixels(*machine), 0);
+}
+
+TEST(VariantTest, XoChipScrollsUpAndOnlySelectedPlanes)
+{
+    std::vector<uint8_t> dot = {0x80};
+
+    auto machine = run(ChipVariant::XoChip, {0x00FF, 0x6008, 0xA20C, 0xD001, 0x00D5, 0x1300}, dot);
+    EXPECT_EQ(litPixels(*machine), 1);
+    EXPECT_EQ(pixel(*machine, 8, 3), FIRST_PLANE);
+
+    // Dot on both planes, then only the second plane scrolls down 2
+    machine = run(ChipVariant::XoChip, {0x00FF, 0x6008, 0xF301, 0xA214, 0xD001, 0xF201, 0x00C2, 0x1300, 0x0000,
+                                        0x0000}, {0x80, 0x80});
+    EXPECT_EQ(pixel(*machine, 8, 8), FIRST_PLANE);
+    EXPECT_EQ(pixel(*machine, 8, 10), SECOND_PLANE);
+}
+
+TEST(VariantTest, XoChipDrawsEachSelectedPlaneFromConsecutiveSprites)
+{
+    // Both planes selected: the first plane's 16x16 sprite, then the second plane's, which overlap at (15, 15)
+    std::vector<uint8_t> sprites = diagonalSprite();
+    for (int row = 0; row < 16; row++)
+    {
+        sprites.push_back(0x00);
+        sprites.push_back(0x01);
+    }
+
+    auto machine = run(ChipVariant::XoChip, {0x00FF, 0x6000, 0xF301, 0xA20E, 0xD000, 0x1300, 0x0000}, sprites);
+    EXPECT_EQ(litPixels(*machine), 31);
+    EXPECT_EQ(pixel(*machine, 0, 0), FIRST_PLANE);
+    EXPECT_EQ(pixel(*machine, 5, 5), FIRST_PLANE);
+    EXPECT_EQ(pixel(*machine, 15, 0), SECOND_PLANE);
+    EXPECT_EQ(pixel(*machine, 15, 15), 0x555555FFu);
+}
+
+TEST(VariantTest, StoresWrapAtTheEndOfMemoryLikeLoads)
+{
+    // I = 0xF00 + 4 * 0xFF = 0x12FC, past CHIP-8's 4 KB
+    std::vector<uint16_t> pointI = {0xAF00, 0x65FF, 0xF51E, 0xF51E, 0xF51E, 0xF51E};
+    std::vector<uint16_t> program = pointI;
+    program.insert(program.end(), {0x6011, 0x6122, 0x6233, 0x6344, 0xF355, 0x6000, 0x6100, 0x6200, 0x6300});
+    program.insert(program.end(), pointI.begin(), pointI.end());
+    program.insert(program.end(), {0xF365, 0x1400});
+
+    auto machine = run(ChipVariant::Chip8, program);
+    EXPECT_EQ(machine->getMemory()[0x2FC], 0x11);
+    EXPECT_EQ(machine->getMemory()[0x2FF], 0x44);
+    const uint8_t expected[] = {0x11, 0x22, 0x33, 0x44};
+    EXPECT_EQ(memcmp(machine->getRegisters(), expected, sizeof(expected)), 0);
+
+    // At the top of XO-CHIP's 64 KB the wrapped bytes land in the font area, where stores are refused
+    machine = run(ChipVariant::XoChip, {0xF000, 0xFFFE, 0x60AA, 0x61BB, 0x62CC, 0xF255, 0x1400});
+    EXPECT_EQ(machine->getMemory()[0xFFFE], 0xAA);
+    EXPECT_EQ(machine->getMemory()[0xFFFF], 0xBB);
+    EXPECT_NE(machine->getMemory()[0x000], 0xCC);
+}
@@ -0,0 +1,28 @@
+#include "TestRoms.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Writes one of the test ROMs to a file, so the build can compile it with chip8_aot for the lockstep tests
+ * Usage: chip8_test_rom <seed | edge> <output>
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "Usage: chip8_test_rom <seed | edge> <output>" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> rom = strcmp(argv[1], "edge") == 0 ? edgeROM()
+                                                             : generateROM((uint32_t) strtoul(argv[1], nullptr, 10));
+    std::ofstream file(argv[2], std::ios::binary);
+    if (!file.write((const char *) rom.data(), (std::streamsize) rom.size()))
+    {
+        std::cout << "ERROR: Couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../hardware/Disassembler.h"
+#include "../hardware/InstructionTrace.h"
+
+static void printUsage()
+{
+    std::cout << "Usage: chip8_trace <command> <trace> [options]\n"
+                 "Reads instruction traces recorded with chip8_emu --record-trace.\n"
+                 "  info <trace>               counts, size and compression of a trace\n"
+                 "  show <trace> [options]     list instructions with the state they changed\n"
+                 "    --from <n>               start at instruction n (default 0)\n"
+                 "    --count <n>              stop after n matching instructions (default 32, 0 for all)\n"
+                 "    --pc <addr>              only instructions at this hex address\n"
+                 "    --opcode <pattern>       only opcodes matching a pattern like D??? or F?33 (X, Y, N, K, ? match\n"
+                 "                             any digit)\n"
+                 "  diff <a> <b> [options]     find the first instruction where two traces differ\n"
+                 "    --context <n>            instructions to show before it (default 8)"
+              << std::endl;
+}
+
+/**
+ * @param text Four characters, hex digits or wildcards
+ * @param mask Bits the opcode has to match
+ * @param value Their values
+ * @return False if the pattern isn't valid
+ */
+static bool parseOpcodePattern(const std::string &text, uint16_t &mask, uint16_t &value)
+{
+    if (text.size() != 4)
+    {
+        return false;
+    }
+
+    mask = 0;
+    value = 0;
+    for (char c : text)
+    {
+        mask <<= 4u;
+        value <<= 4u;
+        if (isxdigit(c))
+        {
+            mask |= 0xFu;
+            value |= std::stoul(std::string(1, c), nullptr, 16);
+        }
+        else if (strchr("XxYyNnKk?", c) == nullptr)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string hex(unsigned int value, int width)
+{
+    std::stringstream text;
+    text << std::uppercase << std::hex << std::setw(width) << std::setfill('0') << value;
+    return text.str();
+}
+
+/**
+ * @return What an instruction changed, e.g. "V3=12 I=0234 [0300]=01 02 03"
+ */
+static std::string describeChanges(const TraceRecord &record)
+{
+    const TraceMachine &before = record.before;
+    const TraceMachine &after = record.after;
+    std::string text;
+    for (int i = 0; i < 16; i++)
+    {
+        if (before.registers[i] != after.registers[i])
+        {
+            text += " V" + hex(i, 1) + "=" + hex(after.registers[i], 2);
+        }
+    }
+    if (before.indexRegister != after.indexRegister)
+    {
+        text += " I=" + hex(after.indexRegister, 4);
+    }
+    if (before.sp != after.sp)
+    {
+        text += " SP=" + hex(after.sp, 1);
+    }
+    if (before.delayRegister != after.delayRegister)
+    {
+        text += " DT=" + hex(after.delayRegister, 2);
+    }
+    if (before.soundRegister != after.soundRegister)
+    {
+        text += " ST=" + hex(after.soundRegister, 2);
+    }
+    if (record.memoryCount > 0)
+    {
+        text += " [" + hex(record.memoryAddress, 4) + "]=";
+        for (int i = 0; i < record.memoryCount; i++)
+        {
+            text += (i > 0 ? " " : "") + hex(record.memory[i], 2);
+        }
+    }
+    if (after.pc != (uint16_t) (before.pc + 2))
+    {
+        text += " -> " + hex(after.pc, 4);
+    }
+    return text;
+}
+
+static void printRecord(const TraceRecord &record, const char *prefix = "")
+{
+    std::string text = disassemble(record.opcode);
+    text.resize(std::max<size_t>(text.size(), 20), ' ');
+    std::cout << prefix << std::setw(10) << record.index << "  frame " << std::setw(7) << record.frame << "  "
+              << hex(record.pc, 4) << "  " << hex(record.opcode, 4) << "  " << text << describeChanges(record)
+              << std::endl;
+}
+
+static void printMachine(const TraceMachine &state, const char *prefix)
+{
+    std::cout << prefix << "PC=" << hex(state.pc, 4) << " I=" << hex(state.indexRegister, 4) << " SP="
+              << hex(state.sp, 1) << " DT=" << hex(state.delayRegister, 2) << " ST=" << hex(state.soundRegister, 2)
+              << "\n" << prefix << "V:";
+    for (uint8_t value : state.registers)
+    {
+        std::cout << " " << hex(value, 2);
+    }
+    std::cout << "\n" << prefix << "stack:";
+    for (int i = 0; i < state.sp && i < 16; i++)
+    {
+        std::cout << " " << hex(state.stack[i], 4);
+    }
+    std::cout << std::endl;
+}
+
+static int info(const InstructionTraceReader &reader)
+{
+    const InstructionTraceHeader &header = reader.getHeader();
+    std::cout << "Instructions:    " << header.instructions << "\n"
+              << "Chunks:          " << header.chunks << "\n"
+              << "Cycles per tick: " << header.cyclesPerTick << "\n"
+              << "ROM hash:        " << hex(header.romHash >> 32u, 8) << hex(header.romHash & 0xFFFFFFFFu, 8) << "\n"
+              << "File size:       " << reader.compressedBytes() << " bytes";
+    if (header.instructions > 0)
+    {
+        std::cout << " (" << std::fixed << std::setprecision(2)
+                  << (double) reader.compressedBytes() / (double) header.instructions << " bytes per instruction)";
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+static int show(InstructionTraceReader &reader, int argc, char **args)
+{
+    uint64_t from = 0;
+    uint64_t count = 32;
+    int pc = -1;
+    uint16_t opcodeMask = 0;
+    uint16_t opcodeValue = 0;
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = args[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--from" && hasValue)
+        {
+            from = std::stoull(args[++i]);
+        }
+        else if (arg == "--count" && hasValue)
+        {
+            count = std::stoull(args[++i]);
+        }
+        else if (arg == "--pc" && hasValue)
+        {
+            pc = std::stoi(args[++i], nullptr, 16);
+        }
+        else if (arg == "--opcode" && hasValue)
+        {
+            if (!parseOpcodePattern(args[++i], opcodeMask, opcodeValue))
+            {
+                std::cout << "ERROR: Opcode patterns are 4 hex digits or X, Y, N, K, ?" << std::endl;
+                return -1;
+            }
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown option: " << arg << std::endl;
+            printUsage();
+            return -1;
+        }
+    }
+
+    if (!reader.seek(from))
+    {
+        std::cout << "ERROR: Trace has " << reader.size() << " instructions" << std::endl;
+        return -1;
+    }
+
+    TraceRecord record{};
+    uint64_t shown = 0;
+    while ((count == 0 || shown < count) && reader.next(record))
+    {
+        if ((pc >= 0 && record.pc != pc) || (record.opcode & opcodeMask) != opcodeValue)
+        {
+            continue;
+        }
+        printRecord(record);
+        ++shown;
+    }
+    return 0;
+}
+
+static bool sameRecord(const TraceRecord &a, const TraceRecord &b)
+{
+    return a.pc == b.pc && a.opcode == b.opcode && memcmp(&a.before, &b.before, sizeof(a.before)) == 0 &&
+           memcmp(&a.after, &b.after, sizeof(a.after)) == 0 && a.memoryCount == b.memoryCount &&
+           (a.memoryCount == 0 ||
+            (a.memoryAddress == b.memoryAddress && memcmp(a.memory, b.memory, a.memoryCount) == 0));
+}
+
+static int diff(InstructionTraceReader &a, InstructionTraceReader &b, int argc, char **args)
+{
+    size_t context = 8;
+    for (int i = 4; i < argc; i++)
+    {
+        std::string arg = args[i];
+        if (arg == "--context" && i + 1 < argc)
+        {
+            context = std::stoul(args[++i]);
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown option: " << arg << std::endl;
+            printUsage();
+            return -1;
+        }
+    }
+
+    if (a.size() == 0 || b.size() == 0)
+    {
+        std::cout << (a.size() == b.size() ? "Traces are identical (empty)" : "One trace is empty") << std::endl;
+        return a.size() == b.size() ? 0 : 1;
+    }
+    a.seek(0);
+    b.seek(0);
+
+    std::deque<TraceRecord> history;
+    TraceRecord recordA{};
+    TraceRecord recordB{};
+    uint64_t skipped = 0;
+    while (true)
+    {
+        // Identical chunks are compared as stored bytes without decoding them
+        while (a.sameChunkAs(b))
+        {
+            a.skipChunk();
+            b.skipChunk();
+            history.clear();
+            ++skipped;
+        }
+
+        bool hasA = a.next(recordA);
+        bool hasB = b.next(recordB);
+        if (!hasA || !hasB)
+        {
+            if (hasA == hasB)
+            {
+                std::cout << "Traces are identical (" << a.size() << " instructions, " << skipped
+                          << " chunks skipped unchanged)" << std::endl;
+                return 0;
+            }
+            std::cout << "Traces match until " << (hasA ? args[3] : args[2]) << " ends after "
+                      << std::min(a.size(), b.size()) << " instructions" << std::endl;
+            return 1;
+        }
+
+        if (!sameRecord(recordA, recordB))
+        {
+            break;
+        }
+        history.push_back(recordA);
+        if (history.size() > context)
+        {
+            history.pop_front();
+        }
+    }
+
+    std::cout << "First difference at instruction " << recordA.index << " (frame " << recordA.frame << ")\n";
+    for (const TraceRecord &record : history)
+    {
+        printRecord(record, "  ");
+    }
+    printRecord(recordA, "a ");
+    printRecord(recordB, "b ");
+    std::cout << "State before, a:" << std::endl;
+    printMachine(recordA.before, "  ");
+    std::cout << "State before, b:" << std::endl;
+    printMachine(recordB.before, "  ");
+    return 1;
+}
+
+int main(int argc, char **args)
+{
+    if (argc < 3 || strcmp(args[1], "-h") == 0 || strcmp(args[1], "--help") == 0)
+    {
+        printUsage();
+        return argc < 2 ? -1 : 0;
+    }
+
+    std::string command = args[1];
+    InstructionTraceReader reader;
+    if (command != "info" && command != "show" && command != "diff")
+    {
+        std::cout << "ERROR: Unknown command: " << command << std::endl;
+        printUsage();
+        return -1;
+    }
+    if (!reader.open(args[2]))
+    {
+        return -1;
+    }
+
+    if (command == "info")
+    {
+        return info(reader);
+    }
+    if (command == "show")
+    {
+        return show(reader, argc, args);
+    }
+
+    if (argc < 4)
+    {
+        printUsage();
+        return -1;
+    }
+    InstructionTraceReader other;
+    if (!other.open(args[3]))
+    {
+        return -1;
+    }
+    return diff(reader, other, argc, args);
+}